@@ -25,4 +25,45 @@
 #define CONST_NV_MAX	128
 //Minimum number of values for genotypes
 #define	CONST_NV_MIN	2
+//Number of columns per tile in fused element-wise kernels,
+//chosen so that a few rows of a tile fit in L1 cache.
+#define	CONST_TILE_NCOL	256
+//Number of rows converted together per thread in LLR to probability conversion,
+//so null density and bin geometry are reused from cache.
+#define	CONST_LLRTOPIJ_NROWBATCH	8
+//Maximum number of null histograms cached in memory
+#define	CONST_NULLHIST_CACHE_NMAX	256
+//Steps per doubling of the grid that maxima of null histograms are rounded up to,
+//so that null histograms of nearby maxima share cache entries.
+#define	CONST_NULLHIST_DMAX_NGRID	32
+//Maximum relative error of tabulated null distribution cdf
+#define	CONST_NULLDIST_CDFQ_RTOL	1E-6
+//Smallest Q covered by tabulated null distribution cdf. Smaller values are evaluated exactly.
+#define	CONST_NULLDIST_CDFQ_QMIN	1E-30
+//Number of sampled elements per batch in accuracy-check mode of tabulated null distribution cdf
+#define	CONST_NULLDIST_CDFQ_NCHECK	64
+//Number of chunks per thread for dynamic scheduling when grain size is not specified
+#define	CONST_THREADING_NCHUNK	16
+//Rows shorter than this are ranked by insertion sort instead of radix sort in supernormalization
+#define	CONST_SUPERNORMALIZE_RADIX_NMIN	64
+//Maximum number of matrices registered for in place supernormalization
+#define	CONST_SUPERNORMALIZE_INPLACE_NMAX	4
+//Alignment in bytes of blocks from the memory pool, so per-thread buffers do not share cache lines
+#define	CONST_POOL_ALIGN	64
+//Minimum number of candidate edges selected per batch in greedy network reconstruction
+#define	CONST_NETR_BATCH_NMIN	65536
+//Batches of candidate edges stop growing at this fraction of all edges, unless the maximum edge count is larger
+#define	CONST_NETR_BATCH_FRAC	16
+//Maximum number of candidate edges selected per batch regardless of the above, so the edge buffer stays bounded
+#define	CONST_NETR_BATCH_NMAX	4194304
+//Candidate edges kept per node by degree cap prefilter of greedy network reconstruction are this multiple of the cap,
+#define	CONST_NETR_PREFILTER_RATIO	2
+//plus this slack
+#define	CONST_NETR_PREFILTER_SLACK	8
+//Maximum number of times to relax degree cap prefilter before dropping it
+#define	CONST_NETR_PREFILTER_NRETRY	1
+//Number of columns scanned together by each thread in degree cap prefilter
+#define	CONST_NETR_PREFILTER_BLOCK	64
+//Initial capacity of the arc array of each vertex in cycle detection, which doubles when full
+#define	CONST_CYCLE_ARC_NMIN	4
 #endif
@@ -503,6 +503,25 @@ int MATRIXFF(cmprow)(const MATRIXF* m1,const MATRIXF* m2,VECTORF* buff1,VECTORF*
 #pragma GCC diagnostic pop
 }
 
+int MATRIXFF(cmprow_auto)(const MATRIXF* m1,const MATRIXF* m2,char nodiag,char warn)
+{
+#define	CLEANUP	AUTOFREEVEC(v1)AUTOFREEVEC(v2)
+	int	ret;
+	AUTOALLOCVECF(v1,m1->size1,10000)
+	AUTOALLOCVECF(v2,m1->size2,10000)
+	
+	if(!(v1&&v2))
+	{
+		LOG(2,"Failed to allocate memory.")
+		CLEANUP
+		return -1;
+	}
+	ret=MATRIXFF(cmprow)(m1,m2,v1,v2,nodiag,warn);
+	CLEANUP
+	return ret;
+#undef	CLEANUP
+}
+
 
 
 
@@ -366,6 +366,11 @@ void MATRIXFF(minmax_nodiag)(const MATRIXF* d,FTYPE* restrict dmin,FTYPE* restri
  */
 int MATRIXFF(cmprow)(const MATRIXF* m1,const MATRIXF* m2,VECTORF* buff1,VECTORF* buff2,char nodiag,char warn);
 
+/* Same as MATRIXFF(cmprow), but allocates buffers automatically.
+ * Return:	As MATRIXFF(cmprow), or -1 if memory allocation failed.
+ */
+int MATRIXFF(cmprow_auto)(const MATRIXF* m1,const MATRIXF* m2,char nodiag,char warn);
+
 
 
 
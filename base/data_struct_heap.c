@@ -168,5 +168,41 @@ HTYPE data_heapdec_pop(struct data_heapdec* h)
 	return ret;
 }
 
+/* Moves index at location i of heap down to restore heap order.
+ */
+static void data_heapidx_down(struct data_heapidx* h,size_t i)
+{
+	size_t	c,v;
+	
+	v=h->d[i];
+	while((c=2*i+1)<h->n)
+	{
+		if((c+1<h->n)&&h->before(h->d[c+1],h->d[c],h->param))
+			c++;
+		if(!h->before(h->d[c],v,h->param))
+			break;
+		h->d[i]=h->d[c];
+		i=c;
+	}
+	h->d[i]=v;
+}
 
+void data_heapidx_init(struct data_heapidx* h,size_t* d,size_t n,int (*before)(size_t,size_t,const void*),const void* param)
+{
+	size_t	i;
+	
+	assert(n);
+	h->n=n;
+	h->d=d;
+	h->before=before;
+	h->param=param;
+	for(i=n/2;i;i--)
+		data_heapidx_down(h,i-1);
+}
 
+void data_heapidx_replacetop(struct data_heapidx* h,size_t v)
+{
+	assert(h->n);
+	h->d[0]=v;
+	data_heapidx_down(h,0);
+}
@@ -23,6 +23,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <assert.h>
+#include "types.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -30,7 +31,7 @@ extern "C"
 #endif
 
 
-#define HTYPE	size_t
+#define HTYPE	ITYPE
 
 //Incremental heap
 struct data_heap
@@ -59,6 +60,34 @@ HTYPE data_heapdec_pop(struct data_heapdec* h);
 #define data_heapdec_get data_heap_get
 #define data_heapdec_top data_heap_top
 
+/* Fixed size heap of indices on a caller buffer, ordered by a comparator of indices
+ * instead of their values, e.g. to rank columns of a matrix row by their values.
+ * The top is the index that comes before all others.
+ * n:		Number of indices in heap
+ * d:		(n) Buffer of indices, owned by caller
+ * before:	Comparator. Returns whether index a comes before index b.
+ * param:	Parameter passed to comparator
+ */
+struct data_heapidx
+{
+	size_t	n;
+	size_t* restrict	d;
+	int	(*before)(size_t a,size_t b,const void* param);
+	const void*	param;
+};
+
+/* Builds heap from the existing indices in buffer, in place.
+ * h:		Heap to build
+ * d:		(n) Buffer of indices
+ * n:		Number of indices. Must be nonzero.
+ * before,
+ * param:	See struct data_heapidx.
+ */
+void data_heapidx_init(struct data_heapidx* h,size_t* d,size_t n,int (*before)(size_t,size_t,const void*),const void* param);
+// Replaces the top of heap with index v, and restores heap order.
+void data_heapidx_replacetop(struct data_heapidx* h,size_t v);
+static inline size_t data_heapidx_top(const struct data_heapidx* h);
+
 
 static inline HTYPE data_heap_get(const struct data_heap* h,size_t n)
 {
@@ -71,6 +100,12 @@ static inline HTYPE data_heap_top(const struct data_heap* h)
 	return data_heap_get(h,0);
 }
 
+static inline size_t data_heapidx_top(const struct data_heapidx* h)
+{
+	assert(h->n);
+	return h->d[0];
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,12 @@
 int data_ll_init(struct data_ll* ll,size_t nmax)
 {
 	assert(ll);
+	ll->d=0;
+	if(nmax>=ITYPE_MAX)
+	{
+		LOG(1,"Too many items for linked list.")
+		return 1;
+	}
 	ll->nmax=nmax;
 	ll->n=0;
 	MALLOCSIZE(ll->d,2*nmax);
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "logger.h"
+#include "types.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -31,7 +32,7 @@ extern "C"
 #endif
 
 
-//Linked list for size_t
+//Linked list for size_t, stored as ITYPE
 struct data_ll
 {
 	//Max number of items
@@ -41,11 +42,12 @@ struct data_ll
 	/* Data and links
 	 * d[2*i] is the child and d[2*i+1] is data.
 	 * Item i has child j (at d[2*j] and d[2*j+1]) if d[2*i]=j.
-	 * For data[2*i]=-1 is no child.
+	 * For data[2*i]=ITYPE_MAX is no child, which is returned as (size_t)-1.
 	 */
-	size_t* restrict	d;
+	ITYPE* restrict	d;
 };
 
+//Initializes linked list. nmax must be less than ITYPE_MAX.
 int data_ll_init(struct data_ll* ll,size_t nmax);
 void data_ll_free(struct data_ll* ll);
 void data_ll_empty(struct data_ll* ll);
@@ -71,8 +73,9 @@ static inline size_t data_ll_insert(struct data_ll* ll,size_t val)
 		LOG(5,"Linked list insertion failed: linked list full.")
 		return (size_t)-1;
 	}
+	assert(val<=ITYPE_MAX);
 	loc=2*ll->n;
-	ll->d[loc+1]=val;
+	ll->d[loc+1]=(ITYPE)val;
 	return ll->n++;
 }
 
@@ -84,7 +87,7 @@ static inline size_t data_ll_insert_after(struct data_ll* ll,size_t id,size_t va
 	if(loc==(size_t)-1)
 		return loc;
 	ll->d[2*loc]=ll->d[2*id];
-	ll->d[2*id]=loc;
+	ll->d[2*id]=(ITYPE)loc;
 	return loc;
 }
 
@@ -95,14 +98,14 @@ static inline size_t data_ll_insert_before(struct data_ll* ll,size_t id,size_t v
 	loc=data_ll_insert(ll,val);
 	if(loc==(size_t)-1)
 		return loc;
-	ll->d[2*loc]=id;
+	ll->d[2*loc]=(id==(size_t)-1)?ITYPE_MAX:(ITYPE)id;
 	return loc;
 }
 
 static inline size_t data_ll_child(const struct data_ll* ll,size_t id)
 {
 	assert(id<ll->n);
-	return ll->d[2*id];
+	return (ll->d[2*id]==ITYPE_MAX)?(size_t)-1:ll->d[2*id];
 }
 
 static inline size_t data_ll_val(const struct data_ll* ll,size_t id)
@@ -23,28 +23,29 @@
 #define _HEADER_LIB_GENERAL_ALG_H_
 #include "config.h"
 #include <stdio.h>
+#include "types.h"
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
 /* Categorize data according to categorical information into separate arrays.
- * s:	Source of data.
+ * s:	Source of data, as indices.
  * c:	Categorical information. Each element contains a category of the corresponding element of s.
  * d:	Destination of categorization. Element i with c[i]=j is put into d[j].
  *		Modified value after this function indicates size of outcome arrays.
  * n:	Size of s and c.
  */
-static inline void general_alg_categorize(const size_t* restrict s,const unsigned char* restrict c,size_t* restrict* restrict d,size_t n);
+static inline void general_alg_categorize(const ITYPE* restrict s,const unsigned char* restrict c,ITYPE* restrict* restrict d,size_t n);
 
 /* Categorize data according to embedded categorical information into separate arrays.
- * s:	Source of data.
+ * s:	Source of data, as indices.
  * c:	Categorical information. Each element contains a category of the corresponding element of s.
  * d:	Destination of categorization. Element i with c[s[i]]=j is put into d[j].
  *		Modified value after this function indicates size of outcome arrays.
  * n:	Size of s and c.
  */
-static inline void general_alg_categorize_embed(const size_t* restrict s,const unsigned char* restrict c,size_t* restrict* restrict d,size_t n);
+static inline void general_alg_categorize_embed(const ITYPE* restrict s,const unsigned char* restrict c,ITYPE* restrict* restrict d,size_t n);
 
 /* Removes duplicates in a sorted array of double, and shifts unique values to
  * the front of the array.
@@ -59,14 +60,14 @@ static inline size_t remove_sorted_duplicates(double* restrict a,size_t n);
 
 
 
-static inline void general_alg_categorize(const size_t* restrict s,const unsigned char* restrict c,size_t* restrict* restrict d,size_t n)
+static inline void general_alg_categorize(const ITYPE* restrict s,const unsigned char* restrict c,ITYPE* restrict* restrict d,size_t n)
 {
 	size_t	i;
 	for(i=0;i<n;i++)
 		*(d[c[i]]++)=s[i];
 }
 
-static inline void general_alg_categorize_embed(const size_t* restrict s,const unsigned char* restrict c,size_t* restrict* restrict d,size_t n)
+static inline void general_alg_categorize_embed(const ITYPE* restrict s,const unsigned char* restrict c,ITYPE* restrict* restrict d,size_t n)
 {
 	size_t	i;
 	for(i=0;i<n;i++)
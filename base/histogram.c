@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 #include "gsl/math.h"
 #include "gsl/blas.h"
 #include "gsl/sort.h"
@@ -73,8 +74,8 @@ int histogram_equalbins_fromnullpdfs(size_t n,double* binrange,void (*pdfs)(cons
 	assert(n);
 	//Extended bin range
 	nb=nbextend*n;
-	vc=VECTORDF(alloc)(nb);
-	vval=VECTORDF(alloc)(nb);
+	vc=VECTORDF(pool_alloc)(nb);
+	vval=VECTORDF(pool_alloc)(nb);
 	
 	if(!(vc&&vval&&vstep))
 		ERRRETV(0,"Not enough memory.")
@@ -283,7 +284,7 @@ double* histogram_unequalbins_exp_vf(const VECTORF* d,size_t nsmnv,double nbinsp
 	//Extended bin range
 	nb=nbr*nbin1+1;
 	nbe=nb+nbextend*nbin1;
-	h1=gsl_histogram_alloc(nbe);
+	h1=histogram_pool_alloc(nbe);
 	MALLOCSIZE(ans,nbin1+1);
 	if(!(h1&&ans))
 		ERRRETV(0,"Not enough memory.")
@@ -518,28 +519,67 @@ void histogram_unequalbins_fromequalbins(size_t n,double* binrange)
 	binrange[n]=binrange[0]+twidth;
 }
 
+/*********************************************************
+ * Histogram bin locators
+ *********************************************************/
 
+struct histogram_locator* histogram_locator_alloc(const double* range,size_t n)
+{
+#define	CLEANUP	histogram_locator_free(l);
+	struct histogram_locator*	l;
+	double	wmin,w;
+	size_t	i,c;
+	
+	assert(n);
+	l=calloc(1,sizeof(*l));
+	if(!l)
+		ERRRETV(0,"Not enough memory.")
+	l->n=n;
+	l->xmin=range[0];
+	l->xmax=range[n];
+	if(!(l->xmax>l->xmin))
+		ERRRETV(0,"Invalid histogram range.")
+	
+	//Guide cells no wider than the narrowest bin, within [n,16n]
+	wmin=l->xmax-l->xmin;
+	for(i=0;i<n;i++)
+	{
+		w=range[i+1]-range[i];
+		if(w<0)
+			ERRRETV(0,"Histogram range not in ascending order.")
+		if(w>0)
+			wmin=GSL_MIN(wmin,w);
+	}
+	w=ceil((l->xmax-l->xmin)/wmin);
+	l->ng=(w<(double)(16*n))?GSL_MAX((size_t)w,n):16*n;
+	l->scale=(double)l->ng/(l->xmax-l->xmin);
+	
+	l->range=malloc((n+1)*sizeof(*l->range));
+	l->guide=malloc(l->ng*sizeof(*l->guide));
+	if(!(l->range&&l->guide))
+		ERRRETV(0,"Not enough memory.")
+	memcpy(l->range,range,(n+1)*sizeof(*l->range));
+	for(c=0,i=0;c<l->ng;c++)
+	{
+		w=l->xmin+(double)c/l->scale;
+		while((i+1<n)&&(w>=range[i+1]))
+			i++;
+		l->guide[c]=i;
+	}
+	return l;
+#undef	CLEANUP
+}
 
+void histogram_locator_free(struct histogram_locator* l)
+{
+	if(!l)
+		return;
+	CLEANMEM(l->range)
+	CLEANMEM(l->guide)
+	free(l);
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+size_t histogram_locator_mem(size_t n)
+{
+	return sizeof(struct histogram_locator)+(n+1)*sizeof(double)+16*n*sizeof(size_t);
+}
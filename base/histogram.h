@@ -217,6 +217,59 @@ void histogram_finer_central(const VECTORD* hold,VECTORD* hnew,size_t nsp);
 void histogram_unequalbins_fromequalbins(size_t n,double* binrange);
 
 
+/*********************************************************
+ * Histogram bin locators
+ *********************************************************/
+
+/* Bin locator for fixed (unequal) bin ranges, as an O(1) replacement of
+ * gsl_histogram_find. The range [range[0],range[n]) is split into ng uniform
+ * guide cells. Each cell stores the bin of its left edge, from which a lookup
+ * only walks over the few bins inside the cell.
+ * n:		Number of bins.
+ * ng:		Number of guide cells.
+ * xmin,
+ * xmax:	range[0] and range[n].
+ * scale:	ng/(xmax-xmin).
+ * range:	(n+1) Copy of bin ranges.
+ * guide:	(ng) Bin of left edge of each guide cell.
+ */
+struct histogram_locator
+{
+	size_t	n;
+	size_t	ng;
+	double	xmin;
+	double	xmax;
+	double	scale;
+	double*	range;
+	size_t*	guide;
+};
+
+/* Constructs bin locator.
+ * range:	(n+1) Bin ranges, in ascending order.
+ * n:		Number of bins.
+ * Return:	Constructed locator, or 0 on failure.
+ */
+struct histogram_locator* histogram_locator_alloc(const double* range,size_t n);
+void histogram_locator_free(struct histogram_locator* l);
+
+// Maximum memory in bytes of bin locator of n bins.
+size_t histogram_locator_mem(size_t n);
+
+/* Locates bin i such that range[i]<=x<range[i+1], same as gsl_histogram_find.
+ * l:		Bin locator
+ * x:		Value to locate
+ * i:		Output of bin index
+ * Return:	0 if found, or 1 if x is out of range or NAN.
+ */
+static inline int histogram_locator_find(const struct histogram_locator* l,double x,size_t* i);
+
+/* Increments bin of x by one if x is within range, same as gsl_histogram_increment.
+ * l:		Bin locator
+ * bin:		(l->n) Histogram bins to increment
+ * x:		Value to count
+ */
+static inline void histogram_locator_increment(const struct histogram_locator* l,double* bin,double x);
+
 /*********************************************************
  * Static functions
  *********************************************************/
@@ -226,6 +279,32 @@ static inline void histogram_equalbins_fromnullcdf(size_t n,double left,double r
 	math_cdf_quantile(n,left,right,func,param,eps,ans);
 }
 
+static inline int histogram_locator_find(const struct histogram_locator* l,double x,size_t* i)
+{
+	size_t	c,j;
+	
+	if(!((x>=l->xmin)&&(x<l->xmax)))
+		return 1;
+	c=(size_t)((x-l->xmin)*l->scale);
+	if(c>=l->ng)
+		c=l->ng-1;
+	j=l->guide[c];
+	//Guard against rounding of cell index
+	while(j&&(x<l->range[j]))
+		j--;
+	while(x>=l->range[j+1])
+		j++;
+	*i=j;
+	return 0;
+}
+
+static inline void histogram_locator_increment(const struct histogram_locator* l,double* bin,double x)
+{
+	size_t	i;
+	if(!histogram_locator_find(l,x,&i))
+		bin[i]++;
+}
+
 
 
 
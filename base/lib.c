@@ -23,6 +23,11 @@
 #include "gsl/errno.h"
 #include "random.h"
 #include "logger.h"
+#include "supernormalize.h"
+#include "numa.h"
+#include "pool.h"
+#include "../pij/nulldist.h"
+#include "../pij/nullhist.h"
 #include "lib.h"
 
 #define MACROSTR(X)	#X
@@ -40,7 +45,7 @@
 #endif
 
 
-void LIBINFONAME(lib_init)(unsigned char loglv,unsigned long rs0,size_t nthread)
+void LIBINFONAME(lib_init_numa)(unsigned char loglv,unsigned long rs0,size_t nthread,unsigned char numa)
 {
 	unsigned long	rs;
 	size_t	nth;
@@ -53,9 +58,24 @@ void LIBINFONAME(lib_init)(unsigned char loglv,unsigned long rs0,size_t nthread)
 	omp_set_nested(0);
 	nth=(size_t)omp_get_max_threads();
 	gsl_set_error_handler_off();
+	numa_init(numa);
 	LOG(7,"Library started with log level %u, initial random seed %lu, and max thread count "PRINTFSIZET".",loglv,rs,nth)
 }
 
+void LIBINFONAME(lib_init)(unsigned char loglv,unsigned long rs0,size_t nthread)
+{
+	LIBINFONAME(lib_init_numa)(loglv,rs0,nthread,0);
+}
+
+void LIBINFONAME(lib_free)()
+{
+	supernormalize_Pinv_cache_clear();
+	pij_nulldist_cdfQ_cache_clear();
+	pij_nullhist_cache_clear();
+	pool_cache_clear();
+	LOG(7,"Library caches freed.")
+}
+
 const char* LIBINFONAME(lib_name)()
 {
 	return LIBNAME;
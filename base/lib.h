@@ -32,6 +32,21 @@ extern "C"
  */
 void lib_init(unsigned char loglv,unsigned long rs,size_t nthread);
 
+/* Initializes the library like lib_init, and also sets NUMA mode.
+ * loglv,
+ * rs,
+ * nthread:	See lib_init.
+ * numa:	NUMA mode as bitwise or of enum numa_mode in numa.h.
+ * 			Use 0 for the behavior of lib_init.
+ */
+void lib_init_numa(unsigned char loglv,unsigned long rs,size_t nthread,unsigned char numa);
+
+/* Frees process-wide caches of the library, such as supernormalization
+ * and null distribution tables, and the memory pool. Should be called when the library is unloaded.
+ * Not thread safe.
+ */
+void lib_free();
+
 /* Returns library name
  */
 const char* lib_name();
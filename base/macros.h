@@ -23,6 +23,7 @@
 #include <string.h>
 #include "types.h"
 #include "logger.h"
+#include "pool.h"
 
 #define	ERRRETV(V,...)	{LOG(1,__VA_ARGS__) CLEANUP return V;}
 #define	ERRRET(...)		ERRRETV(1,__VA_ARGS__)
@@ -31,14 +32,14 @@
 #ifndef __STDC_NO_VLA__
 /* Automatically allocate memory depending on size. For count<=countmax,
  * allocation is through stack. For count>countmax, allocation is through
- * heap.
+ * memory pool, see pool.h.
  */
 
 #define AUTOALLOCSUF(TYPE,NAME,COUNT,COUNTMAX,SUFFIX) \
 	TYPE AUTOALLOCHEADER##NAME[(COUNT)<=(COUNTMAX)?(COUNT):0];\
 	TYPE * SUFFIX NAME;\
 	if((COUNT)<=(COUNTMAX))NAME=AUTOALLOCHEADER##NAME;\
-	else{if(COUNT) NAME=(TYPE*)malloc((COUNT)*(sizeof(TYPE)));\
+	else{if(COUNT) NAME=(TYPE*)pool_malloc((COUNT)*(sizeof(TYPE)));\
 		else NAME=0;}
 #define AUTOCALLOCSUF(TYPE,NAME,COUNT,COUNTMAX,SUFFIX) \
 	TYPE AUTOALLOCHEADER##NAME[(COUNT)<=(COUNTMAX)?(COUNT):0];\
@@ -46,19 +47,19 @@
 	if((COUNT)<=(COUNTMAX)){\
 		NAME=AUTOALLOCHEADER##NAME;\
 		memset(NAME,0,(COUNT)*sizeof(TYPE));}\
-	else{if(COUNT) NAME=(TYPE*)calloc(COUNT,sizeof(TYPE));\
+	else{if(COUNT) NAME=(TYPE*)pool_calloc(COUNT,sizeof(TYPE));\
 		else NAME=0;}
 
 /* Automatically free memory depending on size. Does nothing if memory is on stack,
- * frees memory if is on heap.
+ * frees memory if is from memory pool or heap.
  */
-#define	AUTOFREE(NAME) if(sizeof(AUTOALLOCHEADER##NAME)==0)CLEANMEM(NAME)
+#define	AUTOFREE(NAME) if(sizeof(AUTOALLOCHEADER##NAME)==0)CLEANPOOL(NAME)
 #else
 #define AUTOALLOCSUF(TYPE,NAME,COUNT,COUNTMAX,SUFFIX) \
-	TYPE * SUFFIX NAME=(TYPE*)malloc((COUNT)*sizeof(TYPE));
+	TYPE * SUFFIX NAME=(TYPE*)pool_malloc((COUNT)*sizeof(TYPE));
 #define AUTOCALLOCSUF(TYPE,NAME,COUNT,COUNTMAX,SUFFIX) \
-	TYPE * SUFFIX NAME=(TYPE*)calloc(COUNT,sizeof(TYPE);
-#define AUTOFREE(NAME) CLEANMEM(NAME)
+	TYPE * SUFFIX NAME=(TYPE*)pool_calloc(COUNT,sizeof(TYPE);
+#define AUTOFREE(NAME) CLEANPOOL(NAME)
 #endif
 #define AUTOALLOC(TYPE,NAME,COUNT,COUNTMAX) AUTOALLOCSUF(TYPE,NAME,COUNT,COUNTMAX,)
 #define AUTOCALLOC(TYPE,NAME,COUNT,COUNTMAX) AUTOCALLOCSUF(TYPE,NAME,COUNT,COUNTMAX,)
@@ -108,14 +109,15 @@
 // Cleanup macros
 #define	CLEANANY(X,F)	if(X){F(X);X=0;}
 #define CLEANMEM(X)		CLEANANY(X,free)
+#define CLEANPOOL(X)	CLEANANY(X,pool_free)
 #define CLEANVECO(X)	CLEANANY(X,VECTOROF(free))
-#define CLEANVECD(X)	CLEANANY(X,VECTORDF(free))
+#define CLEANVECD(X)	CLEANANY(X,VECTORDF(pool_free))
 #define CLEANVECC(X)	CLEANANY(X,VECTORCF(free))
 #define CLEANVECUC(X)	CLEANANY(X,VECTORUCF(free))
 #define CLEANVECI(X)	CLEANANY(X,VECTORIF(free))
 #define CLEANVECL(X)	CLEANANY(X,VECTORLF(free))
 #define CLEANVECUL(X)	CLEANANY(X,VECTORULF(free))
-#define CLEANVECF(X)	CLEANANY(X,VECTORFF(free))
+#define CLEANVECF(X)	CLEANANY(X,VECTORFF(pool_free))
 #define CLEANVECG(X)	CLEANANY(X,VECTORGF(free))
 
 #define CLEANMATO(X)	CLEANANY(X,MATRIXOF(free))
@@ -125,11 +127,12 @@
 #define CLEANMATI(X)	CLEANANY(X,MATRIXIF(free))
 #define CLEANMATL(X)	CLEANANY(X,MATRIXLF(free))
 #define CLEANMATUL(X)	CLEANANY(X,MATRIXULF(free))
-#define CLEANMATF(X)	CLEANANY(X,MATRIXFF(free))
+#define CLEANMATF(X)	CLEANANY(X,MATRIXFF(pool_free))
 #define CLEANMATG(X)	CLEANANY(X,MATRIXGF(free))
 
 #define	CLEANPERM(X)	CLEANANY(X,gsl_permutation_free)
-#define	CLEANHIST(X)	CLEANANY(X,gsl_histogram_free)
+#define	CLEANHIST(X)	CLEANANY(X,histogram_pool_free)
+#define	CLEANHISTLOC(X)	CLEANANY(X,histogram_locator_free)
 #define	CLEANFILE(X)	CLEANANY(X,fclose)
 #define	CLEANMMATF(X,N)	if(X){for(i=0;i<N;i++)CLEANMATF(X[i])free(X);X=0;}
 #define	CLEANMMATD(X,N)	if(X){for(i=0;i<N;i++)CLEANMATD(X[i])free(X);X=0;}
@@ -0,0 +1,243 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#if defined(unix) || defined(__unix__) || defined(__unix) || defined(__APPLE__) || defined(__MACH__) || defined(__linux__)
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define	MAPFILE_POSIX
+#endif
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include "gsl/math.h"
+#include "logger.h"
+#include "macros.h"
+#include "mapfile.h"
+
+/* Mapped matrix file.
+ * m:		Matrix of mapped data. Returned to caller.
+ * addr:	Start of mapping
+ * size:	Size of mapping in bytes
+ * fd:		File descriptor
+ * write:	Whether in write mode
+ * next:	Next mapped matrix in registry
+ */
+struct mapfile
+{
+	MATRIXF	m;
+	char*	addr;
+	size_t	size;
+	int		fd;
+	char	write;
+	struct mapfile*	next;
+};
+
+//Registry of mapped matrices, accessed in critical(mapfile)
+static struct mapfile*	mapfile_list=0;
+
+#ifdef MAPFILE_POSIX
+
+/* Finds mapped matrix containing address. Must be called in critical(mapfile).
+ * p:		Address
+ * Return:	Mapped matrix, or 0 if not found.
+ */
+static struct mapfile* mapfile_find(const void* p)
+{
+	struct mapfile*	f;
+	
+	for(f=mapfile_list;f;f=f->next)
+		if(((const char*)p>=f->addr)&&((const char*)p<f->addr+f->size))
+			return f;
+	return 0;
+}
+
+/* Page aligned range of rows in mapped matrix.
+ * f:		Mapped matrix
+ * m:		Matrix or matrix view within f
+ * start:	Start row in m
+ * n:		Number of rows
+ * p:		Output of page aligned start address
+ * size:	Output of size in bytes, or 0 if empty.
+ */
+static void mapfile_range(const struct mapfile* f,const MATRIXF* m,size_t start,size_t n,char** p,size_t* size)
+{
+	size_t	page,a,b;
+	
+	*size=0;
+	if(!(n&&m->size2))
+		return;
+	page=(size_t)sysconf(_SC_PAGESIZE);
+	a=(size_t)((const char*)MATRIXFF(const_ptr)(m,start,0)-f->addr);
+	b=(size_t)((const char*)(MATRIXFF(const_ptr)(m,start+n-1,0)+m->size2)-f->addr);
+	a=a/page*page;
+	b=GSL_MIN((b+page-1)/page*page,f->size);
+	*p=f->addr+a;
+	*size=b-a;
+}
+
+MATRIXF* MATRIXFF(mapfile)(const char* fname,size_t nrow,size_t ncol,char write)
+{
+#define	CLEANUP	if(f){if(f->addr&&(f->addr!=MAP_FAILED))munmap(f->addr,f->size);if(f->fd>=0)close(f->fd);free(f);}
+	struct mapfile*	f;
+	struct stat		st;
+	MATRIXFF(view)	mv;
+	
+	if(!(nrow&&ncol))
+	{
+		LOG(1,"Empty matrix cannot be mapped.")
+		return 0;
+	}
+	if(ncol>((size_t)-1)/sizeof(FTYPE)/nrow)
+	{
+		LOG(1,"Matrix too large to be mapped.")
+		return 0;
+	}
+	f=calloc(1,sizeof(*f));
+	if(!f)
+		ERRRETV(0,"Not enough memory.")
+	f->fd=-1;
+	f->size=nrow*ncol*sizeof(FTYPE);
+	f->write=write;
+	f->fd=open(fname,write?(O_RDWR|O_CREAT):O_RDONLY,0644);
+	if(f->fd<0)
+		ERRRETV(0,"Failed to open matrix file %s: %s.",fname,strerror(errno))
+	if(write)
+	{
+		if(ftruncate(f->fd,(off_t)f->size))
+			ERRRETV(0,"Failed to resize matrix file %s: %s.",fname,strerror(errno))
+	}
+	else if(fstat(f->fd,&st)||((size_t)st.st_size<f->size))
+		ERRRETV(0,"Matrix file %s smaller than "PRINTFSIZET" bytes.",fname,f->size)
+	f->addr=mmap(0,f->size,PROT_READ|PROT_WRITE,write?MAP_SHARED:MAP_PRIVATE,f->fd,0);
+	if(f->addr==MAP_FAILED)
+		ERRRETV(0,"Failed to map matrix file %s: %s.",fname,strerror(errno))
+	//Rows are visited in order by block loops
+	madvise(f->addr,f->size,MADV_SEQUENTIAL);
+	mv=MATRIXFF(view_array)((FTYPE*)f->addr,nrow,ncol);
+	memcpy(&f->m,&mv.matrix,sizeof(f->m));
+	#pragma omp critical(mapfile)
+	{
+		f->next=mapfile_list;
+		mapfile_list=f;
+	}
+	LOG(9,"Mapped "PRINTFSIZET"x"PRINTFSIZET" matrix file %s in %s mode.",nrow,ncol,fname,write?"write":"read")
+	return &f->m;
+#undef	CLEANUP
+}
+
+int MATRIXFF(mapfile_free)(MATRIXF* m)
+{
+	struct mapfile	*f,**pf;
+	int	ret;
+	
+	if(!m)
+		return 0;
+	f=0;
+	#pragma omp critical(mapfile)
+	{
+		for(pf=&mapfile_list;*pf;pf=&(*pf)->next)
+			if(&(*pf)->m==m)
+			{
+				f=*pf;
+				*pf=f->next;
+				break;
+			}
+	}
+	if(!f)
+	{
+		LOG(1,"Matrix not from MATRIXFF(mapfile).")
+		return 1;
+	}
+	ret=0;
+	if(f->write&&msync(f->addr,f->size,MS_SYNC))
+	{
+		LOG(1,"Failed to write matrix file: %s.",strerror(errno))
+		ret=1;
+	}
+	ret=munmap(f->addr,f->size)||ret;
+	ret=close(f->fd)||ret;
+	free(f);
+	return ret;
+}
+
+char MATRIXFF(mapfile_is)(const MATRIXF* m)
+{
+	char	ret;
+	
+	if(!mapfile_list)
+		return 0;
+	#pragma omp critical(mapfile)
+	ret=!!mapfile_find(m->data);
+	return ret;
+}
+
+void MATRIXFF(mapfile_done)(const MATRIXF* m,size_t start,size_t n)
+{
+	char*	p=0;
+	size_t	size=0;
+	
+	assert(start+n<=m->size1);
+	//Fast path without locking when nothing is mapped
+	if(!mapfile_list)
+		return;
+	#pragma omp critical(mapfile)
+	{
+		struct mapfile*	f=mapfile_find(m->data);
+		if(f&&f->write)
+			mapfile_range(f,m,start,n,&p,&size);
+	}
+	if(!size)
+		return;
+	//Start write back, then drop pages from memory. Data stays in page cache or file.
+	if(msync(p,size,MS_ASYNC)||madvise(p,size,MADV_DONTNEED))
+		LOG(5,"Failed to release rows of mapped matrix: %s.",strerror(errno))
+}
+
+#else
+
+MATRIXF* MATRIXFF(mapfile)(const char* fname,size_t nrow,size_t ncol,char write)
+{
+	(void)fname;(void)nrow;(void)ncol;(void)write;
+	LOG(1,"Memory-mapped matrix files are not supported on this system.")
+	return 0;
+}
+
+int MATRIXFF(mapfile_free)(MATRIXF* m)
+{
+	return !!m;
+}
+
+char MATRIXFF(mapfile_is)(const MATRIXF* m)
+{
+	(void)m;
+	return 0;
+}
+
+void MATRIXFF(mapfile_done)(const MATRIXF* m,size_t start,size_t n)
+{
+	(void)m;(void)start;(void)n;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file contains memory-mapped matrices for out-of-core runs.
+ * A matrix can be backed by a dense binary file of FTYPE in row-major order,
+ * the same format as MATRIXFF(from_densefile). Pipelines hand rows of
+ * mapped matrices back to the kernel with MATRIXFF(mapfile_done) once each block
+ * is finished, so outputs larger than physical memory are written out as they go.
+ * Mapped matrices are registered process-wide, so that any matrix or
+ * submatrix view can be checked for being mapped. POSIX only.
+ */
+
+#ifndef _HEADER_LIB_MAPFILE_H_
+#define _HEADER_LIB_MAPFILE_H_
+#include "config.h"
+#include <stdlib.h>
+#include "types.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Maps a dense binary matrix file as matrix.
+ * Read mode maps the file privately: changes, such as in place supernormalization,
+ * are visible to the process but never written to the file.
+ * Write mode creates or resizes the file, and writes changes to it.
+ * fname:	Path of matrix file
+ * nrow,
+ * ncol:	Size of matrix
+ * write:	Whether to open in write mode
+ * Return:	Mapped matrix that must be freed with MATRIXFF(mapfile_free), or 0 on failure.
+ */
+MATRIXF* MATRIXFF(mapfile)(const char* fname,size_t nrow,size_t ncol,char write);
+
+/* Writes changes of matrix in write mode to its file, and unmaps it.
+ * m:		Matrix from MATRIXFF(mapfile), or 0 for no operation.
+ * Return:	0 on success.
+ */
+int MATRIXFF(mapfile_free)(MATRIXF* m);
+
+/* Whether matrix data is (part of) a mapped matrix. Thread safe.
+ * m:		Matrix or matrix view
+ */
+char MATRIXFF(mapfile_is)(const MATRIXF* m);
+
+/* Marks rows of a mapped matrix as finished. In write mode, their changes
+ * start to be written to file and their pages are released from memory.
+ * Rows of read mode matrices are kept as they may have been changed.
+ * No operation if m is not mapped. Thread safe.
+ * m:		Matrix or matrix view
+ * start:	Start row in m
+ * n:		Number of rows
+ */
+void MATRIXFF(mapfile_done)(const MATRIXF* m,size_t start,size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,237 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "logger.h"
+#include "macros.h"
+#include "threading.h"
+#include "numa.h"
+
+static unsigned char numa_mode=NUMA_NONE;
+
+/* Pins every worker thread of OpenMP thread pool to one CPU of the process affinity mask,
+ * in increasing order of CPU ID, so consecutive threads stay on the same socket.
+ * The master thread is the caller's own thread, e.g. the R main thread, so its affinity
+ * is restored afterwards, and threads it creates later are not confined to one CPU.
+ * Return:	0 on success.
+ */
+static int numa_pin()
+{
+#ifdef __linux__
+	cpu_set_t	mask;
+	size_t		ncpu,i;
+	int			ret;
+	
+	if(omp_get_proc_bind()!=omp_proc_bind_false)
+	{
+		LOG(7,"OpenMP thread binding already set. Skipped thread pinning.")
+		return 0;
+	}
+	if(sched_getaffinity(0,sizeof(mask),&mask))
+	{
+		LOG(4,"Failed to obtain CPU affinity. Skipped thread pinning.")
+		return 1;
+	}
+	ncpu=(size_t)CPU_COUNT(&mask);
+	if(!ncpu)
+		return 1;
+	{
+		size_t	cpus[ncpu];
+		for(i=0,ncpu=0;i<CPU_SETSIZE;i++)
+			if(CPU_ISSET(i,&mask))
+				cpus[ncpu++]=i;
+		ret=0;
+		#pragma omp parallel
+		{
+			cpu_set_t	m1;
+			size_t		id=(size_t)omp_get_thread_num();
+			
+			CPU_ZERO(&m1);
+			CPU_SET(cpus[id%ncpu],&m1);
+			if(sched_setaffinity(0,sizeof(m1),&m1))
+			{
+				#pragma omp atomic write
+				ret=1;
+			}
+		}
+	}
+	if(sched_setaffinity(0,sizeof(mask),&mask))
+		LOG(4,"Failed to restore CPU affinity of master thread.")
+	if(ret)
+	{
+		LOG(4,"Failed to pin some threads.")
+		return 1;
+	}
+	LOG(9,"Pinned %i threads to "PRINTFSIZET" CPUs.",omp_get_max_threads(),ncpu)
+	return 0;
+#else
+	LOG(4,"Thread pinning is not supported on this platform.")
+	return 1;
+#endif
+}
+
+void numa_init(unsigned char mode)
+{
+	numa_mode=mode;
+	if(mode&NUMA_PIN)
+		numa_pin();
+	LOG(9,"NUMA first-touch %s, thread pinning %s.",(mode&NUMA_FIRSTTOUCH)?"on":"off",(mode&NUMA_PIN)?"on":"off")
+}
+
+unsigned char numa_getmode()
+{
+	return numa_mode;
+}
+
+size_t numa_node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned	cpu,node;
+	if(syscall(SYS_getcpu,&cpu,&node,NULL))
+		return 0;
+	return (size_t)node;
+#else
+	return 0;
+#endif
+}
+
+void MATRIXFF(numa_touch)(MATRIXF* m)
+{
+	size_t	step;
+	
+	if(!(numa_mode&NUMA_FIRSTTOUCH))
+		return;
+#ifdef __linux__
+	{
+		long	page=sysconf(_SC_PAGESIZE);
+		step=(page>0)?(size_t)page/sizeof(FTYPE):1;
+	}
+#else
+	step=4096/sizeof(FTYPE);
+#endif
+	if(!step)
+		step=1;
+	#pragma omp parallel
+	{
+		size_t	n1,n2,i;
+		FTYPE	*p;
+		
+		threading_get_startend(m->size1,&n1,&n2);
+		if(n2>n1)
+		{
+			p=m->data+n1*m->tda;
+			for(i=0;i<(n2-n1)*m->tda;i+=step)
+				p[i]=0;
+			//Last element also touched for blocks shorter than a page
+			p[(n2-n1-1)*m->tda+m->size2-1]=0;
+		}
+	}
+}
+
+MATRIXF* MATRIXFF(alloc_numa)(size_t n1,size_t n2)
+{
+	MATRIXF*	m;
+	
+	//Not from pool, whose pages may have been touched by previous blocks
+	m=MATRIXFF(alloc)(n1,n2);
+	if(m)
+		MATRIXFF(numa_touch)(m);
+	return m;
+}
+
+int numa_bench(size_t nbyte,size_t nrep)
+{
+#define	CLEANUP	CLEANMATF(m)CLEANMEM(bw)CLEANMEM(nthnode)
+	MATRIXF	*m;
+	double	*bw;
+	size_t	*nthnode;
+	size_t	nth,nnode,ncol,i;
+	
+	m=0;
+	bw=0;
+	nthnode=0;
+	nth=(size_t)omp_get_max_threads();
+	ncol=nbyte/(nth*sizeof(FTYPE));
+	if(!(ncol&&nrep))
+		ERRRET("Invalid benchmark size.")
+	m=MATRIXFF(alloc_numa)(nth,ncol);
+	//Nodes are counted up to the number of threads
+	bw=calloc(nth,sizeof(*bw));
+	nthnode=calloc(nth,sizeof(*nthnode));
+	if(!(m&&bw&&nthnode))
+		ERRRET("Not enough memory.")
+	//Initialize values from owning threads, so the first-touch placement is kept
+	#pragma omp parallel
+	{
+		size_t	n1,n2,j,k;
+		threading_get_startend(nth,&n1,&n2);
+		for(j=n1;j<n2;j++)
+		{
+			VECTORFF(view)	vv=MATRIXFF(row)(m,j);
+			for(k=0;k<ncol;k++)
+				VECTORFF(set)(&vv.vector,k,1);
+		}
+	}
+	
+	nnode=0;
+	#pragma omp parallel
+	{
+		size_t	n1,n2,i1,j,k,node;
+		double	t0,t,sum=0;
+		
+		threading_get_startend(nth,&n1,&n2);
+		#pragma omp barrier
+		t0=omp_get_wtime();
+		for(k=0;k<nrep;k++)
+			for(i1=n1;i1<n2;i1++)
+			{
+				const FTYPE	*p=m->data+i1*m->tda;
+				for(j=0;j<ncol;j++)
+					sum+=p[j];
+			}
+		t=omp_get_wtime()-t0;
+		node=numa_node();
+		if(node>=nth)
+			node=nth-1;
+		#pragma omp critical(numa_bench)
+		{
+			//Sum is used so the reads are kept
+			if((t>0)&&(sum>=0))
+				bw[node]+=(double)((n2-n1)*ncol*sizeof(FTYPE)*nrep)/t;
+			nthnode[node]++;
+			if(node>=nnode)
+				nnode=node+1;
+		}
+	}
+	for(i=0;i<nnode;i++)
+		if(nthnode[i])
+			LOG(7,"NUMA node "PRINTFSIZET": "PRINTFSIZET" threads, read bandwidth %.3g GB/s.",i,nthnode[i],bw[i]/1E9)
+	CLEANUP
+	return 0;
+#undef	CLEANUP
+}
@@ -0,0 +1,93 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file contains NUMA-aware memory placement and thread pinning.
+ * Large matrices can be first-touched from the threads that will own their rows,
+ * so pages are spread over sockets according to the static split of threading.h
+ * instead of all landing on the socket of the main thread.
+ */
+
+#ifndef _HEADER_LIB_NUMA_H_
+#define _HEADER_LIB_NUMA_H_
+#include "config.h"
+#include <stdlib.h>
+#include "types.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* NUMA modes as bit flags.
+ * NUMA_FIRSTTOUCH:	Matrices from MATRIXFF(alloc_numa) are first-touched by
+ * 					row blocks from all threads.
+ * NUMA_PIN:		Pins OpenMP worker threads to cores in the order of the process
+ * 					affinity mask. The calling thread keeps its affinity.
+ * 					Ignored when OpenMP binding is already set,
+ * 					e.g. with OMP_PROC_BIND. Linux only.
+ */
+enum numa_mode
+{
+	NUMA_NONE=0,
+	NUMA_FIRSTTOUCH=1,
+	NUMA_PIN=2
+};
+
+/* Sets NUMA mode. Called by lib_init_numa. Pinning is applied to the
+ * current OpenMP thread pool, so this should be called after the number
+ * of threads is set. Not thread safe.
+ * mode:	Bitwise or of enum numa_mode.
+ */
+void numa_init(unsigned char mode);
+
+/* Returns current NUMA mode as bitwise or of enum numa_mode. */
+unsigned char numa_getmode();
+
+/* Returns NUMA node of the CPU current thread is running on, or 0 if unknown. */
+size_t numa_node();
+
+/* Writes one element in each page of matrix rows, with row blocks split
+ * among threads as threading_get_startend does. Values of touched elements
+ * are undefined afterwards. Only takes effect for fresh pages that have not
+ * been written to, and when NUMA_FIRSTTOUCH is set.
+ * m:		Matrix to touch
+ */
+void MATRIXFF(numa_touch)(MATRIXF* m);
+
+/* Allocates matrix from the system outside memory pool, and first-touches it with
+ * MATRIXFF(numa_touch). Values are undefined as from MATRIXFF(alloc).
+ * Placement only works for fresh pages, i.e. matrices large enough to be mapped
+ * directly by malloc.
+ * Free with CLEANMATF.
+ * n1,
+ * n2:		Size of matrix
+ * Return:	Allocated matrix, or 0 on failure.
+ */
+MATRIXF* MATRIXFF(alloc_numa)(size_t n1,size_t n2);
+
+/* Measures memory read bandwidth of each NUMA node, with the current NUMA mode.
+ * Each thread repeatedly sums its own row block of a matrix from MATRIXFF(alloc_numa),
+ * and bandwidths of threads running on the same node are added up and logged at level 7.
+ * nbyte:	Total size of matrix in bytes
+ * nrep:	Number of repeated passes over the matrix
+ * Return:	0 on success.
+ */
+int numa_bench(size_t nbyte,size_t nrep);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
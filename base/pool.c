@@ -0,0 +1,333 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "logger.h"
+#include "macros.h"
+#include "const.h"
+#include "pool.h"
+
+//Size rounded up to pool alignment
+#define	POOL_ROUND(X)	(((X)+CONST_POOL_ALIGN-1)/CONST_POOL_ALIGN*CONST_POOL_ALIGN)
+//Offset of no block
+#define	POOL_NONE		((size_t)-1)
+
+/* Header before every block in pool.
+ * prev:	Offset of the previous block, or POOL_NONE for the first block.
+ * freed:	Whether the block has been freed.
+ */
+struct pool_block
+{
+	size_t	prev;
+	char	freed;
+};
+#define	POOL_HEAD		POOL_ROUND(sizeof(struct pool_block))
+
+/* Memory pool. All state is only accessed in critical(pool), so concurrent
+ * pipeline invocations from different user threads share the pool safely.
+ * Their blocks may interleave, which only delays reclamation until the blocks
+ * above are freed too.
+ * raw:		Memory from system allocator.
+ * data:	Aligned start of pool in raw.
+ * size:	Size of pool in bytes.
+ * want:	Size of pool in bytes to reserve on the first allocation, or 0 if reserved or not wanted.
+ * used:	Bytes used, i.e. end of the top block.
+ * top:		Offset of the top block, or POOL_NONE if empty.
+ * depth:	Nesting depth of pool_begin over all threads. Pool is only allocated from when depth>0,
+ * 			and is released once depth is 0 and no block is in use.
+ * peak:	Peak bytes used in the outermost invocation.
+ * nfallback:	Number of allocations that fell back to system allocator in the outermost invocation.
+ */
+static char*	pool_raw=0;
+static char*	pool_data=0;
+static size_t	pool_size=0;
+static size_t	pool_want=0;
+static size_t	pool_used=0;
+static size_t	pool_top=POOL_NONE;
+static size_t	pool_depth=0;
+static size_t	pool_peak=0;
+static size_t	pool_nfallback=0;
+
+/* Releases the reservation of pool. Must be called in critical(pool) with no block in use.
+ */
+static void pool_release()
+{
+	assert(!pool_used);
+	CLEANMEM(pool_raw)
+	pool_data=0;
+	pool_size=0;
+	pool_want=0;
+	pool_top=POOL_NONE;
+}
+
+/* Caps the requested pool size to what can be reserved, i.e. without overflow
+ * and within the available physical memory where known.
+ * size:	Requested size in bytes, such as (size_t)-1 for no memory limit.
+ * Return:	Capped size in bytes.
+ */
+static size_t pool_cap(size_t size)
+{
+	if(size>SIZE_MAX-CONST_POOL_ALIGN)
+		size=SIZE_MAX-CONST_POOL_ALIGN;
+#ifdef _SC_AVPHYS_PAGES
+	{
+		long	page=sysconf(_SC_PAGESIZE);
+		long	npage=sysconf(_SC_AVPHYS_PAGES);
+		if((page>0)&&(npage>0)&&((size_t)npage<=SIZE_MAX/(size_t)page)&&(size>(size_t)npage*(size_t)page))
+			size=(size_t)npage*(size_t)page;
+	}
+#endif
+	return size;
+}
+
+/* Reserves the pool requested by pool_begin. Must be called in critical(pool).
+ */
+static void pool_reserve()
+{
+	assert(!(pool_data||pool_used));
+	pool_raw=malloc(pool_want+CONST_POOL_ALIGN);
+	if(pool_raw)
+	{
+		pool_data=pool_raw+(CONST_POOL_ALIGN-(uintptr_t)pool_raw%CONST_POOL_ALIGN)%CONST_POOL_ALIGN;
+		pool_size=pool_want;
+	}
+	else
+		LOG(10,"Failed to reserve memory pool of "PRINTFSIZET" bytes. Using system allocator.",pool_want)
+	pool_want=0;
+}
+
+void pool_begin(size_t size)
+{
+	#pragma omp critical(pool)
+	{
+		if(!(pool_depth++))
+		{
+			pool_peak=pool_nfallback=0;
+			if(pool_used)
+			{
+				if(pool_size<size)
+					LOG(10,"Memory pool in use. Not resized to "PRINTFSIZET" bytes.",size)
+			}
+			else if(!(pool_data&&(pool_size>=pool_cap(size))))
+			{
+				//Reserved on first allocation
+				pool_release();
+				pool_want=pool_cap(size);
+			}
+		}
+	}
+}
+
+void pool_end()
+{
+	#pragma omp critical(pool)
+	{
+		assert(pool_depth);
+		if(!(--pool_depth))
+		{
+			LOG(10,"Memory pool: peak usage "PRINTFSIZET" of "PRINTFSIZET" bytes, "PRINTFSIZET" allocations from system.",pool_peak,pool_size,pool_nfallback)
+			//Blocks still in use release the pool when freed
+			if(!pool_used)
+				pool_release();
+		}
+	}
+}
+
+void pool_cache_clear()
+{
+	#pragma omp critical(pool)
+	{
+		if(pool_used)
+			LOG(4,"Memory pool still in use. Not freed.")
+		else if(!pool_depth)
+			pool_release();
+	}
+}
+
+/* Allocates memory from pool only.
+ * size:	Size in bytes
+ * Return:	Allocated memory, or 0 if pool is not in use or full.
+ */
+static void* pool_malloc_inpool(size_t size)
+{
+	size_t	need=POOL_HEAD+POOL_ROUND(size);
+	void*	ans=0;
+	
+	#pragma omp critical(pool)
+	{
+		if(pool_depth&&pool_want)
+			pool_reserve();
+		if(pool_depth&&pool_data&&(pool_size-pool_used>=need))
+		{
+			struct pool_block*	b=(struct pool_block*)(pool_data+pool_used);
+			b->prev=pool_top;
+			b->freed=0;
+			pool_top=pool_used;
+			pool_used+=need;
+			if(pool_used>pool_peak)
+				pool_peak=pool_used;
+			ans=pool_data+pool_top+POOL_HEAD;
+		}
+		else if(pool_depth)
+			pool_nfallback++;
+	}
+	return ans;
+}
+
+/* Frees memory if it is from pool.
+ * p:		Memory to free
+ * Return:	1 if p is from pool and freed, or 0 if p is not from pool.
+ */
+static int pool_free_inpool(void* p)
+{
+	int		ans;
+	
+	#pragma omp critical(pool)
+	{
+		ans=pool_data&&((char*)p>=pool_data)&&((char*)p<pool_data+pool_size);
+		if(ans)
+		{
+			struct pool_block*	b=(struct pool_block*)((char*)p-POOL_HEAD);
+			b->freed=1;
+			//Reclaim freed blocks on top
+			while((pool_top!=POOL_NONE)&&((struct pool_block*)(pool_data+pool_top))->freed)
+			{
+				pool_used=pool_top;
+				pool_top=((struct pool_block*)(pool_data+pool_top))->prev;
+			}
+			if(!(pool_depth||pool_used))
+				pool_release();
+		}
+	}
+	return ans;
+}
+
+void* pool_malloc(size_t size)
+{
+	void*	ans=pool_malloc_inpool(size);
+	return ans?ans:malloc(size);
+}
+
+void* pool_calloc(size_t n,size_t size)
+{
+	void*	ans;
+	
+	if(size&&(n>SIZE_MAX/size))
+		return 0;
+	ans=pool_malloc_inpool(n*size);
+	if(!ans)
+		return calloc(n,size);
+	memset(ans,0,n*size);
+	return ans;
+}
+
+void pool_free(void* p)
+{
+	if(p&&!pool_free_inpool(p))
+		free(p);
+}
+
+MATRIXF* MATRIXFF(pool_alloc)(size_t n1,size_t n2)
+{
+	MATRIXF*	m;
+	
+	m=(n1&&n2)?pool_malloc_inpool(POOL_ROUND(sizeof(*m))+n1*n2*sizeof(FTYPE)):0;
+	if(!m)
+		return MATRIXFF(alloc)(n1,n2);
+	m->size1=n1;
+	m->size2=m->tda=n2;
+	m->data=(FTYPE*)((char*)m+POOL_ROUND(sizeof(*m)));
+	m->block=0;
+	m->owner=0;
+	return m;
+}
+
+VECTORF* VECTORFF(pool_alloc)(size_t n)
+{
+	VECTORF*	v;
+	
+	v=n?pool_malloc_inpool(POOL_ROUND(sizeof(*v))+n*sizeof(FTYPE)):0;
+	if(!v)
+		return VECTORFF(alloc)(n);
+	v->size=n;
+	v->stride=1;
+	v->data=(FTYPE*)((char*)v+POOL_ROUND(sizeof(*v)));
+	v->block=0;
+	v->owner=0;
+	return v;
+}
+
+VECTORD* VECTORDF(pool_alloc)(size_t n)
+{
+	VECTORD*	v;
+	
+	v=n?pool_malloc_inpool(POOL_ROUND(sizeof(*v))+n*sizeof(double)):0;
+	if(!v)
+		return VECTORDF(alloc)(n);
+	v->size=n;
+	v->stride=1;
+	v->data=(double*)((char*)v+POOL_ROUND(sizeof(*v)));
+	v->block=0;
+	v->owner=0;
+	return v;
+}
+
+void MATRIXFF(pool_free)(MATRIXF* m)
+{
+	if(m&&!pool_free_inpool(m))
+		MATRIXFF(free)(m);
+}
+
+void VECTORFF(pool_free)(VECTORF* v)
+{
+	if(v&&!pool_free_inpool(v))
+		VECTORFF(free)(v);
+}
+
+void VECTORDF(pool_free)(VECTORD* v)
+{
+	if(v&&!pool_free_inpool(v))
+		VECTORDF(free)(v);
+}
+
+gsl_histogram* histogram_pool_alloc(size_t n)
+{
+	gsl_histogram*	h;
+	size_t			i;
+	
+	h=n?pool_malloc_inpool(POOL_ROUND(sizeof(*h))+(2*n+1)*sizeof(double)):0;
+	if(!h)
+		return gsl_histogram_alloc(n);
+	h->n=n;
+	h->range=(double*)((char*)h+POOL_ROUND(sizeof(*h)));
+	h->bin=h->range+n+1;
+	for(i=0;i<=n;i++)
+		h->range[i]=(double)i;
+	memset(h->bin,0,n*sizeof(*h->bin));
+	return h;
+}
+
+void histogram_pool_free(gsl_histogram* h)
+{
+	if(h&&!pool_free_inpool(h))
+		gsl_histogram_free(h);
+}
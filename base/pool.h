@@ -0,0 +1,93 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file contains the memory pool for scratch buffers of pipeline invocations.
+ * The pool is one block reserved from the system, sized by the memory limit of the
+ * outermost pipeline call, and released when that call ends. Allocations are
+ * stacked on the block and freed blocks are reclaimed once all blocks above them
+ * are freed, which suits the nested CLEANUP pattern. Allocations that do not fit,
+ * or are made outside any pipeline, fall back to the system allocator.
+ * All functions are thread safe. Concurrent pipelines from different threads
+ * share the pool and nest as one.
+ * Pointers of either kind are freed with the matching pool_*free functions,
+ * which the CLEAN* and AUTOFREE macros use.
+ */
+
+#ifndef _HEADER_LIB_POOL_H_
+#define _HEADER_LIB_POOL_H_
+#include "config.h"
+#include <stdlib.h>
+#include "gsl/histogram.h"
+#include "types.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Starts using the memory pool for a pipeline invocation. Calls can be nested,
+ * and only the outermost call reserves or grows the pool. The pool is reserved
+ * on its first allocation.
+ * size:	Size of pool in bytes, usually the memory limit of the pipeline. Capped to
+ * 			the available physical memory, so (size_t)-1 means no limit.
+ */
+void pool_begin(size_t size);
+
+/* Stops using the memory pool for the pipeline invocation started by the matching
+ * pool_begin. The outermost call releases the pool. Blocks still in use remain valid,
+ * and the pool is released once they are freed.
+ */
+void pool_end();
+
+/* Frees the memory pool if no pipeline is running and no block is in use. Called by lib_free. */
+void pool_cache_clear();
+
+/* Allocates memory from the pool, or from the system if the pool is not in use or full.
+ * Thread safe.
+ * size:	Size in bytes
+ * Return:	Allocated memory, or 0 on failure.
+ */
+void* pool_malloc(size_t size);
+
+/* Like pool_malloc, with memory set to zero. Returns 0 if n*size overflows. */
+void* pool_calloc(size_t n,size_t size);
+
+/* Frees memory from pool_malloc or pool_calloc, or from the system allocator. Thread safe. */
+void pool_free(void* p);
+
+/* Allocates a matrix or vector from the pool. Falls back to the allocator of GSL,
+ * so the result can be freed with the corresponding pool_free function
+ * in any case. Values are uninitialized. Thread safe.
+ */
+MATRIXF* MATRIXFF(pool_alloc)(size_t n1,size_t n2);
+VECTORF* VECTORFF(pool_alloc)(size_t n);
+VECTORD* VECTORDF(pool_alloc)(size_t n);
+void MATRIXFF(pool_free)(MATRIXF* m);
+void VECTORFF(pool_free)(VECTORF* v);
+void VECTORDF(pool_free)(VECTORD* v);
+
+/* Allocates a histogram from the pool like gsl_histogram_alloc, with ranges 0,...,n
+ * and zero bins. Falls back to gsl_histogram_alloc. Thread safe.
+ * n:		Number of bins
+ * Return:	Histogram, or 0 on failure.
+ */
+gsl_histogram* histogram_pool_alloc(size_t n);
+void histogram_pool_free(gsl_histogram* h);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
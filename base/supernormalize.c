@@ -18,91 +18,333 @@
 #include "config.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <assert.h>
 #include "gsl/sort.h"
 #include "logger.h"
 #include "macros.h"
+#include "const.h"
 #include "threading.h"
 #include "data_process.h"
+#include "numa.h"
 #include "supernormalize.h"
 
-void supernormalize_byrow_single_buffed(MATRIXF* m,gsl_permutation *p1,const FTYPE* restrict Pinv)
+//Number of radix sort passes, one per byte
+#define	SUPERNORMALIZE_NPASS	sizeof(FTYPE_UINT)
+//Sign bit of FTYPE
+#define	SUPERNORMALIZE_SIGN		((FTYPE_UINT)1<<(8*sizeof(FTYPE_UINT)-1))
+
+static enum supernormalize_ties supernormalize_ties_mode=SUPERNORMALIZE_TIES_SEQUENTIAL;
+static enum supernormalize_input supernormalize_input_mode=SUPERNORMALIZE_INPUT_COPY;
+//Matrices the caller allows to be overwritten in SUPERNORMALIZE_INPUT_INPLACE mode
+static MATRIXF* supernormalize_input_inplace[CONST_SUPERNORMALIZE_INPLACE_NMAX];
+static size_t supernormalize_input_ninplace=0;
+
+//Cached Pinv tables
+struct supernormalize_Pinv_table
 {
-	size_t i,j;
+	size_t	n;
+	FTYPE*	Pinv;
+};
+static struct supernormalize_Pinv_table* supernormalize_Pinv_tables=0;
+static size_t supernormalize_Pinv_ntable=0;
+static size_t supernormalize_Pinv_ntablemax=0;
+
+void supernormalize_setties(enum supernormalize_ties ties)
+{
+	supernormalize_ties_mode=ties;
+}
+
+const FTYPE* supernormalize_Pinv_get(size_t n)
+{
+	struct supernormalize_Pinv_table	*t2;
+	FTYPE	*ans=0;
+	size_t	i;
 	
-	for(j=0;j<m->size1;j++)
+	#pragma omp critical(supernormalize_Pinv_cache)
+	{
+		for(i=0;i<supernormalize_Pinv_ntable;i++)
+			if(supernormalize_Pinv_tables[i].n==n)
+			{
+				ans=supernormalize_Pinv_tables[i].Pinv;
+				break;
+			}
+		if(!ans)
+		{
+			if(supernormalize_Pinv_ntable==supernormalize_Pinv_ntablemax)
+			{
+				i=supernormalize_Pinv_ntablemax?2*supernormalize_Pinv_ntablemax:16;
+				t2=realloc(supernormalize_Pinv_tables,i*sizeof(*t2));
+				if(t2)
+				{
+					supernormalize_Pinv_tables=t2;
+					supernormalize_Pinv_ntablemax=i;
+				}
+				else
+					LOG(1,"Not enough memory.")
+			}
+			if(supernormalize_Pinv_ntable<supernormalize_Pinv_ntablemax)
+			{
+				MALLOCSIZE(ans,n);
+				if(ans)
+				{
+					supernormalize_Pinv(n,ans);
+					supernormalize_Pinv_tables[supernormalize_Pinv_ntable].n=n;
+					supernormalize_Pinv_tables[supernormalize_Pinv_ntable++].Pinv=ans;
+				}
+				else
+					LOG(1,"Not enough memory.")
+			}
+		}
+	}
+	return ans;
+}
+
+void supernormalize_Pinv_cache_clear()
+{
+	size_t	i;
+	for(i=0;i<supernormalize_Pinv_ntable;i++)
+		CLEANMEM(supernormalize_Pinv_tables[i].Pinv)
+	CLEANMEM(supernormalize_Pinv_tables)
+	supernormalize_Pinv_ntable=supernormalize_Pinv_ntablemax=0;
+}
+
+/* Memory in bytes of ranking workspace for rows of n elements.
+ * Struct, keys, indices, and histograms in one block. Keys come first for alignment.
+ */
+static inline size_t supernormalize_arena_size(size_t n)
+{
+	return sizeof(struct supernormalize_arena)+2*n*sizeof(FTYPE_UINT)+(2*n+256*SUPERNORMALIZE_NPASS)*sizeof(uint32_t);
+}
+
+struct supernormalize_arena* supernormalize_arena_alloc(size_t n)
+{
+	struct supernormalize_arena*	a;
+	
+	if(n>UINT32_MAX)
+	{
+		LOG(1,"Row length "PRINTFSIZET" too large for ranking.",n)
+		return 0;
+	}
+	a=malloc(supernormalize_arena_size(n));
+	if(!a)
+		return 0;
+	a->n=n;
+	a->key[0]=(FTYPE_UINT*)(a+1);
+	a->key[1]=a->key[0]+n;
+	a->id[0]=(uint32_t*)(a->key[1]+n);
+	a->id[1]=a->id[0]+n;
+	a->count=a->id[1]+n;
+	return a;
+}
+
+void supernormalize_arena_free(struct supernormalize_arena* a)
+{
+	free(a);
+}
+
+/* Converts FTYPE to unsigned integer of the same order.
+ */
+static inline FTYPE_UINT supernormalize_key(FTYPE x)
+{
+	FTYPE_UINT	u;
+	
+	memcpy(&u,&x,sizeof(u));
+	//-0 is regarded as +0
+	if(u==SUPERNORMALIZE_SIGN)
+		u=0;
+	return (u&SUPERNORMALIZE_SIGN)?~u:(u|SUPERNORMALIZE_SIGN);
+}
+
+const uint32_t* supernormalize_argsort(struct supernormalize_arena* a,const FTYPE* restrict x,const FTYPE_UINT** keys)
+{
+	size_t		i,j,n;
+	FTYPE_UINT	*restrict k0,*restrict k1,*kt;
+	uint32_t	*restrict i0,*restrict i1,*it;
+	uint32_t	*restrict c;
+	uint32_t	s,t;
+	FTYPE_UINT	v;
+	
+	n=a->n;
+	k0=a->key[0];
+	k1=a->key[1];
+	i0=a->id[0];
+	i1=a->id[1];
+	for(i=0;i<n;i++)
 	{
-		VECTORFF(view) vvs=MATRIXFF(row)(m,j);
+		k0[i]=supernormalize_key(x[i]);
+		i0[i]=(uint32_t)i;
+	}
+	
+	if(n<CONST_SUPERNORMALIZE_RADIX_NMIN)
+	{
+		//Insertion sort for short rows
+		for(i=1;i<n;i++)
+		{
+			v=k0[i];
+			t=i0[i];
+			for(j=i;j&&(k0[j-1]>v);j--)
+			{
+				k0[j]=k0[j-1];
+				i0[j]=i0[j-1];
+			}
+			k0[j]=v;
+			i0[j]=t;
+		}
+	}
+	else
+	{
+		//Histograms of all bytes in one pass
+		memset(a->count,0,256*SUPERNORMALIZE_NPASS*sizeof(*a->count));
+		for(i=0;i<n;i++)
+			for(j=0;j<SUPERNORMALIZE_NPASS;j++)
+				a->count[(j<<8)+((k0[i]>>(8*j))&0xFF)]++;
 		
+		for(j=0;j<SUPERNORMALIZE_NPASS;j++)
+		{
+			c=a->count+(j<<8);
+			//Skip bytes shared by all keys
+			if(c[(k0[0]>>(8*j))&0xFF]==n)
+				continue;
+			for(i=0,s=0;i<256;i++)
+			{
+				t=c[i];
+				c[i]=s;
+				s+=t;
+			}
+			for(i=0;i<n;i++)
+			{
+				t=c[(k0[i]>>(8*j))&0xFF]++;
+				k1[t]=k0[i];
+				i1[t]=i0[i];
+			}
+			kt=k0;k0=k1;k1=kt;
+			it=i0;i0=i1;i1=it;
+		}
+	}
+	if(keys)
+		*keys=k0;
+	return i0;
+}
+
+/* Normalizes x of length n to 0 mean and 1 variance. Constant x is set to 0.
+ */
+static void supernormalize_normalize(FTYPE* restrict x,size_t n)
+{
+	size_t	i;
+	double	mean,var;
+	
+	mean=var=0;
+	for(i=0;i<n;i++)
+		mean+=x[i];
+	mean/=(double)n;
+	for(i=0;i<n;i++)
+		var+=gsl_pow_2(x[i]-mean);
+	var=var>0?1/sqrt(var/(double)n):0;
+	for(i=0;i<n;i++)
+		x[i]=(FTYPE)((x[i]-mean)*var);
+}
+
+void supernormalize_byrow_single_buffed(MATRIXF* m,struct supernormalize_arena* a,const FTYPE* restrict Pinv,enum supernormalize_ties ties)
+{
+	size_t	i,j,k,n;
+	const uint32_t*		id;
+	const FTYPE_UINT*	keys;
+	FTYPE*	x;
+	double	v;
+	
+	n=m->size2;
+	assert(a->n==n);
+	for(j=0;j<m->size1;j++)
+	{
+		x=MATRIXFF(ptr)(m,j,0);
 		//Rank
-		CONCATENATE3(gsl_sort_vector,FTYPE_SUF,_index)(p1,&(vvs.vector));
+		id=supernormalize_argsort(a,x,&keys);
 		//Distribution
-		for(i=0;i<m->size2;i++)
-			MATRIXFF(set)(m,j,gsl_permutation_get(p1,i),Pinv[i]);
+		if(ties==SUPERNORMALIZE_TIES_SEQUENTIAL)
+		{
+			for(i=0;i<n;i++)
+				x[id[i]]=Pinv[i];
+			continue;
+		}
+		//Ties share the average of their values, after which the row is renormalized
+		for(i=0;i<n;i=k)
+		{
+			v=Pinv[i];
+			for(k=i+1;(k<n)&&(keys[k]==keys[i]);k++)
+				v+=Pinv[k];
+			v/=(double)(k-i);
+			for(;i<k;i++)
+				x[id[i]]=(FTYPE)v;
+		}
+		supernormalize_normalize(x,n);
 	}
-	//Normalize again for unit variance
-	MATRIXFF(normalize_row)(m);
 }
 
 int supernormalize_byrow_single(MATRIXF* m,const FTYPE* restrict Pinv)
 {
-	gsl_permutation *p1;
+	struct supernormalize_arena*	a;
 	
-	p1=gsl_permutation_alloc(m->size2);
-	if(!p1)
+	a=supernormalize_arena_alloc(m->size2);
+	if(!a)
 	{
-		LOG(1,"Can't allocate permutations.")
+		LOG(1,"Can't allocate ranking workspace.")
 		return 1;
 	}
-	supernormalize_byrow_single_buffed(m,p1,Pinv);
-	gsl_permutation_free(p1);
+	supernormalize_byrow_single_buffed(m,a,Pinv,supernormalize_ties_mode);
+	supernormalize_arena_free(a);
 	return 0;
 }
 
-void supernormalize_byrow_buffed(MATRIXF* m,gsl_permutation * const *p,FTYPE* Pinv)
+void supernormalize_byrow_buffed(MATRIXF* m,struct supernormalize_arena * const *a,const FTYPE* Pinv)
 {
 	size_t	nth=(size_t)omp_get_max_threads();
+	enum supernormalize_ties	ties=supernormalize_ties_mode;
+	struct threading_sched	sch;
 	LOG(10,"Supernormalization started for matrix size ("PRINTFSIZET"*"PRINTFSIZET") on "PRINTFSIZET" threads.",m->size1,m->size2,nth)
-	supernormalize_Pinv(m->size2,Pinv);
 
+	threading_sched_init(&sch,m->size1,0);
 	#pragma omp parallel
 	{
 		size_t	nid=(size_t)omp_get_thread_num();
 		size_t	n1,n2;
+		double	t0=omp_get_wtime();
 		MATRIXFF(view)	mv;
 		
-		threading_get_startend(m->size1,&n1,&n2);
-		if(n2>n1)
+		while(threading_sched_next(&sch,&n1,&n2))
 		{
 			mv=MATRIXFF(submatrix)(m,n1,0,n2-n1,m->size2);
-			supernormalize_byrow_single_buffed(&mv.matrix,p[nid],Pinv);
+			supernormalize_byrow_single_buffed(&mv.matrix,a[nid],Pinv,ties);
 		}
+		threading_sched_done(&sch,t0);
 	}
+	threading_sched_log(&sch,"Supernormalization");
 
 	LOG(10,"Supernormalization completed.")
 }
 
 int supernormalize_byrow(MATRIXF* m)
 {
-#define CLEANUP	for(i=0;i<nth;i++)CLEANPERM(p[i])CLEANMEM(Pinv)
+#define CLEANUP	for(i=0;i<nth;i++){supernormalize_arena_free(a[i]);a[i]=0;}
 
 	size_t	nth=(size_t)omp_get_max_threads();
 	size_t	i;
 	int		ret;
-	FTYPE	*Pinv;
-	gsl_permutation* p[nth];
+	const FTYPE	*Pinv;
+	struct supernormalize_arena* a[nth];
 	
 	
-	MALLOCSIZE(Pinv,m->size2);
+	Pinv=supernormalize_Pinv_get(m->size2);
 	ret=!!Pinv;
 	for(i=0;i<nth;i++)
 	{
-		p[i]=gsl_permutation_alloc(m->size2);
-		ret=ret&&p[i];
+		a[i]=supernormalize_arena_alloc(m->size2);
+		ret=ret&&a[i];
 	}
 	
 	if(!ret)
 		ERRRET("Not enough memory.")
-	supernormalize_byrow_buffed(m,p,Pinv);
+	supernormalize_byrow_buffed(m,a,Pinv);
 	CLEANUP
 	return 0;
 #undef	CLEANUP
@@ -111,15 +353,15 @@ int supernormalize_byrow(MATRIXF* m)
 int supernormalizef_byrow_single(MATRIXF* m,const FTYPE* restrict Pinv,FTYPE fluc)
 {
 	int	ret;
-	ret=supernormalizea_byrow_single(m,Pinv);
+	ret=supernormalize_byrow_single(m,Pinv);
 	MATRIXFF(fluc)(m,fluc);
 	MATRIXFF(normalize_row)(m);
 	return ret;
 }
 
-void supernormalizef_byrow_buffed(MATRIXF* m,gsl_permutation * const *p,FTYPE* Pinv,FTYPE fluc)
+void supernormalizef_byrow_buffed(MATRIXF* m,struct supernormalize_arena * const *a,const FTYPE* Pinv,FTYPE fluc)
 {
-	supernormalize_byrow_buffed(m,p,Pinv);
+	supernormalize_byrow_buffed(m,a,Pinv);
 	MATRIXFF(fluc)(m,fluc);
 	MATRIXFF(normalize_row)(m);
 }
@@ -133,10 +375,158 @@ int supernormalizef_byrow(MATRIXF* m,FTYPE fluc)
 	return ret;
 }
 
-void supernormalizer_byrow_single_buffed(MATRIXF* m,gsl_permutation *p1,VECTORF* vb,const gsl_rng* r)
+void supernormalize_setinput(enum supernormalize_input input)
+{
+	supernormalize_input_mode=input;
+}
+
+int supernormalize_setinput_inplace(MATRIXF* const* m,size_t n)
+{
+	size_t	i;
+	
+	if(n>CONST_SUPERNORMALIZE_INPLACE_NMAX)
+	{
+		LOG(1,"Too many matrices for in place supernormalization: "PRINTFSIZET" (maximum "PRINTFSIZET").",n,(size_t)CONST_SUPERNORMALIZE_INPLACE_NMAX)
+		return 1;
+	}
+	for(i=0;i<n;i++)
+		supernormalize_input_inplace[i]=m[i];
+	supernormalize_input_ninplace=n;
+	return 0;
+}
+
+/* Finds the writable matrix registered with supernormalize_setinput_inplace for m.
+ * Return:	Writable pointer to m if registered and in place mode is on, 0 otherwise.
+ */
+static MATRIXF* supernormalize_input_writable(const MATRIXF* m)
+{
+	size_t	i;
+	
+	if(supernormalize_input_mode!=SUPERNORMALIZE_INPUT_INPLACE)
+		return 0;
+	for(i=0;i<supernormalize_input_ninplace;i++)
+		if(supernormalize_input_inplace[i]==m)
+			return supernormalize_input_inplace[i];
+	return 0;
+}
+
+const MATRIXF* supernormalizea_byrow_input(const MATRIXF* m,MATRIXF** buff)
+{
+	MATRIXF*	mw;
+	
+	*buff=0;
+	if(supernormalize_input_mode==SUPERNORMALIZE_INPUT_NORMALIZED)
+		return m;
+	if((mw=supernormalize_input_writable(m)))
+	{
+		if(supernormalizea_byrow(mw))
+		{
+			LOG(1,"Supernormalization failed.")
+			return 0;
+		}
+		return mw;
+	}
+	*buff=MATRIXFF(alloc_numa)(m->size1,m->size2);
+	if(!*buff)
+	{
+		LOG(1,"Not enough memory.")
+		return 0;
+	}
+	MATRIXFF(memcpy)(*buff,m);
+	if(supernormalizea_byrow(*buff))
+	{
+		LOG(1,"Supernormalization failed.")
+		CLEANMATF(*buff)
+		return 0;
+	}
+	return *buff;
+}
+
+/* Locates rows of m within m2.
+ * Return:	1 if all rows of m are rows of m2, with first row at *offset of m2. 0 otherwise.
+ */
+static char supernormalize_input_within(const MATRIXF* m,const MATRIXF* m2,size_t* offset)
+{
+	size_t	k;
+	
+	if((m->size2!=m2->size2)||(m->tda!=m2->tda)||(m->data<m2->data)||(m->data>=m2->data+m2->size1*m2->tda))
+		return 0;
+	k=(size_t)(m->data-m2->data);
+	if(k%m2->tda||(k/m2->tda+m->size1>m2->size1))
+		return 0;
+	*offset=k/m2->tda;
+	return 1;
+}
+
+/* Whether memory of m and m2 overlaps.
+ */
+static char supernormalize_input_overlap(const MATRIXF* m,const MATRIXF* m2)
+{
+	if(!(m->size1&&m->size2&&m2->size1&&m2->size2))
+		return 0;
+	return (m->data<m2->data+(m2->size1-1)*m2->tda+m2->size2)&&(m2->data<m->data+(m->size1-1)*m->tda+m->size2);
+}
+
+int supernormalizea_byrow_input2(const MATRIXF* m,const MATRIXF* m2,const MATRIXF** ans,const MATRIXF** ans2,MATRIXF** buff,MATRIXF** buff2)
+{
+	size_t	k;
+	char	within;
+	
+	*buff=*buff2=0;
+	*ans=*ans2=0;
+	within=supernormalize_input_within(m,m2,&k);
+	if((supernormalize_input_writable(m)||supernormalize_input_writable(m2))&&!within&&supernormalize_input_overlap(m,m2))
+	{
+		LOG(1,"Input matrices partially overlap and cannot be supernormalized in place.")
+		return 1;
+	}
+	if(!(*ans2=supernormalizea_byrow_input(m2,buff2)))
+		return 1;
+	if(!within)
+		return !(*ans=supernormalizea_byrow_input(m,buff));
+	if(!*buff2)
+	{
+		//Normalized together with m2
+		*ans=m;
+		return 0;
+	}
+	//View of the shared rows in the copy of m2
+	MALLOCSIZE(*buff,1);
+	if(!*buff)
+	{
+		LOG(1,"Not enough memory.")
+		return 1;
+	}
+	**buff=MATRIXFF(submatrix)(*buff2,k,0,m->size1,m->size2).matrix;
+	*ans=*buff;
+	return 0;
+}
+
+size_t supernormalize_input_mem(const MATRIXF* m)
+{
+	if((supernormalize_input_mode==SUPERNORMALIZE_INPUT_NORMALIZED)||supernormalize_input_writable(m))
+		return 0;
+	return m->size1*m->size2*sizeof(FTYPE);
+}
+
+size_t supernormalize_input_mem2(const MATRIXF* m,const MATRIXF* m2)
+{
+	size_t	k;
+	return supernormalize_input_mem(m2)+(supernormalize_input_within(m,m2,&k)?0:supernormalize_input_mem(m));
+}
+
+size_t supernormalize_byrow_mem(size_t n)
+{
+	size_t	nth=(size_t)omp_get_max_threads();
+	//Inverse CDF table, and per thread workspace and row buffer for random ties
+	return n*sizeof(FTYPE)+nth*(supernormalize_arena_size(n)+n*sizeof(FTYPE));
+}
+
+void supernormalizer_byrow_single_buffed(MATRIXF* m,struct supernormalize_arena* a,VECTORF* vb,const gsl_rng* r)
 {
 	size_t i,j;
-	VECTORFF(view) vvs;
+	const uint32_t*	id;
+	FTYPE*	x;
 	
 	for(j=0;j<m->size1;j++)
 	{
@@ -146,182 +536,71 @@ void supernormalizer_byrow_single_buffed(MATRIXF* m,gsl_permutation *p1,VECTORF*
 		CONCATENATE2(gsl_sort_vector,FTYPE_SUF)(vb);
 		
 		//Rank
-		vvs=MATRIXFF(row)(m,j);
-		CONCATENATE3(gsl_sort_vector,FTYPE_SUF,_index)(p1,&(vvs.vector));
+		x=MATRIXFF(ptr)(m,j,0);
+		id=supernormalize_argsort(a,x,0);
 		//Distribution
 		for(i=0;i<m->size2;i++)
-			MATRIXFF(set)(m,j,gsl_permutation_get(p1,i),VECTORFF(get)(vb,i));
+			x[id[i]]=VECTORFF(get)(vb,i);
+		//Normalize again for unit variance
+		supernormalize_normalize(x,m->size2);
 	}
-	//Normalize again for unit variance
-	MATRIXFF(normalize_row)(m);
 }
 
-void supernormalizer_byrow_buffed(MATRIXF* m,MATRIXF* mb,gsl_permutation * const *p,gsl_rng * const* rng)
+void supernormalizer_byrow_buffed(MATRIXF* m,MATRIXF* mb,struct supernormalize_arena * const *a,gsl_rng * const* rng)
 {
 	size_t	nth=(size_t)omp_get_max_threads();
+	struct threading_sched	sch;
 	LOG(10,"Randomized normalization started for matrix size ("PRINTFSIZET"*"PRINTFSIZET") on "PRINTFSIZET" threads.",m->size1,m->size2,nth)
 
+	threading_sched_init(&sch,m->size1,0);
 	#pragma omp parallel
 	{
 		size_t	nid=(size_t)omp_get_thread_num();
 		size_t	n1,n2;
+		double	t0=omp_get_wtime();
 		MATRIXFF(view)	mv;
-		VECTORFF(view)	vv;
+		VECTORFF(view)	vv=MATRIXFF(row)(mb,nid);
 		
-		threading_get_startend(m->size1,&n1,&n2);
-		if(n2>n1)
+		while(threading_sched_next(&sch,&n1,&n2))
 		{
 			mv=MATRIXFF(submatrix)(m,n1,0,n2-n1,m->size2);
-			vv=MATRIXFF(row)(mb,nid);
-			supernormalizer_byrow_single_buffed(&mv.matrix,p[nid],&vv.vector,rng[nid]);
+			supernormalizer_byrow_single_buffed(&mv.matrix,a[nid],&vv.vector,rng[nid]);
 		}
+		threading_sched_done(&sch,t0);
 	}
+	threading_sched_log(&sch,"Randomized normalization");
 
 	LOG(10,"Randomized normalization completed.")
 }
 
 int supernormalizer_byrow(MATRIXF* m)
 {
-#define CLEANUP	for(i=0;i<nth;i++){CLEANPERM(p[i])\
+#define CLEANUP	for(i=0;i<nth;i++){supernormalize_arena_free(a[i]);a[i]=0;\
 				if(r[i]){random_free_any(r[i]);r[i]=0;}}\
 				CLEANMATF(mb)
 
 	size_t	nth=(size_t)omp_get_max_threads();
 	size_t	i;
 	int		ret;
-	gsl_permutation* p[nth];
+	struct supernormalize_arena* a[nth];
 	MATRIXF	*mb;
 	gsl_rng	*r[nth];
 	
-	mb=MATRIXFF(alloc)(nth,m->size2);
+	mb=MATRIXFF(pool_alloc)(nth,m->size2);
 	ret=!!mb;
 	for(i=0;i<nth;i++)
 	{
-		p[i]=gsl_permutation_alloc(m->size2);
+		a[i]=supernormalize_arena_alloc(m->size2);
 		r[i]=random_new();
-		ret=ret&&p[i]&&r[i];
+		ret=ret&&a[i]&&r[i];
 	}
 	if(!ret)
 		ERRRET("Not enough memory.")
 	random_seed_any(r[0],(size_t)time(NULL));
 	for(i=1;i<nth;i++)
 		random_seed_any(r[i],gsl_rng_get(r[0])+2314653);
-	supernormalizer_byrow_buffed(m,mb,p,r);
+	supernormalizer_byrow_buffed(m,mb,a,r);
 	CLEANUP
 	return 0;
 #undef	CLEANUP
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
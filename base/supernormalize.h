@@ -23,7 +23,7 @@
 #ifndef _HEADER_LIB_SUPERNORMALIZE_H_
 #define _HEADER_LIB_SUPERNORMALIZE_H_
 #include "config.h"
-#include "gsl/permutation.h"
+#include <stdint.h>
 #include "gsl/cdf.h"
 #include "gsl/math.h"
 #include "random.h"
@@ -33,6 +33,54 @@ extern "C"
 {
 #endif
 
+/**********************************************************************
+ * Ranking
+ **********************************************************************/
+
+/* Treatment of ties in ranking.
+ * SUPERNORMALIZE_TIES_SEQUENTIAL:	Ties are ranked sequentially by their order in row (default).
+ * SUPERNORMALIZE_TIES_AVERAGE:		Ties share the average of values assigned to their ranks.
+ */
+enum supernormalize_ties
+{
+	SUPERNORMALIZE_TIES_SEQUENTIAL=0,
+	SUPERNORMALIZE_TIES_AVERAGE
+};
+
+/* Per-thread workspace for ranking rows of n elements with radix sort.
+ * n:		Row length. Must not exceed UINT32_MAX.
+ * key:		(2,n) Sort keys, as unsigned integers ordered the same way as their FTYPE values.
+ * id:		(2,n) Indices of elements for each key.
+ * count:	(sizeof(FTYPE),256) Histograms of each byte of keys.
+ */
+struct supernormalize_arena
+{
+	size_t		n;
+	FTYPE_UINT*	key[2];
+	uint32_t*	id[2];
+	uint32_t*	count;
+};
+
+/* Allocates workspace for ranking rows of n elements. The workspace is one memory block
+ * and is freed by supernormalize_arena_free.
+ * Return:	Workspace, or 0 on failure.
+ */
+struct supernormalize_arena* supernormalize_arena_alloc(size_t n);
+void supernormalize_arena_free(struct supernormalize_arena* a);
+
+/* Sorts x of length a->n in ascending order by stable LSD radix sort. Rows shorter than
+ * CONST_SUPERNORMALIZE_RADIX_NMIN use insertion sort. -0 and +0 are regarded equal.
+ * a:		Workspace
+ * x:		(a->n) Data to sort
+ * keys:	If not 0, is set to the sorted keys, which are equal only for equal data.
+ * Return:	Indices of x in ascending order. Points to workspace memory.
+ */
+const uint32_t* supernormalize_argsort(struct supernormalize_arena* a,const FTYPE* restrict x,const FTYPE_UINT** keys);
+
+/* Sets treatment of ties for all subsequent deterministic supernormalizations.
+ */
+void supernormalize_setties(enum supernormalize_ties ties);
+
 /**********************************************************************
  * Deterministic supernormalization
  **********************************************************************/
@@ -41,44 +89,54 @@ extern "C"
  * Supernormalization takes place by converting the existing data into a normal distribution
  * with 0 mean and 1 variance. Due to numerical errors, their values may be inexact. This is performed
  * by first converting data into their ranking, and assign new values according to the cummulative
- * distribution function of the respective fraction. After that, a normalization is perform to scale
- * the new data into 0 mean and 1 variance.
+ * distribution function of the respective fraction. The values are normalized beforehand
+ * in Pinv so rows need no renormalization, except when ties are averaged.
  * m:		Matrix to be supernormalized. Overwrites data.
- * p1:		Permutation objects for ranking conversion
+ * a:		Workspace for ranking
  * Pinv:	Inverse transformation from ranking to normal distribution
- * 			(precalculated CDF values of normal distribution of the respective ranking)
+ * 			(precalculated by supernormalize_Pinv)
+ * ties:	Treatment of ties
  */
-void supernormalize_byrow_single_buffed(MATRIXF* m,gsl_permutation *p1,const FTYPE* restrict Pinv);
+void supernormalize_byrow_single_buffed(MATRIXF* m,struct supernormalize_arena* a,const FTYPE* restrict Pinv,enum supernormalize_ties ties);
 
 /* Supernormalize matrix per row with single thread and buff provided.
  * See supernormalize_byrow_single_buffed for detail.
  * m:		Matrix to be supernormalized. Overwrites data.
  * Pinv:	Inverse transformation from ranking to normal distribution
- * 			(precalculated CDF values of normal distribution of the respective ranking)
+ * 			(precalculated by supernormalize_Pinv)
  * Return:	0 on success.
  */
 int supernormalize_byrow_single(MATRIXF* m,const FTYPE* restrict Pinv);
 
-/* Obtain Inverse CDF for normal distribution of n fractiles.
+/* Obtain Inverse CDF for normal distribution of n fractiles,
+ * then normalize them to 0 mean and 1 variance.
  * n:		n
- * Pinv:	Inverse CDF of normal distribution. Return[i]=CDF^(-1)((i+1)/(n+1)).
+ * Pinv:	Inverse CDF of normal distribution. Return[i]=CDF^(-1)((i+1)/(n+1)) before normalization.
  */
 static inline void supernormalize_Pinv(size_t n,FTYPE*restrict Pinv);
 
+/* Obtain Pinv of supernormalize_Pinv from process-wide cache, computing it at first request for n.
+ * Thread safe. Tables stay valid until supernormalize_Pinv_cache_clear.
+ * Return:	Pinv of length n, or 0 on failure.
+ */
+const FTYPE* supernormalize_Pinv_get(size_t n);
+/* Frees all cached Pinv tables. Not thread safe. */
+void supernormalize_Pinv_cache_clear();
+
 
 /* Supernormalizes and overwrites each row of matrix m.
  * Supernormalize into 0 mean and 1 variance, and fulfills normal distribution
  * Therefore numbers are assigned purely according to the rankings.
  * Uses multiple threads
- * Ties are ordered sequentially by GSL (potential increased correlation between rows)
+ * Ties are treated according to supernormalize_setties.
  * With or without buffer included:
  * m:	(n1,n2) Matrix to be supernormalized
- * p:	(nth) permutation buffer
- * Pinv:Buffer to calculate and place inverse CDF
+ * a:	(nth) Workspaces for ranking rows of n2 elements
+ * Pinv:(n2) Inverse CDF from supernormalize_Pinv
  * nth:	Number of threads.
  * Return:	0 if success.
  */
-void supernormalize_byrow_buffed(MATRIXF* m,gsl_permutation * const *p,FTYPE* Pinv);
+void supernormalize_byrow_buffed(MATRIXF* m,struct supernormalize_arena * const *a,const FTYPE* Pinv);
 int supernormalize_byrow(MATRIXF* m);
 
 /**********************************************************************
@@ -94,7 +152,7 @@ int supernormalize_byrow(MATRIXF* m);
  * Return:	0 if success.
  */
 int supernormalizef_byrow_single(MATRIXF* m,const FTYPE* restrict Pinv,FTYPE fluc);
-void supernormalizef_byrow_buffed(MATRIXF* m,gsl_permutation * const *p,FTYPE* Pinv,FTYPE fluc);
+void supernormalizef_byrow_buffed(MATRIXF* m,struct supernormalize_arena * const *a,const FTYPE* Pinv,FTYPE fluc);
 int supernormalizef_byrow(MATRIXF* m,FTYPE fluc);
 
 /**********************************************************************
@@ -104,15 +162,80 @@ int supernormalizef_byrow(MATRIXF* m,FTYPE fluc);
 /* Only fluctuates when m->size2<30, with fluc=2*m->size2^(-2).
  */
 static inline int supernormalizea_byrow_single(MATRIXF* m,const FTYPE* restrict Pinv);
-static inline void supernormalizea_byrow_buffed(MATRIXF* m,gsl_permutation * const *p,FTYPE* Pinv);
+static inline void supernormalizea_byrow_buffed(MATRIXF* m,struct supernormalize_arena * const *a,const FTYPE* Pinv);
 static inline int supernormalizea_byrow(MATRIXF* m);
 
+/**********************************************************************
+ * Input data of inference functions
+ **********************************************************************/
+
+/* How inference functions obtain supernormalized expression data from their input.
+ * SUPERNORMALIZE_INPUT_COPY:		Input is copied and then supernormalized with supernormalizea_byrow (default).
+ * SUPERNORMALIZE_INPUT_NORMALIZED:	Input has already been supernormalized by caller and is used directly.
+ * SUPERNORMALIZE_INPUT_INPLACE:	Inputs registered with supernormalize_setinput_inplace are supernormalized
+ * 								in place, overwriting the caller's data. Other inputs are copied as in
+ * 								SUPERNORMALIZE_INPUT_COPY.
+ */
+enum supernormalize_input
+{
+	SUPERNORMALIZE_INPUT_COPY=0,
+	SUPERNORMALIZE_INPUT_NORMALIZED,
+	SUPERNORMALIZE_INPUT_INPLACE
+};
+
+/* Sets input mode for all subsequent inference function calls. Not thread safe.
+ */
+void supernormalize_setinput(enum supernormalize_input input);
+
+/* Registers matrices that inference functions may overwrite in SUPERNORMALIZE_INPUT_INPLACE mode,
+ * replacing any previous registration. Inputs are matched by pointer, so the same MATRIXF* must be
+ * passed to inference functions. After such a call, a registered matrix holds its supernormalized
+ * data and must not be passed again as raw expression data. Not thread safe.
+ * m:		Array of writable matrices
+ * n:		Number of matrices, at most CONST_SUPERNORMALIZE_INPLACE_NMAX. 0 clears registration.
+ * Return:	0 on success.
+ */
+int supernormalize_setinput_inplace(MATRIXF* const* m,size_t n);
+
+/* Obtains supernormalized data of input matrix according to input mode.
+ * m:		Input matrix
+ * buff:	Set to newly allocated matrix that holds the supernormalized data,
+ * 			or 0 if m is used directly. Should be freed by caller.
+ * Return:	Supernormalized data, which is either m or *buff. 0 on failure.
+ */
+const MATRIXF* supernormalizea_byrow_input(const MATRIXF* m,MATRIXF** buff);
+
+/* Obtains supernormalized data of two input matrices according to input mode,
+ * like supernormalizea_byrow_input. When rows of m are also rows of m2, such as m==m2
+ * or m being the top rows of m2 with nodiag, they are supernormalized once and shared.
+ * When m or m2 is registered for in place mode, they must be either disjoint or shared as above.
+ * m,m2:	Input matrices
+ * ans,
+ * ans2:	Set to supernormalized data of m and m2.
+ * buff,
+ * buff2:	Set to newly allocated matrices or matrix views that should be freed by
+ * 			caller with MATRIXFF(free), or 0 if none.
+ * Return:	0 on success.
+ */
+int supernormalizea_byrow_input2(const MATRIXF* m,const MATRIXF* m2,const MATRIXF** ans,const MATRIXF** ans2,MATRIXF** buff,MATRIXF** buff2);
+
+/* Memory in bytes newly allocated by supernormalizea_byrow_input for m,
+ * or by supernormalizea_byrow_input2 for m and m2.
+ */
+size_t supernormalize_input_mem(const MATRIXF* m);
+size_t supernormalize_input_mem2(const MATRIXF* m,const MATRIXF* m2);
+
+/* Memory in bytes of temporary workspace for supernormalizing rows of n elements
+ * with all threads, such as in supernormalize_byrow.
+ */
+size_t supernormalize_byrow_mem(size_t n);
+
 /**********************************************************************
  * Random supernormalization
  **********************************************************************/
 
 //Check their supernormalize counterparts for definition.
-void supernormalizer_byrow_buffed(MATRIXF* m,MATRIXF* mb,gsl_permutation * const *p,gsl_rng * const* rng);
+void supernormalizer_byrow_buffed(MATRIXF* m,MATRIXF* mb,struct supernormalize_arena * const *a,gsl_rng * const* rng);
 
 int supernormalizer_byrow(MATRIXF* m);
 
@@ -124,9 +247,20 @@ int supernormalizer_byrow(MATRIXF* m);
 static inline void supernormalize_Pinv(size_t n,FTYPE* restrict Pinv)
 {
 	size_t	i;
+	double	mean,var;
 
+	mean=var=0;
 	for(i=0;i<n;i++)
+	{
 		Pinv[i]=(FTYPE)gsl_cdf_gaussian_Pinv(((FTYPE)(i+1))/(FTYPE)(n+1),1);
+		mean+=Pinv[i];
+	}
+	mean/=(double)n;
+	for(i=0;i<n;i++)
+		var+=gsl_pow_2(Pinv[i]-mean);
+	var=1/sqrt(var/(double)n);
+	for(i=0;i<n;i++)
+		Pinv[i]=(FTYPE)((Pinv[i]-mean)*var);
 }
 
 static inline int supernormalizea_byrow_single(MATRIXF* m,const FTYPE* restrict Pinv)
@@ -137,12 +271,12 @@ static inline int supernormalizea_byrow_single(MATRIXF* m,const FTYPE* restrict
 		return supernormalize_byrow_single(m,Pinv);
 }
 
-static inline void supernormalizea_byrow_buffed(MATRIXF* m,gsl_permutation * const *p,FTYPE* Pinv)
+static inline void supernormalizea_byrow_buffed(MATRIXF* m,struct supernormalize_arena * const *a,const FTYPE* Pinv)
 {
 	if(m->size2<30)
-		supernormalizef_byrow_buffed(m,p,Pinv,(FTYPE)(2./gsl_pow_2((FTYPE)m->size2)));
+		supernormalizef_byrow_buffed(m,a,Pinv,(FTYPE)(2./gsl_pow_2((FTYPE)m->size2)));
 	else
-		supernormalize_byrow_buffed(m,p,Pinv);
+		supernormalize_byrow_buffed(m,a,Pinv);
 }
 
 static inline int supernormalizea_byrow(MATRIXF* m)
@@ -157,29 +291,3 @@ static inline int supernormalizea_byrow(MATRIXF* m)
 }
 #endif
 #endif
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
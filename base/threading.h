@@ -21,6 +21,8 @@
 #include "config.h"
 #include <stdlib.h>
 #include <omp.h>
+#include "const.h"
+#include "logger.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -52,6 +54,52 @@ static inline void threading_get_startend_from(size_t ntotal,size_t *start,size_
  */
 static inline void threading_get_startend(size_t ntotal,size_t *start,size_t *end);
 
+/* Dynamic scheduler that hands out chunks of a big problem to threads on demand,
+ * and collects busy time of threads to measure load imbalance.
+ * ntotal:	Total size of the problem
+ * grain:	Size of each chunk
+ * next:	Start position of the next chunk
+ * nth:		Number of threads that have reported their busy time
+ * tmin,
+ * tmax,
+ * tsum:	Minimum, maximum and total busy time of threads in seconds
+ */
+struct threading_sched
+{
+	size_t	ntotal;
+	size_t	grain;
+	size_t	next;
+	size_t	nth;
+	double	tmin,tmax,tsum;
+};
+
+/* Initializes scheduler outside parallel region.
+ * s:		Scheduler
+ * ntotal:	Total size of the problem
+ * grain:	Size of each chunk. If 0, uses about CONST_THREADING_NCHUNK chunks per thread.
+ */
+static inline void threading_sched_init(struct threading_sched* s,size_t ntotal,size_t grain);
+
+/* Obtains the next chunk for current thread. Thread safe.
+ * s:		Scheduler
+ * start,
+ * end:		Return location of start and end positions of the chunk
+ * Return:	1 if a chunk is obtained, or 0 if the problem is exhausted.
+ */
+static inline int threading_sched_next(struct threading_sched* s,size_t *start,size_t *end);
+
+/* Reports busy time of current thread after it has exhausted the problem. Thread safe.
+ * s:		Scheduler
+ * tstart:	Starting time of current thread from omp_get_wtime
+ */
+static inline void threading_sched_done(struct threading_sched* s,double tstart);
+
+/* Logs busy time of threads for a finished parallel region.
+ * s:		Scheduler
+ * name:	Name of parallel region in log
+ */
+static inline void threading_sched_log(const struct threading_sched* s,const char* name);
+
 
 static inline size_t threading_get_start_bare(size_t ntotal,size_t nthread,size_t x)
 {
@@ -79,6 +127,54 @@ static inline void threading_get_startend(size_t ntotal,size_t *start,size_t *en
 	threading_get_startend_from(ntotal,start,end,id,ida);
 }
 
+static inline void threading_sched_init(struct threading_sched* s,size_t ntotal,size_t grain)
+{
+	size_t	nth=(size_t)omp_get_max_threads();
+	s->ntotal=ntotal;
+	s->grain=grain?grain:ntotal/(nth*CONST_THREADING_NCHUNK);
+	if(!s->grain)
+		s->grain=1;
+	s->next=0;
+	s->nth=0;
+	s->tmin=s->tmax=s->tsum=0;
+}
+
+static inline int threading_sched_next(struct threading_sched* s,size_t *start,size_t *end)
+{
+	size_t	i;
+	
+	#pragma omp atomic capture
+	{i=s->next;s->next+=s->grain;}
+	if(i>=s->ntotal)
+		return 0;
+	*start=i;
+	*end=(s->ntotal-i>s->grain)?i+s->grain:s->ntotal;
+	return 1;
+}
+
+static inline void threading_sched_done(struct threading_sched* s,double tstart)
+{
+	double	t=omp_get_wtime()-tstart;
+	
+	#pragma omp critical(threading_sched)
+	{
+		if((!s->nth)||(t<s->tmin))
+			s->tmin=t;
+		if((!s->nth)||(t>s->tmax))
+			s->tmax=t;
+		s->tsum+=t;
+		s->nth++;
+	}
+}
+
+static inline void threading_sched_log(const struct threading_sched* s,const char* name)
+{
+	if(!s->nth)
+		return;
+	LOG(10,"%s: "PRINTFSIZET" threads with chunks of "PRINTFSIZET" in "PRINTFSIZET" took %.3g to %.3g seconds, on average %.3g seconds.",
+		name,s->nth,s->grain,s->ntotal,s->tmin,s->tmax,s->tsum/(double)s->nth)
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,7 @@
 #define _HEADER_LIB_TYPES_H_
 #include "config.h"
 #include <float.h>
+#include <stdint.h>
 #include "gsl/vector.h"
 #include "gsl/matrix.h"
 #include "gsl/blas.h"
@@ -36,12 +37,18 @@
 	// Minimal value
 	#define FTYPE_MIN	FLT_MIN
 	#define FTYPE_MAX	FLT_MAX
+	// Machine epsilon
+	#define FTYPE_EPSILON	FLT_EPSILON
+	// Unsigned integer type of the same size
+	#define FTYPE_UINT	uint32_t
 #elif FTYPEBITS == 64
 	#define FTYPE	double
 	#define	FTYPE_SUF	
 	#define BLASF(X)	BLASFD(X)
 	#define FTYPE_MIN	DBL_MIN
 	#define FTYPE_MAX	DBL_MAX
+	#define FTYPE_EPSILON	DBL_EPSILON
+	#define FTYPE_UINT	uint64_t
 #else
 	#error Unknown float type bit count.
 #endif
@@ -51,6 +58,21 @@
 #else
 	#error Unknown genotype type bit count.
 #endif
+//Default for config_auto.h generated before ITYPEBITS existed
+#ifndef ITYPEBITS
+	#define ITYPEBITS	32
+#endif
+#if ITYPEBITS == 32
+	// Index type for vertices, arcs and order slots in graph, heap and linked list structures
+	#define	ITYPE		uint32_t
+	// Maximal value
+	#define	ITYPE_MAX	UINT32_MAX
+#elif ITYPEBITS == 64
+	#define	ITYPE		uint64_t
+	#define	ITYPE_MAX	UINT64_MAX
+#else
+	#error Unknown index type bit count.
+#endif
 #define BLASFO(X)	gsl_blas_s ## X
 #define BLASFD(X)	gsl_blas_d ## X
 
@@ -20,12 +20,75 @@
 #include <string.h>
 #include "../base/general_alg.h"
 #include "../base/macros.h"
+#include "../base/const.h"
+#include "../base/gsl/math.h"
 #include "vg.h"
 
+/* Initialize arcs of all vertices with empty arrays.
+ * a:		Arcs
+ * dim:		Number of vertices.
+ * Return:	0 on success.
+ */
+static int cycle_vg_arcs_init(struct cycle_vg_arcs* restrict a,size_t dim)
+{
+	a->d=0;
+	a->n=a->nmax=0;
+	MALLOCSIZE(a->p,dim);
+	a->c=calloc(dim,sizeof(*a->c));
+	return !(a->p&&a->c);
+}
+
+static void cycle_vg_arcs_free(struct cycle_vg_arcs* restrict a)
+{
+	CLEANMEM(a->d)
+	CLEANMEM(a->p)
+	CLEANMEM(a->c)
+	a->n=a->nmax=0;
+}
+
+static void cycle_vg_arcs_empty(struct cycle_vg_arcs* restrict a,size_t dim)
+{
+	a->n=0;
+	memset(a->c,0,dim*sizeof(*a->c));
+}
+
+int cycle_vg_arcs_grow(struct cycle_vg_arcs* restrict a,size_t v)
+{
+	size_t	c=a->c[v]?2*a->c[v]:CONST_CYCLE_ARC_NMIN;
+	
+	if(a->n+c>a->nmax)
+	{
+		ITYPE*	t;
+		size_t	nmax=GSL_MAX(2*a->nmax,a->n+c);
+		t=realloc(a->d,nmax*sizeof(*t));
+		if(!t)
+		{
+			LOG(1,"Not enough memory.")
+			return 1;
+		}
+		a->d=t;
+		a->nmax=nmax;
+	}
+	//First growth has nothing to move, and p[v] is not yet set
+	if(a->c[v])
+		memcpy(a->d+a->n,a->d+a->p[v],a->c[v]*sizeof(*a->d));
+	a->p[v]=a->n;
+	a->c[v]=c;
+	a->n+=c;
+	return 0;
+}
+
 int cycle_vg_init(struct cycle_vg_system* restrict vg,size_t dim,size_t amax)
 {
 	int	ret;
 	assert(vg);
+	//So cycle_vg_free is safe on failure
+	memset(vg,0,sizeof(*vg));
+	if(dim>ITYPE_MAX)
+	{
+		LOG(1,"Too many vertices for cycle detection.")
+		return 1;
+	}
 	ret=0;
 	vg->n=dim;
 	vg->nam=amax;
@@ -33,11 +96,12 @@ int cycle_vg_init(struct cycle_vg_system* restrict vg,size_t dim,size_t amax)
 
 	MALLOCSIZE(vg->lvf,dim);
 	MALLOCSIZE(vg->lvb,dim);
+	MALLOCSIZE(vg->lvfv,dim);
+	MALLOCSIZE(vg->lvbv,dim);
 	MALLOCSIZE(vg->go,dim);
 	MALLOCSIZE(vg->goi,dim);
-	ret=ret||data_ll_init(&vg->gao,amax)||data_ll_init(&vg->gai,amax);
-	MALLOCSIZE(vg->gaof,dim);
-	MALLOCSIZE(vg->gaif,dim);
+	ret=cycle_vg_arcs_init(&vg->gao,dim);
+	ret=cycle_vg_arcs_init(&vg->gai,dim)||ret;
 	MALLOCSIZE(vg->gni,dim);
 	MALLOCSIZE(vg->gno,dim);
 	MALLOCSIZE(vg->lao,dim);
@@ -45,7 +109,7 @@ int cycle_vg_init(struct cycle_vg_system* restrict vg,size_t dim,size_t amax)
 	MALLOCSIZE(vg->buff,dim);
 	MALLOCSIZE(vg->buff2,dim);
 	ret=ret||data_heap_init(&vg->lvfl,dim)||data_heapdec_init(&vg->lvbl,dim);
-	if(ret||!(vg->lvf&&vg->lvb&&vg->go&&vg->goi&&vg->gaof&&vg->gaif&&vg->gni&&vg->gno&&vg->lao&&vg->lai&&vg->buff&&vg->buff2))
+	if(ret||!(vg->lvf&&vg->lvb&&vg->lvfv&&vg->lvbv&&vg->go&&vg->goi&&vg->gni&&vg->gno&&vg->lao&&vg->lai&&vg->buff&&vg->buff2))
 	{
 		cycle_vg_free(vg);
 		LOG(1,"Not enough memory.")
@@ -82,18 +146,18 @@ int cycle_vg_free(struct cycle_vg_system* restrict vg)
 #define FREEMEM(X)	if(X){free(X);X=0;}
 	FREEMEM(vg->lvf)
 	FREEMEM(vg->lvb)
+	FREEMEM(vg->lvfv)
+	FREEMEM(vg->lvbv)
 	FREEMEM(vg->go)
 	FREEMEM(vg->goi)
-	FREEMEM(vg->gaof)
-	FREEMEM(vg->gaif)
 	FREEMEM(vg->gni)
 	FREEMEM(vg->gno)
 	FREEMEM(vg->lao)
 	FREEMEM(vg->lai)
 	FREEMEM(vg->buff)
 	FREEMEM(vg->buff2)
-	data_ll_free(&vg->gao);
-	data_ll_free(&vg->gai);
+	cycle_vg_arcs_free(&vg->gao);
+	cycle_vg_arcs_free(&vg->gai);
 	data_heap_free(&vg->lvbl);
 	data_heapdec_free(&vg->lvfl);
 	return 0;
@@ -104,16 +168,17 @@ int cycle_vg_empty(struct cycle_vg_system* restrict vg)
 {
 	size_t i;
 	vg->na=0;
-	memset(vg->gaof,-1,vg->n*sizeof(*vg->gaof));
-	memset(vg->gaif,-1,vg->n*sizeof(*vg->gaif));
 	memset(vg->gni,0,vg->n*sizeof(*vg->gni));
 	memset(vg->gno,0,vg->n*sizeof(*vg->gno));
-	data_ll_empty(&vg->gao);
-	data_ll_empty(&vg->gai);
+	cycle_vg_arcs_empty(&vg->gao,vg->n);
+	cycle_vg_arcs_empty(&vg->gai,vg->n);
+	memset(vg->lvf,0,vg->n*sizeof(*vg->lvf));
+	memset(vg->lvb,0,vg->n*sizeof(*vg->lvb));
+	vg->nlvfv=vg->nlvbv=0;
 	for(i=0;i<vg->n;i++)
 	{
-		vg->go[i]=i;
-		vg->goi[i]=i;
+		vg->go[i]=(ITYPE)i;
+		vg->goi[i]=(ITYPE)i;
 	}
 	return 0;
 }
@@ -122,8 +187,8 @@ void cycle_vg_restore_order(struct cycle_vg_system* restrict vg,size_t vv)
 {
 	size_t	t;
 	char	cond;
-	size_t*	p[2];
-	size_t* ps;
+	ITYPE*	p[2];
+	ITYPE*	ps;
 	
 	t=vg->go[vv];
 	cond=!!vg->lvfl.n;
@@ -169,35 +234,59 @@ void cycle_vg_restore_order(struct cycle_vg_system* restrict vg,size_t vv)
 	return;
 }
 
-int cycle_vg_add(struct cycle_vg_system* restrict vg,size_t v1,size_t v2)
+/* Marks vertex as visited forward/backward, and records it for cycle_vg_clear_visits.
+ * vg:		Cycle detection system.
+ * v:		Vertex
+ */
+static inline void cycle_vg_visit_f(struct cycle_vg_system* restrict vg,size_t v)
 {
-	
-	//Validity check
-	assert(v1!=v2);
-	if(vg->na>=vg->nam)
-		return 1;
-	if(vg->go[v1]<vg->go[v2])
-		return cycle_vg_add_arc(vg,v1,v2);
+	vg->lvf[v]=1;
+	vg->lvfv[vg->nlvfv++]=(ITYPE)v;
+}
+
+static inline void cycle_vg_visit_b(struct cycle_vg_system* restrict vg,size_t v)
+{
+	vg->lvb[v]=1;
+	vg->lvbv[vg->nlvbv++]=(ITYPE)v;
+}
+
+/* Clears visitedness of vertices marked in current search.
+ * vg:		Cycle detection system.
+ */
+static inline void cycle_vg_clear_visits(struct cycle_vg_system* restrict vg)
+{
+	size_t	i;
+	for(i=0;i<vg->nlvfv;i++)
+		vg->lvf[vg->lvfv[i]]=0;
+	for(i=0;i<vg->nlvbv;i++)
+		vg->lvb[vg->lvbv[i]]=0;
+	vg->nlvfv=vg->nlvbv=0;
+}
 
+/* Searches for loop that would be formed by adding arc v1->v2, where v1 is after v2 in current order.
+ * Marks visited vertices in lvf and lvb, which restore_order needs, and should be cleared afterwards.
+ * vg:		Cycle detection system.
+ * v1:		Source of arc
+ * v2:		Destination of arc
+ * Return:	1 if loop is found, or 0 if not.
+ */
+static int cycle_vg_search(struct cycle_vg_system* restrict vg,size_t v1,size_t v2)
+{
 	//Initialize
 	data_heap_empty(&vg->lvfl);
 	data_heapdec_empty(&vg->lvbl);
-	memset(vg->lvf,0,vg->n*sizeof(*vg->lvf));  
-	memset(vg->lvb,0,vg->n*sizeof(*vg->lvb));
-	memset(vg->lao,-1,vg->n*sizeof(*vg->lao));
-	memset(vg->lai,-1,vg->n*sizeof(*vg->lai));
 	
 	//Test loop
 	//Enter function, line 1
-	vg->lvf[v2]=1;
-	vg->lvb[v1]=1;
-	vg->lao[v2]=vg->gaof[v2];
-	vg->lai[v1]=vg->gaif[v1];
+	cycle_vg_visit_f(vg,v2);
+	cycle_vg_visit_b(vg,v1);
+	vg->lao[v2]=vg->gno[v2];
+	vg->lai[v1]=vg->gni[v1];
 	//line 2
-	if(vg->gaof[v2]!=(size_t)-1)
+	if(vg->gno[v2])
 		data_heap_push(&vg->lvfl,vg->go[v2]);
 	//line 3
-	if(vg->gaif[v1]!=(size_t)-1)
+	if(vg->gni[v1])
 		data_heapdec_push(&vg->lvbl,vg->go[v1]);
 	//line 4&5 (while)
 	while((vg->lvfl.n>0)&&(vg->lvbl.n>0))
@@ -210,16 +299,13 @@ int cycle_vg_add(struct cycle_vg_system* restrict vg,size_t v1,size_t v2)
 			break;
 		vu=vg->goi[vu];
 		vz=vg->goi[vz];
-		//Enter macro, line 1
-		vx=data_ll_val(&vg->gao,vg->lao[vu]);
-		vy=data_ll_val(&vg->gai,vg->lai[vz]);
-		//line 2
-		vg->lao[vu]=data_ll_child(&vg->gao,vg->lao[vu]);
-		vg->lai[vz]=data_ll_child(&vg->gai,vg->lai[vz]);
+		//Enter macro, line 1&2
+		vx=cycle_vg_arcs_get(&vg->gao,vu)[--vg->lao[vu]];
+		vy=cycle_vg_arcs_get(&vg->gai,vz)[--vg->lai[vz]];
 		//line 3
-		if(vg->lao[vu]==(size_t)-1)
+		if(!vg->lao[vu])
 			data_heap_pop(&vg->lvfl);
-		if(vg->lai[vz]==(size_t)-1)
+		if(!vg->lai[vz])
 			data_heapdec_pop(&vg->lvbl);
 		//line 4, first half
 		if(vg->lvb[vx])
@@ -228,10 +314,10 @@ int cycle_vg_add(struct cycle_vg_system* restrict vg,size_t v1,size_t v2)
 		if(!vg->lvf[vx])
 		{
 			//line 6,7
-			vg->lvf[vx]=1;
-			if(vg->gaof[vx]!=(size_t)-1)
+			cycle_vg_visit_f(vg,vx);
+			if(vg->gno[vx])
 			{
-				vg->lao[vx]=vg->gaof[vx];
+				vg->lao[vx]=vg->gno[vx];
 				data_heap_push(&vg->lvfl,vg->go[vx]);
 			}
 		}
@@ -242,38 +328,46 @@ int cycle_vg_add(struct cycle_vg_system* restrict vg,size_t v1,size_t v2)
 		if(!vg->lvb[vy])
 		{
 			//line 10,11
-			vg->lvb[vy]=1;
-			if(vg->gaif[vy]!=(size_t)-1)
+			cycle_vg_visit_b(vg,vy);
+			if(vg->gni[vy])
 			{
-				vg->lai[vy]=vg->gaif[vy];
+				vg->lai[vy]=vg->gni[vy];
 				data_heapdec_push(&vg->lvbl,vg->go[vy]);
 			}
 		}
 	}
+	return 0;
+}
+
+int cycle_vg_add(struct cycle_vg_system* restrict vg,size_t v1,size_t v2)
+{
+	int	ret;
 	
-	//Add arc
-	if(cycle_vg_add_arc(vg,v1,v2))
+	//Validity check
+	assert(v1!=v2);
+	if(vg->na>=vg->nam)
 		return 1;
-	
+	if(vg->go[v1]<vg->go[v2])
+		return cycle_vg_add_arc(vg,v1,v2);
+
+	ret=cycle_vg_search(vg,v1,v2)||cycle_vg_add_arc(vg,v1,v2);
 	//Recover ordering
-	cycle_vg_restore_order(vg,v1);
-	return 0;
+	if(!ret)
+		cycle_vg_restore_order(vg,v1);
+	cycle_vg_clear_visits(vg);
+	return ret;
 }
 
 void cycle_vg_extract_graph(const struct cycle_vg_system* restrict vg,MATRIXUC* g)
 {
-	size_t	i;
-	size_t	t1;
+	size_t	i,j;
 	
 	assert((vg->n==g->size1)&&(vg->n==g->size2));
 	MATRIXUCF(set_zero)(g);
 	for(i=0;i<vg->n;i++)
 	{
-		t1=vg->gaof[i];
-		while(t1!=(size_t)-1)
-		{
-			MATRIXUCF(set)(g,i,data_ll_val(&vg->gao,t1),1);
-			t1=data_ll_child(&vg->gao,t1);
-		}
+		const ITYPE*	a=cycle_vg_arcs_get(&vg->gao,i);
+		for(j=0;j<vg->gno[i];j++)
+			MATRIXUCF(set)(g,i,a[j],1);
 	}
 }
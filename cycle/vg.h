@@ -31,6 +31,22 @@ extern "C"
 {
 #endif
 
+/* Arcs of all vertices in one direction, as contiguous arrays of each vertex in a shared pool.
+ * An array is moved to the end of pool with doubled capacity when full,
+ * so appending is amortized constant time.
+ * Arcs of vertex i are d[p[i]] to d[p[i]+k-1] in insertion order, with k kept by the owner.
+ */
+struct cycle_vg_arcs
+{
+	//Pool of arrays, its used and allocated size
+	ITYPE* restrict	d;
+	size_t	n;
+	size_t	nmax;
+	//Start of array of each vertex in pool
+	size_t* restrict	p;
+	//Capacity of array of each vertex
+	size_t* restrict	c;
+};
 
 struct cycle_vg_system
 {
@@ -49,48 +65,53 @@ struct cycle_vg_system
 	//Graph construction variables:
 	//Current number of arcs
 	size_t	na;
-	//Order of vertices
-	size_t* restrict go;
+	//Order of vertices. Vertex ids and order slots are ITYPE to halve cache footprint.
+	ITYPE* restrict go;
 	//Inverse of go
-	size_t* restrict goi;
-	/* Graph representation for arcs out with linked list.
-	 * Each value j in linked list i corresponds to arc (i,j).
-	 * First item of each linked list i is specified in gaof.
+	ITYPE* restrict goi;
+	/* Graph representation for arcs out with arc arrays.
+	 * Each value j in array i corresponds to arc (i,j).
 	 */
-	struct data_ll	gao;
-	//First item of each linked list i of gao, or -1 of not exist.
-	size_t* restrict	gaof;
+	struct cycle_vg_arcs	gao;
 	//Below for arcs in
-	struct data_ll	gai;
-	size_t* restrict	gaif;
-	//Number of incoming arcs for each vertex
-	size_t* restrict gni;
-	//Number of outgoing arcs for each vertex
-	size_t* restrict gno;
+	struct cycle_vg_arcs	gai;
+	//Number of incoming arcs for each vertex, i.e. size of its array in gai
+	ITYPE* restrict gni;
+	//Number of outgoing arcs for each vertex, i.e. size of its array in gao
+	ITYPE* restrict gno;
 	
 	
 	
 	//Loop detection temporary variables:
-	//Vertices visitedness forward/backward, i.e. membership of F,B
+	/* Vertices visitedness forward/backward, i.e. membership of F,B.
+	 * All zero outside cycle_vg_add. Only vertices marked by a search are cleared after it,
+	 * so each search costs what it explores instead of the number of vertices.
+	 */
 	unsigned char* restrict	lvf;
 	unsigned char* restrict	lvb;
+	//Vertices marked in lvf/lvb by current search, and their counts
+	ITYPE* restrict	lvfv;
+	ITYPE* restrict	lvbv;
+	size_t	nlvfv;
+	size_t	nlvbv;
 	//Vertices to be visited forward/backward, i.e. membership of FL,BL
 	struct data_heap	lvfl;
 	struct data_heapdec	lvbl;
-	/* Current arc id of those from/to a specific vertex.
-	 * (i,lao[i]) is the current out arc from i during the search, indexed by gao.
-	 * (lai[i],i) is the current in arc to i during the search, index by gai.
+	/* Number of arcs from/to a specific vertex yet to visit during the search.
+	 * Arcs are visited from the latest added, so the next out arc from i is
+	 * the (lao[i]-1)-th in its array of gao, and likewise for lai and gai.
+	 * Only valid for vertices in FL/BL, as they are set when vertices are pushed.
 	 */
-	size_t* restrict	lao;
-	size_t* restrict	lai;
+	ITYPE* restrict	lao;
+	ITYPE* restrict	lai;
 	//Buffer for calculation during loop detection and order maintenance.
- 	size_t*	buff;
- 	size_t*	buff2;
+ 	ITYPE*	buff;
+ 	ITYPE*	buff2;
 };
 
 /* Initialize cycle detection system with vertex count and max number of arc count
  * vg:		Cycle detection system.
- * dim:		Number of vertices.
+ * dim:		Number of vertices. Must not exceed ITYPE_MAX.
  * amax:	Max number of arcs.
  * Return:	0 on success.
  */
@@ -110,11 +131,21 @@ int cycle_vg_empty(struct cycle_vg_system* restrict vg);
  */
 static inline size_t cycle_vg_dim(const struct cycle_vg_system* restrict vg);
 
+/* Moves array of vertex to the end of pool with doubled capacity.
+ * a:		Arcs
+ * v:		Vertex
+ * Return:	0 on success.
+ */
+int cycle_vg_arcs_grow(struct cycle_vg_arcs* restrict a,size_t v);
+
+// Arc array of vertex
+static inline const ITYPE* cycle_vg_arcs_get(const struct cycle_vg_arcs* restrict a,size_t v);
+
 /* Add arc v1->v2 to current graph in vg without loop checks.
  * vg:		Cycle detection system.
  * v1:		Source of arc
  * v2:		Destination of arc
- * Return:	1 if arc full, or otherwise 0 for success.
+ * Return:	1 if arc full or out of memory, or otherwise 0 for success.
  */
 static inline int cycle_vg_add_arc(struct cycle_vg_system* restrict vg,size_t v1,size_t v2);
 
@@ -151,21 +182,21 @@ static inline size_t cycle_vg_dim(const struct cycle_vg_system* restrict vg)
 	return vg->n;
 }
 
+static inline const ITYPE* cycle_vg_arcs_get(const struct cycle_vg_arcs* restrict a,size_t v)
+{
+	return a->d+a->p[v];
+}
+
 static inline int cycle_vg_add_arc(struct cycle_vg_system* restrict vg,size_t v1,size_t v2)
 {
-	size_t	ret;
-	
 	if((vg->gno[v1]>=vg->nom)||(vg->gni[v2]>=vg->nim))
 		return 1;
-	ret=data_ll_insert_before(&vg->gao,vg->gaof[v1],v2);
-	if(ret==(size_t)-1)
+	if(((vg->gno[v1]==vg->gao.c[v1])&&cycle_vg_arcs_grow(&vg->gao,v1))
+		||((vg->gni[v2]==vg->gai.c[v2])&&cycle_vg_arcs_grow(&vg->gai,v2)))
 		return 1;
-	vg->gaof[v1]=ret;
-	ret=data_ll_insert_before(&vg->gai,vg->gaif[v2],v1);
-	vg->gaif[v2]=ret;
+	vg->gao.d[vg->gao.p[v1]+(vg->gno[v1]++)]=(ITYPE)v2;
+	vg->gai.d[vg->gai.p[v2]+(vg->gni[v2]++)]=(ITYPE)v1;
 	vg->na++;
-	vg->gno[v1]++;
-	vg->gni[v2]++;
 	return 0;
 }
 
@@ -173,14 +204,14 @@ static inline void cycle_vg_fix_go(struct cycle_vg_system* restrict vg)
 {
 	size_t 	i;
 	for(i=0;i<vg->n;i++)
-		vg->go[vg->goi[i]]=i;
+		vg->go[vg->goi[i]]=(ITYPE)i;
 }
 
 static inline void cycle_vg_fix_goi(struct cycle_vg_system* restrict vg)
 {
 	size_t 	i;
 	for(i=0;i<vg->n;i++)
-		vg->goi[vg->go[i]]=i;
+		vg->goi[vg->go[i]]=(ITYPE)i;
 }
 
 
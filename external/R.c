@@ -26,6 +26,7 @@
 #include "../base/random.h"
 #include "../base/macros.h"
 #include "../base/lib.h"
+#include "../base/numa.h"
 #include "../pij/gassist/gassist.h"
 #include "../pij/cassist/cassist.h"
 #include "../pij/rank.h"
@@ -36,6 +37,21 @@ void external_R_lib_init(const int *loglv,const int *rs0,const int *nthread)
 	lib_init((unsigned char)(*loglv),(unsigned long)(*rs0),(size_t)(*nthread));
 }
 
+void external_R_lib_init_numa(const int *loglv,const int *rs0,const int *nthread,const int *numa)
+{
+	lib_init_numa((unsigned char)(*loglv),(unsigned long)(*rs0),(size_t)(*nthread),(unsigned char)(*numa));
+}
+
+void external_R_numa_bench(const double *nbyte,const int *nrep,int *ret)
+{
+	*ret=numa_bench((size_t)(*nbyte),(size_t)(*nrep));
+}
+
+void external_R_lib_free()
+{
+	lib_free();
+}
+
 void external_R_lib_name(const char** ans)
 {
 	*ans=lib_name();
@@ -64,13 +80,13 @@ void external_R_pijs_gassist_pv(const int *ng,const int *nt,const int *ns,const
 	
 	//Construct GTYPE matrix for g
 	mg=MATRIXGF(alloc)(ngv,nsv);
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
+	mt=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt2=MATRIXFF(alloc_numa)(ntv,nsv);
 	vp1=VECTORFF(alloc)(ngv);
-	mp2=MATRIXFF(alloc)(ngv,ntv);
-	mp3=MATRIXFF(alloc)(ngv,ntv);
-	mp4=MATRIXFF(alloc)(ngv,ntv);
-	mp5=MATRIXFF(alloc)(ngv,ntv);
+	mp2=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp3=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp4=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp5=MATRIXFF(alloc_numa)(ngv,ntv);
 	if(!(mg&&mt&&mt2&&vp1&&mp2&&mp3&&mp4&&mp5))
 	{
 		LOG(1,"Not enough memory.")
@@ -129,13 +145,13 @@ void external_R_pijs_gassist_any(const int *ng,const int *nt,const int *ns,const
 	
 	//Construct GTYPE matrix for g
 	mg=MATRIXGF(alloc)(ngv,nsv);
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
+	mt=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt2=MATRIXFF(alloc_numa)(ntv,nsv);
 	vp1=VECTORFF(alloc)(ngv);
-	mp2=MATRIXFF(alloc)(ngv,ntv);
-	mp3=MATRIXFF(alloc)(ngv,ntv);
-	mp4=MATRIXFF(alloc)(ngv,ntv);
-	mp5=MATRIXFF(alloc)(ngv,ntv);
+	mp2=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp3=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp4=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp5=MATRIXFF(alloc_numa)(ngv,ntv);
 	if(!(mg&&mt&&mt2&&vp1&&mp2&&mp3&&mp4&&mp5))
 	{
 		LOG(1,"Not enough memory.")
@@ -197,9 +213,9 @@ void external_R_pij_gassist_any(const int *ng,const int *nt,const int *ns,const
 	
 	//Construct GTYPE matrix for g
 	mg=MATRIXGF(alloc)(ngv,nsv);
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
-	mp=MATRIXFF(alloc)(ngv,ntv);
+	mt=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt2=MATRIXFF(alloc_numa)(ntv,nsv);
+	mp=MATRIXFF(alloc_numa)(ngv,ntv);
 	if(!(mg&&mt&&mt2&&mp))
 	{
 		LOG(1,"Not enough memory.")
@@ -259,14 +275,14 @@ void external_R_pijs_cassist_pv(const int *ng,const int *nt,const int *ns,const
 	
 	LOG(12,"R interface for external_R_pijs_cassist_pv: nt=%i, nt2=%i, ns=%i",*ng,*nt,*ns)
 	
-	mg=MATRIXFF(alloc)(ngv,nsv);
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
+	mg=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt2=MATRIXFF(alloc_numa)(ntv,nsv);
 	vp1=VECTORFF(alloc)(ngv);
-	mp2=MATRIXFF(alloc)(ngv,ntv);
-	mp3=MATRIXFF(alloc)(ngv,ntv);
-	mp4=MATRIXFF(alloc)(ngv,ntv);
-	mp5=MATRIXFF(alloc)(ngv,ntv);
+	mp2=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp3=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp4=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp5=MATRIXFF(alloc_numa)(ngv,ntv);
 	if(!(mg&&mt&&mt2&&vp1&&mp2&&mp3&&mp4&&mp5))
 	{
 		LOG(1,"Not enough memory.")
@@ -322,14 +338,14 @@ void external_R_pijs_cassist_any(const int *ng,const int *nt,const int *ns,const
 	MATRIXF	*mt,*mt2,*mp2,*mp3,*mp4,*mp5;
 	VECTORF	*vp1;
 	
-	mg=MATRIXFF(alloc)(ngv,nsv);
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
+	mg=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt2=MATRIXFF(alloc_numa)(ntv,nsv);
 	vp1=VECTORFF(alloc)(ngv);
-	mp2=MATRIXFF(alloc)(ngv,ntv);
-	mp3=MATRIXFF(alloc)(ngv,ntv);
-	mp4=MATRIXFF(alloc)(ngv,ntv);
-	mp5=MATRIXFF(alloc)(ngv,ntv);
+	mp2=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp3=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp4=MATRIXFF(alloc_numa)(ngv,ntv);
+	mp5=MATRIXFF(alloc_numa)(ngv,ntv);
 	if(!(mg&&mt&&mt2&&vp1&&mp2&&mp3&&mp4&&mp5))
 	{
 		LOG(1,"Not enough memory.")
@@ -388,10 +404,10 @@ void external_R_pij_cassist_any(const int *ng,const int *nt,const int *ns,const
 	MATRIXF *mg;
 	MATRIXF	*mt,*mt2,*mp;
 	
-	mg=MATRIXFF(alloc)(ngv,nsv);
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
-	mp=MATRIXFF(alloc)(ngv,ntv);
+	mg=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt=MATRIXFF(alloc_numa)(ngv,nsv);
+	mt2=MATRIXFF(alloc_numa)(ntv,nsv);
+	mp=MATRIXFF(alloc_numa)(ngv,ntv);
 	if(!(mg&&mt&&mt2&&mp))
 	{
 		LOG(1,"Not enough memory.")
@@ -436,51 +452,24 @@ void external_R_pij_cassist_trad(const int *ng,const int *nt,const int *ns,const
 	external_R_pij_cassist_any(ng,nt,ns,g,t,t2,p,nodiag,ret,pij_cassist_trad);
 }
 
-void external_R_pij_rank_pv(const int *ng,const int *nt,const int *ns,const double* t,const double* t2,double* p,int *ret)
+/* Whether t is the top rows of t2, both in R column major.
+ */
+static char external_R_pij_rank_istop(size_t ngv,size_t ntv,size_t nsv,const double* t,const double* t2)
 {
-#define	CLEANUP	CLEANMATF(mt)CLEANMATF(mt2)CLEANMATF(mp)
-	LOG(12,"R interface for external_R_pij_rank_pv: nt=%i, nt2=%i, ns=%i",*ng,*nt,*ns)
 	size_t	i,j;
-	size_t	ngv,ntv,nsv;
-	ngv=(size_t)*ng;
-	ntv=(size_t)*nt;
-	nsv=(size_t)*ns;
-	MATRIXF	*mt,*mt2,*mp;
 	
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
-	mp=MATRIXFF(alloc)(ngv,ntv);
-	if(!(mt&&mt2&&mp))
-	{
-		LOG(1,"Not enough memory.")
-		CLEANUP
-		*ret=1;
-		return;
-	}
-
-	//Copy data, R uses column major
-	for(i=0;i<ngv;i++)
-		for(j=0;j<nsv;j++)
-			MATRIXFF(set)(mt,i,j,(FTYPE)(t[j*ngv+i]));
-	for(i=0;i<ntv;i++)
-		for(j=0;j<nsv;j++)
-			MATRIXFF(set)(mt2,i,j,(FTYPE)(t2[j*ntv+i]));
-	
-	//Calculation
-	*ret=pij_rank_pv(mt,mt2,mp,(size_t)-1);
-	//Copy data back
-	if(!*ret)
+	if(ngv>ntv)
+		return 0;
+	for(j=0;j<nsv;j++)
 		for(i=0;i<ngv;i++)
-			for(j=0;j<ntv;j++)
-				p[j*ngv+i]=(double)MATRIXFF(get)(mp,i,j);
-	CLEANUP
-#undef CLEANUP
+			if(t[j*ngv+i]!=t2[j*ntv+i])
+				return 0;
+	return 1;
 }
 
-void external_R_pij_rank(const int *ng,const int *nt,const int *ns,const double* t,const double* t2,double* p,const int* nodiag,int *ret)
+void external_R_pij_rank_any(const int *ng,const int *nt,const int *ns,const double* t,const double* t2,double* p,const int* nodiag,int *ret,int (*func)(const MATRIXF*,const MATRIXF*,MATRIXF*,char,size_t))
 {
 #define	CLEANUP	CLEANMATF(mt)CLEANMATF(mt2)CLEANMATF(mp)
-	LOG(12,"R interface for external_R_pij_rank: nt=%i, nt2=%i, ns=%i, nodiag=%i",*ng,*nt,*ns,*nodiag)
 	size_t	i,j;
 	char	nd=(char)(*nodiag);
 	size_t	ngv,ntv,nsv;
@@ -488,11 +477,15 @@ void external_R_pij_rank(const int *ng,const int *nt,const int *ns,const double*
 	ntv=(size_t)*nt;
 	nsv=(size_t)*ns;
 	MATRIXF	*mt,*mt2,*mp;
+	MATRIXFF(view)	mvt;
+	char	istop;
 	
-	mt=MATRIXFF(alloc)(ngv,nsv);
-	mt2=MATRIXFF(alloc)(ntv,nsv);
-	mp=MATRIXFF(alloc)(ngv,ntv);
-	if(!(mt&&mt2&&mp))
+	//When t is the top rows of t2, e.g. t==t2, share its copy so symmetry and shared supernormalization apply
+	istop=external_R_pij_rank_istop(ngv,ntv,nsv,t,t2);
+	mt=istop?0:MATRIXFF(alloc_numa)(ngv,nsv);
+	mt2=MATRIXFF(alloc_numa)(ntv,nsv);
+	mp=MATRIXFF(alloc_numa)(ngv,ntv);
+	if(!((mt||istop)&&mt2&&mp))
 	{
 		LOG(1,"Not enough memory.")
 		CLEANUP
@@ -501,15 +494,24 @@ void external_R_pij_rank(const int *ng,const int *nt,const int *ns,const double*
 	}
 
 	//Copy data, R uses column major
-	for(i=0;i<ngv;i++)
-		for(j=0;j<nsv;j++)
-			MATRIXFF(set)(mt,i,j,(FTYPE)(t[j*ngv+i]));
 	for(i=0;i<ntv;i++)
 		for(j=0;j<nsv;j++)
 			MATRIXFF(set)(mt2,i,j,(FTYPE)(t2[j*ntv+i]));
+	if(istop)
+	{
+		LOG(10,"Sharing data of t with the top rows of t2.")
+		mvt=MATRIXFF(submatrix)(mt2,0,0,ngv,nsv);
+	}
+	else
+	{
+		for(i=0;i<ngv;i++)
+			for(j=0;j<nsv;j++)
+				MATRIXFF(set)(mt,i,j,(FTYPE)(t[j*ngv+i]));
+		mvt=MATRIXFF(submatrix)(mt,0,0,ngv,nsv);
+	}
 	
 	//Calculation
-	*ret=pij_rank(mt,mt2,mp,nd,(size_t)-1);
+	*ret=func(&mvt.matrix,mt2,mp,nd,(size_t)-1);
 	//Copy data back
 	if(!*ret)
 		for(i=0;i<ngv;i++)
@@ -519,6 +521,25 @@ void external_R_pij_rank(const int *ng,const int *nt,const int *ns,const double*
 #undef CLEANUP
 }
 
+static int external_R_pij_rank_pv_func(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,char nodiag,size_t memlimit)
+{
+	(void)nodiag;
+	return pij_rank_pv(t,t2,p,memlimit);
+}
+
+void external_R_pij_rank_pv(const int *ng,const int *nt,const int *ns,const double* t,const double* t2,double* p,int *ret)
+{
+	const int	nodiag=0;
+	LOG(12,"R interface for external_R_pij_rank_pv: nt=%i, nt2=%i, ns=%i",*ng,*nt,*ns)
+	external_R_pij_rank_any(ng,nt,ns,t,t2,p,&nodiag,ret,external_R_pij_rank_pv_func);
+}
+
+void external_R_pij_rank(const int *ng,const int *nt,const int *ns,const double* t,const double* t2,double* p,const int* nodiag,int *ret)
+{
+	LOG(12,"R interface for external_R_pij_rank: nt=%i, nt2=%i, ns=%i, nodiag=%i",*ng,*nt,*ns,*nodiag)
+	external_R_pij_rank_any(ng,nt,ns,t,t2,p,nodiag,ret,pij_rank);
+}
+
 void external_R_netr_one_greedy(const int *nt,const double* p,const int* namax0,const int* nimax0,const int* nomax0,int* net,int *ret)
 {
 #define	CLEANUP	CLEANMATF(mp)CLEANMATUC(mnet)
@@ -529,7 +550,7 @@ void external_R_netr_one_greedy(const int *nt,const double* p,const int* namax0,
 	MATRIXF		*mp;
 	MATRIXUC	*mnet;
 	
-	mp=MATRIXFF(alloc)(ntv,ntv);
+	mp=MATRIXFF(alloc_numa)(ntv,ntv);
 	mnet=MATRIXUCF(alloc)(ntv,ntv);
 	if(!(mp&&mnet))
 	{
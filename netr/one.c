@@ -16,27 +16,474 @@
  * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
 #include "../base/gsl/math.h"
-#include "../base/gsl/permutation.h"
-#include "../base/gsl/sort.h"
 #include "../base/logger.h"
 #include "../base/macros.h"
+#include "../base/const.h"
+#include "../base/threading.h"
 #include "../base/data_process.h"
 #include "../cycle/cycle.h"
 #include "one.h"
 
+//Candidate edge with its probability and flat index among the n(n-1) edges
+struct netr_one_edge
+{
+	FTYPE	v;
+	size_t	id;
+};
+
+/* Source of candidate edges in descending order of probability, and ascending order
+ * of flat index for ties. Edges are selected in batches with partial selection over
+ * the whole matrix, so only one batch is kept in memory instead of a full sort.
+ * p:		(n,n) Probability matrix
+ * e:		(2*nb) Buffer of candidate edges. First ne are the current batch in order.
+ * nb:		Batch size
+ * nbmax:	Maximum batch size
+ * ne:		Number of edges in current batch
+ * ie:		Position of next edge in current batch
+ * last:	Last edge of previous batch. Only edges after it are selected.
+ * started:	Whether any batch has been selected.
+ * done:	Whether all edges have been selected.
+ * thr:		(2*n) Last edge kept for each source node then for each target node
+ * 			by degree cap prefilter, or 0 to keep all edges.
+ */
+struct netr_one_edges
+{
+	const MATRIXF*	p;
+	const struct netr_one_edge*	thr;
+	struct netr_one_edge*	e;
+	size_t	nb;
+	size_t	nbmax;
+	size_t	ne;
+	size_t	ie;
+	struct netr_one_edge	last;
+	char	started;
+	char	done;
+};
+
+// Whether edge a comes before b, i.e. has larger probability or smaller flat index for ties.
+static inline int netr_one_edge_before(const struct netr_one_edge* a,const struct netr_one_edge* b)
+{
+	return (a->v>b->v)||((a->v==b->v)&&(a->id<b->id));
+}
+
+static int netr_one_edge_cmp(const void* a,const void* b)
+{
+	if(netr_one_edge_before((const struct netr_one_edge*)a,(const struct netr_one_edge*)b))
+		return -1;
+	return netr_one_edge_before((const struct netr_one_edge*)b,(const struct netr_one_edge*)a);
+}
+
+static inline void netr_one_edge_swap(struct netr_one_edge* a,struct netr_one_edge* b)
+{
+	struct netr_one_edge	t=*a;
+	*a=*b;
+	*b=t;
+}
+
+/* Partial selection like nth_element. Moves the first k edges in order to the front of e,
+ * with the k-th at position k-1. Their relative order is undefined.
+ * e:		(n) Edges
+ * n:		Number of edges
+ * k:		Number of edges to select, 0<k<=n.
+ */
+static void netr_one_edge_select(struct netr_one_edge* e,size_t n,size_t k)
+{
+	size_t	lo,hi,i,j;
+	
+	assert(k&&(k<=n));
+	lo=0;
+	hi=n-1;
+	while(lo<hi)
+	{
+		//Median of three pivot, moved to hi
+		i=lo+(hi-lo)/2;
+		if(netr_one_edge_before(e+hi,e+lo))
+			netr_one_edge_swap(e+hi,e+lo);
+		if(netr_one_edge_before(e+i,e+lo))
+			netr_one_edge_swap(e+i,e+lo);
+		if(netr_one_edge_before(e+i,e+hi))
+			netr_one_edge_swap(e+i,e+hi);
+		//Lomuto partition. Keys are unique as flat indices are.
+		for(i=j=lo;i<hi;i++)
+			if(netr_one_edge_before(e+i,e+hi))
+				netr_one_edge_swap(e+i,e+(j++));
+		netr_one_edge_swap(e+j,e+hi);
+		if(j==k-1)
+			return;
+		if(j<k-1)
+			lo=j+1;
+		else
+			hi=j-1;
+	}
+}
+
+/* Edge that is never before any other, as threshold to keep all edges or as
+ * saturation of a node that is never saturated. */
+static inline struct netr_one_edge netr_one_edge_none(void)
+{
+	struct netr_one_edge	e;
+	e.v=-INFINITY;
+	e.id=(size_t)-1;
+	return e;
+}
+
+/* Accumulator for the first k of a stream of edges. Edges are kept in a buffer of 2k,
+ * which is partitioned to keep the first k whenever full.
+ * e:		(2*k) Buffer
+ * k:		Number of edges to keep
+ * m:		Number of edges in buffer
+ * thr:		k-th edge after the last partition. Only edges before it are accepted.
+ * full:	Whether buffer has been partitioned.
+ */
+struct netr_one_topk
+{
+	struct netr_one_edge*	e;
+	size_t	k;
+	size_t	m;
+	struct netr_one_edge	thr;
+	char	full;
+};
+
+static inline void netr_one_topk_init(struct netr_one_topk* t,struct netr_one_edge* e,size_t k)
+{
+	t->e=e;
+	t->k=k;
+	t->m=0;
+	t->thr=netr_one_edge_none();
+	t->full=0;
+}
+
+static inline void netr_one_topk_push(struct netr_one_topk* t,const struct netr_one_edge* c)
+{
+	if(t->full&&!netr_one_edge_before(c,&t->thr))
+		return;
+	t->e[t->m++]=*c;
+	if(t->m==2*t->k)
+	{
+		netr_one_edge_select(t->e,t->m,t->k);
+		t->m=t->k;
+		t->thr=t->e[t->k-1];
+		t->full=1;
+	}
+}
+
+/* Finishes accumulation. The first min(k,m) edges are moved to the front of buffer.
+ * If there are at least k edges, the k-th is at position k-1.
+ * Return:	Number of edges kept.
+ */
+static inline size_t netr_one_topk_finish(struct netr_one_topk* t)
+{
+	if(t->m>=t->k)
+	{
+		netr_one_edge_select(t->e,t->m,t->k);
+		t->m=t->k;
+	}
+	return t->m;
+}
+
+// Whether edge c=(i,j) is removed by degree cap prefilter thresholds thr.
+static inline int netr_one_edge_filtered(const struct netr_one_edge* thr,size_t n,size_t i,size_t j,const struct netr_one_edge* c)
+{
+	return netr_one_edge_before(thr+i,c)||netr_one_edge_before(thr+n+j,c);
+}
+
+/* Number of candidate edges to keep for each node by degree cap prefilter.
+ * cap:		Degree cap
+ * n:		Number of nodes
+ * Return:	Number of edges to keep, or 0 if prefilter is not useful.
+ */
+static size_t netr_one_prefilter_k(size_t cap,size_t n)
+{
+	size_t	k;
+	
+	if(cap>=n)
+		return 0;
+	k=cap*CONST_NETR_PREFILTER_RATIO+CONST_NETR_PREFILTER_SLACK;
+	return (k<(n-1)/2)?k:0;
+}
+
+/* Degree cap prefilter. Finds the ko-th edge from each source node and
+ * the ki-th edge to each target node in parallel. Edges after either are removed
+ * from greedy network reconstruction.
+ * p:		(n,n) Probability matrix
+ * ko,
+ * ki:		Number of edges to keep for each source and target node. 0 to keep all.
+ * thr:		(2*n) Output of the last edge kept for each source node then for each target node.
+ * Return:	0 on success.
+ */
+static int netr_one_prefilter(const MATRIXF* p,size_t ko,size_t ki,struct netr_one_edge* thr)
+{
+#define CLEANUP	CLEANMEM(buff)CLEANMEM(tk)
+	size_t	n=p->size1;
+	size_t	nth=(size_t)omp_get_max_threads();
+	size_t	nbo,nbi;
+	struct netr_one_edge*	buff;
+	struct netr_one_topk*	tk;
+	
+	//Per thread buffers of one accumulator for rows and CONST_NETR_PREFILTER_BLOCK for columns
+	nbo=2*ko;
+	nbi=2*ki*CONST_NETR_PREFILTER_BLOCK;
+	MALLOCSIZE(buff,nth*(nbo+nbi));
+	MALLOCSIZE(tk,nth*CONST_NETR_PREFILTER_BLOCK);
+	if(!(buff&&tk))
+		ERRRET("Not enough memory.")
+	
+	#pragma omp parallel
+	{
+		size_t	id=(size_t)omp_get_thread_num();
+		struct netr_one_edge*	b=buff+id*(nbo+nbi);
+		struct netr_one_topk*	t=tk+id*CONST_NETR_PREFILTER_BLOCK;
+		struct netr_one_edge	c;
+		size_t	n1,n2,i,j,j1,j2,k;
+		
+		//Rows
+		threading_get_startend(n,&n1,&n2);
+		for(i=n1;i<n2;i++)
+		{
+			const FTYPE*	row=MATRIXFF(const_ptr)(p,i,0);
+			thr[i]=netr_one_edge_none();
+			if(!ko)
+				continue;
+			netr_one_topk_init(t,b,ko);
+			for(j=0;j<n;j++)
+			{
+				if((j==i)||gsl_isnan(row[j]))
+					continue;
+				c.v=row[j];
+				c.id=i*(n-1)+j-(j>i);
+				netr_one_topk_push(t,&c);
+			}
+			if(netr_one_topk_finish(t)==ko)
+				thr[i]=b[ko-1];
+		}
+		//Columns, in blocks so rows are read contiguously
+		for(j1=n1;j1<n2;j1=j2)
+		{
+			j2=GSL_MIN(j1+CONST_NETR_PREFILTER_BLOCK,n2);
+			for(j=j1;j<j2;j++)
+				thr[n+j]=netr_one_edge_none();
+			if(!ki)
+				continue;
+			for(j=j1;j<j2;j++)
+				netr_one_topk_init(t+j-j1,b+nbo+2*ki*(j-j1),ki);
+			for(i=0;i<n;i++)
+			{
+				const FTYPE*	row=MATRIXFF(const_ptr)(p,i,0);
+				for(j=j1;j<j2;j++)
+				{
+					if((j==i)||gsl_isnan(row[j]))
+						continue;
+					c.v=row[j];
+					c.id=i*(n-1)+j-(j>i);
+					netr_one_topk_push(t+j-j1,&c);
+				}
+			}
+			for(j=j1;j<j2;j++)
+			{
+				k=j-j1;
+				if(netr_one_topk_finish(t+k)==ki)
+					thr[n+j]=t[k].e[ki-1];
+			}
+		}
+	}
+	CLEANUP
+	return 0;
+#undef	CLEANUP
+}
+
+/* Checks whether degree cap prefilter has kept greedy network reconstruction intact,
+ * and relaxes the prefilter where it has not. This holds if every removed edge up to
+ * the last attempted one comes after its source or target node has been saturated,
+ * so it would have been rejected anyway. Otherwise, the thresholds removing that edge are
+ * dropped. Removed edges that would only be rejected for cycles are therefore eventually kept.
+ * p:		(n,n) Probability matrix
+ * thr:		(2*n) Last edge kept for each source node then for each target node.
+ * 			Updated to keep all edges of nodes that need relaxing.
+ * sat:		(2*n) Edge that saturated each source node then each target node
+ * last:	Last attempted edge, or 0 if all edges have been attempted.
+ * rel:		(2*n) Buffer
+ * Return:	Number of relaxed thresholds. 0 if intact.
+ */
+static size_t netr_one_prefilter_check(const MATRIXF* p,struct netr_one_edge* thr,const struct netr_one_edge* sat,const struct netr_one_edge* last,char* rel)
+{
+	size_t	n=p->size1;
+	size_t	i,ret;
+	
+	memset(rel,0,2*n*sizeof(*rel));
+	#pragma omp parallel
+	{
+		struct netr_one_edge	c;
+		size_t	n1,n2,i,j;
+		
+		threading_get_startend(n,&n1,&n2);
+		for(i=n1;i<n2;i++)
+		{
+			const FTYPE*	row=MATRIXFF(const_ptr)(p,i,0);
+			for(j=0;j<n;j++)
+			{
+				if((j==i)||gsl_isnan(row[j]))
+					continue;
+				c.v=row[j];
+				c.id=i*(n-1)+j-(j>i);
+				if((!netr_one_edge_filtered(thr,n,i,j,&c))||(last&&!netr_one_edge_before(&c,last))
+					||netr_one_edge_before(sat+i,&c)||netr_one_edge_before(sat+n+j,&c))
+					continue;
+				if(netr_one_edge_before(thr+i,&c))
+					rel[i]=1;
+				if(netr_one_edge_before(thr+n+j,&c))
+				{
+					#pragma omp atomic write
+					rel[n+j]=1;
+				}
+			}
+		}
+	}
+	for(i=0,ret=0;i<2*n;i++)
+		if(rel[i])
+		{
+			thr[i]=netr_one_edge_none();
+			ret++;
+		}
+	return ret;
+}
+
+static void netr_one_edges_free(struct netr_one_edges* s)
+{
+	CLEANMEM(s->e)
+}
+
+/* Initializes edge source.
+ * s:		Edge source
+ * p:		(n,n) Probability matrix
+ * nam:		Maximum number of edges to add, which decides the initial batch size
+ * 			up to CONST_NETR_BATCH_NMAX.
+ * thr:		(2*n) Last edge kept for each source node then for each target node
+ * 			by degree cap prefilter, or 0 to keep all edges.
+ * Return:	0 on success.
+ */
+static int netr_one_edges_init(struct netr_one_edges* s,const MATRIXF* p,size_t nam,const struct netr_one_edge* thr)
+{
+	size_t	ntot=p->size1*(p->size1-1);
+	
+	s->p=p;
+	s->thr=thr;
+	s->nbmax=GSL_MAX(GSL_MAX(nam,CONST_NETR_BATCH_NMIN),ntot/CONST_NETR_BATCH_FRAC);
+	//Fixed cap, so the edge buffer stays bounded on dense inputs
+	s->nbmax=GSL_MIN(s->nbmax,CONST_NETR_BATCH_NMAX);
+	s->nbmax=GSL_MAX(GSL_MIN(s->nbmax,ntot),1);
+	s->nb=GSL_MIN(GSL_MAX(nam,CONST_NETR_BATCH_NMIN),s->nbmax);
+	s->ne=s->ie=0;
+	s->started=s->done=0;
+	MALLOCSIZE(s->e,2*s->nb);
+	if(!s->e)
+	{
+		LOG(1,"Not enough memory.")
+		return 1;
+	}
+	return 0;
+}
+
+/* Selects the next batch of edges after the last one. The whole matrix is scanned
+ * with a buffer of 2*nb edges, which is partitioned to keep the first nb whenever full.
+ * NAN probabilities are never selected.
+ * s:		Edge source
+ */
+static void netr_one_edges_fill(struct netr_one_edges* s)
+{
+	const MATRIXF*	p=s->p;
+	size_t	n=p->size1;
+	size_t	i,j,m;
+	struct netr_one_edge	c;
+	struct netr_one_topk	t;
+	
+	netr_one_topk_init(&t,s->e,s->nb);
+	for(i=0;i<n;i++)
+	{
+		const FTYPE*	row=MATRIXFF(const_ptr)(p,i,0);
+		for(j=0;j<n;j++)
+		{
+			if((j==i)||gsl_isnan(row[j]))
+				continue;
+			c.v=row[j];
+			c.id=i*(n-1)+j-(j>i);
+			if((s->started&&!netr_one_edge_before(&s->last,&c))||(s->thr&&netr_one_edge_filtered(s->thr,n,i,j,&c)))
+				continue;
+			netr_one_topk_push(&t,&c);
+		}
+	}
+	m=netr_one_topk_finish(&t);
+	qsort(s->e,m,sizeof(*s->e),netr_one_edge_cmp);
+	s->ne=m;
+	s->ie=0;
+	s->done=(m<s->nb);
+	s->started=1;
+	if(m)
+		s->last=s->e[m-1];
+}
+
+/* Obtains the next candidate edge.
+ * s:		Edge source
+ * v1,
+ * v2:		Output of source and target of edge
+ * Return:	1 if an edge is obtained, 0 if all edges are exhausted, or -1 on failure.
+ */
+static int netr_one_edges_next(struct netr_one_edges* s,size_t* v1,size_t* v2)
+{
+	size_t	n=s->p->size1;
+	size_t	id;
+	
+	if(s->ie==s->ne)
+	{
+		if(s->done)
+			return 0;
+		//Grow batches geometrically, so the number of scans stays logarithmic
+		if(s->started&&(s->nb<s->nbmax))
+		{
+			struct netr_one_edge*	t;
+			size_t	nb=GSL_MIN(2*s->nb,s->nbmax);
+			t=realloc(s->e,2*nb*sizeof(*t));
+			if(!t)
+			{
+				LOG(1,"Not enough memory.")
+				return -1;
+			}
+			s->e=t;
+			s->nb=nb;
+		}
+		netr_one_edges_fill(s);
+		if(!s->ne)
+			return 0;
+	}
+	id=s->e[s->ie++].id;
+	*v1=id/(n-1);
+	*v2=id%(n-1);
+	if(*v2>=*v1)
+		(*v2)++;
+	return 1;
+}
+
+// Last edge obtained from source.
+static inline const struct netr_one_edge* netr_one_edges_last(const struct netr_one_edges* s)
+{
+	assert(s->ie);
+	return s->e+s->ie-1;
+}
+
 
 size_t netr_one_greedy(const MATRIXF* p,MATRIXUC* net,size_t nam,size_t nimax,size_t nomax)
 {
-#define CLEANUP	CLEANVECF(v)CYCLEF(free)(&cs);CLEANPERM(perm)
-#define	TOID(N,V1,V2)	V1=(N)/(n-1);V2=(N)%(n-1);if((V2)>=(V1))V2++;
+#define CLEANUP	CYCLEF(free)(&cs);netr_one_edges_free(&es);CLEANMEM(thr)CLEANMEM(rel)
 
 	struct CYCLEF(system)	cs;
-	VECTORF*	v=0;
-	gsl_permutation*	perm=0;
+	struct netr_one_edges	es={0};
+	struct netr_one_edge	*thr=0,*sat=0;
+	char*	rel=0;
 	int	ret;
-	size_t	n,na,i,ntot;
+	size_t	n,na,ntot,v1,v2,ko,ki,nrel,nretry;
 
 
 
@@ -57,45 +504,76 @@ size_t netr_one_greedy(const MATRIXF* p,MATRIXUC* net,size_t nam,size_t nimax,si
 		ERRRETV(0,"Failed to initialize cycle detection.")
 	cs.nim=nimax;
 	cs.nom=nomax;
-	v=VECTORFF(alloc)(ntot);
-	perm=gsl_permutation_alloc(ntot);
-	if(!(v&&perm))
-		ERRRETV(0,"Not enough memory.")
-	
-	//Obtain edge order
-	MATRIXFF(flatten_nodiag)(p,v);
-	ret=CONCATENATE3(gsl_sort_vector,FTYPE_SUF,_index)(perm,v);
-	if(ret)
-		ERRRETV(0,"Failed to sort vector.")
-	CLEANVECF(v)
+	//Degree cap prefilter removes edges that are unlikely to be added
+	ko=netr_one_prefilter_k(nomax,n);
+	ki=netr_one_prefilter_k(nimax,n);
+	if(ko||ki)
+	{
+		MALLOCSIZE(thr,4*n);
+		MALLOCSIZE(rel,2*n);
+		if(!(thr&&rel))
+			ERRRETV(0,"Not enough memory.")
+		if(netr_one_prefilter(p,ko,ki,thr))
+			ERRRETV(0,"Degree cap prefilter failed.")
+		sat=thr+2*n;
+	}
 	
-	//Add edges
-	for(i=0,na=0;(i<ntot)&&(na<nam);i++)
+	for(nretry=0;;nretry++)
 	{
-		size_t	v0,v1,v2;
-		v0=gsl_permutation_get(perm,ntot-i-1);
-		TOID(v0,v1,v2)
-		ret=cycle_vg_add(&cs,v1,v2);
-		na+=!ret;
+		//Edges in descending order of probability
+		if(netr_one_edges_init(&es,p,nam,thr))
+			ERRRETV(0,"Not enough memory.")
+		if(thr)
+			for(v1=0;v1<2*n;v1++)
+				sat[v1]=netr_one_edge_none();
+		
+		//Add edges
+		for(na=0;(na<nam)&&((ret=netr_one_edges_next(&es,&v1,&v2))>0);)
+		{
+			if(cycle_vg_add(&cs,v1,v2))
+				continue;
+			na++;
+			if(!thr)
+				continue;
+			if(cs.gno[v1]==nomax)
+				sat[v1]=*netr_one_edges_last(&es);
+			if(cs.gni[v2]==nimax)
+				sat[n+v2]=*netr_one_edges_last(&es);
+		}
+		if(ret<0)
+			ERRRETV(0,"Failed to obtain edge order.")
+		if(!thr)
+			break;
+		nrel=netr_one_prefilter_check(p,thr,sat,ret?netr_one_edges_last(&es):0,rel);
+		if(!nrel)
+			break;
+		//Removed edges could have been added. Start over with relaxed prefilter, or without it.
+		if(nretry<CONST_NETR_PREFILTER_NRETRY)
+			LOG(10,"Degree cap prefilter relaxed for "PRINTFSIZET" nodes. Retrying.",nrel)
+		else
+		{
+			LOG(10,"Degree cap prefilter relaxed for "PRINTFSIZET" nodes. Retrying without prefilter.",nrel)
+			CLEANMEM(thr)
+		}
+		netr_one_edges_free(&es);
+		if(CYCLEF(empty)(&cs))
+			ERRRETV(0,"Failed to empty cycle detection.")
 	}
 	CYCLEF(extract_graph)(&cs,net);
 	
 	CLEANUP
 	return na;
-#undef	TOID
 #undef	CLEANUP
 }
 
 size_t netr_one_greedy_info(const MATRIXF* p,MATRIXL* net,MATRIXD* time,size_t nam,size_t nimax,size_t nomax)
 {
-#define CLEANUP	CLEANVECF(v)CYCLEF(free)(&cs);CLEANPERM(perm)
-#define	TOID(N,V1,V2)	V1=(N)/(n-1);V2=(N)%(n-1);if((V2)>=(V1))V2++;
+#define CLEANUP	CYCLEF(free)(&cs);netr_one_edges_free(&es);
 
 	struct CYCLEF(system)	cs;
-	VECTORF*	v=0;
-	gsl_permutation*	perm=0;
+	struct netr_one_edges	es={0};
 	int	ret;
-	size_t	n,na,i,ntot;
+	size_t	n,na,i,ntot,v1,v2;
 	int	sign[2]={1,-1};
 	clock_t	cstart,cnow;
 
@@ -110,39 +588,29 @@ size_t netr_one_greedy_info(const MATRIXF* p,MATRIXL* net,MATRIXD* time,size_t n
 		ERRRETV(0,"Failed to initialize cycle detection.")	
 	cs.nim=nimax;
 	cs.nom=nomax;
-	v=VECTORFF(alloc)(ntot);
-	perm=gsl_permutation_alloc(ntot);
-	if(!(v&&perm))
+	//Edges in descending order of probability
+	if(netr_one_edges_init(&es,p,nam,0))
 		ERRRETV(0,"Not enough memory.")
 	
-	//Obtain edge order
-	MATRIXFF(flatten_nodiag)(p,v);
-	ret=CONCATENATE3(gsl_sort_vector,FTYPE_SUF,_index)(perm,v);
-	if(ret)
-		ERRRETV(0,"Failed to sort vector.")
-	CLEANVECF(v)
-	
 	//Add edges
 	MATRIXLF(set_zero)(net);
 	cstart=clock();
 	MATRIXDF(set_all)(time,(double)cstart);
-	for(i=0,na=0;(i<ntot)&&(na<nam);i++)
+	for(i=0,na=0;(na<nam)&&((ret=netr_one_edges_next(&es,&v1,&v2))>0);i++)
 	{
-		size_t	v0,v1,v2;
-		v0=gsl_permutation_get(perm,ntot-i-1);
-		TOID(v0,v1,v2)
 		ret=cycle_vg_add(&cs,v1,v2);
 		cnow=clock();
 		MATRIXLF(set)(net,v1,v2,(int)(i+1)*sign[ret]);
 		MATRIXDF(set)(time,v1,v2,(double)cnow);
 		na+=!ret;
 	}
+	if(ret<0)
+		ERRRETV(0,"Failed to obtain edge order.")
 	MATRIXDF(add_constant)(time,(double)-cstart);
 	MATRIXDF(scale)(time,1/(double)CLOCKS_PER_SEC);
 	
 	CLEANUP
 	return na;
-#undef	TOID
 #undef	CLEANUP
 }
 
@@ -25,6 +25,11 @@
 #include "../../base/supernormalize.h"
 #include "../../base/threading.h"
 #include "../../base/data_process.h"
+#include "../../base/numa.h"
+#include "../../base/mapfile.h"
+#include "../llrtopij.h"
+#include "../memplan.h"
+#include "../stream.h"
 #include "llr.h"
 #include "llrtopij.h"
 #include "llrtopv.h"
@@ -33,9 +38,9 @@
 
 int pijs_cassist_pv(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t memlimit)
 {
-#define	CLEANUP			CLEANMATF(gnew)CLEANMATF(tnew)CLEANMATF(tnew2)
-	MATRIXF		*gnew;			//(ng,ns) Supernormalized transcript matrix
-	MATRIXF		*tnew,*tnew2;	//(nt,ns) Supernormalized transcript matrix
+#define	CLEANUP			CLEANMATF(gnew)CLEANMATF(tnew)CLEANMATF(tnew2)pool_end();
+	MATRIXF		*gnew,*tnew,*tnew2;	//Supernormalized copies of g, t and t2, if needed
+	const MATRIXF	*gn,*tn,*tn2;	//(ng,ns), (ng,ns) and (nt,ns) Supernormalized matrices
 	int			ret;
 	size_t		ns=g->size2;
 #ifndef NDEBUG
@@ -47,6 +52,7 @@ int pijs_cassist_pv(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 #endif
 
 	gnew=tnew=tnew2=0;
+	gn=tn=tn2=0;
 
 	//Validation
 	assert(!((t->size1!=ng)||(t->size2!=ns)||(t2->size2!=ns)
@@ -56,38 +62,31 @@ int pijs_cassist_pv(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 		||(p4&&((p4->size1!=ng)||(p4->size2!=nt)))
 		||(p5&&((p5->size1!=ng)||(p5->size2!=nt)))));
 	assert(memlimit);
+	pool_begin(memlimit);
 	
 	if(ns<4)
 		ERRRET("Cannot compute p-values with fewer than 4 samples.")
 
 	{
-		size_t mem1;
-		mem1=(4*t->size1*t->size2+2*t2->size1*t2->size2+p1->size+p2->size1*p2->size2*4)*sizeof(FTYPE);
-		if(memlimit<=mem1)
-			ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
-		LOG(10,"Memory limit: %lu bytes.",memlimit)
+		struct pij_memplan	mp;
+		pij_memplan_init(&mp,"pijs_cassist_pv");
+		//Inputs, outputs, and supernormalized copies
+		pij_memplan_base(&mp,(2*t->size1*t->size2+t2->size1*t2->size2+p1->size+p2->size1*p2->size2*4)*sizeof(FTYPE)
+			+supernormalize_input_mem(g)+supernormalize_input_mem2(t,t2),0);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		if(pij_memplan_fit(&mp,g->size1,memlimit))
+			ERRRET("pij_memplan_fit failed.")
 	}
 	
-	gnew=MATRIXFF(alloc)(g->size1,g->size2);
-	tnew=MATRIXFF(alloc)(t->size1,t->size2);
-	tnew2=MATRIXFF(alloc)(t2->size1,t2->size2);
-	if(!(gnew&&tnew&&tnew2))
-		ERRRET("Not enough memory.")
-
 	//Step 1: Supernormalization
 	LOG(9,"Supernormalizing...")
-	MATRIXFF(memcpy)(gnew,g);
-	ret=supernormalizea_byrow(gnew);
-	MATRIXFF(memcpy)(tnew,t);
-	ret=ret||supernormalizea_byrow(tnew);
-	MATRIXFF(memcpy)(tnew2,t2);
-	ret=ret||supernormalizea_byrow(tnew2);
-	if(ret)
+	if(!(gn=supernormalizea_byrow_input(g,&gnew))||supernormalizea_byrow_input2(t,t2,&tn,&tn2,&tnew,&tnew2))
 		ERRRET("Supernormalization failed.")
+	ret=0;
 
 	//Step 2: Log likelihood ratios from nonpermuted data
 	LOG(9,"Calculating real log likelihood ratios...")
-	pij_cassist_llr(gnew,tnew,tnew2,p1,p2,p3,p4,p5);
+	pij_cassist_llr(gn,tn,tn2,p1,p2,p3,p4,p5);
 	//Step 3: Convert log likelihood ratios to p-values
 	LOG(9,"Converting log likelihood ratios into p-values...")
 	pij_cassist_llrtopvs(p1,p2,p3,p4,p5,ns);
@@ -99,9 +98,9 @@ int pijs_cassist_pv(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 
 int pijs_cassist(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,char nodiag,size_t memlimit)
 {
-#define	CLEANUP			CLEANMATF(gnew)CLEANMATF(tnew)CLEANMATF(tnew2)
-	MATRIXF		*gnew;			//(ng,ns) Supernormalized transcript matrix
-	MATRIXF		*tnew,*tnew2;	//(nt,ns) Supernormalized transcript matrix
+#define	CLEANUP			CLEANMATF(gnew)CLEANMATF(tnew)CLEANMATF(tnew2)pool_end();
+	MATRIXF		*gnew,*tnew,*tnew2;	//Supernormalized copies of g, t and t2, if needed
+	const MATRIXF	*gn,*tn,*tn2;	//(ng,ns), (ng,ns) and (nt,ns) Supernormalized matrices
 	VECTORFF(view)	vv;
 	int			ret;
 	size_t		ns=g->size2;
@@ -114,6 +113,7 @@ int pijs_cassist(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 #endif
 
 	gnew=tnew=tnew2=0;
+	gn=tn=tn2=0;
 
 	//Validation
 	assert(!((t->size1!=ng)||(t->size2!=ns)||(t2->size2!=ns)
@@ -123,45 +123,38 @@ int pijs_cassist(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 		||(p4&&((p4->size1!=ng)||(p4->size2!=nt)))
 		||(p5&&((p5->size1!=ng)||(p5->size2!=nt)))));
 	assert(memlimit);
+	pool_begin(memlimit);
 	
 	if(ns<4)
 		ERRRET("Cannot compute probabilities with fewer than 4 samples.")
 	//Defaults to 8GB memory usage
 	{
-		size_t mem1;
-		mem1=(4*t->size1*t->size2+2*t2->size1*t2->size2+p1->size+p2->size1*p2->size2*4)*sizeof(FTYPE);
-		if(memlimit<=mem1)
-			ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
-		LOG(10,"Memory limit: %lu bytes.",memlimit)
+		struct pij_memplan	mp;
+		size_t	fixed,perrow;
+		pij_memplan_init(&mp,"pijs_cassist");
+		//Inputs, outputs, and supernormalized copies
+		pij_memplan_base(&mp,(2*t->size1*t->size2+t2->size1*t2->size2+p1->size+p2->size1*p2->size2*4)*sizeof(FTYPE)
+			+supernormalize_input_mem(g)+supernormalize_input_mem2(t,t2),0);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		//One null histogram at a time
+		pij_llrtopij_engine_mem(t2->size1,1,&fixed,&perrow);
+		pij_memplan_stage(&mp,"conversion to probabilities",fixed,perrow);
+		if(pij_memplan_fit(&mp,g->size1,memlimit))
+			ERRRET("pij_memplan_fit failed.")
 	}
 	
-	gnew=MATRIXFF(alloc)(g->size1,g->size2);
-	tnew=MATRIXFF(alloc)(t->size1,t->size2);
-	tnew2=MATRIXFF(alloc)(t2->size1,t2->size2);
-	if(!(gnew&&tnew&&tnew2))
-		ERRRET("Not enough memory.")
-
 	//Check for identical rows in input data
-	{
-		VECTORFF(view) vbuff1=MATRIXFF(column)(tnew,0);
-		VECTORFF(view) vbuff2=MATRIXFF(row)(tnew2,0);
-		MATRIXFF(cmprow)(t,t2,&vbuff1.vector,&vbuff2.vector,nodiag,1);
-	}
+	MATRIXFF(cmprow_auto)(t,t2,nodiag,1);
 
 	//Step 1: Supernormalization
 	LOG(9,"Supernormalizing...")
-	MATRIXFF(memcpy)(gnew,g);
-	ret=supernormalizea_byrow(gnew);
-	MATRIXFF(memcpy)(tnew,t);
-	ret=ret||supernormalizea_byrow(tnew);
-	MATRIXFF(memcpy)(tnew2,t2);
-	ret=ret||supernormalizea_byrow(tnew2);
-	if(ret)
+	if(!(gn=supernormalizea_byrow_input(g,&gnew))||supernormalizea_byrow_input2(t,t2,&tn,&tn2,&tnew,&tnew2))
 		ERRRET("Supernormalization failed.")
+	ret=0;
 
 	//Step 2: Log likelihood ratios from nonpermuted data
 	LOG(9,"Calculating real log likelihood ratios...")
-	pij_cassist_llr(gnew,tnew,tnew2,p1,p2,p3,p4,p5);
+	pij_cassist_llr(gn,tn,tn2,p1,p2,p3,p4,p5);
 	//Step 3: Convert log likelihood ratios to probabilities
 	if((ret=pij_cassist_llrtopijs(p1,p2,p3,p4,p5,ns,nodiag)))
 		LOG(4,"Failed to convert all log likelihood ratios to probabilities.")
@@ -194,10 +187,13 @@ int pij_cassist(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans
 	assert(g&&t&&t2&&ans&&pijs);
 	assert((g->size2==t->size2)&&(g->size2==t2->size2));
 	assert((t->size1==ng)&&(ans->size1==ng)&&(ans->size2==nt));
-	p1=VECTORFF(alloc)(ng);
-	p2=MATRIXFF(alloc)(ng,nt);
-	p3=MATRIXFF(alloc)(ng,nt);
-	p4=MATRIXFF(alloc)(ng,nt);
+	//Out of core: only keep buffers for one block of rows
+	if(MATRIXFF(mapfile_is)(ans))
+		return pij_cassist_stream(g,t,t2,ans,0,0,nodiag,memlimit);
+	p1=VECTORFF(pool_alloc)(ng);
+	p2=MATRIXFF(alloc_numa)(ng,nt);
+	p3=MATRIXFF(alloc_numa)(ng,nt);
+	p4=MATRIXFF(alloc_numa)(ng,nt);
 	if(!(p1&&p2&&p3&&p4))
 		ERRRET("Not enough memory.")
 	if(pijs_cassist(g,t,t2,p1,p2,p3,p4,ans,nodiag,memlimit))
@@ -236,10 +232,10 @@ int pij_cassist_trad(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF
 	assert(g&&t&&t2&&ans);
 	assert((g->size2==t->size2)&&(g->size2==t2->size2));
 	assert((t->size1==ng)&&(ans->size1==ng)&&(ans->size2==nt));
-	p1=VECTORFF(alloc)(ng);
-	p2=MATRIXFF(alloc)(ng,nt);
-	p4=MATRIXFF(alloc)(ng,nt);
-	p5=MATRIXFF(alloc)(ng,nt);
+	p1=VECTORFF(pool_alloc)(ng);
+	p2=MATRIXFF(alloc_numa)(ng,nt);
+	p4=MATRIXFF(alloc_numa)(ng,nt);
+	p5=MATRIXFF(alloc_numa)(ng,nt);
 	if(!(p1&&p2&&p5&&p4))
 		ERRRET("Not enough memory.")
 	if(pijs_cassist(g,t,t2,p1,p2,ans,p4,p5,nodiag,memlimit))
@@ -253,3 +249,127 @@ int pij_cassist_trad(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF
 	return 0;
 #undef	CLEANUP
 }
+
+//Data of pij_cassist_stream for the callbacks of pij_stream_run
+struct pij_cassist_stream_data
+{
+	//(ng,ns), (ng,ns) and (nt,ns) Supernormalized matrices
+	const MATRIXF	*g,*t,*t2;
+	//(nsplit) Buffer for step 1
+	VECTORF*	p1;
+	char		nodiag;
+};
+
+/* Calculates LLRs of steps 2 to 5 of a block for pij_stream_run.
+ * d[0] to d[3] are LLRs of steps 5, 2, 4, and 3 respectively.
+ * Step 3 is not used in the combination and needs no maximum.
+ */
+static int pij_cassist_stream_llr(void* data,size_t start,MATRIXF* const* d)
+{
+	struct pij_cassist_stream_data*	s=data;
+	size_t	nb=d[0]->size1;
+	MATRIXFF(const_view) mvg=MATRIXFF(const_submatrix)(s->g,start,0,nb,s->g->size2);
+	MATRIXFF(const_view) mvt=MATRIXFF(const_submatrix)(s->t,start,0,nb,s->t->size2);
+	VECTORFF(view)	vvp1=VECTORFF(subvector)(s->p1,0,nb);
+	
+	//Step 2: Log likelihood ratios from nonpermuted data
+	pij_cassist_llr(&mvg.matrix,&mvt.matrix,s->t2,&vvp1.vector,d[1],d[3],d[2],d[0]);
+	return 0;
+}
+
+//Steps 3 and 4: Convert log likelihood ratios to probabilities and combine tests
+static int pij_cassist_stream_convert(void* data,size_t start,MATRIXF* const* d,const FTYPE* dmax)
+{
+	struct pij_cassist_stream_data*	s=data;
+	FTYPE	dm[4]={dmax[1],0,dmax[2],dmax[0]};
+	int		ret=0;
+	
+	if(pij_cassist_llrtopijs_dmax(d[1],0,d[2],d[0],s->t2->size2,dm,s->nodiag,(long)start))
+	{
+		LOG(4,"Failed to convert all log likelihood ratios to probabilities.")
+		ret=1;
+	}
+	MATRIXFF(mul_elements)(d[0],d[1]);
+	MATRIXFF(add)(d[0],d[2]);
+	MATRIXFF(scale)(d[0],0.5);
+	return ret;
+}
+
+int pij_cassist_stream(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,pij_stream_func func,void* data,char nodiag,size_t memlimit)
+{
+#define	CLEANUP			CLEANMATF(gnew)CLEANMATF(tnew)CLEANMATF(tnew2)CLEANVECF(sd.p1)pool_end();
+	MATRIXF			*gnew,*tnew,*tnew2;	//Supernormalized copies of g, t and t2, if needed
+	struct pij_cassist_stream_data	sd={0,0,0,0,0};
+	struct pij_stream_method	m={"pij_cassist_stream",4,3,1,0,pij_cassist_stream_llr,0,pij_cassist_stream_convert};
+	int				ret;
+	size_t			ng,nt,ns,nsplit;
+	
+	ng=g->size1;
+	nt=t2->size1;
+	ns=g->size2;
+
+	gnew=tnew=tnew2=0;
+
+	//Validation
+	assert(!((t->size1!=ng)||(t->size2!=ns)||(t2->size2!=ns)
+		||(ans&&((ans->size1!=ng)||(ans->size2!=nt)))));
+	assert(memlimit);
+	pool_begin(memlimit);
+	if(!(ans||func))
+		ERRRET("Neither output matrix nor callback function is specified.")
+	if(ns<4)
+		ERRRET("Cannot compute probabilities with fewer than 4 samples.")
+	{
+		struct pij_memplan	mp;
+		size_t	fixed,perrow;
+		pij_memplan_init(&mp,"pij_cassist_stream");
+		//Inputs, output, and supernormalized copies. Per primary target: LLR buffers.
+		pij_memplan_base(&mp,(2*t->size1*t->size2+t2->size1*t2->size2)*sizeof(FTYPE)
+			+supernormalize_input_mem(g)+supernormalize_input_mem2(t,t2),(1+nt*pij_stream_nbuf(4,ans))*sizeof(FTYPE));
+		if(ans)
+			pij_memplan_matrix(&mp,ans);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		//One null histogram at a time
+		pij_llrtopij_engine_mem(nt,1,&fixed,&perrow);
+		pij_memplan_stage(&mp,"conversion to probabilities",fixed,perrow);
+		if(pij_memplan_split(&mp,ng,memlimit,&nsplit))
+			ERRRET("pij_memplan_split failed.")
+	}
+	
+	sd.p1=VECTORFF(pool_alloc)(nsplit);
+	if(!sd.p1)
+		ERRRET("Not enough memory.")
+
+	//Check for identical rows in input data
+	MATRIXFF(cmprow_auto)(t,t2,nodiag,1);
+
+	//Step 1: Supernormalization
+	LOG(9,"Supernormalizing...")
+	if(!(sd.g=supernormalizea_byrow_input(g,&gnew))||supernormalizea_byrow_input2(t,t2,&sd.t,&sd.t2,&tnew,&tnew2))
+		ERRRET("Supernormalization failed.")
+	sd.nodiag=nodiag;
+	m.data=&sd;
+	ret=pij_stream_run(&m,ng,nt,nsplit,ans,func,data,nodiag);
+
+	//Cleanup
+	CLEANUP
+	return ret;
+#undef	CLEANUP
+}
+
+int pij_cassist_sparse(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,struct pij_sparse* ans,FTYPE threshold,size_t k,char nodiag,size_t memlimit)
+{
+	struct pij_sparse_filter	f={ans,threshold,k};
+	
+	if(pij_sparse_init(ans,g->size1,t2->size1,(k?GSL_MIN(k,t2->size1):1)*g->size1))
+	{
+		LOG(1,"Not enough memory.")
+		return 1;
+	}
+	if(pij_cassist_stream(g,t,t2,0,pij_sparse_stream_func,&f,nodiag,memlimit))
+	{
+		pij_sparse_free(ans);
+		return 1;
+	}
+	return 0;
+}
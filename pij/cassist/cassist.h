@@ -22,6 +22,7 @@
 #define _HEADER_LIB_PIJ_CASSIST_H_
 #include "../../base/config.h"
 #include "../../base/types.h"
+#include "../sparse.h"
 #ifdef __cplusplus
 extern "C"
 {
@@ -69,6 +70,7 @@ int pijs_cassist(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 
 /* Estimates the probability of A->B from genotype and expression data with defaults combination of tests. Uses results from pijs_gassist_tot or pijs_gassist_a. Variables have the same definitions except:
  * ans:	(ng,nt) Predicted probability of A->B based on default combination of 5 tests. The default combination is (p2*p5+p4)/2. Note: this combination does not include p1.
+ * 		If ans is from MATRIXFF(mapfile), runs out of core with pij_cassist_stream.
  * Return:	0 on sucess
  */
 int pij_cassist(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,char nodiag,size_t memlimit);
@@ -79,6 +81,30 @@ int pij_cassist(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans
  */
 int pij_cassist_trad(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,char nodiag,size_t memlimit);
 
+/* Streaming version of pij_cassist that never keeps full (ng,nt) matrices of intermediate results.
+ * A first pass over row blocks records the maximum LLRs for null histograms.
+ * A second pass recomputes the LLRs of each block and converts them to the combined
+ * probability (p2*p5+p4)/2, which is written to ans and/or passed to func.
+ * Results are identical to pij_cassist. Variables have the same definitions as pij_cassist except:
+ * ans:		(ng,nt) Predicted probability of A->B. Can be NULL if func is specified.
+ * func:	Callback function to receive each finished block of the predicted probability (see pij_stream_func).
+ * 			Can be NULL if ans is specified. Called in the order of rows.
+ * data:	User data pointer passed to func.
+ * Return:	0 on sucess
+ */
+int pij_cassist_stream(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,pij_stream_func func,void* data,char nodiag,size_t memlimit);
+
+/* Sparse output version of pij_cassist. Uses pij_cassist_stream and keeps, for each A,
+ * only probabilities no smaller than threshold and at most the k largest of them.
+ * Variables have the same definitions as pij_cassist except:
+ * ans:		Output sparse matrix for predicted probability of A->B. Initialized by this function
+ * 			and must be freed with pij_sparse_free on success.
+ * threshold:	Minimum probability to keep.
+ * k:		Maximum number of Bs to keep for each A. 0 for unlimited.
+ * Return:	0 on sucess
+ */
+int pij_cassist_sparse(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,struct pij_sparse* ans,FTYPE threshold,size_t k,char nodiag,size_t memlimit);
+
 #ifdef __cplusplus
 }
 #endif
@@ -30,6 +30,81 @@
 #include "llr.h"
 
 
+/* Converts correlations into the 5 log likelihood ratios of Trigger in a single tiled pass.
+ * On input, llr1 is rho_EA, llr2 is rho_EB and llr5 is rho_AB.
+ * On output, llr1 to llr5 are the final log likelihood ratios (see pij_cassist_llr_block).
+ * Each row is processed in tiles of CONST_TILE_NCOL columns so that llr2 to llr5
+ * are each streamed through memory only once. The log arguments of a tile are
+ * computed first and then taken log of in tight loops to allow vectorization.
+ * Operation order follows the former matrix-wise implementation to keep results
+ * identical within floating point tolerance.
+ */
+static void pij_cassist_llr_block_fused(VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5)
+{
+	size_t	i,j,j0,nj;
+	size_t	ng=llr2->size1;
+	size_t	nt=llr2->size2;
+	FTYPE	vea,vea2,vlea2;
+	FTYPE	veb,vab,vd;
+	FTYPE	*p2,*p3,*p4,*p5;
+
+	for(i=0;i<ng;i++)
+	{
+		vea=VECTORFF(get)(llr1,i);
+		//1-rho_EA^2
+		vea2=(FTYPE)(1-vea*vea);
+		vlea2=(FTYPE)log(vea2);
+		for(j0=0;j0<nt;j0+=CONST_TILE_NCOL)
+		{
+			nj=GSL_MIN(CONST_TILE_NCOL,nt-j0);
+			p2=MATRIXFF(ptr)(llr2,i,j0);
+			p3=MATRIXFF(ptr)(llr3,i,j0);
+			p4=MATRIXFF(ptr)(llr4,i,j0);
+			p5=MATRIXFF(ptr)(llr5,i,j0);
+			//Log arguments
+			for(j=0;j<nj;j++)
+			{
+				veb=p2[j];
+				vab=p5[j];
+				//(rho_AB-rho_EA*rho_EB)^2
+				vd=veb*vea-vab;
+				vd=vd*vd;
+				//1-rho_EB^2
+				veb=(FTYPE)(1-veb*veb);
+				//1-rho_AB^2
+				vab=(FTYPE)(1-vab*vab);
+				//(1-rho_EA^2)*(1-rho_EB^2)-(rho_AB-rho_EA*rho_EB)^2
+				vd=-(vd-veb*vea2);
+				p4[j]=vd<FTYPE_MIN?FTYPE_MIN:vd;
+				p2[j]=veb;
+				p5[j]=vab;
+			}
+			//Logs
+			for(j=0;j<nj;j++)
+				p2[j]=(FTYPE)log(p2[j]);
+			for(j=0;j<nj;j++)
+				p4[j]=(FTYPE)log(p4[j]);
+			for(j=0;j<nj;j++)
+				p5[j]=(FTYPE)log(p5[j]);
+			//Combine, scale and bound from 0
+			for(j=0;j<nj;j++)
+			{
+				vd=p4[j]-vlea2;
+				veb=(FTYPE)(-0.5*(vd-p5[j]));
+				p3[j]=veb<0?0:veb;
+				veb=(FTYPE)(-0.5*(vd-p2[j]));
+				p5[j]=veb<0?0:veb;
+				veb=(FTYPE)(-0.5*vd);
+				p4[j]=veb<0?0:veb;
+				veb=(FTYPE)(-0.5*p2[j]);
+				p2[j]=veb<0?0:veb;
+			}
+		}
+		vea=(FTYPE)(-0.5*vlea2);
+		VECTORFF(set)(llr1,i,vea<0?0:vea);
+	}
+}
+
 /* Calculates the 5 log likelihood ratios of Trigger with nonpermuted data in block form:
  * 1. E->A v.s. E no relation with A
  * 2. A<-E->B with A--B v.s. E->A<-B
@@ -41,10 +116,10 @@
  */
 static void pij_cassist_llr_block(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5)
 {
-	size_t	i,j;
-	VECTORFF(view)	vv;
+#ifndef NDEBUG
 	size_t	ng=g->size1;
 	size_t	nt=t2->size1;
+#endif
 	
 	assert(ng&&(t->size1==ng)&&(llr1->size==ng)&&(llr2->size1==ng)&&(llr3->size1==ng)
 		&&(llr4->size1==ng)&&(llr5->size1==ng));
@@ -57,83 +132,13 @@ static void pij_cassist_llr_block(const MATRIXF* g,const MATRIXF* t,const MATRIX
 	MATRIXFF(cov2_bounded)(g,t2,llr2);
 	//llr5=rho_AB
 	MATRIXFF(cov2_bounded)(t,t2,llr5);
-
-	//llr4=rho_EA*rho_EB
-	MATRIXFF(memcpy)(llr4,llr2);
-	for(i=0;i<ng;i++)
-	{
-		vv=MATRIXFF(row)(llr4,i);
-		VECTORFF(scale)(&vv.vector,VECTORFF(get)(llr1,i));
-	}
-	//llr4=(rho_AB-rho_EA*rho_EB)^2
-	MATRIXFF(sub)(llr4,llr5);
-	MATRIXFF(mul_elements)(llr4,llr4);
-	//llr2=1-rho_EB^2
-	MATRIXFF(mul_elements)(llr2,llr2);
-	MATRIXFF(scale)(llr2,-1);
-	MATRIXFF(add_constant)(llr2,1);
-	//llr5=1-rho_AB^2
-	MATRIXFF(mul_elements)(llr5,llr5);
-	MATRIXFF(scale)(llr5,-1);
-	MATRIXFF(add_constant)(llr5,1);
-	//llr1=1-rho_EA^2
-	VECTORFF(mul)(llr1,llr1);
-	VECTORFF(scale)(llr1,-1);
-	VECTORFF(add_constant)(llr1,1);
-	//llr4=(1-rho_EA^2)*(1-rho_EB^2)-(rho_AB-rho_EA*rho_EB)^2, using llr3 as buffer
-	MATRIXFF(memcpy)(llr3,llr2);
-	for(i=0;i<ng;i++)
-	{
-		vv=MATRIXFF(row)(llr3,i);
-		VECTORFF(scale)(&vv.vector,VECTORFF(get)(llr1,i));
-	}
-	MATRIXFF(sub)(llr4,llr3);
-	MATRIXFF(scale)(llr4,-1);
-	MATRIXFF(bound_below)(llr4,FTYPE_MIN);
-	
-	//ALL log
-	for(i=0;i<ng;i++)
-	{
-		VECTORFF(set)(llr1,i,(FTYPE)log(VECTORFF(get)(llr1,i)));
-		for(j=0;j<nt;j++)
-		{
-			MATRIXFF(set)(llr2,i,j,(FTYPE)log(MATRIXFF(get)(llr2,i,j)));
-			MATRIXFF(set)(llr4,i,j,(FTYPE)log(MATRIXFF(get)(llr4,i,j)));
-			MATRIXFF(set)(llr5,i,j,(FTYPE)log(MATRIXFF(get)(llr5,i,j)));
-		}
-	}
-	//llr4=llr4 before scaling -0.5
-	for(i=0;i<ng;i++)
-	{
-		FTYPE v;
-		v=VECTORFF(get)(llr1,i);
-		vv=MATRIXFF(row)(llr4,i);
-		VECTORFF(add_constant)(&vv.vector,-v);
-	}
-	//llr3=llr3 before scaling -0.5
-	MATRIXFF(memcpy)(llr3,llr4);
-	MATRIXFF(sub)(llr3,llr5);
-	//llr5=llr5 before scaling -0.5
-	MATRIXFF(memcpy)(llr5,llr4);
-	MATRIXFF(sub)(llr5,llr2);
-
-	//Finalize all for coefficients
-	VECTORFF(scale)(llr1,-0.5);
-	MATRIXFF(scale)(llr2,-0.5);
-	MATRIXFF(scale)(llr3,-0.5);
-	MATRIXFF(scale)(llr4,-0.5);
-	MATRIXFF(scale)(llr5,-0.5);
-	
-	//Bounding from 0
-	VECTORFF(bound_below)(llr1,0);
-	MATRIXFF(bound_below)(llr2,0);
-	MATRIXFF(bound_below)(llr3,0);
-	MATRIXFF(bound_below)(llr4,0);
-	MATRIXFF(bound_below)(llr5,0);
+	//Everything else in one pass
+	pij_cassist_llr_block_fused(llr1,llr2,llr3,llr4,llr5);
 }
 
 void pij_cassist_llr(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5)
 {
+	struct threading_sched	sch;
 #ifndef NDEBUG
 	size_t	ng,nt,ns;
 
@@ -146,11 +151,12 @@ void pij_cassist_llr(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF
 	assert(!((g->size2!=ns)||(t2->size2!=ns)||(t->size1!=ng)||(llr2->size1!=ng)||(llr2->size2!=nt)||(llr3->size1!=ng)||(llr3->size2!=nt)||(llr4->size1!=ng)||(llr4->size2!=nt)||(llr5->size1!=ng)||(llr5->size2!=nt)));
 	assert(!(llr1->size!=ng));
 	
+	threading_sched_init(&sch,t->size1,0);
 	#pragma omp parallel
 	{
 		size_t	n1,n2;
-		threading_get_startend(t->size1,&n1,&n2);
-		if(n2>n1)
+		double	t0=omp_get_wtime();
+		while(threading_sched_next(&sch,&n1,&n2))
 		{
 			MATRIXFF(const_view) mvg=MATRIXFF(const_submatrix)(g,n1,0,n2-n1,g->size2);
 			MATRIXFF(const_view) mvt=MATRIXFF(const_submatrix)(t,n1,0,n2-n1,t->size2);
@@ -163,6 +169,8 @@ void pij_cassist_llr(const MATRIXF* g,const MATRIXF* t,const MATRIXF* t2,VECTORF
 			mvllr5=MATRIXFF(submatrix)(llr5,n1,0,n2-n1,llr5->size2);
 			pij_cassist_llr_block(&mvg.matrix,&mvt.matrix,t2,&vvllr1.vector,&mvllr2.matrix,&mvllr3.matrix,&mvllr4.matrix,&mvllr5.matrix);
 		}
+		threading_sched_done(&sch,t0);
 	}
+	threading_sched_log(&sch,"pij_cassist_llr");
 }
 
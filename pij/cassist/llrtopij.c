@@ -115,15 +115,31 @@ int pij_cassist_llrtopijs(VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIX
 	return ret;
 }
 
-
-
-
-
-
-
-
-
-
-
-
-
+int pij_cassist_llrtopijs_dmax(MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t ns,const FTYPE dmax[4],char nodiag,long nodiagshift)
+{
+	int	ret=0,ret2=0;
+	
+	if(ns<4)
+	{
+		LOG(0,"Cannot convert log likelihood ratios to probabilities. Needs at least 4 samples.")
+		return 1;
+	}
+	if(p2&&(ret2=pij_llrtopij_convert_single_self_dmax(p2,dmax[0],1,ns-2,nodiag,nodiagshift)))
+		LOG(1,"Failed to convert log likelihood ratios to probabilities in step 2.")
+	ret=ret||ret2;
+	if(p3)
+	{
+		if((ret2=pij_llrtopij_convert_single_self_dmax(p3,dmax[1],1,ns-3,nodiag,nodiagshift)))
+			LOG(1,"Failed to convert log likelihood ratios to probabilities in step 3.")
+		MATRIXFF(scale)(p3,-1);
+		MATRIXFF(add_constant)(p3,1);
+		ret=ret||ret2;
+	}
+	if(p4&&(ret2=pij_llrtopij_convert_single_self_dmax(p4,dmax[2],2,ns-3,nodiag,nodiagshift)))
+		LOG(1,"Failed to convert log likelihood ratios to probabilities in step 4.")
+	ret=ret||ret2;
+	if(p5&&(ret2=pij_llrtopij_convert_single_self_dmax(p5,dmax[3],1,ns-3,nodiag,nodiagshift)))
+		LOG(1,"Failed to convert log likelihood ratios to probabilities in step 5.")
+	ret=ret||ret2;
+	return ret;
+}
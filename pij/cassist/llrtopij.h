@@ -35,6 +35,18 @@ extern "C"
  */
 int pij_cassist_llrtopijs(VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t ns,char nodiag);
 
+/* Converts LLRs of a block of rows into probabilities for steps 2 to 5, with null
+ * histograms constructed up to given maxima of the full LLR matrices.
+ * Results are identical to converting the full matrices with pij_cassist_llrtopijs.
+ * p2,p3,p4,p5:	Blocks of LLRs to convert in place. Any of them can be NULL to skip.
+ * ns:			Number of samples
+ * dmax:		Maxima of full LLR matrices of steps 2 to 5.
+ * nodiag:		Whether diagonal elements should be ignored.
+ * nodiagshift:	Diangonal column shift for nodiag==1, i.e. index of first row of the block.
+ * Return: 0 if all conversions are successful.
+ */
+int pij_cassist_llrtopijs_dmax(MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t ns,const FTYPE dmax[4],char nodiag,long nodiagshift);
+
 
 
 
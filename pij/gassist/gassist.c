@@ -25,18 +25,57 @@
 #include "../../base/supernormalize.h"
 #include "../../base/threading.h"
 #include "../../base/data_process.h"
+#include "../../base/numa.h"
+#include "../../base/mapfile.h"
 #include "../llrtopij.h"
+#include "../memplan.h"
+#include "../stream.h"
 #include "llr.h"
 #include "llrtopv.h"
 #include "llrtopij.h"
 #include "nullhist.h"
 #include "gassist.h"
 
+/* Adds stages of log likelihood ratios and, if conv, conversion to probabilities to memory plan.
+ * mp:		Memory plan
+ * ns:		Number of samples
+ * nt:		Number of transcripts for B
+ * nv:		Number of possible values for each genotype
+ * conv:	Whether to include conversion to probabilities.
+ */
+static void pij_gassist_memplan_stages(struct pij_memplan* mp,size_t ns,size_t nt,size_t nv,char conv)
+{
+	size_t	fixed,perrow;
+	
+	pij_gassist_llr_mem(ns,nt,nv,&fixed,&perrow);
+	pij_memplan_stage(mp,"log likelihood ratios",fixed,perrow);
+	if(!conv)
+		return;
+	//Null histograms of all four tests with their engines, and genotype value counts
+	pij_llrtopij_engine_mem(nt,4*(nv-1),&fixed,&perrow);
+	pij_memplan_stage(mp,"conversion to probabilities",fixed,perrow+sizeof(GTYPE));
+}
+
+/* Marks rows of output matrices as finished with MATRIXFF(mapfile_done).
+ * p2,p3,p4,p5:	Output matrices
+ * start:	Start row
+ * n:		Number of rows
+ */
+static void pij_gassist_mapfile_done(const MATRIXF* p2,const MATRIXF* p3,const MATRIXF* p4,const MATRIXF* p5,size_t start,size_t n)
+{
+	MATRIXFF(mapfile_done)(p2,start,n);
+	MATRIXFF(mapfile_done)(p3,start,n);
+	MATRIXFF(mapfile_done)(p4,start,n);
+	MATRIXFF(mapfile_done)(p5,start,n);
+}
+
 int pijs_gassist_pv(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t nv,size_t memlimit)
 {
-#define	CLEANUP			CLEANMATF(tnew)CLEANMATF(tnew2)
-	MATRIXF		*tnew,*tnew2;	//(nt,ns) Supernormalized transcript matrix
-	MATRIXFF(view)	mvt,mvp2,mvp3,mvp4,mvp5;
+#define	CLEANUP			CLEANMATF(tnew)CLEANMATF(tnew2)pool_end();
+	MATRIXF		*tnew,*tnew2;	//Supernormalized copies of t and t2, if needed
+	const MATRIXF	*tn,*tn2;	//(ng,ns) and (nt,ns) Supernormalized transcript matrices
+	MATRIXFF(const_view)	mvt;
+	MATRIXFF(view)	mvp2,mvp3,mvp4,mvp5;
 	VECTORFF(view)	vvp1;
 	int			ret;
 	size_t		i,ng,ns,ngnow,nsplit;
@@ -49,6 +88,7 @@ int pijs_gassist_pv(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 	ng=g->size1;
 
 	tnew=tnew2=0;
+	tn=tn2=0;
 
 	//Validation
 	assert(!((t->size1!=ng)||(t->size2!=ns)||(t2->size2!=ns)
@@ -59,41 +99,34 @@ int pijs_gassist_pv(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 		||(p5&&((p3->size1!=ng)||(p3->size2!=nt)))));
 	assert(!(nv>CONST_NV_MAX));
 	assert(memlimit);
+	pool_begin(memlimit);
 	if(ns<4)
 		ERRRET("Needs at least 4 samples to compute p-values.")
 
 	{
-		size_t mem1,mem2;
-		mem1=g->size1*g->size2*sizeof(GTYPE)+(2*t->size1*t->size2+2*t2->size1*t2->size2+p1->size+p2->size1*p2->size2*4)*sizeof(FTYPE);
-		mem2=t2->size1*2*nv*sizeof(FTYPE);
-		if((memlimit<=mem1)||!(nsplit=(memlimit-mem1)/mem2))
-			ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
-		LOG(10,"Memory limit: %lu bytes.",memlimit)
-		nsplit=(size_t)ceil((float)ng/ceil((float)ng/(float)nsplit));
-		//if(nsplit<ng)
-			LOG(9,"Splitting %lu primary targets into groups of about size %lu.",ng,nsplit)
+		struct pij_memplan	mp;
+		pij_memplan_init(&mp,"pijs_gassist_pv");
+		//Inputs, outputs, and supernormalized copies
+		pij_memplan_base(&mp,g->size1*g->size2*sizeof(GTYPE)+(t->size1*t->size2+t2->size1*t2->size2+p1->size+p2->size1*p2->size2*4)*sizeof(FTYPE)
+			+supernormalize_input_mem2(t,t2),0);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		pij_gassist_memplan_stages(&mp,ns,t2->size1,nv,0);
+		if(pij_memplan_split(&mp,ng,memlimit,&nsplit))
+			ERRRET("pij_memplan_split failed.")
 	}
-	
-	tnew=MATRIXFF(alloc)(t->size1,t->size2);
-	tnew2=MATRIXFF(alloc)(t2->size1,t2->size2);
-	if(!(tnew&&tnew2))
-		ERRRET("Not enough memory.")
 
 	//Step 1: Supernormalization
 	LOG(9,"Supernormalizing...")
-	MATRIXFF(memcpy)(tnew,t);
-	ret=supernormalizea_byrow(tnew);
-	MATRIXFF(memcpy)(tnew2,t2);
-	ret=ret||supernormalizea_byrow(tnew2);
-	if(ret)
+	if(supernormalizea_byrow_input2(t,t2,&tn,&tn2,&tnew,&tnew2))
 		ERRRET("Supernormalization failed.")
 	
+	ret=0;
 	for(i=0;i<ng;i+=nsplit)
 	{
 		ngnow=GSL_MIN(ng-i,nsplit);
 
 		MATRIXGF(const_view) mvg=MATRIXGF(const_submatrix)(g,i,0,ngnow,g->size2);
-		mvt=MATRIXFF(submatrix)(tnew,i,0,ngnow,tnew->size2);
+		mvt=MATRIXFF(const_submatrix)(tn,i,0,ngnow,tn->size2);
 		vvp1=VECTORFF(subvector)(p1,i,ngnow);
 		mvp2=MATRIXFF(submatrix)(p2,i,0,ngnow,p2->size2);
 		mvp3=MATRIXFF(submatrix)(p3,i,0,ngnow,p3->size2);
@@ -101,7 +134,7 @@ int pijs_gassist_pv(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 		mvp5=MATRIXFF(submatrix)(p5,i,0,ngnow,p5->size2);
 		//Step 2: Log likelihood ratios from nonpermuted data
 		LOG(9,"Calculating real log likelihood ratios...")
-		if(pij_gassist_llr(&mvg.matrix,&mvt.matrix,tnew2,&vvp1.vector,&mvp2.matrix,&mvp3.matrix,&mvp4.matrix,&mvp5.matrix,nv))
+		if(pij_gassist_llr(&mvg.matrix,&mvt.matrix,tn2,&vvp1.vector,&mvp2.matrix,&mvp3.matrix,&mvp4.matrix,&mvp5.matrix,nv))
 			ERRRET("pij_gassist_llr failed.")
 		//Step 3: Convert log likelihood ratios to p-values
 		LOG(9,"Converting log likelihood ratios into p-values...")
@@ -115,11 +148,11 @@ int pijs_gassist_pv(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 #undef	CLEANUP		
 }
 
-int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t nv,char nodiag,size_t memlimit)
+int pijs_gassist_normalized(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t nv,char nodiag,size_t memlimit,struct pij_gassist_llr_scratch* sc)
 {
-#define	CLEANUP			CLEANMATF(tnew)CLEANMATF(tnew2)for(i=0;i<4;i++){if(hnull[i])for(j=0;j<nv-1;j++)CLEANHIST(hnull[i][j]);CLEANMEM(hnull[i]);}
-	MATRIXF			*tnew,*tnew2;	//(nt,ns) Supernormalized transcript matrix
-	MATRIXFF(view)	mvt,mvp2,mvp3,mvp4,mvp5;
+#define	CLEANUP			for(i=0;i<4;i++){if(hnull[i])for(j=0;j<nv-1;j++)CLEANHIST(hnull[i][j]);CLEANMEM(hnull[i]);}pool_end();
+	MATRIXFF(const_view)	mvt;
+	MATRIXFF(view)	mvp2,mvp3,mvp4,mvp5;
 	VECTORFF(view)	vv,vvp1;
 	gsl_histogram**	hnull[4]={0,0,0,0};
 	int				ret;
@@ -129,8 +162,6 @@ int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 	ng=g->size1;
 	ns=g->size2;
 
-	tnew=tnew2=0;
-
 	//Validation
 	assert(!((t->size1!=ng)||(t->size2!=ns)||(t2->size2!=ns)
 		||(p1&&(p1->size!=ng))
@@ -140,57 +171,40 @@ int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 		||(p5&&((p3->size1!=ng)||(p3->size2!=nt)))));
 	assert(!(nv>CONST_NV_MAX));
 	assert(memlimit);
+	pool_begin(memlimit);
 	if(ns<4)
 		ERRRET("Needs at least 4 samples to compute probabilities.")
-	//Defaults to 8GB memory usage
-	{
-		size_t mem1,mem2;
-		mem1=g->size1*g->size2*sizeof(GTYPE)+(2*t->size1*t->size2+2*t2->size1*t2->size2+p1->size+p2->size1*p2->size2*4)*sizeof(FTYPE);
-		mem2=t2->size1*2*nv*sizeof(FTYPE);
-		if((memlimit<=mem1)||!(nsplit=(memlimit-mem1)/mem2))
-			ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
-		LOG(10,"Memory limit: %lu bytes.",memlimit)
-		nsplit=(size_t)ceil((float)ng/ceil((float)ng/(float)nsplit));
-		if(nsplit<ng)
-			LOG(9,"Splitting %lu primary targets into groups of about size %lu.",ng,nsplit)
-	}
-	
-	tnew=MATRIXFF(alloc)(t->size1,t->size2);
-	tnew2=MATRIXFF(alloc)(t2->size1,t2->size2);
-	if(!(tnew&&tnew2))
-		ERRRET("Not enough memory.")
-
-	//Check for identical rows in input data
 	{
-		VECTORFF(view) vbuff1=MATRIXFF(column)(tnew,0);
-		VECTORFF(view) vbuff2=MATRIXFF(row)(tnew2,0);
-		MATRIXFF(cmprow)(t,t2,&vbuff1.vector,&vbuff2.vector,nodiag,1);
+		struct pij_memplan	mp;
+		pij_memplan_init(&mp,"pijs_gassist_normalized");
+		//Inputs and outputs
+		pij_memplan_base(&mp,g->size1*g->size2*sizeof(GTYPE)+(t->size1*t->size2+t2->size1*t2->size2+p1->size)*sizeof(FTYPE),0);
+		pij_memplan_matrix(&mp,p2);
+		pij_memplan_matrix(&mp,p3);
+		pij_memplan_matrix(&mp,p4);
+		pij_memplan_matrix(&mp,p5);
+		pij_gassist_memplan_stages(&mp,ns,nt,nv,1);
+		if(pij_memplan_split(&mp,ng,memlimit,&nsplit))
+			ERRRET("pij_memplan_split failed.")
 	}
-
-	//Step 1: Supernormalization
-	LOG(9,"Supernormalizing...")
-	MATRIXFF(memcpy)(tnew,t);
-	ret=supernormalizea_byrow(tnew);
-	MATRIXFF(memcpy)(tnew2,t2);
-	ret=ret||supernormalizea_byrow(tnew2);
-	if(ret)
-		ERRRET("Supernormalization failed.")
 	
 	//Step 2: Log likelihood ratios from nonpermuted data
 	LOG(9,"Calculating real log likelihood ratios...")
+	ret=0;
 	for(i=0;i<ng;i+=nsplit)
 	{
 		ngnow=GSL_MIN(ng-i,nsplit);
 
 		MATRIXGF(const_view) mvg=MATRIXGF(const_submatrix)(g,i,0,ngnow,g->size2);
-		mvt=MATRIXFF(submatrix)(tnew,i,0,ngnow,tnew->size2);
+		mvt=MATRIXFF(const_submatrix)(t,i,0,ngnow,t->size2);
 		vvp1=VECTORFF(subvector)(p1,i,ngnow);
 		mvp2=MATRIXFF(submatrix)(p2,i,0,ngnow,p2->size2);
 		mvp3=MATRIXFF(submatrix)(p3,i,0,ngnow,p3->size2);
 		mvp4=MATRIXFF(submatrix)(p4,i,0,ngnow,p4->size2);
 		mvp5=MATRIXFF(submatrix)(p5,i,0,ngnow,p5->size2);
-		if(pij_gassist_llr(&mvg.matrix,&mvt.matrix,tnew2,&vvp1.vector,&mvp2.matrix,&mvp3.matrix,&mvp4.matrix,&mvp5.matrix,nv))
-			ERRRET("pij_gassist_llr failed.")
+		if(pij_gassist_llr_buffed(&mvg.matrix,&mvt.matrix,t2,&vvp1.vector,&mvp2.matrix,&mvp3.matrix,&mvp4.matrix,&mvp5.matrix,nv,sc))
+			ERRRET("pij_gassist_llr_buffed failed.")
+		pij_gassist_mapfile_done(p2,p3,p4,p5,i,ngnow);
 	}
 	
 	//Step 3: Obtain null histograms
@@ -212,14 +226,16 @@ int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 		ngnow=GSL_MIN(ng-i,nsplit);
 
 		MATRIXGF(const_view) mvg=MATRIXGF(const_submatrix)(g,i,0,ngnow,g->size2);
-		mvt=MATRIXFF(submatrix)(tnew,i,0,ngnow,tnew->size2);
 		vvp1=VECTORFF(subvector)(p1,i,ngnow);
 		mvp2=MATRIXFF(submatrix)(p2,i,0,ngnow,p2->size2);
 		mvp3=MATRIXFF(submatrix)(p3,i,0,ngnow,p3->size2);
 		mvp4=MATRIXFF(submatrix)(p4,i,0,ngnow,p4->size2);
 		mvp5=MATRIXFF(submatrix)(p5,i,0,ngnow,p5->size2);
-		if((ret=pij_gassist_llrtopijs(&mvg.matrix,&vvp1.vector,&mvp2.matrix,&mvp3.matrix,&mvp4.matrix,&mvp5.matrix,nv,(const gsl_histogram* const **)hnull,nodiag,(long)i)))
+		if(pij_gassist_llrtopijs(&mvg.matrix,&vvp1.vector,&mvp2.matrix,&mvp3.matrix,&mvp4.matrix,&mvp5.matrix,nv,(const gsl_histogram* const **)hnull,nodiag,(long)i))
+		{
 			LOG(4,"Failed to convert all log likelihood ratios to probabilities.")
+			ret=1;
+		}
 		if(nodiag)
 		{
 			vv=MATRIXFF(superdiagonal)(&mvp2.matrix,i);
@@ -231,6 +247,7 @@ int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 			vv=MATRIXFF(superdiagonal)(&mvp5.matrix,i);
 			VECTORFF(set_zero)(&vv.vector);
 		}
+		pij_gassist_mapfile_done(p2,p3,p4,p5,i,ngnow);
 	}
 
 	//Cleanup
@@ -239,6 +256,70 @@ int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1
 #undef	CLEANUP		
 }
 
+int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t nv,char nodiag,size_t memlimit)
+{
+#define	CLEANUP			CLEANMATF(tnew)CLEANMATF(tnew2)pool_end();
+	MATRIXF			*tnew,*tnew2;	//Supernormalized copies of t and t2, if needed
+	const MATRIXF	*tn,*tn2;		//(ng,ns) and (nt,ns) Supernormalized transcript matrices
+	int				ret;
+	size_t			mem0;
+	
+	tnew=tnew2=0;
+	tn=tn2=0;
+	assert(memlimit);
+	pool_begin(memlimit);
+	//Memory of supernormalized copies
+	mem0=supernormalize_input_mem2(t,t2);
+	{
+		struct pij_memplan	mp;
+		pij_memplan_init(&mp,"pijs_gassist");
+		//Inputs, outputs, and supernormalized copies
+		pij_memplan_base(&mp,g->size1*g->size2*sizeof(GTYPE)+(t->size1*t->size2+t2->size1*t2->size2+p1->size)*sizeof(FTYPE)+mem0,0);
+		pij_memplan_matrix(&mp,p2);
+		pij_memplan_matrix(&mp,p3);
+		pij_memplan_matrix(&mp,p4);
+		pij_memplan_matrix(&mp,p5);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(t->size2),0);
+		if(pij_memplan_fit(&mp,g->size1,memlimit))
+			ERRRET("pij_memplan_fit failed.")
+	}
+
+	//Check for identical rows in input data
+	MATRIXFF(cmprow_auto)(t,t2,nodiag,1);
+
+	//Step 1: Supernormalization
+	LOG(9,"Supernormalizing...")
+	if(supernormalizea_byrow_input2(t,t2,&tn,&tn2,&tnew,&tnew2))
+		ERRRET("Supernormalization failed.")
+	
+	ret=pijs_gassist_normalized(g,tn,tn2,p1,p2,p3,p4,p5,nv,nodiag,memlimit-mem0,0);
+	//Cleanup
+	CLEANUP
+	return ret;
+#undef	CLEANUP		
+}
+
+void pij_gassist_combine(MATRIXF* ans,const MATRIXF* p2,const MATRIXF* p4)
+{
+	assert((ans->size1==p2->size1)&&(ans->size2==p2->size2)&&(ans->size1==p4->size1)&&(ans->size2==p4->size2));
+	#pragma omp parallel
+	{
+		size_t	ng1,ng2;
+		MATRIXFF(view)	mva;
+		MATRIXFF(const_view)	mv2,mv4;
+		threading_get_startend(ans->size1,&ng1,&ng2);
+		if(ng1<ng2)
+		{
+			mva=MATRIXFF(submatrix)(ans,ng1,0,ng2-ng1,ans->size2);
+			mv2=MATRIXFF(const_submatrix)(p2,ng1,0,ng2-ng1,p2->size2);
+			mv4=MATRIXFF(const_submatrix)(p4,ng1,0,ng2-ng1,p4->size2);
+			MATRIXFF(mul_elements)(&mva.matrix,&mv2.matrix);
+			MATRIXFF(add)(&mva.matrix,&mv4.matrix);
+			MATRIXFF(scale)(&mva.matrix,0.5);
+		}
+	}
+}
+
 int pij_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,size_t nv,char nodiag,size_t memlimit)
 {
 #define	CLEANUP			CLEANVECF(p1)CLEANMATF(p2)CLEANMATF(p3)CLEANMATF(p4)
@@ -250,31 +331,20 @@ int pij_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans
 	assert(g&&t&&t2&&ans&&pijs);
 	assert((g->size2==t->size2)&&(g->size2==t2->size2));
 	assert((t->size1==ng)&&(ans->size1==ng)&&(ans->size2==nt)&&(nv>1));
-	p1=VECTORFF(alloc)(ng);
-	p2=MATRIXFF(alloc)(ng,nt);
-	p3=MATRIXFF(alloc)(ng,nt);
-	p4=MATRIXFF(alloc)(ng,nt);
+	//Out of core: only keep buffers for one block of rows
+	if(MATRIXFF(mapfile_is)(ans))
+		return pij_gassist_stream(g,t,t2,ans,0,0,nv,nodiag,memlimit);
+	p1=VECTORFF(pool_alloc)(ng);
+	p2=MATRIXFF(alloc_numa)(ng,nt);
+	p3=MATRIXFF(alloc_numa)(ng,nt);
+	p4=MATRIXFF(alloc_numa)(ng,nt);
 	if(!(p1&&p2&&p3&&p4))
 		ERRRET("Not enough memory.")
 	if(pijs_gassist(g,t,t2,p1,p2,p3,p4,ans,nv,nodiag,memlimit))
 		ERRRET("pij_gassist_pijs failed.")
 		
 	//Combine tests
-	#pragma omp parallel
-	{
-		size_t	ng1,ng2;
-		MATRIXFF(view)	mva,mv2,mv4;
-		threading_get_startend(g->size1,&ng1,&ng2);
-		if(ng1<ng2)
-		{
-			mva=MATRIXFF(submatrix)(ans,ng1,0,ng2-ng1,ans->size2);
-			mv2=MATRIXFF(submatrix)(p2,ng1,0,ng2-ng1,p2->size2);
-			mv4=MATRIXFF(submatrix)(p4,ng1,0,ng2-ng1,p4->size2);
-			MATRIXFF(mul_elements)(&mva.matrix,&mv2.matrix);
-			MATRIXFF(add)(&mva.matrix,&mv4.matrix);
-			MATRIXFF(scale)(&mva.matrix,0.5);
-		}
-	}	
+	pij_gassist_combine(ans,p2,p4);
 	//Cleanup
 	CLEANUP
 	return 0;
@@ -292,10 +362,10 @@ int pij_gassist_trad(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF
 	assert(g&&t&&t2&&ans);
 	assert((g->size2==t->size2)&&(g->size2==t2->size2));
 	assert((t->size1==ng)&&(ans->size1==ng)&&(ans->size2==nt)&&(nv>1));
-	p1=VECTORFF(alloc)(ng);
-	p2=MATRIXFF(alloc)(ng,nt);
-	p4=MATRIXFF(alloc)(ng,nt);
-	p5=MATRIXFF(alloc)(ng,nt);
+	p1=VECTORFF(pool_alloc)(ng);
+	p2=MATRIXFF(alloc_numa)(ng,nt);
+	p4=MATRIXFF(alloc_numa)(ng,nt);
+	p5=MATRIXFF(alloc_numa)(ng,nt);
 	if(!(p1&&p2&&p5&&p4))
 		ERRRET("Not enough memory.")
 	if(pijs_gassist(g,t,t2,p1,p2,ans,p4,p5,nv,nodiag,memlimit))
@@ -309,3 +379,148 @@ int pij_gassist_trad(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF
 	return 0;
 #undef	CLEANUP
 }
+
+//Data of pij_gassist_stream for the callbacks of pij_stream_run
+struct pij_gassist_stream_data
+{
+	//(ng,ns) Genotype data
+	const MATRIXG*	g;
+	//(ng,ns) and (nt,ns) Supernormalized transcript matrices
+	const MATRIXF	*t,*t2;
+	//(nsplit) Buffer for step 1
+	VECTORF*	p1;
+	//Null histograms of steps 2 to 5
+	gsl_histogram**	hnull[4];
+	size_t		nv;
+	char		nodiag;
+};
+
+/* Calculates LLRs of steps 2 to 5 of a block for pij_stream_run.
+ * d[0] to d[3] are LLRs of steps 5, 2, 3, and 4 respectively.
+ */
+static int pij_gassist_stream_llr(void* data,size_t start,MATRIXF* const* d)
+{
+	struct pij_gassist_stream_data*	s=data;
+	size_t	nb=d[0]->size1;
+	MATRIXGF(const_view) mvg=MATRIXGF(const_submatrix)(s->g,start,0,nb,s->g->size2);
+	MATRIXFF(const_view) mvt=MATRIXFF(const_submatrix)(s->t,start,0,nb,s->t->size2);
+	VECTORFF(view)	vvp1=VECTORFF(subvector)(s->p1,0,nb);
+	
+	//Step 2: Log likelihood ratios from nonpermuted data
+	return pij_gassist_llr(&mvg.matrix,&mvt.matrix,s->t2,&vvp1.vector,d[1],d[2],d[3],d[0],s->nv);
+}
+
+//Step 3: Obtain null histograms
+static int pij_gassist_stream_prepare(void* data,const FTYPE* dmax)
+{
+	struct pij_gassist_stream_data*	s=data;
+	FTYPE	dm[4]={dmax[1],dmax[2],dmax[3],dmax[0]};
+	
+	if(!(dm[0]&&dm[1]&&dm[2]&&dm[3]))
+	{
+		LOG(1,"Negative or NAN found in LLR.")
+		return 1;
+	}
+	return pij_gassist_nullhists(s->hnull,s->t2->size1,s->t2->size2,s->nv,dm);
+}
+
+//Steps 4 and 5: Convert log likelihood ratios to probabilities and combine tests
+static int pij_gassist_stream_convert(void* data,size_t start,MATRIXF* const* d,const FTYPE* dmax)
+{
+	struct pij_gassist_stream_data*	s=data;
+	size_t	nb=d[0]->size1;
+	size_t	i;
+	int		ret=0;
+	MATRIXGF(const_view) mvg=MATRIXGF(const_submatrix)(s->g,start,0,nb,s->g->size2);
+	VECTORFF(view)	vvp1=VECTORFF(subvector)(s->p1,0,nb);
+	
+	for(i=0;i<4;i++)
+		MATRIXFF(set_inf)(d[i],dmax[i]);
+	if(pij_gassist_llrtopijs(&mvg.matrix,&vvp1.vector,d[1],d[2],d[3],d[0],s->nv,(const gsl_histogram* const **)s->hnull,s->nodiag,(long)start))
+	{
+		LOG(4,"Failed to convert all log likelihood ratios to probabilities.")
+		ret=1;
+	}
+	pij_gassist_combine(d[0],d[1],d[3]);
+	return ret;
+}
+
+int pij_gassist_stream(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,pij_stream_func func,void* data,size_t nv,char nodiag,size_t memlimit)
+{
+#define	CLEANUP			CLEANMATF(tnew)CLEANMATF(tnew2)CLEANVECF(sd.p1)\
+						for(i=0;i<4;i++){if(sd.hnull[i])for(j=0;j<nv-1;j++)CLEANHIST(sd.hnull[i][j]);CLEANMEM(sd.hnull[i]);}pool_end();
+	MATRIXF			*tnew,*tnew2;	//Supernormalized copies of t and t2, if needed
+	struct pij_gassist_stream_data	sd={0,0,0,0,{0,0,0,0},0,0};
+	struct pij_stream_method	m={"pij_gassist_stream",4,4,1,0,pij_gassist_stream_llr,pij_gassist_stream_prepare,pij_gassist_stream_convert};
+	int				ret;
+	size_t			i,j,ng,nt,nsplit,ns;
+	
+	nt=t2->size1;
+	ng=g->size1;
+	ns=g->size2;
+
+	tnew=tnew2=0;
+
+	//Validation
+	assert(!((t->size1!=ng)||(t->size2!=ns)||(t2->size2!=ns)
+		||(ans&&((ans->size1!=ng)||(ans->size2!=nt)))));
+	assert(!(nv>CONST_NV_MAX));
+	assert(memlimit);
+	pool_begin(memlimit);
+	if(!(ans||func))
+		ERRRET("Neither output matrix nor callback function is specified.")
+	if(ns<4)
+		ERRRET("Needs at least 4 samples to compute probabilities.")
+	{
+		struct pij_memplan	mp;
+		pij_memplan_init(&mp,"pij_gassist_stream");
+		//Inputs, output, and supernormalized copies. Per primary target: LLR buffers.
+		pij_memplan_base(&mp,g->size1*g->size2*sizeof(GTYPE)+(t->size1*t->size2+t2->size1*t2->size2)*sizeof(FTYPE)
+			+supernormalize_input_mem2(t,t2),(1+nt*pij_stream_nbuf(4,ans))*sizeof(FTYPE));
+		if(ans)
+			pij_memplan_matrix(&mp,ans);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		pij_gassist_memplan_stages(&mp,ns,nt,nv,1);
+		if(pij_memplan_split(&mp,ng,memlimit,&nsplit))
+			ERRRET("pij_memplan_split failed.")
+	}
+	
+	sd.p1=VECTORFF(pool_alloc)(nsplit);
+	if(!sd.p1)
+		ERRRET("Not enough memory.")
+
+	//Check for identical rows in input data
+	MATRIXFF(cmprow_auto)(t,t2,nodiag,1);
+
+	//Step 1: Supernormalization
+	LOG(9,"Supernormalizing...")
+	if(supernormalizea_byrow_input2(t,t2,&sd.t,&sd.t2,&tnew,&tnew2))
+		ERRRET("Supernormalization failed.")
+	sd.g=g;
+	sd.nv=nv;
+	sd.nodiag=nodiag;
+	m.data=&sd;
+	ret=pij_stream_run(&m,ng,nt,nsplit,ans,func,data,nodiag);
+
+	//Cleanup
+	CLEANUP
+	return ret;
+#undef	CLEANUP		
+}
+
+int pij_gassist_sparse(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,struct pij_sparse* ans,FTYPE threshold,size_t k,size_t nv,char nodiag,size_t memlimit)
+{
+	struct pij_sparse_filter	f={ans,threshold,k};
+	
+	if(pij_sparse_init(ans,g->size1,t2->size1,(k?GSL_MIN(k,t2->size1):1)*g->size1))
+	{
+		LOG(1,"Not enough memory.")
+		return 1;
+	}
+	if(pij_gassist_stream(g,t,t2,0,pij_sparse_stream_func,&f,nv,nodiag,memlimit))
+	{
+		pij_sparse_free(ans);
+		return 1;
+	}
+	return 0;
+}
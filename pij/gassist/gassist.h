@@ -22,6 +22,8 @@
 #define _HEADER_LIB_PIJ_GASSIST_H_
 #include "../../base/config.h"
 #include "../../base/types.h"
+#include "../sparse.h"
+#include "llr.h"
 #ifdef __cplusplus
 extern "C"
 {
@@ -61,6 +63,7 @@ int pijs_gassist_pv(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
  * nodiag:	When the top ng rows of t2 is exactly t, diagonals of p2 and p3 are meaningless. In this case, set nodiag to 1 to avoid inclusion of NANs. For nodiag=0, t and t2 should not have any identical genes.
  * memlimit:	The function is able to split very large datasets (ng and nt) into smaller chunks for inference. This variable specifies the approximate memory usage limit. Note: For large datasets, a too small memory limit can fail the function. For unlimited memory, set memlimit=-1.
  * Return:	0 on sucess
+ * Out of core:	p2 to p5 can be matrices from MATRIXFF(mapfile), whose rows are released block by block.
  * Appendix:
  * 		ng:	Number of genes with best eQTL.
  * 		nt:	Number of genes with expression data for B
@@ -68,8 +71,24 @@ int pijs_gassist_pv(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
  */
 int pijs_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t nv,char nodiag,size_t memlimit);
 
+/* Same as pijs_gassist, but t and t2 are already supernormalized by row, e.g. by supernormalizea_byrow.
+ * Input matrices are used directly without copy, and identical rows are not checked.
+ * memlimit excludes the memory of t and t2 themselves.
+ * sc:		If not 0, per-thread buffers of log likelihood ratios are taken from and kept in sc.
+ *			See pij_gassist_llr_buffed.
+ */
+int pijs_gassist_normalized(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,size_t nv,char nodiag,size_t memlimit,struct pij_gassist_llr_scratch* sc);
+
+/* Combines probabilities of tests with the default combination (p2*p5+p4)/2 in parallel.
+ * ans:	(ng,nt) Input as p5, and output as combined probability.
+ * p2,
+ * p4:	(ng,nt) Probabilities of step 2 and 4.
+ */
+void pij_gassist_combine(MATRIXF* ans,const MATRIXF* p2,const MATRIXF* p4);
+
 /* Estimates the probability of A->B from genotype and expression data with defaults combination of tests. Uses results from pijs_gassist. Variables have the same definitions except:
  * ans:	(ng,nt) Predicted probability of A->B based on default combination of 5 tests. The default combination is (p2*p5+p4)/2. Note: this combination does not include p1.
+ * 		If ans is from MATRIXFF(mapfile), runs out of core with pij_gassist_stream.
  * Return:	0 on sucess
  */
 int pij_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,size_t nv,char nodiag,size_t memlimit);
@@ -80,6 +99,33 @@ int pij_gassist(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans
  */
 int pij_gassist_trad(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,size_t nv,char nodiag,size_t memlimit);
 
+/* Streaming version of pij_gassist that never keeps full (ng,nt) matrices of intermediate results.
+ * Null histograms are obtained from a first pass over row blocks that only records the maximum
+ * LLRs. A second pass recomputes the LLRs of each block and converts them to the combined
+ * probability (p2*p5+p4)/2. Each block is then written to ans and/or passed to func.
+ * Peak memory is therefore the inputs plus a working set of about (4+nv)*nt floats per row
+ * in a block, at the cost of computing LLRs twice. Results are identical to pij_gassist.
+ * Variables have the same definitions as pij_gassist except:
+ * ans:		(ng,nt) Predicted probability of A->B. Can be NULL if func is specified.
+ * func:	Callback function to receive each finished block of the predicted probability (see pij_stream_func).
+ * 			Can be NULL if ans is specified. Called in the order of rows.
+ * data:	User data pointer passed to func.
+ * Return:	0 on sucess
+ */
+int pij_gassist_stream(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* ans,pij_stream_func func,void* data,size_t nv,char nodiag,size_t memlimit);
+
+/* Sparse output version of pij_gassist. Uses pij_gassist_stream and keeps, for each A,
+ * only probabilities no smaller than threshold and at most the k largest of them.
+ * The dense (ng,nt) output is never allocated.
+ * Variables have the same definitions as pij_gassist except:
+ * ans:		Output sparse matrix for predicted probability of A->B. Initialized by this function
+ * 			and must be freed with pij_sparse_free on success.
+ * threshold:	Minimum probability to keep.
+ * k:		Maximum number of Bs to keep for each A. 0 for unlimited.
+ * Return:	0 on sucess
+ */
+int pij_gassist_sparse(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,struct pij_sparse* ans,FTYPE threshold,size_t k,size_t nv,char nodiag,size_t memlimit);
+
 #ifdef __cplusplus
 }
 #endif
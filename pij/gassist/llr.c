@@ -53,54 +53,101 @@ struct pij_gassist_llr_block_buffed_params{
 	//(ng,nt) Output matrix for log likelihood ratio 5,
 	//Also used as correlation matrix for input
 	MATRIXF*		llr5;
-	//[nv](ng,nt) Buffer matrix
-	MATRIXF**		mb1;
 };
 
+/* Bucket sorts the samples of one SNP by genotype value (counting sort).
+ * g:		VECTORG (ns) genotype data of the SNP. Each element takes the value 0 to nv-1
+ * nv:		number of possible values of g.
+ * vs:		(ns) Output sample indices, grouped by genotype value in ascending order.
+ * vstart:	(nv+1) Output start position of each genotype group in vs.
+ * 			vstart[nv]=ns.
+ */
+static inline void pij_gassist_llr_bucket(const VECTORG* g,size_t nv,size_t* vs,size_t* vstart)
+{
+	size_t	i;
+	
+	memset(vstart,0,(nv+1)*sizeof(*vstart));
+	for(i=0;i<g->size;i++)
+		vstart[VECTORGF(get)(g,i)+1]++;
+	for(i=1;i<=nv;i++)
+		vstart[i]+=vstart[i-1];
+	for(i=0;i<g->size;i++)
+		vs[vstart[VECTORGF(get)(g,i)]++]=i;
+	for(i=nv;i;i--)
+		vstart[i]=vstart[i-1];
+	vstart[0]=0;
+}
+
 /* Calculates the ratio and mean of all transcripts (t) for genes (g) with existing buffers.
+ * Samples of each SNP are bucketed by genotype once, and the per genotype sums of t2 are
+ * accumulated as segmented sums of rows of t2t in column tiles of CONST_TILE_NCOL.
+ * This needs ns*nt additions per SNP, instead of 2*nv*ns*nt FLOPs for GEMMs with
+ * nv dense (ng,ns) indicator matrices.
  * g:		MATRIXG (ng,ns) genotype data, for multiple SNP and samples. Each element takes the value 0 to nv-1
  * t:		MATRIXF (ng,ns) of transcript data for A
- * t2:		MATRIXF (nt,ns) of transcript data for B
+ * t2t:		MATRIXF (ns,nt) of transposed transcript data for B
  * mratio:	MATRIXF (nv,ng) of the ratio of samples for each SNP type. For return purpose.
  * mmean1:	MATRIXF (nv,ng) of the means of each transcript among the samples of a specific SNP type. For return purpose.
  * mmean2:	MATRIXF[nv] (ng,nt) of the means of each transcript among the samples of a specific SNP type. For return purpose.
  * nv:		number of possible values of g.
- * mb1:		MATRIXF[nv] (ng,ns) Buffer matrix
- * vb:		buffer. const VECTORF (ns). Must be set to 1 for all elements.
+ * vs:		(ng*(ns+nv+1)) Buffer for sample indices and genotype group starts of all SNPs
  */
-static void pij_gassist_llr_ratioandmean_buffed(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* mratio,MATRIXF* mmean1,MATRIXF** mmean2,size_t nv,MATRIXF** mb1,const VECTORF* vb)
+static void pij_gassist_llr_ratioandmean_buffed(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2t,MATRIXF* mratio,MATRIXF* mmean1,MATRIXF** mmean2,size_t nv,size_t* vs)
 {
 	size_t	ng=g->size1;
 	size_t	ns=t->size2;
-	size_t	i,j;
-	VECTORFF(view) vv;
+	size_t	nt=t2t->size2;
+	size_t	i,j,k,l,j0,nj;
+	size_t	*vsi,*vstart;
 	FTYPE	t1;
-		
-	//Initialize matrices for ratio and mean.
-	for(i=0;i<nv;i++)
-		MATRIXFF(set_zero)(mb1[i]);
+	FTYPE	*pm;
+	const FTYPE	*pt;
+	
+	assert((t2t->size1==ns)&&(mmean2[0]->size2==nt));
+	//Bucket sort and count and mean for t1, which do not depend on the tile
 	for(i=0;i<ng;i++)
-		for(j=0;j<ns;j++)
-			MATRIXFF(set)(mb1[MATRIXGF(get)(g,i,j)],i,j,1);
+	{
+		VECTORGF(const_view) vvg=MATRIXGF(const_row)(g,i);
+		vsi=vs+i*ns;
+		vstart=vs+ng*ns+i*(nv+1);
+		pij_gassist_llr_bucket(&vvg.vector,nv,vsi,vstart);
+		pt=MATRIXFF(const_ptr)(t,i,0);
+		for(k=0;k<nv;k++)
+		{
+			t1=(FTYPE)(vstart[k+1]-vstart[k]);
+			MATRIXFF(set)(mratio,k,i,t1);
+			MATRIXFF(set)(mmean1,k,i,0);
+			pm=MATRIXFF(ptr)(mmean1,k,i);
+			for(l=vstart[k];l<vstart[k+1];l++)
+				*pm+=pt[vsi[l]];
+			*pm/=t1+FTYPE_MIN;
+		}
+	}
 	
-	for(i=0;i<nv;i++)
+	for(j0=0;j0<nt;j0+=CONST_TILE_NCOL)
 	{
-		//Count into (mratio)
-		vv=MATRIXFF(row)(mratio,i);
-		BLASF(gemv)(CblasNoTrans,1,mb1[i],vb,0,&(vv.vector));
-		//Sum for t2
-		BLASF(gemm)(CblasNoTrans,CblasTrans,1,mb1[i],t2,0,mmean2[i]);
-		//Sum for t1
-		vv=MATRIXFF(row)(mmean1,i);
-		MATRIXFF(mul_elements)(mb1[i],t);
-		BLASF(gemv)(CblasNoTrans,1,mb1[i],vb,0,&vv.vector);
-		//Mean=Sum/Count
-		for(j=0;j<ng;j++)
+		nj=GSL_MIN(CONST_TILE_NCOL,nt-j0);
+		for(i=0;i<ng;i++)
 		{
-			t1=MATRIXFF(get)(mratio,i,j);
-			MATRIXFF(ptr)(mmean1,i,j)[0]/=t1+FTYPE_MIN;
-			vv=MATRIXFF(row)(mmean2[i],j);
-			VECTORFF(scale)(&(vv.vector),1/(t1+FTYPE_MIN));
+			vsi=vs+i*ns;
+			vstart=vs+ng*ns+i*(nv+1);
+			for(k=0;k<nv;k++)
+			{
+				//Segmented sum for t2
+				pm=MATRIXFF(ptr)(mmean2[k],i,j0);
+				for(j=0;j<nj;j++)
+					pm[j]=0;
+				for(l=vstart[k];l<vstart[k+1];l++)
+				{
+					pt=MATRIXFF(const_ptr)(t2t,vsi[l],j0);
+					for(j=0;j<nj;j++)
+						pm[j]+=pt[j];
+				}
+				//Mean=Sum/Count
+				t1=1/((FTYPE)(vstart[k+1]-vstart[k])+FTYPE_MIN);
+				for(j=0;j<nj;j++)
+					pm[j]*=t1;
+			}
 		}
 	}
 
@@ -109,34 +156,26 @@ static void pij_gassist_llr_ratioandmean_buffed(const MATRIXG* g,const MATRIXF*
 }
 
 
-/* Calculates the ratio and mean of all transcripts (t) for genes (g) with existing buffers.
+/* Calculates the ratio and mean of all transcripts (t) for genes (g).
  * g:		MATRIXG (ng,ns) genotype data, for multiple SNP and samples. Each element takes the value 0 to nv-1
- * t:		MATRIXF (nt,ns) of transcript data.
- * t2:		MATRIXF (nt,ns) of transcript data for B
+ * t:		MATRIXF (ng,ns) of transcript data for A
+ * t2t:		MATRIXF (ns,nt) of transposed transcript data for B
  * mratio:	MATRIXF (nv,ng) of the ratio of samples for each SNP type. For return purpose.
  * mmean1:	MATRIXF (nv,ng) of the means of each transcript among the samples of a specific SNP type. For return purpose.
  * mmean2:	MATRIXF[nv] (ng,nt) of the means of each transcript among the samples of a specific SNP type. For return purpose.
  * nv:		number of possible values of g.
- * vb:		buffer. const VECTORF (ns). Must be set to 1 for all elements.
  * Return:	0 on success
  */
-static int pij_gassist_llr_ratioandmean(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,MATRIXF* mratio,MATRIXF* mmean1,MATRIXF** mmean2,size_t nv,const VECTORF* vb)
+static int pij_gassist_llr_ratioandmean(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2t,MATRIXF* mratio,MATRIXF* mmean1,MATRIXF** mmean2,size_t nv)
 {
-#define	CLEANUP			CLEANAMMATF(mb1,nv)
-	size_t	i;
-	int		ret;
-	
+#define	CLEANUP			AUTOFREE(vs)
 	//Memory allocation
-	AUTOCALLOC(MATRIXF*,mb1,nv,200)
-	if(!mb1)
-		ERRRET("Not enough memory.")
-	ret=1;
-	for(i=0;i<nv;i++)
-		ret=ret&&(mb1[i]=MATRIXFF(alloc)(g->size1,g->size2));
-	if(!ret)
+	size_t	nvs=g->size1*(g->size2+nv+1);
+	AUTOALLOC(size_t,vs,nvs,1000)
+	if(!vs)
 		ERRRET("Not enough memory.")
-		
-	pij_gassist_llr_ratioandmean_buffed(g,t,t2,mratio,mmean1,mmean2,nv,mb1,vb);
+	
+	pij_gassist_llr_ratioandmean_buffed(g,t,t2t,mratio,mmean1,mmean2,nv,vs);
 	CLEANUP
 	return 0;
 #undef	CLEANUP
@@ -149,137 +188,127 @@ static int pij_gassist_llr_ratioandmean(const MATRIXG* g,const MATRIXF* t,const
  * 3. E->A->B v.s. A<-E->B with A--B
  * 4. A<-E->B with A->B v.s. E->A
  * 5. A<-E->B with A->B v.s. A<-E->B
- * Uses GSL BLAS.
+ * Each row is processed in tiles of CONST_TILE_NCOL columns. Sums over genotypes
+ * are accumulated in place in the llr2 and llr4 tiles, which stay in cache for all nv
+ * genotypes, so every output is streamed through memory only once and no (ng,nt)
+ * buffer is needed.
  * Note: for each row, g must be the best eQTL of t of the same row.
  */
 static void pij_gassist_llr_block_buffed(const struct pij_gassist_llr_block_buffed_params* p)
 {
-	size_t	i,j;
-	FTYPE	f1;
-	VECTORFF(view)	vv;
+	size_t	i,j,k,j0,nj;
+	FTYPE	vf,vm1,vl1,va,vr;
+	FTYPE	*p2,*p3,*p4,*p5;
+	const FTYPE	*pm2;
 	size_t	ng=p->ng;
-#ifndef NDEBUG
 	size_t	nt=p->llr4->size2;
-#endif
 	assert(p->nv&&(p->mratio->size1==p->nv)&&(p->mmean1->size1==p->nv));	
 	assert(ng&&(p->mratio->size2==ng)&&(p->mmean1->size2==ng)
 		&&(p->mmean2[0]->size1==ng)&&(p->llr5->size1==ng)&&(p->llr1->size==ng)
-		&&(p->llr4->size1==ng)&&(p->llr2->size1==ng)&&(p->llr3->size1==ng)
-		&&(p->mb1[0]->size1==ng));
+		&&(p->llr4->size1==ng)&&(p->llr2->size1==ng)&&(p->llr3->size1==ng));
 	assert(nt&&(p->mmean2[0]->size2==nt)&&(p->llr5->size2==nt)
-		&&(p->llr2->size2==nt)&&(p->llr3->size2==nt)&&(p->mb1[0]->size2==nt));
-	
-	for(i=0;i<p->nv;i++)
-	{
-		MATRIXFF(memcpy)(p->mb1[i],p->mmean2[i]);
-		for(j=0;j<ng;j++)
-		{
-			f1=MATRIXFF(get)(p->mratio,i,j);
-			vv=MATRIXFF(row)(p->mb1[i],j);
-			VECTORFF(scale)(&vv.vector,f1);
-		}
-	}
+		&&(p->llr2->size2==nt)&&(p->llr3->size2==nt));
 	
-	//llr4=llr2=1-sum_alpha f_{alpha i}mu_{alpha ij}^2, using llr3 as buff
-	MATRIXFF(set_zero)(p->llr4);
-	for(i=0;i<p->nv;i++)
-	{
-		MATRIXFF(memcpy)(p->llr3,p->mb1[i]);
-		MATRIXFF(mul_elements)(p->llr3,p->mmean2[i]);
-		MATRIXFF(add)(p->llr4,p->llr3);
-	}
-	MATRIXFF(scale)(p->llr4,-1);
-	MATRIXFF(add_constant)(p->llr4,1);
-	MATRIXFF(memcpy)(p->llr2,p->llr4);
-	//llr1=1-sum_alpha f_{alpha i}mu_{alpha ii}^2, using llr3[:,0] as buff
-	VECTORFF(set_zero)(p->llr1);
-	vv=MATRIXFF(column)(p->llr3,0);
-	for(i=0;i<p->nv;i++)
+	for(i=0;i<ng;i++)
 	{
-		VECTORFF(const_view) vv2=MATRIXFF(const_row)(p->mratio,i);
-		VECTORFF(const_view) vv3=MATRIXFF(const_row)(p->mmean1,i);
-		VECTORFF(memcpy)(&vv.vector,&vv2.vector);
-		VECTORFF(mul)(&vv.vector,&vv3.vector);
-		VECTORFF(mul)(&vv.vector,&vv3.vector);
-		VECTORFF(add)(p->llr1,&vv.vector);
-	}
-	VECTORFF(scale)(p->llr1,-1);
-	VECTORFF(add_constant)(p->llr1,1);
-		
-	//mb1[i][j,k]=mb1[i][j,k]*mmean1[i][j]=f_{ij}mu_{ijj}mu_{ijk}
-	for(i=0;i<p->nv;i++)
-		for(j=0;j<ng;j++)
+		//llr1=1-sum_alpha f_{alpha i}mu_{alpha ii}^2
+		vl1=0;
+		for(k=0;k<p->nv;k++)
 		{
-			vv=MATRIXFF(row)(p->mb1[i],j);
-			VECTORFF(scale)(&vv.vector,MATRIXFF(get)(p->mmean1,i,j));
+			vm1=MATRIXFF(get)(p->mmean1,k,i);
+			vl1+=MATRIXFF(get)(p->mratio,k,i)*vm1*vm1;
 		}
-	//mb1[0]=sum_alpha f_{alpha i}mu_{alpha ii}mu_{alpha ij}
-	for(i=1;i<p->nv;i++)
-		MATRIXFF(add)(p->mb1[0],p->mb1[i]);
-	//mb1[0]=(rho_{ij}-sum_alpha f_{alpha i}mu_{alpha ii}mu_{alpha ij})^2
-	MATRIXFF(sub)(p->mb1[0],p->llr5);
-	MATRIXFF(mul_elements)(p->mb1[0],p->mb1[0]);
-	
-	//llr4=(1-sum_alpha f_{alpha i}mu_{alpha ii}^2)(1-sum_alpha f_{alpha i}mu_{alpha ij}^2)
-	for(i=0;i<ng;i++)
-	{
-		vv=MATRIXFF(row)(p->llr4,i);
-		VECTORFF(scale)(&vv.vector,VECTORFF(get)(p->llr1,i));
-	}
-	//llr4=ML3=(1-sum_alpha f_{alpha i}mu_{alpha ii}^2)(1-sum_alpha f_{alpha i}mu_{alpha ij}^2)-(rho_{ij}-sum_alpha f_{alpha i}mu_{alpha ii}mu_{alpha ij})^2
-	MATRIXFF(sub)(p->llr4,p->mb1[0]);
-	
-	//mb1[1]=(1-rho_{ij}^2)
-	MATRIXFF(memcpy)(p->mb1[1],p->llr5);
-	MATRIXFF(mul_elements)(p->mb1[1],p->llr5);
-	MATRIXFF(scale)(p->mb1[1],-1);
-	MATRIXFF(add_constant)(p->mb1[1],1);
-	
-	//ALL log
-	for(i=0;i<ng;i++)
-	{
-		VECTORFF(set)(p->llr1,i,(FTYPE)log(VECTORFF(get)(p->llr1,i)));
-		for(j=0;j<p->llr4->size2;j++)
+		vl1=1-vl1;
+		for(j0=0;j0<nt;j0+=CONST_TILE_NCOL)
 		{
-			MATRIXFF(set)(p->llr4,i,j,(FTYPE)log(MATRIXFF(get)(p->llr4,i,j)));
-			MATRIXFF(set)(p->llr2,i,j,(FTYPE)log(MATRIXFF(get)(p->llr2,i,j)));
-			MATRIXFF(set)(p->mb1[0],i,j,(FTYPE)log(MATRIXFF(get)(p->mb1[0],i,j)));
-			MATRIXFF(set)(p->mb1[1],i,j,(FTYPE)log(MATRIXFF(get)(p->mb1[1],i,j)));
+			nj=GSL_MIN(CONST_TILE_NCOL,nt-j0);
+			p2=MATRIXFF(ptr)(p->llr2,i,j0);
+			p3=MATRIXFF(ptr)(p->llr3,i,j0);
+			p4=MATRIXFF(ptr)(p->llr4,i,j0);
+			p5=MATRIXFF(ptr)(p->llr5,i,j0);
+			//llr2=sum_alpha f_{alpha i}mu_{alpha ij}^2
+			//llr4=sum_alpha f_{alpha i}mu_{alpha ii}mu_{alpha ij}
+			for(j=0;j<nj;j++)
+				p2[j]=p4[j]=0;
+			for(k=0;k<p->nv;k++)
+			{
+				vf=MATRIXFF(get)(p->mratio,k,i);
+				vm1=MATRIXFF(get)(p->mmean1,k,i);
+				pm2=MATRIXFF(const_ptr)(p->mmean2[k],i,j0);
+				for(j=0;j<nj;j++)
+				{
+					va=pm2[j]*vf;
+					p2[j]+=va*pm2[j];
+					p4[j]+=va*vm1;
+				}
+			}
+			for(j=0;j<nj;j++)
+			{
+				vr=p5[j];
+				//llr2=1-sum_alpha f_{alpha i}mu_{alpha ij}^2
+				p2[j]=1-p2[j];
+				//llr4=ML3=(1-sum_alpha f_{alpha i}mu_{alpha ii}^2)(1-sum_alpha f_{alpha i}mu_{alpha ij}^2)-(rho_{ij}-sum_alpha f_{alpha i}mu_{alpha ii}mu_{alpha ij})^2
+				va=p4[j]-vr;
+				p4[j]=p2[j]*vl1-va*va;
+				//llr3=1-rho_{ij}^2
+				p3[j]=1-vr*vr;
+			}
+			//ALL log
+			for(j=0;j<nj;j++)
+				p2[j]=(FTYPE)log(p2[j]);
+			for(j=0;j<nj;j++)
+				p3[j]=(FTYPE)log(p3[j]);
+			for(j=0;j<nj;j++)
+				p4[j]=(FTYPE)log(p4[j]);
+			//Final values, bounded from 0
+			vm1=(FTYPE)log(vl1);
+			for(j=0;j<nj;j++)
+			{
+				//llr4=log(ML3)-log(llr1)
+				va=p4[j]-vm1;
+				vr=(FTYPE)(-0.5*(va-p3[j]));
+				p3[j]=vr<0?0:vr;
+				vr=(FTYPE)(-0.5*(va-p2[j]));
+				p5[j]=vr<0?0:vr;
+				vr=(FTYPE)(-0.5*va);
+				p4[j]=vr<0?0:vr;
+				vr=(FTYPE)(-0.5*p2[j]);
+				p2[j]=vr<0?0:vr;
+			}
 		}
+		vl1=(FTYPE)(-0.5*log(vl1));
+		VECTORFF(set)(p->llr1,i,vl1<0?0:vl1);
 	}
-	
-	
-	//llr4=log((1-sum_alpha f_{alpha i}mu_{alpha ii}^2)(1-sum_alpha f_{alpha i}mu_{alpha ij}^2)-(rho_{ij}-sum_alpha f_{alpha i}mu_{alpha ii}mu_{alpha ij})^2)-llr1
-	for(i=0;i<ng;i++)
-	{
-		vv=MATRIXFF(row)(p->llr4,i);
-		VECTORFF(add_constant)(&vv.vector,-VECTORFF(get)(p->llr1,i));
-	}
-	
-	//llr3 final
-	MATRIXFF(memcpy)(p->llr3,p->llr4);
-	MATRIXFF(sub)(p->llr3,p->mb1[1]);
-	MATRIXFF(scale)(p->llr3,-0.5);
-	//llr5 final
-	MATRIXFF(memcpy)(p->llr5,p->llr4);
-	MATRIXFF(sub)(p->llr5,p->llr2);
-	MATRIXFF(scale)(p->llr5,-0.5);
+}
 
-	//llr4 final
-	MATRIXFF(scale)(p->llr4,-0.5);
-	
-	//llr2 final
-	MATRIXFF(scale)(p->llr2,-0.5);
+/* Calculates covariance and log likelihood ratios of one block from genotype ratios and means.
+ * t:		MATRIXF (ng,ns) Supernormalized transcript data matrix for A
+ * t2:		MATRIXF (nt,ns) Supernormalized transcript data matrix for B
+ * nv:		Number of possible values for each genotype
+ * mratio,
+ * mmean1,
+ * mmean2:	Genotype ratios and means from pij_gassist_llr_ratioandmean_buffed
+ * llr1-llr5:	See pij_gassist_llr_block.
+ */
+static void pij_gassist_llr_block_calc(const MATRIXF* t,const MATRIXF* t2,size_t nv,const MATRIXF* mratio,const MATRIXF* mmean1,const MATRIXF** mmean2,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5)
+{
+	struct pij_gassist_llr_block_buffed_params llp;
 	
-	//llr1 final
-	VECTORFF(scale)(p->llr1,-0.5);
+	//Calculate covariance
+	MATRIXFF(cov2_bounded)(t,t2,llr5);
+	//Initialize parameter pack
+	llp.ng=t->size1;
+	llp.nv=nv;
+	llp.mratio=mratio;
+	llp.mmean1=mmean1;
+	llp.mmean2=mmean2;
+	llp.llr1=llr1;
+	llp.llr2=llr2;
+	llp.llr3=llr3;
+	llp.llr4=llr4;
+	llp.llr5=llr5;
 	
-	//Bounding from 0
-	VECTORFF(bound_below)(p->llr1,0);
-	MATRIXFF(bound_below)(p->llr2,0);
-	MATRIXFF(bound_below)(p->llr3,0);
-	MATRIXFF(bound_below)(p->llr4,0);
-	MATRIXFF(bound_below)(p->llr5,0);
+	pij_gassist_llr_block_buffed(&llp);
 }
 
 /* Wrapper of pij_gassist_llr_block_buffed. Performs memory allocation and pre-calculations of
@@ -287,13 +316,13 @@ static void pij_gassist_llr_block_buffed(const struct pij_gassist_llr_block_buff
  * g:		MATRIXF (ng,ns) Full genotype data matrix
  * t:		MATRIXF (ng,ns) Supernormalized transcript data matrix for A
  * t2:		MATRIXF (nt,ns) Supernormalized transcript data matrix for B
+ * t2t:		MATRIXF (ns,nt) Transpose of t2
  * nv:		Number of possible values for each genotype
  * llr1:	VECTORF (end-start). Log likelihood ratios for test 1.
  * llr2:	MATRIXF (end-start,nt). Log likelihood ratios for test 2.
  * llr3:	MATRIXF (end-start,nt). Log likelihood ratios for test 3.
  * llr4:	MATRIXF (end-start,nt). Log likelihood ratios for test 4.
  * llr5:	MATRIXF (end-start,nt). Log likelihood ratios for test 5.
- * vb1:		VECTORF (ns). Constant buffer vector, must be set to 1 initially.
  * Return:	0 on success.
  * Notes:	1.	block range only applicable to A, all other transcripts as B are always considered.
  * 			2.	for each row, g must be the best eQTL of t of the same row.
@@ -301,60 +330,151 @@ static void pij_gassist_llr_block_buffed(const struct pij_gassist_llr_block_buff
  * 								nt: number of transcripts for B
  * 								ns: number of samples
  */
-static int pij_gassist_llr_block(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,size_t nv,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5,const VECTORF* vb1)
+static int pij_gassist_llr_block(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,const MATRIXF* t2t,size_t nv,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5)
 {
-#define	CLEANUP	CLEANMATF(mratio)CLEANMATF(mmean1)CLEANAMMATF(mmean2,nv)CLEANAMMATF(mmb1,nv)
+#define	CLEANUP	CLEANMATF(mratio)CLEANMATF(mmean1)CLEANAMMATF(mmean2,nv)
 	size_t	i,j;
 	int		ret;
 	size_t	ng=g->size1;
 	size_t	nt=t2->size1;
 	MATRIXF	*mratio,*mmean1;	//Buffer matrix (nv,ng)
-	struct pij_gassist_llr_block_buffed_params llp;
 	
 	//Memory allocation
 	mmean1=mratio=0;
 	AUTOCALLOC(MATRIXF*,mmean2,nv,200)
-	AUTOCALLOC(MATRIXF*,mmb1,nv,200)
-	if(!(mmean2&&mmb1))
+	if(!mmean2)
 		ERRRET("Not enough memory.")
 	for(i=0,j=1;i<nv;i++)
-		j=j&&(mmean2[i]=MATRIXFF(alloc)(ng,nt))&&(mmb1[i]=MATRIXFF(alloc)(ng,nt));
-	mratio=MATRIXFF(alloc)(nv,ng);
-	mmean1=MATRIXFF(alloc)(nv,ng);
+		j=j&&(mmean2[i]=MATRIXFF(pool_alloc)(ng,nt));
+	mratio=MATRIXFF(pool_alloc)(nv,ng);
+	mmean1=MATRIXFF(pool_alloc)(nv,ng);
 	if(!(mratio&&mmean1&&j))
 		ERRRET("Not enough memory.")
 	
 	//Calculate ratio and mean
-	ret=pij_gassist_llr_ratioandmean(g,t,t2,mratio,mmean1,mmean2,nv,vb1);
+	ret=pij_gassist_llr_ratioandmean(g,t,t2t,mratio,mmean1,mmean2,nv);
 	if(ret)
 		ERRRET("Not enough memory.")
-	//Calculate covariance
-	MATRIXFF(cov2_bounded)(t,t2,llr5);
-	//Initialize parameter pack
-	llp.ng=ng;
-	llp.nv=nv;
-	llp.mratio=(const MATRIXF*)mratio;
-	llp.mmean1=(const MATRIXF*)mmean1;
-	llp.mmean2=(const MATRIXF**)mmean2;
-	llp.llr1=llr1;
-	llp.llr2=llr2;
-	llp.llr3=llr3;
-	llp.llr4=llr4;
-	llp.llr5=llr5;
-	llp.mb1=mmb1;
-	
-	pij_gassist_llr_block_buffed(&llp);
+	pij_gassist_llr_block_calc(t,t2,nv,mratio,mmean1,(const MATRIXF**)mmean2,llr1,llr2,llr3,llr4,llr5);
 	
 	CLEANUP
 	return 0;
 #undef CLEANUP
 }
 
+/* Grows buffer of scratch to at least n elements. Existing content is discarded.
+ * d:		Buffer to grow
+ * nd:		Capacity of buffer, updated
+ * n:		Number of elements needed
+ * size:	Size of each element
+ * Return:	Buffer with capacity of at least n elements, or 0 on failure.
+ */
+static void* pij_gassist_llr_scratch_grow(void* d,size_t* nd,size_t n,size_t size)
+{
+	if(*nd>=n)
+		return d;
+	free(d);
+	d=malloc(n*size);
+	*nd=d?n:0;
+	return d;
+}
+
+/* Same as pij_gassist_llr_block, but with buffers in slot th of scratch s.
+ * Falls back to pij_gassist_llr_block if the slot cannot grow.
+ */
+static int pij_gassist_llr_block_scratch(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,const MATRIXF* t2t,size_t nv,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5,struct pij_gassist_llr_scratch* s,size_t th)
+{
+	size_t	i;
+	size_t	ng=g->size1;
+	size_t	nt=t2->size1;
+	size_t	ns=g->size2;
+	MATRIXFF(view)	mvratio,mvmean1;
+	MATRIXFF(view)	mvmean2[CONST_NV_MAX];
+	MATRIXF*	mmean2[CONST_NV_MAX];
+	
+	s->d[th]=pij_gassist_llr_scratch_grow(s->d[th],&s->n[th],nv*ng*(nt+2),sizeof(FTYPE));
+	s->vs[th]=pij_gassist_llr_scratch_grow(s->vs[th],&s->ns[th],ng*(ns+nv+1),sizeof(size_t));
+	if(!(s->d[th]&&s->vs[th]))
+		return pij_gassist_llr_block(g,t,t2,t2t,nv,llr1,llr2,llr3,llr4,llr5);
+	mvratio=MATRIXFF(view_array)(s->d[th],nv,ng);
+	mvmean1=MATRIXFF(view_array)(s->d[th]+nv*ng,nv,ng);
+	for(i=0;i<nv;i++)
+	{
+		mvmean2[i]=MATRIXFF(view_array)(s->d[th]+nv*ng*2+i*ng*nt,ng,nt);
+		mmean2[i]=&mvmean2[i].matrix;
+	}
+	
+	pij_gassist_llr_ratioandmean_buffed(g,t,t2t,&mvratio.matrix,&mvmean1.matrix,mmean2,nv,s->vs[th]);
+	pij_gassist_llr_block_calc(t,t2,nv,&mvratio.matrix,&mvmean1.matrix,(const MATRIXF**)mmean2,llr1,llr2,llr3,llr4,llr5);
+	return 0;
+}
+
+void pij_gassist_llr_scratch_free(struct pij_gassist_llr_scratch* s)
+{
+	size_t	i;
+	
+	if(!s)
+		return;
+	for(i=0;i<s->nth;i++)
+	{
+		if(s->d)
+			free(s->d[i]);
+		if(s->vs)
+			free(s->vs[i]);
+	}
+	CLEANMEM(s->n)
+	CLEANMEM(s->d)
+	CLEANMEM(s->ns)
+	CLEANMEM(s->vs)
+	CLEANMEM(s->t2t)
+	free(s);
+}
+
+struct pij_gassist_llr_scratch* pij_gassist_llr_scratch_alloc(void)
+{
+#define	CLEANUP			pij_gassist_llr_scratch_free(s);
+	struct pij_gassist_llr_scratch*	s;
+	size_t	nth=(size_t)omp_get_max_threads();
+	
+	s=calloc(1,sizeof(*s));
+	if(!s)
+		ERRRETV(0,"Not enough memory.")
+	s->nth=nth;
+	s->n=calloc(nth,sizeof(*s->n));
+	s->d=calloc(nth,sizeof(*s->d));
+	s->ns=calloc(nth,sizeof(*s->ns));
+	s->vs=calloc(nth,sizeof(*s->vs));
+	if(!(s->n&&s->d&&s->ns&&s->vs))
+		ERRRETV(0,"Not enough memory.")
+	return s;
+#undef	CLEANUP
+}
+
+size_t pij_gassist_llr_scratch_mem(const struct pij_gassist_llr_scratch* s)
+{
+	size_t	i,ans;
+	
+	if(!s)
+		return 0;
+	ans=s->nt2t*sizeof(FTYPE);
+	for(i=0;i<s->nth;i++)
+		ans+=s->n[i]*sizeof(FTYPE)+s->ns[i]*sizeof(size_t);
+	return ans;
+}
+
 int pij_gassist_llr(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5,size_t nv)
 {
-#define	CLEANUP			CLEANVECF(vbuff1)
-	VECTORF	*vbuff1=0;		//(ns) Const buffer, set to all 1.
+	return pij_gassist_llr_buffed(g,t,t2,llr1,llr2,llr3,llr4,llr5,nv,0);
+}
+
+int pij_gassist_llr_buffed(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5,size_t nv,struct pij_gassist_llr_scratch* s)
+{
+#define	CLEANUP			CLEANMATF(t2tp)
+	MATRIXF	*t2tp=0;	//(ns,nt) Transpose of t2 from pool
+	MATRIXFF(view)	mvt2t;
+	const MATRIXF*	t2t;
 	int		ret;
+	struct threading_sched	sch;
 #ifndef NDEBUG
 	size_t	ng,nt,ns;
 
@@ -374,20 +494,39 @@ int pij_gassist_llr(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 		if(tg>=nv)
 			ERRRET("Maximum genotype value "PRINTFSIZET" exceeds the stated maximum possible value "PRINTFSIZET". Please check your input genotype matrix and allele count.",tg,nv-1)
 	}
-	//Buff unit vector
-	vbuff1=VECTORFF(alloc)(g->size2);
-	if(!(vbuff1))
-		ERRRET("Not enough memory.")
-	VECTORFF(set_all)(vbuff1,1);
+	//Transpose of t2 for genotype-bucketed sums
+	if(s)
+		s->t2t=pij_gassist_llr_scratch_grow(s->t2t,&s->nt2t,t2->size1*t2->size2,sizeof(FTYPE));
+	if(s&&s->t2t)
+	{
+		mvt2t=MATRIXFF(view_array)(s->t2t,t2->size2,t2->size1);
+		MATRIXFF(transpose_memcpy)(&mvt2t.matrix,t2);
+		t2t=&mvt2t.matrix;
+	}
+	else
+	{
+		t2tp=MATRIXFF(pool_alloc)(t2->size2,t2->size1);
+		if(!t2tp)
+			ERRRET("Not enough memory.")
+		MATRIXFF(transpose_memcpy)(t2tp,t2);
+		t2t=t2tp;
+	}
+	LOG(10,"Genotype-bucketed means: %.3g FLOPs and %.3g bytes of buffers, compared to %.3g FLOPs and %.3g bytes with dense genotype indicators.",
+		(double)g->size1*(double)g->size2*(double)t2->size1,
+		(double)(t2->size1*t2->size2*sizeof(FTYPE)+g->size1*(g->size2+nv+1)*sizeof(size_t)),
+		2*(double)nv*(double)g->size1*(double)g->size2*(double)t2->size1,
+		(double)(nv*g->size1*g->size2*sizeof(FTYPE)))
 	
 	ret=0;
+	threading_sched_init(&sch,t->size1,0);
 	#pragma omp parallel
 	{
 		size_t	n1,n2;
+		size_t	th=(size_t)omp_get_thread_num();
 		int		retth;
+		double	t0=omp_get_wtime();
 		
-		threading_get_startend(t->size1,&n1,&n2);
-		if(n2>n1)
+		while(threading_sched_next(&sch,&n1,&n2))
 		{
 			MATRIXGF(const_view) mvg=MATRIXGF(const_submatrix)(g,n1,0,n2-n1,g->size2);
 			MATRIXFF(const_view) mvt=MATRIXFF(const_submatrix)(t,n1,0,n2-n1,t->size2);
@@ -398,11 +537,16 @@ int pij_gassist_llr(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 			mvllr3=MATRIXFF(submatrix)(llr3,n1,0,n2-n1,llr3->size2);
 			mvllr4=MATRIXFF(submatrix)(llr4,n1,0,n2-n1,llr4->size2);
 			mvllr5=MATRIXFF(submatrix)(llr5,n1,0,n2-n1,llr5->size2);
-			retth=pij_gassist_llr_block(&mvg.matrix,&mvt.matrix,t2,nv,&vvllr1.vector,&mvllr2.matrix,&mvllr3.matrix,&mvllr4.matrix,&mvllr5.matrix,vbuff1);
+			if(s&&(th<s->nth))
+				retth=pij_gassist_llr_block_scratch(&mvg.matrix,&mvt.matrix,t2,t2t,nv,&vvllr1.vector,&mvllr2.matrix,&mvllr3.matrix,&mvllr4.matrix,&mvllr5.matrix,s,th);
+			else
+				retth=pij_gassist_llr_block(&mvg.matrix,&mvt.matrix,t2,t2t,nv,&vvllr1.vector,&mvllr2.matrix,&mvllr3.matrix,&mvllr4.matrix,&mvllr5.matrix);
 			#pragma omp atomic
 			ret+=retth;
 		}
+		threading_sched_done(&sch,t0);
 	}
+	threading_sched_log(&sch,"pij_gassist_llr");
 
 	if(ret)
 		ERRRET("Failed to calculate nonpermuted log likelihood ratios.")
@@ -413,3 +557,15 @@ int pij_gassist_llr(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF*
 #undef	CLEANUP		
 }
 
+void pij_gassist_llr_mem(size_t ns,size_t nt,size_t nv,size_t* fixed,size_t* perrow)
+{
+	size_t	nth=(size_t)omp_get_max_threads();
+	size_t	row;
+	
+	//Per row of chunk: genotype means of B, ratio and mean of A, and bucketed sample indices
+	row=nv*(nt+2)*sizeof(FTYPE)+(ns+nv+1)*sizeof(size_t);
+	//Each thread holds one chunk of at most 1+ng/(nth*CONST_THREADING_NCHUNK) rows
+	*fixed=ns*nt*sizeof(FTYPE)+nth*row;
+	*perrow=(row+CONST_THREADING_NCHUNK-1)/CONST_THREADING_NCHUNK;
+}
+
@@ -41,6 +41,51 @@ extern "C"
  */
 int pij_gassist_llr(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5,size_t nv);
 
+/* Per-thread scratch of pij_gassist_llr kept between calls, e.g. by pij_gassist_session,
+ * so repeated calls do not allocate chunk buffers again. Buffers grow on demand and
+ * are allocated outside the memory pool.
+ * nth:		Number of thread slots
+ * n:		(nth) Capacity of d in each slot, in number of FTYPEs
+ * d:		(nth) Buffer of genotype ratios and means in each slot
+ * ns:		(nth) Capacity of vs in each slot
+ * vs:		(nth) Buffer of bucketed sample indices and genotype group starts in each slot
+ * nt2t:	Capacity of t2t, in number of FTYPEs
+ * t2t:		Buffer of transpose of t2
+ */
+struct pij_gassist_llr_scratch
+{
+	size_t		nth;
+	size_t*		n;
+	FTYPE**		d;
+	size_t*		ns;
+	size_t**	vs;
+	size_t		nt2t;
+	FTYPE*		t2t;
+};
+
+/* Constructs empty scratch for the maximum number of threads.
+ * Return:	Constructed scratch, or 0 on failure.
+ */
+struct pij_gassist_llr_scratch* pij_gassist_llr_scratch_alloc(void);
+void pij_gassist_llr_scratch_free(struct pij_gassist_llr_scratch* s);
+/* Memory in bytes currently held by scratch. */
+size_t pij_gassist_llr_scratch_mem(const struct pij_gassist_llr_scratch* s);
+
+/* Same as pij_gassist_llr, but takes buffers from scratch s and keeps them there.
+ * If s is 0, buffers are allocated and freed in every call as pij_gassist_llr.
+ */
+int pij_gassist_llr_buffed(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,VECTORF* llr1,MATRIXF* llr2,MATRIXF* llr3,MATRIXF* llr4,MATRIXF* llr5,size_t nv,struct pij_gassist_llr_scratch* s);
+
+/* Temporary memory in bytes needed by pij_gassist_llr on top of its inputs and outputs,
+ * as fixed+perrow*ng for ng rows of g and t. Upper bound with dynamic scheduling.
+ * ns:		Number of samples
+ * nt:		Number of transcripts for B
+ * nv:		Number of possible values for each genotype
+ * fixed:	Output of memory independent of ng
+ * perrow:	Output of memory per row of g and t
+ */
+void pij_gassist_llr_mem(size_t ns,size_t nt,size_t nv,size_t* fixed,size_t* perrow);
+
 
 
 
@@ -58,65 +58,17 @@ static inline int pij_gassist_llrtopij1_1(VECTORF* p1)
  */
 static int pij_gassist_llrtopij_convert_self(MATRIXF* d,const MATRIXG* g,const gsl_histogram * const * h, size_t nv,char nodiag,long nodiagshift)
 {
-#define	CLEANUP	CLEANVECG(vcount)CLEANAMHIST(hreal,nth)CLEANAMHIST(hc,nth)\
-				CLEANMATD(mb1)CLEANMATD(mb2)CLEANMATD(mnull)CLEANMATF(mb3)CLEANVECD(vwidth)
+#define	CLEANUP	CLEANVECG(vcount)if(e){for(i=0;i<nv-1;i++)pij_llrtopij_engine_free(e[i]);AUTOFREE(e)}
 
 	VECTORG		*vcount;
-	size_t		ng=g->size1;
-	size_t		i,nbin;
-	//gsl_histogram **hreal,**hc;
-	MATRIXD		*mb1,*mb2,*mnull;
-	MATRIXF		*mb3;
-	VECTORD		*vwidth;
-	VECTORDF(view)	vv1;
-	size_t		nth;
-
-	mb1=mb2=mnull=0;
-	mb3=0;
-	vwidth=0;
-	vcount=0;
-	//Validity checks
-	{
-		int	nth0=omp_get_max_threads();
-		assert(nth0>0);
-		nth=(size_t)nth0;
-	}
-	
-	
-	AUTOCALLOC(gsl_histogram*,hreal,nth,64)
-	AUTOCALLOC(gsl_histogram*,hc,nth,64)
-	if(!(hreal&&hc))
-		ERRRET("Not enough memory.");
+	size_t		i;
+	int			ret;
 
-	//Construct null density histograms
-	nbin=h[0]->n;
-	//Memory allocation
-	{
-		size_t	n1,n2;
-		pij_llrtopij_convert_histograms_get_buff_sizes(nbin,&n1,&n2);
-		mb1=MATRIXDF(alloc)(nth,n1);
-		mb2=MATRIXDF(alloc)(nth,n2);
-		mnull=MATRIXDF(alloc)(nth,nbin);
-		mb3=MATRIXFF(alloc)(nth,d->size2);
-		vwidth=VECTORDF(alloc)(nbin);
-		if(!(mb1&&mb2&&mnull&&mb3&&vwidth))
-			ERRRET("Not enough memory.")
-	}
-	
-	//Prepare for real histogram
-	{
-		int	ret;
-		for(i=0,ret=1;i<nth;i++)
-		{
-			hreal[i]=gsl_histogram_clone(h[0]);
-			hc[i]=gsl_histogram_alloc(hreal[i]->n+2);
-			ret=ret&&hreal[i]&&hc[i];
-		}
-		vcount=VECTORGF(alloc)(ng);
-		if(!(ret&&vcount))
-			ERRRET("Not enough memory.");
-	}
-	
+	assert(nv>=2);
+	AUTOCALLOC(struct pij_llrtopij_engine*,e,nv-1,32)
+	vcount=VECTORGF(alloc)(g->size1);
+	if(!(vcount&&e))
+		ERRRET("Not enough memory.");
 	{
 		VECTORUC	*vb4=VECTORUCF(alloc)(nv);
 		if(!vb4)
@@ -125,63 +77,16 @@ static int pij_gassist_llrtopij_convert_self(MATRIXF* d,const MATRIXG* g,const g
 		CLEANVECUC(vb4)
 	}
 	
-	//Conversion
-	for(i=2;i<=nv;i++)
+	//Conversion in one pass, with each row using the null histogram for its number of genotype values
+	for(i=0,ret=1;i<nv-1;i++)
 	{
-		vv1=VECTORDF(view_array)(h[i-2]->range+1,nbin);
-		VECTORDF(memcpy)(vwidth,&vv1.vector);
-		vv1=VECTORDF(view_array)(h[i-2]->range,nbin);
-		VECTORDF(sub)(vwidth,&vv1.vector);
-		vv1=VECTORDF(view_array)(h[i-2]->bin,nbin);
-		#pragma omp parallel
-		{
-			size_t	ng1,ng2,id;
-			size_t	j;
-			long	k;
-			VECTORDF(view)	vvreal,vvnull,vvb1,vvb2;
-			VECTORFF(view)	vvb3,vva;
-		
-			id=(size_t)omp_get_thread_num();
-			vvreal=VECTORDF(view_array)(hreal[id]->bin,nbin);
-			vvnull=MATRIXDF(row)(mnull,id);
-			vvb1=MATRIXDF(row)(mb1,id);
-			vvb2=MATRIXDF(row)(mb2,id);
-			vvb3=MATRIXFF(row)(mb3,id);
-			threading_get_startend(ng,&ng1,&ng2);
-			
-			for(j=ng1;j<ng2;j++)
-				if(VECTORGF(get)(vcount,j)==i)
-				{
-					MATRIXFF(get_row)(&vvb3.vector,d,j);
-					VECTORDF(memcpy)(&vvnull.vector,&vv1.vector);
-					memcpy(hreal[id]->range,h[i-2]->range,(nbin+1)*sizeof(*hreal[id]->range));
-					memset(hreal[id]->bin,0,nbin*sizeof(*hreal[id]->bin));
-					//Construct real histogram
-					if(nodiag&&((long)j+nodiagshift>=0)&&((long)j+nodiagshift<(long)d->size2))
-					{
-						for(k=(long)j+nodiagshift-1;k>=0;k--)
-							gsl_histogram_increment(hreal[id],MATRIXFF(get)(d,j,(size_t)k));
-						for(k=(long)j+nodiagshift+1;k<(long)d->size2;k++)
-							gsl_histogram_increment(hreal[id],MATRIXFF(get)(d,j,(size_t)k));
-						VECTORDF(scale)(&vvreal.vector,1./(double)(d->size2-1));
-					}
-					else
-					{
-						for(k=0;k<(long)d->size2;k++)
-							gsl_histogram_increment(hreal[id],MATRIXFF(get)(d,j,(size_t)k));
-						VECTORDF(scale)(&vvreal.vector,1./(double)(d->size2));
-					}					
-
-					//Convert to density histogram
-					VECTORDF(div)(&vvreal.vector,vwidth);
-					//Convert to probability central histogram
-					pij_llrtopij_convert_histograms_buffed(hreal[id],&vvnull.vector,hc[id],&vvb1.vector,&vvb2.vector);
-					//Convert likelihoods to probabilities
-					vva=MATRIXFF(row)(d,j);
-					pij_llrtopij_histogram_interpolate_linear(hc[id],&vvb3.vector,&vva.vector);
-				}
-		}
+		e[i]=pij_llrtopij_engine_alloc(h[i]);
+		ret=ret&&e[i];
 	}
+	if(!ret)
+		ERRRET("pij_llrtopij_engine_alloc failed.")
+	if(pij_llrtopij_engine_convert_multi((const struct pij_llrtopij_engine* const*)e,nv-1,d,d,d,vcount,2,nodiag,nodiagshift))
+		ERRRET("pij_llrtopij_engine_convert_multi failed.")
 	CLEANUP
 	return 0;
 #undef	CLEANUP
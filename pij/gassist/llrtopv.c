@@ -132,6 +132,7 @@ static int pij_gassist_llrtopvs_block(VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIX
 int pij_gassist_llrtopvs(VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF* p5,const MATRIXG* g,size_t nv)
 {
 	int	ret=0;
+	struct threading_sched	sch;
 	assert((p1->size==g->size1)&&(p2->size1==g->size1)&&(p3->size1==g->size1)&&(p4->size1==g->size1)&&(p5->size1==g->size1));
 	assert((p2->size2==p3->size2)&&(p2->size2==p4->size2)&&(p2->size2==p5->size2));
 	
@@ -141,13 +142,14 @@ int pij_gassist_llrtopvs(VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF
 		return 1;
 	}
 	
+	threading_sched_init(&sch,p1->size,0);
 	#pragma omp parallel
 	{
 		size_t	ng1,ng2;
 		int		ret2=0;
+		double	t0=omp_get_wtime();
 
-		threading_get_startend(p1->size,&ng1,&ng2);
-		if(ng2>ng1)
+		while(threading_sched_next(&sch,&ng1,&ng2))
 		{
 			size_t			dn=ng2-ng1;
 			VECTORFF(view)	vv1;
@@ -158,11 +160,13 @@ int pij_gassist_llrtopvs(VECTORF* p1,MATRIXF* p2,MATRIXF* p3,MATRIXF* p4,MATRIXF
 			mv3=MATRIXFF(submatrix)(p3,ng1,0,dn,p2->size2);
 			mv4=MATRIXFF(submatrix)(p4,ng1,0,dn,p2->size2);
 			mv5=MATRIXFF(submatrix)(p5,ng1,0,dn,p2->size2);
-			ret2=pij_gassist_llrtopvs_block(&vv1.vector,&mv2.matrix,&mv3.matrix,&mv4.matrix,&mv5.matrix,&mvg.matrix,nv);
+			ret2=pij_gassist_llrtopvs_block(&vv1.vector,&mv2.matrix,&mv3.matrix,&mv4.matrix,&mv5.matrix,&mvg.matrix,nv)||ret2;
 		}
+		threading_sched_done(&sch,t0);
 		#pragma omp critical
 			ret=ret||ret2;
 	}
+	threading_sched_log(&sch,"pij_gassist_llrtopvs");
 	return ret;
 }
 
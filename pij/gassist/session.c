@@ -0,0 +1,148 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "../../base/config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "../../base/logger.h"
+#include "../../base/macros.h"
+#include "../../base/const.h"
+#include "../../base/supernormalize.h"
+#include "../../base/data_process.h"
+#include "../../base/numa.h"
+#include "gassist.h"
+#include "session.h"
+
+void pij_gassist_session_free(struct pij_gassist_session* s)
+{
+	if(!s)
+		return;
+	CLEANMATF(s->tnew)
+	CLEANMATF(s->t2new)
+	CLEANMATF(s->t2sub)
+	CLEANVECF(s->p1)
+	CLEANMATF(s->p2)
+	CLEANMATF(s->p3)
+	CLEANMATF(s->p4)
+	pij_gassist_llr_scratch_free(s->sc);
+	free(s);
+}
+
+struct pij_gassist_session* pij_gassist_session_alloc(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,size_t nv,char nodiag,size_t memlimit)
+{
+#define	CLEANUP			pij_gassist_session_free(s);
+	struct pij_gassist_session*	s;
+	
+	assert(g&&t&&t2);
+	assert((g->size2==t->size2)&&(g->size2==t2->size2)&&(t->size1==g->size1)&&(nv>1));
+	assert(!(nv>CONST_NV_MAX));
+	assert(memlimit);
+	s=calloc(1,sizeof(*s));
+	if(!s)
+		ERRRETV(0,"Not enough memory.")
+	s->g=g;
+	s->nv=nv;
+	s->nodiag=nodiag;
+	s->memlimit=memlimit;
+	//Supernormalized copies are kept by session
+	s->memt=supernormalize_input_mem2(t,t2);
+	if(memlimit<=s->memt)
+		ERRRETV(0,"Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
+
+	//Check for identical rows in input data
+	MATRIXFF(cmprow_auto)(t,t2,nodiag,1);
+	
+	LOG(9,"Supernormalizing...")
+	if(supernormalizea_byrow_input2(t,t2,&s->t,&s->t2,&s->tnew,&s->t2new))
+		ERRRETV(0,"Supernormalization failed.")
+	return s;
+#undef	CLEANUP
+}
+
+int pij_gassist_session_run(struct pij_gassist_session* s,const size_t* rows,size_t nb,MATRIXF* ans)
+{
+#define	CLEANUP
+	size_t	ng,nt,ns,i,mem0;
+	MATRIXFF(view)	mvt2,mvp2,mvp3,mvp4;
+	const MATRIXF*	t2now;	//(nb,ns) Supernormalized data of the Bs
+	
+	ng=s->t->size1;
+	nt=s->t2->size1;
+	ns=s->t->size2;
+	assert((ans->size1==ng)&&(ans->size2==nb));
+	if(!rows&&(nb!=nt))
+		ERRRET("Number of B genes must match session without subset.")
+	if(rows&&s->nodiag)
+		ERRRET("Subsets of B are not supported for sessions with nodiag.")
+	if(!nb)
+		return 0;
+	
+	//Allocate buffers at first use
+	if(!s->p1)
+	{
+		s->p1=VECTORFF(alloc)(ng);
+		s->p2=MATRIXFF(alloc_numa)(ng,nt);
+		s->p3=MATRIXFF(alloc_numa)(ng,nt);
+		s->p4=MATRIXFF(alloc_numa)(ng,nt);
+		s->sc=pij_gassist_llr_scratch_alloc();
+		if(!(s->p1&&s->p2&&s->p3&&s->p4&&s->sc))
+		{
+			CLEANVECF(s->p1)CLEANMATF(s->p2)CLEANMATF(s->p3)CLEANMATF(s->p4)
+			pij_gassist_llr_scratch_free(s->sc);
+			s->sc=0;
+			ERRRET("Not enough memory.")
+		}
+	}
+	//Memory of session storage not counted by pijs_gassist_normalized
+	mem0=(3*ng*(nt-nb)+(rows?nt*ns:0))*sizeof(FTYPE)+s->memt+pij_gassist_llr_scratch_mem(s->sc);
+	
+	if(rows)
+	{
+		if(!s->t2sub)
+		{
+			s->t2sub=MATRIXFF(alloc_numa)(nt,ns);
+			if(!s->t2sub)
+				ERRRET("Not enough memory.")
+		}
+		mvt2=MATRIXFF(submatrix)(s->t2sub,0,0,nb,ns);
+		for(i=0;i<nb;i++)
+		{
+			VECTORFF(const_view)	vv1;
+			VECTORFF(view)	vv2;
+			if(rows[i]>=nt)
+				ERRRET("Index of B out of range.")
+			vv1=MATRIXFF(const_row)(s->t2,rows[i]);
+			vv2=MATRIXFF(row)(&mvt2.matrix,i);
+			VECTORFF(memcpy)(&vv2.vector,&vv1.vector);
+		}
+		t2now=&mvt2.matrix;
+	}
+	else
+		t2now=s->t2;
+	if(s->memlimit<=mem0)
+		ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
+	
+	mvp2=MATRIXFF(submatrix)(s->p2,0,0,ng,nb);
+	mvp3=MATRIXFF(submatrix)(s->p3,0,0,ng,nb);
+	mvp4=MATRIXFF(submatrix)(s->p4,0,0,ng,nb);
+	if(pijs_gassist_normalized(s->g,s->t,t2now,s->p1,&mvp2.matrix,&mvp3.matrix,&mvp4.matrix,ans,s->nv,s->nodiag,s->memlimit-mem0,s->sc))
+		ERRRET("pijs_gassist_normalized failed.")
+	pij_gassist_combine(ans,&mvp2.matrix,&mvp4.matrix);
+	return 0;
+#undef	CLEANUP
+}
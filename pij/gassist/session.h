@@ -0,0 +1,94 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This part contains the session interface of genotype assisted pij inference,
+ * for repeated inferences on the same A and B genes.
+ */
+
+#ifndef _HEADER_LIB_PIJ_GASSIST_SESSION_H_
+#define _HEADER_LIB_PIJ_GASSIST_SESSION_H_
+#include "../../base/config.h"
+#include "../../base/types.h"
+#include "llr.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Session of genotype assisted pij inference. It keeps the supernormalized expression
+ * data, the buffers of intermediate probabilities, and the per-thread scratch of LLR
+ * calculation, so that repeated calls of pij_gassist_session_run only compute LLRs
+ * and their conversion without reallocation.
+ * g:		(ng,ns) Genotype data. Not owned by session and must stay valid.
+ * t:		(ng,ns) Supernormalized expression data of A.
+ * t2:		(nt,ns) Supernormalized expression data of B.
+ * 			Both are from supernormalizea_byrow_input2, so they follow the input mode of
+ * 			supernormalize_setinput, and may be the inputs themselves, which must then stay valid.
+ * tnew,
+ * t2new:	Supernormalized copies or views owned by session behind t and t2, or 0 if none.
+ * memt:	Memory in bytes of the supernormalized copies.
+ * t2sub:	(nt,ns) Buffer for subsets of B. Allocated at first use.
+ * p1:		(ng) Buffer of probabilities of step 1. Allocated at first use.
+ * p2,
+ * p3,
+ * p4:		(ng,nt) Buffers of probabilities of steps 2 to 4. Allocated at first use.
+ * sc:		Per-thread scratch of LLR calculation. Allocated at first use and grown on demand.
+ * nv:		Number of possible values each genotype entry may take.
+ * nodiag:	Whether the top ng rows of t2 are exactly t. See pij_gassist.
+ * memlimit:	Approximate memory usage limit of session, including its own storage and memt.
+ */
+struct pij_gassist_session
+{
+	const MATRIXG*	g;
+	const MATRIXF*	t;
+	const MATRIXF*	t2;
+	MATRIXF*	tnew;
+	MATRIXF*	t2new;
+	size_t		memt;
+	MATRIXF*	t2sub;
+	VECTORF*	p1;
+	MATRIXF*	p2;
+	MATRIXF*	p3;
+	MATRIXF*	p4;
+	struct pij_gassist_llr_scratch*	sc;
+	size_t		nv;
+	char		nodiag;
+	size_t		memlimit;
+};
+
+/* Constructs session for pij_gassist. Input expression data are supernormalized according to
+ * the input mode of supernormalize_setinput, so rows of t shared with t2 are processed once.
+ * Variables have the same definitions as pij_gassist.
+ * Return:	Constructed session, or 0 on failure.
+ */
+struct pij_gassist_session* pij_gassist_session_alloc(const MATRIXG* g,const MATRIXF* t,const MATRIXF* t2,size_t nv,char nodiag,size_t memlimit);
+void pij_gassist_session_free(struct pij_gassist_session* s);
+
+/* Estimates the probability of A->B for all A and a subset of B in session, same as pij_gassist.
+ * s:		Session
+ * rows:	(nb) Indices of B in t2 of session. If 0, all Bs are used and nb must be nt.
+ * 			Subsets require s->nodiag=0.
+ * nb:		Number of Bs.
+ * ans:		(ng,nb) Predicted probability of A->B.
+ * Return:	0 on success.
+ */
+int pij_gassist_session_run(struct pij_gassist_session* s,const size_t* rows,size_t nb,MATRIXF* ans);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -29,29 +29,33 @@
 #include "../base/data_process.h"
 #include "../base/histogram.h"
 #include "../base/threading.h"
+#include "../base/const.h"
 #include "nullhist.h"
 #include "llrtopij.h"
 
 // #pragma GCC diagnostic ignored "-Wunused-parameter"
 
+//Maximum half size of Gaussian convolution mask in histogram smoothening
+#define	PIJ_LLRTOPIJ_NCUT_MAX	50
+
 /* Smoothen true ratio histogram to make it monotonically increasing
  * Method:	1.	Construct increasing upper bound histogram (hup)
  * 				so every bin is max(self,left neighbor of self)
  * 			2.	Construct increasing lower bound histogram (hlow)
  * 				so every bin is min(self,right neighbor of self)
  * 			3.	Return (hup+hlow)/2
- * h:		[n] double histogram to be smoothened
+ * bin:		[n] double histogram bins to be smoothened
  * 			Input as histogram of true ratio and,
  * 			output as smoothened histogram of true ratio
  * n:		size of histogram
- * Return:	0 on success.
+ * hup:		[n] Buffer
  */
-static void pij_llrtopij_histogram_force_incremental_buffed(gsl_histogram *h,VECTORD* hup)
+static void pij_llrtopij_histogram_force_incremental_buffed(double* bin,size_t n,VECTORD* hup)
 {
-	VECTORDF(view)	hlow=VECTORDF(view_array)(h->bin,h->n);
+	VECTORDF(view)	hlow=VECTORDF(view_array)(bin,n);
 	size_t	i;
 	
-	assert(hup->size==h->n);
+	assert(hup->size==n);
 	VECTORDF(memcpy)(hup,&hlow.vector);
 	//Step 1
 	for(i=1;i<hup->size;i++)
@@ -64,29 +68,22 @@ static void pij_llrtopij_histogram_force_incremental_buffed(gsl_histogram *h,VEC
 	VECTORDF(scale)(&hlow.vector,0.5);
 }
 
-/* Smoothen 1D histogram with buffer provided as the following:
- * 1. Calculate bin differences.
- * 2. Extrapolates with fixed boundary values to ensure same size of histogram
- * 3. Convolution with Gaussian filter.
- * 4. Calculate cumulative sum
- * 5. Scale and shift to original head-tail positions
- * WARNING:	Gaussian filter applied using bin index as distance measure,
- * 			not the actual histogram range.
- * h:		[n] double histogram to be smoothened
- * n:		size of histogram
+// Sigma of Gaussian filter for histogram smoothening with mask size 2*ncut+1
+static inline double pij_llrtopij_histogram_smoothen_sigma(size_t ncut)
+{
+	return GSL_MIN((double)ncut/3.,30.);
+}
+
+/* Construct normalized convolution mask for histogram smoothening.
  * sigma:	sigma of Gaussian filter
  * ncut:	size of Gaussian convolution vector is 2*ncut+1
- * vlarge:	[n+2*ncut-1] Buffer for data before convolution
- * vconv:	[2*ncut+1] Buffer for convolution mask.
- * Return:	0 on success
+ * vconv:	[2*ncut+1] Output of convolution mask.
  */
-static void pij_llrtopij_histogram_smoothen_buffed(gsl_histogram *h,double sigma,size_t ncut,VECTORD *vlarge,VECTORD *vconv)
+static void pij_llrtopij_histogram_smoothen_mask(double sigma,size_t ncut,VECTORD *vconv)
 {
-	VECTORDF(view)	vv1,vv2;
-	double	tmp,dmin,ddiff,t1,t2;
+	double	tmp;
 	size_t	i;
-
-	assert(vlarge->size==h->n+2*ncut-1);
+	
 	assert(vconv->size==2*ncut+1);
 	//Construct convolution vector
 	VECTORDF(set)(vconv,ncut,1);
@@ -101,10 +98,34 @@ static void pij_llrtopij_histogram_smoothen_buffed(gsl_histogram *h,double sigma
 	for(i=0,tmp=0;i<=2*ncut;i++)
 		tmp+=VECTORDF(get)(vconv,i);
 	VECTORDF(scale)(vconv,1/tmp);
+}
+
+/* Smoothen 1D histogram with buffer provided as the following:
+ * 1. Calculate bin differences.
+ * 2. Extrapolates with fixed boundary values to ensure same size of histogram
+ * 3. Convolution with Gaussian filter.
+ * 4. Calculate cumulative sum
+ * 5. Scale and shift to original head-tail positions
+ * WARNING:	Gaussian filter applied using bin index as distance measure,
+ * 			not the actual histogram range.
+ * bin:		[n] double histogram bins to be smoothened
+ * n:		size of histogram
+ * ncut:	size of Gaussian convolution vector is 2*ncut+1
+ * vlarge:	[n+2*ncut-1] Buffer for data before convolution
+ * vconv:	[2*ncut+1] Convolution mask from pij_llrtopij_histogram_smoothen_mask.
+ */
+static void pij_llrtopij_histogram_smoothen_buffed(double* bin,size_t n,size_t ncut,VECTORD *vlarge,const VECTORD *vconv)
+{
+	VECTORDF(view)	vv1,vv2;
+	double	tmp,dmin,ddiff,t1,t2;
+	size_t	i;
+
+	assert(vlarge->size==n+2*ncut-1);
+	assert(vconv->size==2*ncut+1);
 	
 	//Construct difference vector
-	vv1=VECTORDF(subvector)(vlarge,ncut-1,h->n);
-	vv2=VECTORDF(view_array)(h->bin,h->n);
+	vv1=VECTORDF(subvector)(vlarge,ncut-1,n);
+	vv2=VECTORDF(view_array)(bin,n);
 	VECTORDF(minmax)(&vv2.vector,&dmin,&ddiff);
 	ddiff-=dmin;
 	if(!ddiff)
@@ -121,10 +142,10 @@ static void pij_llrtopij_histogram_smoothen_buffed(gsl_histogram *h,double sigma
 	VECTORDF(set_all)(&vv1.vector,tmp);
 	
 	//Convolution
-	for(i=1;i<h->n;i++)
+	for(i=1;i<n;i++)
 	{
 		vv1=VECTORDF(subvector)(vlarge,i-1,2*ncut+1);
-		gsl_blas_ddot(&vv1.vector,vconv,h->bin+i);
+		gsl_blas_ddot(&vv1.vector,vconv,bin+i);
 	}
 	
 	//Cumulative sum and recover original mean and difference
@@ -135,6 +156,50 @@ static void pij_llrtopij_histogram_smoothen_buffed(gsl_histogram *h,double sigma
 	VECTORDF(add_constant)(&vv2.vector,dmin-t1*ddiff/(t2-t1));
 }
 
+void pij_llrtopij_histogram_central_range(const double* range,size_t n,double* rangec)
+{
+	VECTORDF(view)	vv1;
+	VECTORDF(const_view)	vv2;
+	
+	memcpy(rangec+1,range+1,n*sizeof(*rangec));
+	vv1=VECTORDF(view_array)(rangec+1,n+1);
+	vv2=VECTORDF(const_view_array)(range,n+1);
+	VECTORDF(add)(&vv1.vector,&vv2.vector);
+	VECTORDF(scale)(&vv1.vector,0.5);
+	rangec[0]=range[0];
+	rangec[n+1]=range[n];
+	rangec[n+2]=rangec[n+1]+fabs(rangec[n+1]);
+}
+
+/* Construct central value histogram bins from bounded histogram bins.
+ * bin:		(n) Input bounded histogram bins
+ * n:		Number of bins of bounded histogram
+ * binc:	(n+2) Output central histogram bins
+ */
+static inline void pij_llrtopij_histogram_central_bins(const double* bin,size_t n,double* binc)
+{
+	memcpy(binc+1,bin,n*sizeof(*binc));
+	//Use fixed boundary condition
+	binc[0]=binc[1];
+	binc[n+1]=binc[n];
+}
+
+struct histogram_locator* pij_llrtopij_histogram_central_locator(const double* range,size_t n)
+{
+#define	CLEANUP	CLEANPOOL(rangec)
+	struct histogram_locator*	ans;
+	double*	rangec;
+	
+	rangec=pool_malloc((n+3)*sizeof(*rangec));
+	if(!rangec)
+		ERRRETV(0,"Not enough memory.")
+	pij_llrtopij_histogram_central_range(range,n,rangec);
+	ans=histogram_locator_alloc(rangec,n+2);
+	CLEANUP
+	return ans;
+#undef	CLEANUP
+}
+
 /* Construct central value histogram from bounded histogram for interpolation.
  * In central value histogram, bin[i] is the value at range[i].
  * h:		(nbin) Input bounded histogram
@@ -142,23 +207,9 @@ static void pij_llrtopij_histogram_smoothen_buffed(gsl_histogram *h,double sigma
  */
 static void pij_llrtopij_histogram_to_central(const gsl_histogram *h,gsl_histogram* hc)
 {
-	size_t	n;
-	VECTORDF(view)	vv1,vv2;
-	
 	assert(hc->n==h->n+2);
-	n=h->n;
-	memcpy(hc->range+1,h->range+1,n*sizeof(*hc->range));
-	vv1=VECTORDF(view_array)(hc->range+1,n+1);
-	vv2=VECTORDF(view_array)(h->range,n+1);
-	VECTORDF(add)(&vv1.vector,&vv2.vector);
-	VECTORDF(scale)(&vv1.vector,0.5);
-	hc->range[0]=h->range[0];
-	hc->range[n+1]=h->range[n];
-	hc->range[n+2]=hc->range[n+1]+fabs(hc->range[n+1]);
-	memcpy(hc->bin+1,h->bin,h->n*sizeof(*hc->bin));
-	//Use fixed boundary condition
-	hc->bin[0]=hc->bin[1];
-	hc->bin[h->n+1]=hc->bin[h->n];
+	pij_llrtopij_histogram_central_range(h->range,h->n,hc->range);
+	pij_llrtopij_histogram_central_bins(h->bin,h->n,hc->bin);
 }
 
 void pij_llrtopij_histogram_interpolate_linear(const gsl_histogram *hc,const VECTORF* d,VECTORF* ans)
@@ -182,11 +233,33 @@ void pij_llrtopij_histogram_interpolate_linear(const gsl_histogram *hc,const VEC
 	}
 }
 
+void pij_llrtopij_histogram_interpolate_linear_located(const struct histogram_locator* l,const double* bin,const VECTORF* d,VECTORF* ans)
+{
+	size_t	i;
+	size_t	loc;
+	FTYPE	f;
+	const double	*range=l->range;
+	const size_t	n=l->n;
+	
+	for(i=0;i<d->size;i++)
+	{
+		f=VECTORFF(get)(d,i);
+		if(f<=range[0])
+			VECTORFF(set)(ans,i,(FTYPE)bin[0]);
+		else if(f>=range[n])
+			VECTORFF(set)(ans,i,(FTYPE)bin[n-1]);
+		else if(!histogram_locator_find(l,f,&loc))
+			VECTORFF(set)(ans,i,(FTYPE)(bin[loc]+(f-range[loc])*(bin[loc+1]-bin[loc])/(range[loc+1]-range[loc])));
+		else
+			VECTORFF(set)(ans,i,f);
+	}
+}
+
 void pij_llrtopij_convert_histograms_get_buff_sizes(size_t n,size_t *n1,size_t *n2)
 {
 	size_t ncut;
 
-	ncut=GSL_MIN(n/2,50);
+	ncut=GSL_MIN(n/2,PIJ_LLRTOPIJ_NCUT_MAX);
 	*n1=n+2*ncut-1;
 	*n2=2*ncut+1;
 }
@@ -197,83 +270,96 @@ int pij_llrtopij_convert_histograms_make_buffs(size_t n,VECTORD** vb1,VECTORD**
 	size_t n1,n2;
 	
 	pij_llrtopij_convert_histograms_get_buff_sizes(n,&n1,&n2);
-	*vb1=VECTORDF(alloc)(n1);
-	*vb2=VECTORDF(alloc)(n2);
+	*vb1=VECTORDF(pool_alloc)(n1);
+	*vb2=VECTORDF(pool_alloc)(n2);
 	if(!(*vb1&&*vb2))
 		ERRRET("Not enough memory.")
 	return 0;
 #undef	CLEANUP
 }
 
-void pij_llrtopij_convert_histograms_buffed(gsl_histogram* hreal,VECTORD* vnull,gsl_histogram* hc,VECTORD* vb1,VECTORD* vb2)
+/* Convert density histograms of null and real distribution into smoothened
+ * true ratio histogram on bin arrays. See pij_llrtopij_convert_histograms_buffed.
+ * real:	(nbin) Real density histogram as input, and true ratio histogram as output.
+ * vnull:	(nbin) Null density histogram.
+ * nbin:	Number of bins.
+ * masks:	Precomputed convolution masks in the format of struct pij_llrtopij_engine,
+ * 			or 0 to construct mask in vb2.
+ * vb1:		Buffer of size from pij_llrtopij_convert_histograms_get_buff_sizes.
+ * vb2:		Buffer of size from pij_llrtopij_convert_histograms_get_buff_sizes.
+ * 			Only used when masks is 0.
+ */
+static void pij_llrtopij_convert_bins_buffed(double* real,const double* vnull,size_t nbin,const double* masks,VECTORD* vb1,VECTORD* vb2)
 {
 	size_t	minpos;		//Position of minimum true density		
-	double	ndens;
-	double	psmooth;
-	size_t	nbin=hreal->n,ncut,nb;
+	double	ndens,vtail;
+	size_t	ncut,nb;
 	size_t	i;
-	VECTORDF(view)	vv1,vvreal,vv2,vvnull,vv3;
+	VECTORDF(view)	vv1,vv2;
 
 	//Trim trailing 0s in histogram	
-	for(nb=nbin-1;nb&&(!hreal->bin[nb]);nb--);
+	for(nb=nbin-1;nb&&(!real[nb]);nb--);
 	nb++;
 	//If all in smallest histogram, then output zeros
 	if(nb==1)
 	{
-		vv1=VECTORDF(view_array)(hreal->bin,hreal->n);
-		VECTORDF(set_all)(&vv1.vector,0);
-		pij_llrtopij_histogram_to_central(hreal,hc);
+		memset(real,0,nbin*sizeof(*real));
 		return;
 	}
 
-	ncut=GSL_MIN(nb/2,50);
-	assert(vb1->size>=hreal->n+2*ncut-1);
-	assert(vb2->size>=2*ncut+1);
-	assert((vnull->size==nbin)&&(hc->n==nbin+2));
-	vvreal=VECTORDF(view_array)(hreal->bin,nb);
-	vvnull=VECTORDF(subvector)(vnull,0,nb);
-	for(i=1;i<nb;i++)
-		if(!hreal->bin[i])
-			hreal->bin[i]=hreal->bin[i-1];
-
-	//Find minimum location
-	VECTORDF(div)(&vvnull.vector,&vvreal.vector);
+	ncut=GSL_MIN(nb/2,PIJ_LLRTOPIJ_NCUT_MAX);
+	assert(vb1->size>=nbin+2*ncut-1);
 	//Fill zeros with the one before
-	minpos=VECTORDF(max_index)(&vvnull.vector);
-	ndens=1/VECTORDF(get)(&vvnull.vector,minpos);
+	for(i=1;i<nb;i++)
+		if(!real[i])
+			real[i]=real[i-1];
+
+	//Find minimum location of null to real density ratio, computed in place
+	for(i=0;i<nb;i++)
+		real[i]=vnull[i]/real[i];
+	vv1=VECTORDF(view_array)(real,nb);
+	minpos=VECTORDF(max_index)(&vv1.vector);
+	ndens=1/real[minpos];
 	if(ndens==0)
 	{
-		vv1=VECTORDF(view_array)(hreal->bin,hreal->n);
-		VECTORDF(set_all)(&vv1.vector,1);
-		pij_llrtopij_histogram_to_central(hreal,hc);
+		for(i=0;i<nbin;i++)
+			real[i]=1;
 		return;
 	}
-	//Calculate true distribution ratio
-	VECTORDF(scale)(&vvnull.vector,-ndens);
-	VECTORDF(add_constant)(&vvnull.vector,1);
-	if(nb<nbin)
-	{
-		vv1=VECTORDF(subvector)(vnull,nb,nbin-nb);
-		VECTORDF(set_all)(&vv1.vector,VECTORDF(get)(&vvnull.vector,nb-1));
-	}
-	
-	//Trim true ratio so bin location<=minpos all become zero
-	vv1=VECTORDF(subvector)(&vvnull.vector,0,minpos+1);
-	VECTORDF(set_zero)(&vv1.vector);
-	vvreal=VECTORDF(view_array)(hreal->bin,nbin);
-	VECTORDF(memcpy)(&vvreal.vector,vnull);
+	//Calculate true distribution ratio, and trim so bin location<=minpos all become zero
+	vtail=real[nb-1]*(-ndens)+1;
+	for(i=0;i<=minpos;i++)
+		real[i]=0;
+	for(;i<nb;i++)
+		real[i]=real[i]*(-ndens)+1;
+	for(i=nb;i<nbin;i++)
+		real[i]=vtail;
 	
 	//Convert true ratio to monotonic function and smoothening
-	vv3=VECTORDF(subvector)(vb1,0,hreal->n);
-	pij_llrtopij_histogram_force_incremental_buffed(hreal,&vv3.vector);
+	vv1=VECTORDF(subvector)(vb1,0,nbin);
+	pij_llrtopij_histogram_force_incremental_buffed(real,nbin,&vv1.vector);
 	//Slightly smoothen before convert to monotonic function
-	psmooth=GSL_MIN((double)ncut/3.,30.);
-	vv1=VECTORDF(subvector)(vb1,0,hreal->n+2*ncut-1);
-	vv2=VECTORDF(subvector)(vb2,0,2*ncut+1);
-	pij_llrtopij_histogram_smoothen_buffed(hreal,psmooth,ncut,&vv1.vector,&vv2.vector);
+	vv1=VECTORDF(subvector)(vb1,0,nbin+2*ncut-1);
+	if(masks)
+	{
+		VECTORDF(const_view)	vvc=VECTORDF(const_view_array)(masks+ncut*ncut,2*ncut+1);
+		pij_llrtopij_histogram_smoothen_buffed(real,nbin,ncut,&vv1.vector,&vvc.vector);
+	}
+	else
+	{
+		assert(vb2->size>=2*ncut+1);
+		vv2=VECTORDF(subvector)(vb2,0,2*ncut+1);
+		pij_llrtopij_histogram_smoothen_mask(pij_llrtopij_histogram_smoothen_sigma(ncut),ncut,&vv2.vector);
+		pij_llrtopij_histogram_smoothen_buffed(real,nbin,ncut,&vv1.vector,&vv2.vector);
+	}
+}
+
+void pij_llrtopij_convert_histograms_buffed(gsl_histogram* hreal,VECTORD* vnull,gsl_histogram* hc,VECTORD* vb1,VECTORD* vb2)
+{
+	assert((vnull->size==hreal->n)&&(vnull->stride==1)&&(hc->n==hreal->n+2));
+	pij_llrtopij_convert_bins_buffed(hreal->bin,vnull->data,hreal->n,0,vb1,vb2);
 	//Convert bounded histogram to central histogram
 	pij_llrtopij_histogram_to_central(hreal,hc);
-	
 }
 
 int pij_llrtopij_convert_histograms(gsl_histogram* hreal,VECTORD* vnull,gsl_histogram* hc)
@@ -289,6 +375,251 @@ int pij_llrtopij_convert_histograms(gsl_histogram* hreal,VECTORD* vnull,gsl_hist
 #undef	CLEANUP
 }
 
+/*************************************************************
+ * Conversion engine
+ *************************************************************/
+
+void pij_llrtopij_engine_free(struct pij_llrtopij_engine* e)
+{
+	if(!e)
+		return;
+	CLEANHISTLOC(e->loc)
+	CLEANHISTLOC(e->locc)
+	CLEANPOOL(e->width)
+	CLEANPOOL(e->vnull)
+	CLEANPOOL(e->masks)
+	pool_free(e);
+}
+
+struct pij_llrtopij_engine* pij_llrtopij_engine_alloc(const gsl_histogram* h)
+{
+#define	CLEANUP	pij_llrtopij_engine_free(e);
+	struct pij_llrtopij_engine*	e;
+	size_t	i,nbin=h->n;
+	VECTORDF(view)	vv;
+	
+	e=pool_calloc(1,sizeof(*e));
+	if(!e)
+		ERRRETV(0,"Not enough memory.")
+	e->nbin=nbin;
+	e->loc=histogram_locator_alloc(h->range,nbin);
+	e->locc=pij_llrtopij_histogram_central_locator(h->range,nbin);
+	e->width=pool_malloc(nbin*sizeof(*e->width));
+	e->vnull=pool_malloc(nbin*sizeof(*e->vnull));
+	e->masks=pool_malloc((PIJ_LLRTOPIJ_NCUT_MAX+1)*(PIJ_LLRTOPIJ_NCUT_MAX+1)*sizeof(*e->masks));
+	if(!(e->loc&&e->locc&&e->width&&e->vnull&&e->masks))
+		ERRRETV(0,"Not enough memory.")
+	for(i=0;i<nbin;i++)
+		e->width[i]=h->range[i+1]-h->range[i];
+	memcpy(e->vnull,h->bin,nbin*sizeof(*e->vnull));
+	for(i=0;i<=PIJ_LLRTOPIJ_NCUT_MAX;i++)
+	{
+		vv=VECTORDF(view_array)(e->masks+i*i,2*i+1);
+		pij_llrtopij_histogram_smoothen_mask(pij_llrtopij_histogram_smoothen_sigma(i),i,&vv.vector);
+	}
+	return e;
+#undef	CLEANUP
+}
+
+void pij_llrtopij_scratch_free(struct pij_llrtopij_scratch* s)
+{
+	if(!s)
+		return;
+	CLEANPOOL(s->rows)
+	CLEANPOOL(s->real)
+	CLEANPOOL(s->binc)
+	CLEANVECD(s->vb1)
+	pool_free(s);
+}
+
+struct pij_llrtopij_scratch* pij_llrtopij_scratch_alloc(const struct pij_llrtopij_engine* e,size_t nrow)
+{
+#define	CLEANUP	pij_llrtopij_scratch_free(s);
+	struct pij_llrtopij_scratch*	s;
+	size_t	n1,n2;
+	
+	assert(nrow);
+	s=pool_calloc(1,sizeof(*s));
+	if(!s)
+		ERRRETV(0,"Not enough memory.")
+	s->nrow=nrow;
+	pij_llrtopij_convert_histograms_get_buff_sizes(e->nbin,&n1,&n2);
+	s->rows=pool_malloc(nrow*sizeof(*s->rows));
+	s->real=pool_malloc(nrow*e->nbin*sizeof(*s->real));
+	s->binc=pool_malloc((e->nbin+2)*sizeof(*s->binc));
+	s->vb1=VECTORDF(pool_alloc)(n1);
+	if(!(s->rows&&s->real&&s->binc&&s->vb1))
+		ERRRETV(0,"Not enough memory.")
+	return s;
+#undef	CLEANUP
+}
+
+void pij_llrtopij_engine_convert_rows(const struct pij_llrtopij_engine* e,struct pij_llrtopij_scratch* s,const MATRIXF* d,const MATRIXF* dconv,MATRIXF* ans,size_t n,char nodiag,long nodiagshift)
+{
+	const size_t	nbin=e->nbin,nx=d->size2;
+	size_t	i,j,k,k0;
+	double	*real,scale;
+	const FTYPE	*row;
+	
+	assert(n<=s->nrow);
+	//Construct real density histograms of all rows in batch
+	memset(s->real,0,n*nbin*sizeof(*s->real));
+	for(i=0;i<n;i++)
+	{
+		j=s->rows[i];
+		real=s->real+i*nbin;
+		row=d->data+j*d->tda;
+		if(nodiag&&((long)j+nodiagshift>=0)&&((long)j+nodiagshift<(long)nx))
+		{
+			k0=(size_t)((long)j+nodiagshift);
+			for(k=0;k<k0;k++)
+				histogram_locator_increment(e->loc,real,row[k]);
+			for(k=k0+1;k<nx;k++)
+				histogram_locator_increment(e->loc,real,row[k]);
+			scale=1./(double)(nx-1);
+		}
+		else
+		{
+			for(k=0;k<nx;k++)
+				histogram_locator_increment(e->loc,real,row[k]);
+			scale=1./(double)nx;
+		}
+		//Convert to density histogram
+		for(k=0;k<nbin;k++)
+			real[k]=real[k]*scale/e->width[k];
+	}
+	
+	//Convert to probabilities
+	for(i=0;i<n;i++)
+	{
+		VECTORFF(const_view)	vvd=MATRIXFF(const_row)(dconv,s->rows[i]);
+		VECTORFF(view)	vva=MATRIXFF(row)(ans,s->rows[i]);
+		
+		real=s->real+i*nbin;
+		pij_llrtopij_convert_bins_buffed(real,e->vnull,nbin,e->masks,s->vb1,0);
+		pij_llrtopij_histogram_central_bins(real,nbin,s->binc);
+		pij_llrtopij_histogram_interpolate_linear_located(e->locc,s->binc,&vvd.vector,&vva.vector);
+	}
+}
+
+int pij_llrtopij_engine_convert_multi(const struct pij_llrtopij_engine* const* e,size_t ne,const MATRIXF* d,const MATRIXF* dconv,MATRIXF* ans,const VECTORG* vsel,size_t sel0,char nodiag,long nodiagshift)
+{
+#define	CLEANUP	if(s){for(i=0;i<nth;i++)pij_llrtopij_scratch_free(s[i]);CLEANPOOL(s)}CLEANPOOL(rows)CLEANPOOL(cnt)
+	size_t	i,j,k,nth,nsel,emax;
+	size_t	*rows,*cnt;
+	struct pij_llrtopij_scratch	**s;
+	int		ret;
+	struct threading_sched	sch;
+	
+	assert((dconv->size1==d->size1)&&(ans->size1==d->size1)&&(ans->size2==dconv->size2));
+	assert((!vsel)||(vsel->size==d->size1));
+	assert(ne&&(vsel||(ne==1)));
+	{
+		int	nth0=omp_get_max_threads();
+		assert(nth0>0);
+		nth=(size_t)nth0;
+	}
+	s=0;
+	rows=pool_malloc(d->size1*sizeof(*rows));
+	cnt=pool_calloc(ne+1,sizeof(*cnt));
+	if(!(rows&&cnt))
+		ERRRET("Not enough memory.")
+	
+	//Counting sort of selected rows by engine, so rows of each engine are contiguous
+	for(j=0;j<d->size1;j++)
+	{
+		k=vsel?(size_t)VECTORGF(get)(vsel,j)-sel0:0;
+		if(k<ne)
+			cnt[k+1]++;
+	}
+	for(k=0;k<ne;k++)
+		cnt[k+1]+=cnt[k];
+	nsel=cnt[ne];
+	for(j=0;j<d->size1;j++)
+	{
+		k=vsel?(size_t)VECTORGF(get)(vsel,j)-sel0:0;
+		if(k<ne)
+			rows[cnt[k]++]=j;
+	}
+	if(!nsel)
+	{
+		CLEANUP
+		return 0;
+	}
+	
+	//Scratch space is sized for the engine with most bins
+	for(k=1,emax=0;k<ne;k++)
+		if(e[k]->nbin>e[emax]->nbin)
+			emax=k;
+	s=pool_calloc(nth,sizeof(*s));
+	if(!s)
+		ERRRET("Not enough memory.")
+	for(i=0,ret=1;i<nth;i++)
+	{
+		s[i]=pij_llrtopij_scratch_alloc(e[emax],CONST_LLRTOPIJ_NROWBATCH);
+		ret=ret&&s[i];
+	}
+	if(!ret)
+		ERRRET("Not enough memory.")
+	
+	threading_sched_init(&sch,nsel,0);
+	#pragma omp parallel
+	{
+		size_t	ng1,ng2,id,p,n,kr,kc;
+		double	t0=omp_get_wtime();
+		struct pij_llrtopij_scratch*	st;
+		
+		id=(size_t)omp_get_thread_num();
+		st=s[id];
+		n=0;
+		kc=0;
+		while(threading_sched_next(&sch,&ng1,&ng2))
+			for(p=ng1;p<ng2;p++)
+			{
+				kr=vsel?(size_t)VECTORGF(get)(vsel,rows[p])-sel0:0;
+				//Batch only contains rows of the same engine
+				if(n&&((kr!=kc)||(n==st->nrow)))
+				{
+					pij_llrtopij_engine_convert_rows(e[kc],st,d,dconv,ans,n,nodiag,nodiagshift);
+					n=0;
+				}
+				kc=kr;
+				st->rows[n++]=rows[p];
+			}
+		if(n)
+			pij_llrtopij_engine_convert_rows(e[kc],st,d,dconv,ans,n,nodiag,nodiagshift);
+		threading_sched_done(&sch,t0);
+	}
+	threading_sched_log(&sch,"pij_llrtopij_engine_convert_multi");
+	CLEANUP
+	return 0;
+#undef	CLEANUP
+}
+
+void pij_llrtopij_engine_mem(size_t nd,size_t ne,size_t* fixed,size_t* perrow)
+{
+	size_t	nth=(size_t)omp_get_max_threads();
+	size_t	nbin,n1,n2,me,ms;
+	
+	nbin=histogram_unequalbins_param_count(nd);
+	pij_llrtopij_convert_histograms_get_buff_sizes(nbin,&n1,&n2);
+	//Null histogram and engine with its locators and central bin ranges
+	me=sizeof(gsl_histogram)+(2*nbin+1)*sizeof(double)
+		+sizeof(struct pij_llrtopij_engine)+histogram_locator_mem(nbin)+histogram_locator_mem(nbin+2)
+		+(nbin+3+2*nbin+(PIJ_LLRTOPIJ_NCUT_MAX+1)*(PIJ_LLRTOPIJ_NCUT_MAX+1))*sizeof(double);
+	//Scratch of one thread
+	ms=sizeof(struct pij_llrtopij_scratch)+CONST_LLRTOPIJ_NROWBATCH*(sizeof(size_t)+nbin*sizeof(double))
+		+(nbin+2+n1)*sizeof(double)+sizeof(VECTORD);
+	*fixed=ne*me+nth*ms+(ne+1)*sizeof(size_t);
+	//Rows grouped by engine
+	*perrow=sizeof(size_t);
+}
+
+int pij_llrtopij_engine_convert(const struct pij_llrtopij_engine* e,const MATRIXF* d,const MATRIXF* dconv,MATRIXF* ans,const VECTORG* vsel,size_t sel,char nodiag,long nodiagshift)
+{
+	return pij_llrtopij_engine_convert_multi(&e,1,d,dconv,ans,vsel,sel,nodiag,nodiagshift);
+}
+
 FTYPE pij_llrtopij_llrmatmax(MATRIXF* d,char nodiag)
 {
 	FTYPE	dmin,dmax;
@@ -336,20 +667,14 @@ FTYPE pij_llrtopij_llrvecmax(VECTORF* d)
 
 int pij_llrtopij_convert_single(const MATRIXF* d,const MATRIXF* dconv,MATRIXF* ans,size_t n1,size_t n2,char nodiag,long nodiagshift)
 {
-#define	CLEANUP	CLEANHIST(hreal)CLEANHIST(hc)\
-				CLEANHIST(h)CLEANVECD(vb1)CLEANVECD(vb2)
-	size_t		ng=d->size1;
-	long		k;
-	size_t		j,nbin;
-	gsl_histogram *h,*hreal,*hc;
-	VECTORD		*vb1,*vb2;
+#define	CLEANUP	CLEANHIST(h)pij_llrtopij_engine_free(e);
+	gsl_histogram	*h;
+	struct pij_llrtopij_engine	*e;
 	
 	h=0;
-	hreal=hc=0;
-	vb1=0;
-	vb2=0;
+	e=0;
 	//Validity checks
-	assert((dconv->size1==ng)&&(ans->size1==ng)&&(ans->size2==dconv->size2));
+	assert((dconv->size1==d->size1)&&(ans->size1==d->size1)&&(ans->size2==dconv->size2));
 
 	//Construct null density histograms
 	{
@@ -360,228 +685,75 @@ int pij_llrtopij_convert_single(const MATRIXF* d,const MATRIXF* dconv,MATRIXF* a
 		h=pij_nullhist_single((double)dmax,d->size2,n1,n2);
 		if(!h)
 			ERRRET("pij_nullhist_single failed.")
-		nbin=h->n;
 	}
 	
-	//Prepare for real histogram
-	hreal=gsl_histogram_clone(h);
-	hc=gsl_histogram_alloc(hreal->n+2);
-	if(!(hreal&&hc))
-		ERRRET("Not enough memory.");
-	if(pij_llrtopij_convert_histograms_make_buffs(nbin,&vb1,&vb2))
-		ERRRET("pij_llrtopij_convert_histograms_make_buffs failed.")
-	
 	//Conversion
-	{
-		VECTORDF(view)	vv1,vvreal;
-		VECTORFF(view)	vva;
-		VECTORD	*vwidth,*vnull;
-		vwidth=VECTORDF(alloc)(nbin);
-		vnull=VECTORDF(alloc)(nbin);
-		if(!(vwidth&&vnull))
-		{
-			CLEANVECD(vwidth)CLEANVECD(vnull)
-			ERRRET("Not enough memory.")
-		}
-		vv1=VECTORDF(view_array)(h->range+1,nbin);
-		VECTORDF(memcpy)(vwidth,&vv1.vector);
-		vv1=VECTORDF(view_array)(h->range,nbin);
-		VECTORDF(sub)(vwidth,&vv1.vector);
-		vvreal=VECTORDF(view_array)(hreal->bin,nbin);
-		vv1=VECTORDF(view_array)(h->bin,nbin);
-		for(j=0;j<ng;j++)
-		{
-			VECTORFF(const_view)	vvd=MATRIXFF(const_row)(dconv,j);
-			VECTORDF(memcpy)(vnull,&vv1.vector);
-			memcpy(hreal->range,h->range,(nbin+1)*sizeof(*hreal->range));
-			memset(hreal->bin,0,nbin*sizeof(*hreal->bin));
-			//Construct real histogram
-			if(nodiag&&((long)j+nodiagshift>=0)&&((long)j+nodiagshift<(long)d->size2))
-			{
-				for(k=(long)j+nodiagshift-1;k>=0;k--)
-					gsl_histogram_increment(hreal,MATRIXFF(get)(d,j,(size_t)k));
-				for(k=(long)j+nodiagshift+1;k<(long)d->size2;k++)
-					gsl_histogram_increment(hreal,MATRIXFF(get)(d,j,(size_t)k));
-				VECTORDF(scale)(&vvreal.vector,1./(double)(d->size2-1));
-			}
-			else
-			{
-				for(k=0;k<(long)d->size2;k++)
-					gsl_histogram_increment(hreal,MATRIXFF(get)(d,j,(size_t)k));
-				VECTORDF(scale)(&vvreal.vector,1./(double)(d->size2));
-			}
-			//Convert to density histogram
-			VECTORDF(div)(&vvreal.vector,vwidth);
-			//Convert to probability central histogram
-			pij_llrtopij_convert_histograms_buffed(hreal,vnull,hc,vb1,vb2);
-			//Convert likelihoods to probabilities
-			vva=MATRIXFF(row)(ans,j);
-			pij_llrtopij_histogram_interpolate_linear(hc,&vvd.vector,&vva.vector);
-		}
-		CLEANVECD(vwidth)CLEANVECD(vnull)
-	}
+	e=pij_llrtopij_engine_alloc(h);
+	if(!e)
+		ERRRET("pij_llrtopij_engine_alloc failed.")
+	if(pij_llrtopij_engine_convert(e,d,dconv,ans,0,0,nodiag,nodiagshift))
+		ERRRET("pij_llrtopij_engine_convert failed.")
 	CLEANUP
 	return 0;
 #undef	CLEANUP
 }
 
-int pij_llrtopij_convert_single_self(MATRIXF* d,size_t n1,size_t n2,char nodiag,long nodiagshift)
+int pij_llrtopij_llrmatmax_block(MATRIXF* d,FTYPE* dmax,char nodiag,long nodiagshift)
 {
-#define	CLEANUP	CLEANAMHIST(hreal,nth)CLEANAMHIST(hc,nth)\
-				CLEANHIST(h)CLEANMATD(mb1)CLEANMATD(mb2)CLEANMATD(mnull)CLEANMATF(mb3)CLEANVECD(vwidth)
-		
-	size_t		ng=d->size1;
-	size_t		i,nbin;
-	gsl_histogram	*h;
-	MATRIXD		*mb1,*mb2,*mnull;
-	MATRIXF		*mb3;
-	VECTORD		*vwidth;
-	VECTORDF(view)	vv1;
-	size_t		nth;
+	FTYPE	dmin1,dmax1;
 	
-	h=0;
-	mb1=mb2=mnull=0;
-	mb3=0;
-	vwidth=0;
-	//Validity checks
+	if(nodiag)
+		MATRIXFF(minmax_nodiag)(d,&dmin1,&dmax1,nodiagshift);
+	else
+		MATRIXFF(minmax)(d,&dmin1,&dmax1);
+	if((!(dmin1>=0))||gsl_isnan(dmax1))
 	{
-		int	nth0=omp_get_max_threads();
-		assert(nth0>0);
-		nth=(size_t)nth0;
+		LOG(1,"Negative or NAN found in input data. It may invalidate follow up analysis. This may be due to incorrect previous steps.")
+		return 1;
 	}
-	
-	
-	AUTOCALLOC(gsl_histogram*,hreal,nth,64)
-	AUTOCALLOC(gsl_histogram*,hc,nth,64)
-	if(!(hreal&&hc))
-		ERRRET("Not enough memory.");
-
-	//Construct null density histograms
+	if(gsl_isinf(dmax1))
 	{
-		FTYPE		dmin,dmax;
+		LOG(5,"INF found in input data. It may invalidate follow up analysis. This may be due to incorrect previous steps or duplicate rows. Now regard INFs as largest non-INF value.")
+		MATRIXFF(set_inf)(d,-1);
 		if(nodiag)
-			MATRIXFF(minmax_nodiag)(d,&dmin,&dmax,nodiagshift);
+			MATRIXFF(minmax_nodiag)(d,&dmin1,&dmax1,nodiagshift);
 		else
-			MATRIXFF(minmax)(d,&dmin,&dmax);
-		if((!(dmin>=0))||gsl_isnan(dmax))
-			ERRRET("Negative or NAN found in input data. It may invalidate follow up analysis. This may be due to incorrect previous steps.")
-		if(gsl_isinf(dmax))
-		{
-			LOG(5,"INF found in input data. It may invalidate follow up analysis. This may be due to incorrect previous steps or duplicate rows (by Spearman correlation).")
-			MATRIXFF(set_inf)(d,-1);
-			if(nodiag)
-				MATRIXFF(minmax_nodiag)(d,&dmin,&dmax,nodiagshift);
-			else
-				MATRIXFF(minmax)(d,&dmin,&dmax);
-			MATRIXFF(set_value)(d,-1,dmax);
-		}
-		h=pij_nullhist_single((double)dmax,d->size2,n1,n2);
-		if(!h)
-			ERRRET("pij_nullhist_single failed.")
-		nbin=h->n;
-	}
-	//Memory allocation
-	{
-		size_t	n1,n2;
-		pij_llrtopij_convert_histograms_get_buff_sizes(nbin,&n1,&n2);
-		mb1=MATRIXDF(alloc)(nth,n1);
-		mb2=MATRIXDF(alloc)(nth,n2);
-		mnull=MATRIXDF(alloc)(nth,nbin);
-		mb3=MATRIXFF(alloc)(nth,d->size2);
-		vwidth=VECTORDF(alloc)(nbin);
-		if(!(mb1&&mb2&&mnull&&mb3&&vwidth))
-			ERRRET("Not enough memory.")
-	}
-	
-	//Prepare for real histogram
-	{
-		int	ret;
-		for(i=0,ret=1;i<nth;i++)
-		{
-			hreal[i]=gsl_histogram_clone(h);
-			hc[i]=gsl_histogram_alloc(hreal[i]->n+2);
-			ret=ret&&hreal[i]&&hc[i];
-		}
-		if(!ret)
-			ERRRET("Not enough memory.");
+			dmax1=MATRIXFF(max)(d);
+		MATRIXFF(set_value)(d,-1,dmax1);
 	}
+	*dmax=GSL_MAX(*dmax,dmax1);
+	return 0;
+}
+
+int pij_llrtopij_convert_single_self(MATRIXF* d,size_t n1,size_t n2,char nodiag,long nodiagshift)
+{
+	FTYPE	dmax=0;
 	
-	//Conversion
-	vv1=VECTORDF(view_array)(h->range+1,nbin);
-	VECTORDF(memcpy)(vwidth,&vv1.vector);
-	vv1=VECTORDF(view_array)(h->range,nbin);
-	VECTORDF(sub)(vwidth,&vv1.vector);
-	vv1=VECTORDF(view_array)(h->bin,nbin);
-	#pragma omp parallel
-	{
-		size_t	ng1,ng2,id;
-		size_t	j;
-		long	k;
-		VECTORDF(view)	vvreal,vvnull,vvb1,vvb2;
-		VECTORFF(view)	vvb3,vva;
+	if(pij_llrtopij_llrmatmax_block(d,&dmax,nodiag,nodiagshift))
+		return 1;
+	return pij_llrtopij_convert_single_self_dmax(d,dmax,n1,n2,nodiag,nodiagshift);
+}
+
+int pij_llrtopij_convert_single_self_dmax(MATRIXF* d,FTYPE dmax,size_t n1,size_t n2,char nodiag,long nodiagshift)
+{
+#define	CLEANUP	CLEANHIST(h)pij_llrtopij_engine_free(e);
+	gsl_histogram	*h;
+	struct pij_llrtopij_engine	*e;
 	
-		id=(size_t)omp_get_thread_num();
-		vvreal=VECTORDF(view_array)(hreal[id]->bin,nbin);
-		vvnull=MATRIXDF(row)(mnull,id);
-		vvb1=MATRIXDF(row)(mb1,id);
-		vvb2=MATRIXDF(row)(mb2,id);
-		vvb3=MATRIXFF(row)(mb3,id);
-		
-		threading_get_startend(ng,&ng1,&ng2);
-		
-		for(j=ng1;j<ng2;j++)
-		{
-			MATRIXFF(get_row)(&vvb3.vector,d,j);
-			VECTORDF(memcpy)(&vvnull.vector,&vv1.vector);
-			memcpy(hreal[id]->range,h->range,(nbin+1)*sizeof(*hreal[id]->range));
-			memset(hreal[id]->bin,0,nbin*sizeof(*hreal[id]->bin));
-			//Construct real histogram
-			if(nodiag&&((long)j+nodiagshift>=0)&&((long)j+nodiagshift<(long)d->size2))
-			{
-				for(k=(long)j+nodiagshift-1;k>=0;k--)
-					gsl_histogram_increment(hreal[id],MATRIXFF(get)(d,j,(size_t)k));
-				for(k=(long)j+nodiagshift+1;k<(long)d->size2;k++)
-					gsl_histogram_increment(hreal[id],MATRIXFF(get)(d,j,(size_t)k));
-				VECTORDF(scale)(&vvreal.vector,1./(double)(d->size2-1));
-			}
-			else
-			{
-				for(k=0;k<(long)d->size2;k++)
-					gsl_histogram_increment(hreal[id],MATRIXFF(get)(d,j,(size_t)k));
-				VECTORDF(scale)(&vvreal.vector,1./(double)(d->size2));
-			}					
-
-			//Convert to density histogram
-			VECTORDF(div)(&vvreal.vector,vwidth);
-			//Convert to probability central histogram
-			pij_llrtopij_convert_histograms_buffed(hreal[id],&vvnull.vector,hc[id],&vvb1.vector,&vvb2.vector);
-			//Convert likelihoods to probabilities
-			vva=MATRIXFF(row)(d,j);
-			pij_llrtopij_histogram_interpolate_linear(hc[id],&vvb3.vector,&vva.vector);
-		}
-	}
+	e=0;
+	//Construct null density histograms
+	MATRIXFF(set_inf)(d,dmax);
+	h=pij_nullhist_single((double)dmax,d->size2,n1,n2);
+	if(!h)
+		ERRRET("pij_nullhist_single failed.")
 	
+	//Conversion
+	e=pij_llrtopij_engine_alloc(h);
+	if(!e)
+		ERRRET("pij_llrtopij_engine_alloc failed.")
+	if(pij_llrtopij_engine_convert(e,d,d,d,0,0,nodiag,nodiagshift))
+		ERRRET("pij_llrtopij_engine_convert failed.")
 	CLEANUP
 	return 0;
 #undef	CLEANUP
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -24,6 +24,7 @@
 #include "../base/config.h"
 #include "../base/gsl/histogram.h"
 #include "../base/types.h"
+#include "../base/histogram.h"
 #ifdef __cplusplus
 extern "C"
 {
@@ -38,6 +39,29 @@ extern "C"
  * ans:	output of estimated probabilities
  */
 void pij_llrtopij_histogram_interpolate_linear(const gsl_histogram *hc,const VECTORF* d,VECTORF* ans);
+
+/* Same as pij_llrtopij_histogram_interpolate_linear, but for central histogram bins
+ * on fixed ranges, which are located with a precomputed bin locator instead of binary search.
+ * l:	Bin locator of central histogram ranges, from pij_llrtopij_histogram_central_locator.
+ * bin:	(l->n) Central histogram bins.
+ */
+void pij_llrtopij_histogram_interpolate_linear_located(const struct histogram_locator* l,const double* bin,const VECTORF* d,VECTORF* ans);
+
+/* Construct ranges of central value histogram from bounded histogram ranges.
+ * In central value histogram, bin[i] is the value at range[i].
+ * range:	(n+1) Input bounded histogram range
+ * n:		Number of bins of bounded histogram
+ * rangec:	(n+3) Output central histogram range
+ */
+void pij_llrtopij_histogram_central_range(const double* range,size_t n,double* rangec);
+
+/* Construct bin locator for central histogram of bounded histogram ranges,
+ * which stay fixed for all rows in one conversion.
+ * range:	(n+1) Input bounded histogram range
+ * n:		Number of bins of bounded histogram
+ * Return:	Bin locator for central histogram, or 0 on failure.
+ */
+struct histogram_locator* pij_llrtopij_histogram_central_locator(const double* range,size_t n);
  
 /* Calculate buffer sizes for histogram conversion in pij_llrtopij_convert_histograms_buffed.
  * n:	Number of histogram bins. This must match pij_llrtopij_convert_histograms_buffed.
@@ -58,7 +82,7 @@ int pij_llrtopij_convert_histograms_make_buffs(size_t n,VECTORD** vb1,VECTORD**
  * histogram with buffer provided. Both histograms must be distributions
  * (sum to unity and nonnegative).
  * hreal:	(n) Real density histogram to convert from. Also changed in calculation.
- * vnull:	(n) Null density histogram in vector format. Also changed in calculation.
+ * vnull:	(n) Null density histogram in vector format, with unit stride.
  * hc:		(n+2) Central probability histogram as output.
  * vb1,
  * vb2:		Buffers needed for conversion. To allocate buffers, use
@@ -74,6 +98,112 @@ void pij_llrtopij_convert_histograms_buffed(gsl_histogram* hreal,VECTORD* vnull,
  */
 int pij_llrtopij_convert_histograms(gsl_histogram* hreal,VECTORD* vnull,gsl_histogram* hc);
 
+/* Conversion engine from LLRs to probabilities for one null histogram.
+ * Bin geometry, null density, bin locators and convolution masks depend only on
+ * the null histogram, so they are computed once and shared read-only by all threads.
+ * nbin:	Number of bins.
+ * loc:		Bin locator of null histogram ranges.
+ * locc:	Bin locator of central histogram ranges.
+ * width:	(nbin) Bin widths.
+ * vnull:	(nbin) Null density histogram.
+ * masks:	Normalized convolution masks for histogram smoothening. The mask for
+ * 			half size ncut has 2*ncut+1 elements, starting at masks[ncut*ncut].
+ */
+struct pij_llrtopij_engine
+{
+	size_t	nbin;
+	struct histogram_locator	*loc;
+	struct histogram_locator	*locc;
+	double	*width;
+	double	*vnull;
+	double	*masks;
+};
+
+/* Per-thread scratch space of conversion engine for a batch of rows.
+ * nrow:	Maximum number of rows in a batch.
+ * rows:	(nrow) Row indices of the current batch.
+ * real:	(nrow,nbin) Real density histograms of rows in batch.
+ * binc:	(nbin+2) Central histogram bins.
+ * vb1:		Buffer for histogram smoothening.
+ */
+struct pij_llrtopij_scratch
+{
+	size_t	nrow;
+	size_t	*rows;
+	double	*real;
+	double	*binc;
+	VECTORD	*vb1;
+};
+
+/* Constructs conversion engine from null density histogram.
+ * h:		Null density histogram, e.g. from pij_nullhist_single.
+ * Return:	Conversion engine, or 0 on failure.
+ */
+struct pij_llrtopij_engine* pij_llrtopij_engine_alloc(const gsl_histogram* h);
+void pij_llrtopij_engine_free(struct pij_llrtopij_engine* e);
+
+/* Allocates scratch space of conversion engine for one thread.
+ * e:		Conversion engine
+ * nrow:	Maximum number of rows in a batch
+ * Return:	Scratch space, or 0 on failure.
+ */
+struct pij_llrtopij_scratch* pij_llrtopij_scratch_alloc(const struct pij_llrtopij_engine* e,size_t nrow);
+void pij_llrtopij_scratch_free(struct pij_llrtopij_scratch* s);
+
+/* Converts a batch of rows of LLRs to probabilities in single thread.
+ * Real histograms of all rows are constructed first, and then converted
+ * one after another, so the null density and bin geometry stay in cache.
+ * e:		Conversion engine
+ * s:		Scratch space, with s->rows[0..n-1] filled with row indices to convert.
+ * d:		[nrow,nx] The data to use for calculation of conversion rule from LLR to pij.
+ * dconv:	[nrow,nd] The data of LLR to actually convert to pij. Can be same with d.
+ * ans:		[nrow,nd] The output location of converted pij from dconv. Can be same with dconv.
+ * n:		Number of rows in batch.
+ * nodiag,
+ * nodiagshift:	See pij_llrtopij_convert_single.
+ */
+void pij_llrtopij_engine_convert_rows(const struct pij_llrtopij_engine* e,struct pij_llrtopij_scratch* s,const MATRIXF* d,const MATRIXF* dconv,MATRIXF* ans,size_t n,char nodiag,long nodiagshift);
+
+/* Converts rows of LLRs to probabilities in parallel, in batches of CONST_LLRTOPIJ_NROWBATCH rows.
+ * e:		Conversion engine
+ * d,
+ * dconv,
+ * ans:		See pij_llrtopij_engine_convert_rows.
+ * vsel:	(nrow) If not 0, only convert rows j with vsel[j]==sel.
+ * sel:		Value of vsel for rows to convert.
+ * nodiag,
+ * nodiagshift:	See pij_llrtopij_convert_single.
+ * Return:	0 on success.
+ */
+int pij_llrtopij_engine_convert(const struct pij_llrtopij_engine* e,const MATRIXF* d,const MATRIXF* dconv,MATRIXF* ans,const VECTORG* vsel,size_t sel,char nodiag,long nodiagshift);
+
+/* Converts rows of LLRs to probabilities in a single parallel pass, with each row
+ * using the engine chosen by vsel. Selected rows are first grouped by engine with
+ * a counting sort, and batches never mix engines.
+ * e:		[ne] Conversion engines
+ * ne:		Number of engines
+ * d,
+ * dconv,
+ * ans:		See pij_llrtopij_engine_convert_rows.
+ * vsel:	(nrow) Row j is converted with engine e[vsel[j]-sel0], and skipped if
+ * 			vsel[j]-sel0 is not within [0,ne). If 0, all rows use e[0] and ne must be 1.
+ * sel0:	Value of vsel for rows of the first engine.
+ * nodiag,
+ * nodiagshift:	See pij_llrtopij_convert_single.
+ * Return:	0 on success.
+ */
+int pij_llrtopij_engine_convert_multi(const struct pij_llrtopij_engine* const* e,size_t ne,const MATRIXF* d,const MATRIXF* dconv,MATRIXF* ans,const VECTORG* vsel,size_t sel0,char nodiag,long nodiagshift);
+
+/* Temporary memory in bytes needed to convert LLRs with ne null histograms in
+ * pij_llrtopij_engine_convert_multi, as fixed+perrow*nrow for nrow rows of d.
+ * Includes null histograms, engines, and scratch space of all threads.
+ * nd:		Count of real data per row, which decides the bin count of null histograms.
+ * ne:		Number of null histograms and engines
+ * fixed:	Output of memory independent of nrow
+ * perrow:	Output of memory per row of d
+ */
+void pij_llrtopij_engine_mem(size_t nd,size_t ne,size_t* fixed,size_t* perrow);
+
 
 /* Obtains the maximum of matrix, possibly ignoring diagonal elements.
  * Fails in the presence of NAN, and warns and updates at INFs.
@@ -84,13 +214,21 @@ int pij_llrtopij_convert_histograms(gsl_histogram* hreal,VECTORD* vnull,gsl_hist
 FTYPE pij_llrtopij_llrmatmax(MATRIXF* d,char nodiag);
 FTYPE pij_llrtopij_llrvecmax(VECTORF* d);
 
+/* Updates the maximum of LLRs with a block of rows of the LLR matrix, for streaming
+ * functions that never keep the full matrix. Same as pij_llrtopij_llrmatmax otherwise.
+ * d:		Block of rows of LLR matrix. INFs are replaced by the maximum of the block.
+ * dmax:	Maximum to update. Should be initialized to 0 before the first block.
+ * nodiag:	Whether to ignore diagonal values when searching for maximum.
+ * nodiagshift:	Diangonal column shift for nodiag==1, i.e. index of first row of the block.
+ * Return:	0 on success, or 1 if negative or NAN values are found.
+ */
+int pij_llrtopij_llrmatmax_block(MATRIXF* d,FTYPE* dmax,char nodiag,long nodiagshift);
+
 
 /* Convert LLR of real data to probabilities, when the distribution
  * of LLR of null distribution can be calculated analytically to follow
  * x=-0.5*log(1-z1/(z1+z2)), where z1~chi2(n1),z2~chi2(n2).
- * The conversion is performed for each gene A, i.e. per row of d and dconv.
- * This function is older than pij_llrtopij_convert_single so it is not parallel.
- * Make it parallel before using.
+ * The conversion is performed for each gene A, i.e. per row of d and dconv, in parallel.
  * d:		[nrow,nx] The data to use for calculation of conversion rule from LLR to pij.
  * dconv:	[nrow,nd] The data of LLR to actually convert to pij. Can be same with d.
  * ans:		[nrow,nd] The output location of converted pij from dconv.
@@ -107,6 +245,14 @@ int pij_llrtopij_convert_single(const MATRIXF* d,const MATRIXF* dconv,MATRIXF* a
 // Same with pij_llrtopij_convert_single, for d=dconv=ans. Saves memory.
 int pij_llrtopij_convert_single_self(MATRIXF* d,size_t n1,size_t n2,char nodiag,long nodiagshift);
 
+/* Same with pij_llrtopij_convert_single_self, but null histogram is constructed up to the
+ * given maximum instead of the maximum of d. This allows converting blocks of rows
+ * separately with identical results as converting the full matrix at once.
+ * dmax:	Maximum of LLRs of the full matrix, e.g. from pij_llrtopij_llrmatmax_block.
+ * 			INFs in d are regarded as dmax.
+ */
+int pij_llrtopij_convert_single_self_dmax(MATRIXF* d,FTYPE dmax,size_t n1,size_t n2,char nodiag,long nodiagshift);
+
 
 
 
@@ -25,17 +25,22 @@
 
 void pij_llrtopvm(MATRIXF* p,size_t n1,size_t n2)
 {
+	struct threading_sched	sch;
+	
+	threading_sched_init(&sch,p->size1,0);
 	#pragma omp parallel
 	{
 		size_t	m1,m2;
+		double	t0=omp_get_wtime();
 	
-		threading_get_startend(p->size1,&m1,&m2);
-		if(m2>m1)
+		while(threading_sched_next(&sch,&m1,&m2))
 		{
 			MATRIXFF(view)	mvp=MATRIXFF(submatrix)(p,m1,0,m2-m1,p->size2);
 			pij_llrtopvm_block(&mvp.matrix,n1,n2);
 		}
+		threading_sched_done(&sch,t0);
 	}
+	threading_sched_log(&sch,"pij_llrtopvm");
 }
 
 
@@ -31,7 +31,7 @@ extern "C"
 
 /* Converts a vector of log likelihood ratios into p-values with the same null distribution.
  * Single thread.
- * For null distribution, see pij_nulldist_cdfQ.
+ * For null distribution, see pij_nulldist_cdfQ. Evaluation goes through pij_nulldist_cdfQ_batch.
  * p:	data as input for LLR and output for p-values
  * n1,
  * n2:	Null distribution parameters.
@@ -47,16 +47,23 @@ void pij_llrtopvm(MATRIXF* p,size_t n1,size_t n2);
 static inline void pij_llrtopv_block(VECTORF* p,size_t n1,size_t n2)
 {
 	size_t i;
+	if(p->stride==1)
+	{
+		pij_nulldist_cdfQ_batch(p->data,p->data,p->size,n1,n2);
+		return;
+	}
 	for(i=0;i<p->size;i++)
 		VECTORFF(set)(p,i,(FTYPE)pij_nulldist_cdfQ(VECTORFF(get)(p,i),n1,n2));
 }
 
 static inline void pij_llrtopvm_block(MATRIXF* p,size_t n1,size_t n2)
 {
-	size_t i,j;
-	for(i=0;i<p->size1;i++)
-		for(j=0;j<p->size2;j++)
-			MATRIXFF(set)(p,i,j,(FTYPE)pij_nulldist_cdfQ(MATRIXFF(get)(p,i,j),n1,n2));
+	size_t i;
+	if(p->size2==p->tda)
+		pij_nulldist_cdfQ_batch(p->data,p->data,p->size1*p->size2,n1,n2);
+	else
+		for(i=0;i<p->size1;i++)
+			pij_nulldist_cdfQ_batch(p->data+i*p->tda,p->data+i*p->tda,p->size2,n1,n2);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,142 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "../base/config.h"
+#include <stdint.h>
+#include <assert.h>
+#include "../base/gsl/math.h"
+#include "../base/logger.h"
+#include "../base/macros.h"
+#include "../base/mapfile.h"
+#include "memplan.h"
+
+static inline size_t pij_memplan_add(size_t a,size_t b)
+{
+	return (a>SIZE_MAX-b)?SIZE_MAX:a+b;
+}
+
+/* Memory of one component with nb primary targets per block, saturated at SIZE_MAX.
+ */
+static inline size_t pij_memplan_item_size(const struct pij_memplan_item* t,size_t nb)
+{
+	if(nb&&(t->perrow>SIZE_MAX/nb))
+		return SIZE_MAX;
+	return pij_memplan_add(t->fixed,t->perrow*nb);
+}
+
+void pij_memplan_init(struct pij_memplan* p,const char* name)
+{
+	p->name=name;
+	p->base.name="base";
+	p->base.fixed=p->base.perrow=0;
+	p->nstage=0;
+}
+
+void pij_memplan_base(struct pij_memplan* p,size_t fixed,size_t perrow)
+{
+	p->base.fixed=pij_memplan_add(p->base.fixed,fixed);
+	p->base.perrow=pij_memplan_add(p->base.perrow,perrow);
+}
+
+void pij_memplan_matrix(struct pij_memplan* p,const MATRIXF* m)
+{
+	if(MATRIXFF(mapfile_is)(m))
+		pij_memplan_base(p,0,m->size2*sizeof(FTYPE));
+	else
+		pij_memplan_base(p,m->size1*m->size2*sizeof(FTYPE),0);
+}
+
+void pij_memplan_stage(struct pij_memplan* p,const char* name,size_t fixed,size_t perrow)
+{
+	assert(p->nstage<PIJ_MEMPLAN_NSTAGE_MAX);
+	p->stage[p->nstage].name=name;
+	p->stage[p->nstage].fixed=fixed;
+	p->stage[p->nstage].perrow=perrow;
+	p->nstage++;
+}
+
+size_t pij_memplan_peak(const struct pij_memplan* p,size_t nb)
+{
+	size_t	i,m;
+	
+	for(i=0,m=0;i<p->nstage;i++)
+		m=GSL_MAX(m,pij_memplan_item_size(&p->stage[i],nb));
+	return pij_memplan_add(pij_memplan_item_size(&p->base,nb),m);
+}
+
+/* Logs the per-stage breakdown of the plan.
+ * p:		Memory plan
+ * nb:		Number of primary targets in each block
+ * memlimit:	Memory limit in bytes
+ */
+static void pij_memplan_log(const struct pij_memplan* p,size_t nb,size_t memlimit)
+{
+	size_t	i;
+	
+	LOG(10,"Memory limit: "PRINTFSIZET" bytes.",memlimit)
+	LOG(10,"Memory plan of %s with blocks of "PRINTFSIZET" primary targets:",p->name,nb)
+	LOG(10,"    %s: "PRINTFSIZET" bytes.",p->base.name,pij_memplan_item_size(&p->base,nb))
+	for(i=0;i<p->nstage;i++)
+		LOG(10,"    stage %s: "PRINTFSIZET" bytes.",p->stage[i].name,pij_memplan_item_size(&p->stage[i],nb))
+	LOG(10,"    peak: "PRINTFSIZET" bytes.",pij_memplan_peak(p,nb))
+}
+
+int pij_memplan_fit(const struct pij_memplan* p,size_t n,size_t memlimit)
+{
+#define	CLEANUP
+	pij_memplan_log(p,n,memlimit);
+	if(pij_memplan_peak(p,n)>memlimit)
+		ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
+	return 0;
+#undef	CLEANUP
+}
+
+int pij_memplan_split(const struct pij_memplan* p,size_t n,size_t memlimit,size_t* nsplit)
+{
+#define	CLEANUP
+	size_t	lo,hi,mid,nblock;
+	
+	if(!n)
+	{
+		*nsplit=1;
+		return pij_memplan_fit(p,0,memlimit);
+	}
+	if(pij_memplan_peak(p,1)>memlimit)
+	{
+		pij_memplan_log(p,1,memlimit);
+		ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
+	}
+	//Largest block size that fits. Peak is nondecreasing in block size.
+	lo=1;
+	hi=n;
+	while(lo<hi)
+	{
+		mid=hi-(hi-lo)/2;
+		if(pij_memplan_peak(p,mid)<=memlimit)
+			lo=mid;
+		else
+			hi=mid-1;
+	}
+	//Balance block sizes with the same number of blocks
+	nblock=(n+lo-1)/lo;
+	*nsplit=(n+nblock-1)/nblock;
+	pij_memplan_log(p,*nsplit,memlimit);
+	if(*nsplit<n)
+		LOG(9,"Splitting "PRINTFSIZET" primary targets into groups of about size "PRINTFSIZET".",n,*nsplit)
+	return 0;
+#undef	CLEANUP
+}
@@ -0,0 +1,128 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file contains the memory planner of block-wise pij pipelines.
+ * A pipeline keeps a set of buffers throughout (the base), and runs through
+ * stages one after another, each holding its own temporary buffers on top of
+ * the base. Every component is modelled as fixed+perrow*nb bytes when nb primary
+ * targets are processed per block, so the peak is the base plus the largest stage.
+ * The planner picks the largest block size whose peak fits in the memory limit.
+ */
+
+#ifndef _HEADER_LIB_PIJ_MEMPLAN_H_
+#define _HEADER_LIB_PIJ_MEMPLAN_H_
+#include "../base/config.h"
+#include <stddef.h>
+#include "../base/types.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Maximum number of stages in a memory plan
+#define	PIJ_MEMPLAN_NSTAGE_MAX	8
+
+//Memory of one component of a pipeline
+struct pij_memplan_item
+{
+	//Name for logging
+	const char*	name;
+	//Memory in bytes independent of block size
+	size_t	fixed;
+	//Memory in bytes per primary target in each block
+	size_t	perrow;
+};
+
+//Memory plan of a pipeline
+struct pij_memplan
+{
+	//Name of pipeline for logging
+	const char*	name;
+	//Buffers kept throughout the pipeline
+	struct pij_memplan_item	base;
+	//Number of stages
+	size_t	nstage;
+	//Temporary buffers of each stage, which are not held at the same time
+	struct pij_memplan_item	stage[PIJ_MEMPLAN_NSTAGE_MAX];
+};
+
+/* Initializes an empty memory plan.
+ * p:		Memory plan
+ * name:	Name of pipeline for logging. Must outlive p.
+ */
+void pij_memplan_init(struct pij_memplan* p,const char* name);
+
+/* Adds memory to the base of the plan, i.e. buffers kept throughout the pipeline.
+ * p:		Memory plan
+ * fixed:	Memory in bytes independent of block size
+ * perrow:	Memory in bytes per primary target in each block
+ */
+void pij_memplan_base(struct pij_memplan* p,size_t fixed,size_t perrow);
+
+/* Adds a caller matrix whose rows are primary targets to the base of the plan.
+ * Memory-mapped matrices (see mapfile.h) only take memory of the rows in each block,
+ * as rows are released when their block is finished.
+ * p:		Memory plan
+ * m:		Matrix
+ */
+void pij_memplan_matrix(struct pij_memplan* p,const MATRIXF* m);
+
+/* Adds a stage to the plan.
+ * p:		Memory plan
+ * name:	Name of stage for logging. Must outlive p.
+ * fixed:	Temporary memory in bytes independent of block size
+ * perrow:	Temporary memory in bytes per primary target in each block
+ */
+void pij_memplan_stage(struct pij_memplan* p,const char* name,size_t fixed,size_t perrow);
+
+/* Peak memory of the plan.
+ * p:		Memory plan
+ * nb:		Number of primary targets in each block
+ * Return:	Peak memory in bytes, saturated at SIZE_MAX.
+ */
+size_t pij_memplan_peak(const struct pij_memplan* p,size_t nb);
+
+/* Checks whether the plan fits in the memory limit with all n primary targets
+ * in one block, and logs the per-stage breakdown.
+ * p:		Memory plan
+ * n:		Number of primary targets
+ * memlimit:	Memory limit in bytes
+ * Return:	0 if the plan fits.
+ */
+int pij_memplan_fit(const struct pij_memplan* p,size_t n,size_t memlimit);
+
+/* Determines the block size of the plan for a memory limit, as the largest
+ * block size that fits, then balanced among blocks. Logs the per-stage breakdown.
+ * p:		Memory plan
+ * n:		Number of primary targets
+ * memlimit:	Memory limit in bytes
+ * nsplit:	Output of number of primary targets in each block.
+ * Return:	0 on success, or 1 if even blocks of one primary target do not fit.
+ */
+int pij_memplan_split(const struct pij_memplan* p,size_t n,size_t memlimit,size_t* nsplit);
+
+
+
+
+
+
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -21,6 +21,8 @@
 #include <math.h>
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
+#include <float.h>
 #include "../base/gsl/blas.h"
 #include "../base/gsl/math.h"
 #include "../base/logger.h"
@@ -125,8 +127,8 @@ int pij_nulldist_hist_pdf(const double* restrict range,size_t nbin,double* restr
 	
 	assert(n&&(n<10));
 	nsp=(size_t)1<<(n-1);
-	loc=VECTORDF(alloc)(nbin*nsp);
-	val=VECTORDF(alloc)(nbin*nsp);
+	loc=VECTORDF(pool_alloc)(nbin*nsp);
+	val=VECTORDF(pool_alloc)(nbin*nsp);
 	if(!(loc&&val))
 		ERRRET("Not enough memory.")
 	
@@ -161,38 +163,241 @@ int pij_nulldist_hist_pdf(const double* restrict range,size_t nbin,double* restr
 
 
 
+/*************************************************************
+ * Tabulated cdf
+ *************************************************************/
 
+static enum pij_nulldist_cdfQ_modes pij_nulldist_cdfQ_mode=PIJ_NULLDIST_CDFQ_TABLE;
+//Cached tables
+static struct pij_nulldist_cdfQ_table** pij_nulldist_cdfQ_tables=0;
+static size_t pij_nulldist_cdfQ_ntable=0;
+static size_t pij_nulldist_cdfQ_ntablemax=0;
 
+void pij_nulldist_cdfQ_setmode(enum pij_nulldist_cdfQ_modes mode)
+{
+	pij_nulldist_cdfQ_mode=mode;
+}
 
+static inline double pij_nulldist_cdfQ_logu(double u,size_t n1,size_t n2)
+{
+	return log(pij_nulldist_cdfQ(u*u,n1,n2));
+}
 
+static void pij_nulldist_cdfQ_table_free(struct pij_nulldist_cdfQ_table* t)
+{
+	if(!t)
+		return;
+	CLEANMEM(t->logq)
+	free(t);
+}
 
+/* Constructs table for (n1,n2). See struct pij_nulldist_cdfQ_table.
+ * Return:	Constructed table, or NULL if failed. A table that cannot meet
+ * 			CONST_NULLDIST_CDFQ_RTOL is returned empty (n=0), so the failure is cached.
+ */
+static struct pij_nulldist_cdfQ_table* pij_nulldist_cdfQ_table_new(size_t n1,size_t n2)
+{
+#define	CLEANUP	CLEANMEM(mid)CLEANMEM(logq2)pij_nulldist_cdfQ_table_free(t);
+	struct pij_nulldist_cdfQ_table*	t;
+	double	*mid=0,*logq2=0;
+	double	lo,hi,umax,ucap,err,v;
+	const double	lqmin=log(CONST_NULLDIST_CDFQ_QMIN);
+	const size_t	nmax=(size_t)1<<22;
+	size_t	i,n;
+	
+	assert(n1&&n2);
+	t=calloc(1,sizeof(*t));
+	if(!t)
+		ERRRETV(0,"Not enough memory.")
+	t->n1=n1;
+	t->n2=n2;
+	
+	//Find table range u in [0,umax] with Q(umax^2)=CONST_NULLDIST_CDFQ_QMIN.
+	//Range is also limited to where 1-y=exp(-2x) is accurate enough for pij_nulldist_cdfQ,
+	//whose relative error is about n2*DBL_EPSILON/(2*(1-y)).
+	ucap=sqrt(-0.5*log(8*(double)n2*DBL_EPSILON/CONST_NULLDIST_CDFQ_RTOL));
+	lo=0;
+	hi=GSL_MIN(1,ucap);
+	for(i=0;(i<64)&&(hi<ucap)&&(pij_nulldist_cdfQ_logu(hi,n1,n2)>=lqmin);i++)
+	{
+		lo=hi;
+		hi=GSL_MIN(2*hi,ucap);
+	}
+	if((hi>=ucap)&&(pij_nulldist_cdfQ_logu(hi,n1,n2)>=lqmin))
+		lo=hi;
+	for(i=0;i<64;i++)
+	{
+		v=(lo+hi)/2;
+		if(pij_nulldist_cdfQ_logu(v,n1,n2)>=lqmin)
+			lo=v;
+		else
+			hi=v;
+	}
+	umax=lo;
+	if(!(umax>0))
+		ERRRETV(0,"Failed to locate range of tabulated null distribution with n1="PRINTFSIZET", n2="PRINTFSIZET".",n1,n2)
+	
+	//Tabulate on coarse grid and refine until midpoints satisfy tolerance
+	n=64;
+	t->logq=malloc((n+1)*sizeof(*t->logq));
+	mid=malloc(n*sizeof(*mid));
+	if(!(t->logq&&mid))
+		ERRRETV(0,"Not enough memory.")
+	for(i=0;i<=n;i++)
+		t->logq[i]=pij_nulldist_cdfQ_logu(umax*(double)i/(double)n,n1,n2);
+	while(1)
+	{
+		err=0;
+		for(i=0;i<n;i++)
+		{
+			mid[i]=pij_nulldist_cdfQ_logu(umax*((double)i+0.5)/(double)n,n1,n2);
+			v=fabs(expm1((t->logq[i]+t->logq[i+1])/2-mid[i]));
+			err=GSL_MAX(err,v);
+		}
+		if((err<=CONST_NULLDIST_CDFQ_RTOL)||(n>=nmax))
+			break;
+		logq2=malloc((2*n+1)*sizeof(*logq2));
+		if(!logq2)
+			ERRRETV(0,"Not enough memory.")
+		for(i=0;i<n;i++)
+		{
+			logq2[2*i]=t->logq[i];
+			logq2[2*i+1]=mid[i];
+		}
+		logq2[2*n]=t->logq[n];
+		free(t->logq);
+		t->logq=logq2;
+		logq2=0;
+		n*=2;
+		free(mid);
+		mid=malloc(n*sizeof(*mid));
+		if(!mid)
+			ERRRETV(0,"Not enough memory.")
+	}
+	if(err>CONST_NULLDIST_CDFQ_RTOL)
+	{
+		LOG(9,"Tabulated null distribution with n1="PRINTFSIZET", n2="PRINTFSIZET" has relative error %G above tolerance. Using exact evaluation.",n1,n2,err)
+		CLEANMEM(mid)
+		CLEANMEM(t->logq)
+		t->n=0;
+		return t;
+	}
+	t->n=n;
+	t->idu=(double)n/umax;
+	t->xmax=umax*umax;
+	LOG(10,"Tabulated null distribution with n1="PRINTFSIZET", n2="PRINTFSIZET" on "PRINTFSIZET" intervals for x<%G, maximum midpoint relative error %G.",n1,n2,n,t->xmax,err)
+	CLEANMEM(mid)
+	return t;
+#undef	CLEANUP
+}
 
+const struct pij_nulldist_cdfQ_table* pij_nulldist_cdfQ_table_get(size_t n1,size_t n2)
+{
+	struct pij_nulldist_cdfQ_table	*ans=0,**t2;
+	size_t	i;
+	
+	#pragma omp critical(pij_nulldist_cdfQ_cache)
+	{
+		for(i=0;i<pij_nulldist_cdfQ_ntable;i++)
+			if((pij_nulldist_cdfQ_tables[i]->n1==n1)&&(pij_nulldist_cdfQ_tables[i]->n2==n2))
+			{
+				ans=pij_nulldist_cdfQ_tables[i];
+				break;
+			}
+		if(!ans)
+		{
+			if(pij_nulldist_cdfQ_ntable==pij_nulldist_cdfQ_ntablemax)
+			{
+				i=pij_nulldist_cdfQ_ntablemax?2*pij_nulldist_cdfQ_ntablemax:16;
+				t2=realloc(pij_nulldist_cdfQ_tables,i*sizeof(*t2));
+				if(t2)
+				{
+					pij_nulldist_cdfQ_tables=t2;
+					pij_nulldist_cdfQ_ntablemax=i;
+				}
+				else
+					LOG(1,"Not enough memory.")
+			}
+			if(pij_nulldist_cdfQ_ntable<pij_nulldist_cdfQ_ntablemax)
+			{
+				ans=pij_nulldist_cdfQ_table_new(n1,n2);
+				if(ans)
+					pij_nulldist_cdfQ_tables[pij_nulldist_cdfQ_ntable++]=ans;
+			}
+		}
+	}
+	//Empty table failed tolerance
+	return (ans&&ans->n)?ans:0;
+}
 
+void pij_nulldist_cdfQ_cache_clear()
+{
+	size_t	i;
+	for(i=0;i<pij_nulldist_cdfQ_ntable;i++)
+		pij_nulldist_cdfQ_table_free(pij_nulldist_cdfQ_tables[i]);
+	CLEANMEM(pij_nulldist_cdfQ_tables)
+	pij_nulldist_cdfQ_ntable=pij_nulldist_cdfQ_ntablemax=0;
+}
 
+/* Compares a sample of tabulated evaluations against pij_nulldist_cdfQ.
+ * x:		(n) Input locations.
+ * ans:		(n) Tabulated output to check.
+ */
+static void pij_nulldist_cdfQ_batch_check(const FTYPE* x,const FTYPE* ans,size_t n,size_t n1,size_t n2)
+{
+	size_t	i,step;
+	double	v,err=0;
+	
+	step=GSL_MAX(n/CONST_NULLDIST_CDFQ_NCHECK,1);
+	for(i=0;i<n;i+=step)
+	{
+		v=pij_nulldist_cdfQ(x[i],n1,n2);
+		//Skip values below precision of FTYPE
+		if(v>=FTYPE_MIN)
+		{
+			v=fabs(ans[i]/v-1);
+			err=GSL_MAX(err,v);
+		}
+	}
+	//Allow for rounding to FTYPE
+	if(err>CONST_NULLDIST_CDFQ_RTOL+2*FTYPE_EPSILON)
+		LOG(3,"Tabulated null distribution with n1="PRINTFSIZET", n2="PRINTFSIZET" has sampled relative error %G above tolerance.",n1,n2,err)
+	else
+		LOG(10,"Tabulated null distribution with n1="PRINTFSIZET", n2="PRINTFSIZET" has sampled relative error %G.",n1,n2,err)
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+void pij_nulldist_cdfQ_batch(const FTYPE* x,FTYPE* ans,size_t n,size_t n1,size_t n2)
+{
+	const struct pij_nulldist_cdfQ_table*	t=0;
+	FTYPE	*xc=0;
+	size_t	i;
+	
+	if(!n)
+		return;
+	if(pij_nulldist_cdfQ_mode!=PIJ_NULLDIST_CDFQ_EXACT)
+		t=pij_nulldist_cdfQ_table_get(n1,n2);
+	if(!t)
+	{
+		for(i=0;i<n;i++)
+			ans[i]=(FTYPE)pij_nulldist_cdfQ(x[i],n1,n2);
+		return;
+	}
+	
+	//Keep a copy of input for in-place evaluation in accuracy-check mode
+	if((pij_nulldist_cdfQ_mode==PIJ_NULLDIST_CDFQ_CHECK)&&(x==ans))
+	{
+		xc=malloc(n*sizeof(*xc));
+		if(xc)
+		{
+			memcpy(xc,x,n*sizeof(*xc));
+			x=xc;
+		}
+		else
+			LOG(3,"Not enough memory for accuracy check of tabulated null distribution.")
+	}
+	for(i=0;i<n;i++)
+		ans[i]=(FTYPE)pij_nulldist_cdfQ_table_eval(t,x[i]);
+	if((pij_nulldist_cdfQ_mode==PIJ_NULLDIST_CDFQ_CHECK)&&(x!=ans))
+		pij_nulldist_cdfQ_batch_check(x,ans,n,n1,n2);
+	CLEANMEM(xc)
+}
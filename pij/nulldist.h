@@ -30,6 +30,7 @@
 #include "../base/config.h"
 #include "../base/types.h"
 #include "../base/math.h"
+#include "../base/const.h"
 #ifdef __cplusplus
 extern "C"
 {
@@ -88,6 +89,71 @@ int pij_nulldist_hist_pdf(const double* restrict range,size_t nbin,double* restr
 // CDF for x=-log(1-y)/2, y=z1/(z1+z2), z1~chi2(n1), z2~chi2(n2), i.e. y~Beta(n1/2,n2/2)
 static inline double pij_nulldist_cdfQ(double x,const size_t n1,const size_t n2);
 
+/* Tabulated evaluator of pij_nulldist_cdfQ for fixed (n1,n2).
+ * log(Q) is tabulated on a uniform grid of u=sqrt(x), on which it is smooth
+ * for all n1 and n2, and linearly interpolated. On construction, the grid is refined
+ * until the relative error at every interval midpoint is below CONST_NULLDIST_CDFQ_RTOL.
+ * For x<=0, NaN, or beyond the table range (Q<CONST_NULLDIST_CDFQ_QMIN), pij_nulldist_cdfQ is used.
+ * n1,
+ * n2:		Parameters of null distribution.
+ * n:		Number of intervals in table, or 0 if refinement could not meet CONST_NULLDIST_CDFQ_RTOL.
+ * idu:		Inverse of grid spacing in u.
+ * xmax:	Upper bound of x covered by table.
+ * logq:	(n+1) log(Q) at grid points u=i/idu.
+ */
+struct pij_nulldist_cdfQ_table
+{
+	size_t		n1;
+	size_t		n2;
+	size_t		n;
+	double		idu;
+	double		xmax;
+	double*		logq;
+};
+
+/* Evaluation modes of pij_nulldist_cdfQ_batch.
+ * EXACT:	Call pij_nulldist_cdfQ for every element.
+ * TABLE:	Use cached table (default).
+ * CHECK:	Use cached table, and additionally compare a sample of
+ * 			CONST_NULLDIST_CDFQ_NCHECK elements per call against pij_nulldist_cdfQ.
+ * 			Maximum relative errors are logged at level 10, and those
+ * 			above CONST_NULLDIST_CDFQ_RTOL at level 3.
+ */
+enum pij_nulldist_cdfQ_modes
+{
+	PIJ_NULLDIST_CDFQ_EXACT=0,
+	PIJ_NULLDIST_CDFQ_TABLE,
+	PIJ_NULLDIST_CDFQ_CHECK
+};
+
+/* Sets evaluation mode for pij_nulldist_cdfQ_batch. See enum pij_nulldist_cdfQ_modes.
+ * Not thread safe. Should be called before computation starts.
+ */
+void pij_nulldist_cdfQ_setmode(enum pij_nulldist_cdfQ_modes mode);
+
+/* Obtains the cached table for (n1,n2), constructing it on first use.
+ * Thread safe. Tables stay valid until pij_nulldist_cdfQ_cache_clear.
+ * Return:	Table, or NULL if failed or the table cannot meet CONST_NULLDIST_CDFQ_RTOL,
+ * 			in which case pij_nulldist_cdfQ should be used.
+ */
+const struct pij_nulldist_cdfQ_table* pij_nulldist_cdfQ_table_get(size_t n1,size_t n2);
+
+/* Frees all cached tables. Not thread safe. */
+void pij_nulldist_cdfQ_cache_clear();
+
+/* Evaluates pij_nulldist_cdfQ for a contiguous array in single thread,
+ * according to the mode set by pij_nulldist_cdfQ_setmode.
+ * x:		(n) Input locations.
+ * ans:		(n) Output Q values. Can be identical with x for in-place evaluation.
+ * n:		Size of x and ans.
+ * n1,
+ * n2:		Parameters of null distribution.
+ */
+void pij_nulldist_cdfQ_batch(const FTYPE* x,FTYPE* ans,size_t n,size_t n1,size_t n2);
+
+// Evaluates Q at x with table t.
+static inline double pij_nulldist_cdfQ_table_eval(const struct pij_nulldist_cdfQ_table* t,double x);
+
 /*****************************************************
  * Inline functions
  *****************************************************/
@@ -100,6 +166,21 @@ static inline double pij_nulldist_cdfQ(double x,const size_t n1,const size_t n2)
 	return x1;
 }
 
+static inline double pij_nulldist_cdfQ_table_eval(const struct pij_nulldist_cdfQ_table* t,double x)
+{
+	double	u;
+	size_t	i;
+	
+	if(!((x>0)&&(x<t->xmax)))
+		return pij_nulldist_cdfQ(x,t->n1,t->n2);
+	u=sqrt(x)*t->idu;
+	i=(size_t)u;
+	if(i>=t->n)
+		i=t->n-1;
+	u-=(double)i;
+	return exp(t->logq[i]+(t->logq[i+1]-t->logq[i])*u);
+}
+
 
 
 
@@ -19,31 +19,207 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
 #include "../base/gsl/histogram.h"
 #include "../base/logger.h"
 #include "../base/macros.h"
 #include "../base/histogram.h"
+#include "../base/const.h"
 #include "nulldist.h"
 #include "nullhist.h"
 
 
 
-gsl_histogram* pij_nullhist_single(double dmax,size_t nd,size_t n1,size_t n2)
+/*************************************************************
+ * Null histogram cache
+ *************************************************************/
+
+/* Cache entry of one null histogram.
+ * dmax:	Histogram bound after rounding by pij_nullhist_dmax_grid.
+ * nbin:	Bin count from pij_nullhist_nbin.
+ * n1,
+ * n2:		Parameters of null distribution.
+ * h:		Cached histogram.
+ */
+struct pij_nullhist_cache_entry
+{
+	double	dmax;
+	size_t	nbin;
+	size_t	n1;
+	size_t	n2;
+	gsl_histogram*	h;
+};
+
+static char pij_nullhist_cache_on=1;
+static char* pij_nullhist_cache_path=0;
+//Cache entries as circular buffer with capacity CONST_NULLHIST_CACHE_NMAX
+static struct pij_nullhist_cache_entry pij_nullhist_cache_entries[CONST_NULLHIST_CACHE_NMAX];
+static size_t pij_nullhist_cache_n=0;
+static size_t pij_nullhist_cache_next=0;
+//Magic string of cache files. Also distinguishes size_t and double formats.
+static const char pij_nullhist_cache_magic[8]={'F','N','H','2',(char)sizeof(size_t),(char)sizeof(double),0,0};
+
+void pij_nullhist_cache_enable(char on)
+{
+	pij_nullhist_cache_on=on;
+}
+
+int pij_nullhist_cache_dir(const char* dir)
+{
+#define	CLEANUP
+	char*	p=0;
+	if(dir)
+	{
+		MALLOCSIZE(p,strlen(dir)+1);
+		if(!p)
+			ERRRET("Not enough memory.")
+		strcpy(p,dir);
+	}
+	CLEANMEM(pij_nullhist_cache_path)
+	pij_nullhist_cache_path=p;
+	return 0;
+#undef	CLEANUP
+}
+
+void pij_nullhist_cache_clear()
+{
+	size_t	i;
+	for(i=0;i<pij_nullhist_cache_n;i++)
+		CLEANHIST(pij_nullhist_cache_entries[i].h)
+	pij_nullhist_cache_n=pij_nullhist_cache_next=0;
+}
+
+static inline int pij_nullhist_cache_match(const struct pij_nullhist_cache_entry* e,double dmax,size_t nbin,size_t n1,size_t n2)
+{
+	return (!memcmp(&e->dmax,&dmax,sizeof(dmax)))&&(e->nbin==nbin)&&(e->n1==n1)&&(e->n2==n2);
+}
+
+/* Obtains file name of cache entry in cache directory.
+ * Return:	File name, or 0 if cache directory is not set or out of memory.
+ */
+static char* pij_nullhist_cache_filename(const char* dir,double dmax,size_t nbin,size_t n1,size_t n2)
+{
+	unsigned char	b[sizeof(dmax)];
+	char	*ans;
+	size_t	i,n;
+	
+	memcpy(b,&dmax,sizeof(dmax));
+	n=strlen(dir)+2*sizeof(dmax)+3*24+32;
+	MALLOCSIZE(ans,n);
+	if(!ans)
+		return 0;
+	i=(size_t)snprintf(ans,n,"%s/findr_nullhist_",dir);
+	for(n=0;n<sizeof(dmax);n++,i+=2)
+		sprintf(ans+i,"%02x",b[n]);
+	sprintf(ans+i,"_"PRINTFSIZET"_"PRINTFSIZET"_"PRINTFSIZET".bin",nbin,n1,n2);
+	return ans;
+}
+
+/* Loads null histogram from cache directory.
+ * Return:	Loaded histogram, or 0 if not found or invalid.
+ */
+static gsl_histogram* pij_nullhist_cache_load(const char* fname,double dmax,size_t nbin,size_t n1,size_t n2)
+{
+#define	CLEANUP	CLEANFILE(f)CLEANHIST(h)
+	FILE	*f;
+	gsl_histogram	*h=0;
+	char	magic[sizeof(pij_nullhist_cache_magic)];
+	struct pij_nullhist_cache_entry	e;
+	
+	f=fopen(fname,"rb");
+	if(!f)
+		return 0;
+	if((fread(magic,sizeof(magic),1,f)!=1)||memcmp(magic,pij_nullhist_cache_magic,sizeof(magic))
+		||(fread(&e.dmax,sizeof(e.dmax),1,f)!=1)||(fread(&e.nbin,sizeof(e.nbin),1,f)!=1)
+		||(fread(&e.n1,sizeof(e.n1),1,f)!=1)||(fread(&e.n2,sizeof(e.n2),1,f)!=1)
+		||(!pij_nullhist_cache_match(&e,dmax,nbin,n1,n2)))
+		ERRRETV(0,"Invalid null histogram cache file %s. Ignored.",fname)
+	h=gsl_histogram_alloc(nbin);
+	if(!h)
+		ERRRETV(0,"Not enough memory.")
+	if((fread(h->range,sizeof(*h->range),nbin+1,f)!=nbin+1)||(fread(h->bin,sizeof(*h->bin),nbin,f)!=nbin))
+		ERRRETV(0,"Invalid null histogram cache file %s. Ignored.",fname)
+	CLEANFILE(f)
+	LOG(10,"Loaded null histogram from cache file %s.",fname)
+	return h;
+#undef	CLEANUP
+}
+
+/* Saves null histogram into cache directory. The file is written under a
+ * temporary name first and then renamed, so concurrent readers never see partial files.
+ */
+static void pij_nullhist_cache_save(const char* fname,const gsl_histogram* h,double dmax,size_t n1,size_t n2)
+{
+#define	CLEANUP	CLEANFILE(f)if(ftmp){remove(ftmp);CLEANMEM(ftmp)}
+	FILE	*f=0;
+	char	*ftmp=0;
+	size_t	n;
+	int		ret;
+	
+	n=strlen(fname)+64;
+	MALLOCSIZE(ftmp,n);
+	if(!ftmp)
+	{
+		LOG(3,"Not enough memory.")
+		return;
+	}
+	snprintf(ftmp,n,"%s.%lu.%lu.tmp",fname,(unsigned long)time(NULL),(unsigned long)(size_t)h);
+	f=fopen(ftmp,"wb");
+	if(!f)
+	{
+		LOG(3,"Failed to write null histogram cache file %s.",ftmp)
+		CLEANMEM(ftmp)
+		return;
+	}
+	n=h->n;
+	ret=(fwrite(pij_nullhist_cache_magic,sizeof(pij_nullhist_cache_magic),1,f)==1)
+		&&(fwrite(&dmax,sizeof(dmax),1,f)==1)&&(fwrite(&n,sizeof(n),1,f)==1)
+		&&(fwrite(&n1,sizeof(n1),1,f)==1)&&(fwrite(&n2,sizeof(n2),1,f)==1)
+		&&(fwrite(h->range,sizeof(*h->range),n+1,f)==n+1)&&(fwrite(h->bin,sizeof(*h->bin),n,f)==n);
+	ret=(fclose(f)==0)&&ret;
+	f=0;
+	if(!(ret&&(rename(ftmp,fname)==0)))
+	{
+		LOG(3,"Failed to write null histogram cache file %s.",fname)
+		CLEANUP
+		return;
+	}
+	LOG(10,"Saved null histogram to cache file %s.",fname)
+	CLEANMEM(ftmp)
+#undef	CLEANUP
+}
+
+/* Determines the number of bins from real data count.
+ * nd:		Count of real data to form real histograms.
+ * nbin:	Output of bin count.
+ * Return:	0 on success.
+ */
+static int pij_nullhist_nbin(size_t nd,size_t* nbin)
+{
+#define	CLEANUP
+	*nbin=histogram_unequalbins_param_count(nd);
+	if(*nbin<5)
+		ERRRET("Determined "PRINTFSIZET" bins constructed. Bin count too small.",*nbin)
+	else if(*nbin<10)
+		LOG(5,"Determined "PRINTFSIZET" bins, smaller than recommended minimum bin count (10).",*nbin)
+	else
+		LOG(10,"Determined "PRINTFSIZET" bins.",*nbin)
+	return 0;
+#undef	CLEANUP
+}
+
+/* Computes one null histogram without cache. See pij_nullhist_single.
+ * nbin:	Bin count, from pij_nullhist_nbin.
+ */
+static gsl_histogram* pij_nullhist_compute(double dmax,size_t nbin,size_t n1,size_t n2)
 {
 #define	CLEANUP	CLEANHIST(h)
 	struct pij_nulldist_pdfs_param param={n1,n2};
-	size_t	nbin;
 	gsl_histogram *h=0;
 	
 	assert(n1&&n2);
 	dmax*=(1+1E-6);
-	nbin=histogram_unequalbins_param_count(nd);
-	if(nbin<5)
-		ERRRETV(0,"Determined "PRINTFSIZET" bins constructed. Bin count too small.",nbin)
-	else if(nbin<10)
-		LOG(5,"Determined "PRINTFSIZET" bins, smaller than recommended minimum bin count (10).",nbin)
-	else
-		LOG(10,"Determined "PRINTFSIZET" bins.",nbin)
 	h=gsl_histogram_alloc(nbin);
 	if(!h)
 		ERRRETV(0,"Not enough memory.")
@@ -59,43 +235,126 @@ gsl_histogram* pij_nullhist_single(double dmax,size_t nd,size_t n1,size_t n2)
 #undef	CLEANUP
 }
 
+/* Rounds histogram bound up to a grid of CONST_NULLHIST_DMAX_NGRID steps per doubling.
+ * Histograms are computed with the rounded bound regardless of cache, which
+ * still covers all data and widens bins by less than 1/CONST_NULLHIST_DMAX_NGRID.
+ */
+static double pij_nullhist_dmax_grid(double dmax)
+{
+	int		e;
+	double	m;
+	
+	m=frexp(dmax,&e);
+	m=ceil(m*(2*CONST_NULLHIST_DMAX_NGRID))/(2*CONST_NULLHIST_DMAX_NGRID);
+	return ldexp(m,e);
+}
+
+/* Obtains one null histogram, from memory cache, cache directory, or computation
+ * in that order. Newly obtained histograms are stored in the caches.
+ * Entries are keyed on bin count instead of real data count, and on rounded dmax.
+ * nbin:	Bin count, from pij_nullhist_nbin.
+ * Return:	Null histogram owned by the caller, or 0 on failure.
+ */
+static gsl_histogram* pij_nullhist_cached(double dmax,size_t nbin,size_t n1,size_t n2)
+{
+	gsl_histogram	*h=0,*hc;
+	char	*fname=0;
+	size_t	i;
+	
+	dmax=pij_nullhist_dmax_grid(dmax);
+	if(!pij_nullhist_cache_on)
+		return pij_nullhist_compute(dmax,nbin,n1,n2);
+	#pragma omp critical(pij_nullhist_cache)
+	{
+		for(i=0;i<pij_nullhist_cache_n;i++)
+			if(pij_nullhist_cache_match(&pij_nullhist_cache_entries[i],dmax,nbin,n1,n2))
+			{
+				h=gsl_histogram_clone(pij_nullhist_cache_entries[i].h);
+				break;
+			}
+		if(pij_nullhist_cache_path)
+			fname=pij_nullhist_cache_filename(pij_nullhist_cache_path,dmax,nbin,n1,n2);
+	}
+	if(h)
+	{
+		LOG(10,"Found null histogram in cache.")
+		CLEANMEM(fname)
+		return h;
+	}
+	
+	//Computation is outside critical section. Concurrent computation of the same entry gives identical results.
+	if(fname)
+		h=pij_nullhist_cache_load(fname,dmax,nbin,n1,n2);
+	if(!h)
+	{
+		h=pij_nullhist_compute(dmax,nbin,n1,n2);
+		if(h&&fname)
+			pij_nullhist_cache_save(fname,h,dmax,n1,n2);
+	}
+	CLEANMEM(fname)
+	if(!h)
+		return 0;
+	hc=gsl_histogram_clone(h);
+	if(!hc)
+		return h;
+	#pragma omp critical(pij_nullhist_cache)
+	{
+		for(i=0;i<pij_nullhist_cache_n;i++)
+			if(pij_nullhist_cache_match(&pij_nullhist_cache_entries[i],dmax,nbin,n1,n2))
+				break;
+		if(i==pij_nullhist_cache_n)
+		{
+			struct pij_nullhist_cache_entry	*e=pij_nullhist_cache_entries+pij_nullhist_cache_next;
+			CLEANHIST(e->h)
+			e->dmax=dmax;
+			e->nbin=nbin;
+			e->n1=n1;
+			e->n2=n2;
+			e->h=hc;
+			hc=0;
+			pij_nullhist_cache_next=(pij_nullhist_cache_next+1)%CONST_NULLHIST_CACHE_NMAX;
+			if(pij_nullhist_cache_n<CONST_NULLHIST_CACHE_NMAX)
+				pij_nullhist_cache_n++;
+		}
+	}
+	CLEANHIST(hc)
+	return h;
+}
+
+/*************************************************************
+ * Null histograms
+ *************************************************************/
+
+gsl_histogram* pij_nullhist_single(double dmax,size_t nd,size_t n1,size_t n2)
+{
+	size_t	nbin;
+	
+	assert(n1&&n2);
+	if(pij_nullhist_nbin(nd,&nbin))
+		return 0;
+	return pij_nullhist_cached(dmax,nbin,n1,n2);
+}
+
 gsl_histogram** pij_nullhist(double dmax,size_t nv,size_t nd,long n1c,size_t n1d,long n2c,size_t n2d)
 {
 #define	CLEANUP	if(h){for(i=0;i<nv-1;i++)CLEANHIST(h[i])free(h);h=0;}
-	struct pij_nulldist_pdfs_param param;
-	size_t	nbin,i;
-	int		ret;
+	size_t	nbin,i,n1,n2;
 	gsl_histogram **h;
 	
 	assert(nv>=2);
-	dmax*=(1+1E-6);
 	CALLOCSIZE(h,nv-1);
 	if(!h)
 		ERRRETV(0,"Not enough memory.")
-	nbin=histogram_unequalbins_param_count(nd);
-	if(nbin<5)
-		ERRRETV(0,"Determined "PRINTFSIZET" bins constructed. Bin count too small.",nbin)
-	else if(nbin<10)
-		LOG(5,"Determined "PRINTFSIZET" bins, smaller than recommended minimum bin count (10).",nbin)
-	else
-		LOG(10,"Determined "PRINTFSIZET" bins.",nbin)
-	ret=1;
-	for(i=0;i<nv-1;i++)
-		ret=ret&&(h[i]=gsl_histogram_alloc(nbin));
-	if(!ret)
-		ERRRETV(0,"Not enough memory.")
+	if(pij_nullhist_nbin(nd,&nbin))
+		ERRRETV(0,"pij_nullhist_nbin failed.")
 	//Null density histogram
 	for(i=0;i<nv-1;i++)
 	{
-		gsl_histogram_set_ranges_uniform(h[i],0,dmax);
-		//Set null histogram ranges
-		param.n1=(size_t)((long)i*n1c+(long)n1d);
-		param.n2=(size_t)(-(long)i*n2c+(long)n2d);
-		if(histogram_unequalbins_fromnullpdfs(nbin,h[i]->range,pij_nulldist_pdfs,&param))
-			ERRRETV(0,"histogram_unequalbins_fromnullpdfs failed.")
-		//Calculate null density histogram
-		if(pij_nulldist_hist_pdf(h[i]->range,nbin,h[i]->bin,param.n1,param.n2,5))
-			ERRRETV(0,"pij_nulldist_hist_pdf failed.")
+		n1=(size_t)((long)i*n1c+(long)n1d);
+		n2=(size_t)(-(long)i*n2c+(long)n2d);
+		h[i]=pij_nullhist_cached(dmax,nbin,n1,n2);
+		if(!h[i])
+			ERRRETV(0,"Failed to construct null histogram.")
 	}
 	return h;
 #undef	CLEANUP
@@ -29,6 +29,31 @@ extern "C"
 #endif
 
 
+/* Null histograms are cached process-wide, keyed on (dmax,nbin,n1,n2) of single
+ * histograms, where nbin is the bin count determined from nd. The bound dmax is always
+ * rounded up to a grid of CONST_NULLHIST_DMAX_NGRID steps per doubling, so calls with
+ * nearby maxima, e.g. on different subsets of B, reuse the same histograms. Histograms of
+ * pij_nullhist are cached as single histograms with their (n1,n2) for each genotype count.
+ * Callers always receive their own copy. The cache keeps the last CONST_NULLHIST_CACHE_NMAX
+ * histograms in memory, and optionally persists them in a directory across processes.
+ * Cached and computed histograms are identical.
+ */
+
+/* Enables (default) or disables null histogram cache. Not thread safe.
+ * on:		Whether to enable cache.
+ */
+void pij_nullhist_cache_enable(char on);
+
+/* Sets directory for persistent null histogram cache. Not thread safe.
+ * Each histogram is stored as one binary file in native format. Invalid files are ignored.
+ * dir:		Existing directory for cache files, or 0 to disable persistence (default).
+ * Return:	0 on success.
+ */
+int pij_nullhist_cache_dir(const char* dir);
+
+/* Frees all null histograms cached in memory. Not thread safe. */
+void pij_nullhist_cache_clear();
+
 /* Construct one null histogram for a specific genotype value count.
  * The function calculates the null density histogram for random variable:
  * x=-0.5*log(1-z1/(z1+z2)), where z1~chi2(n1),z2~chi2(n2),
@@ -36,7 +61,7 @@ extern "C"
  * from real data count (nd).
  * For bin range settings, see histogram_unequalbins_fromnullcdf.
  * For null density histogram from pdf, see pij_nulldist_hist_pdf.
- * dmax:	Specifies the histogram bound as [0,dmax).
+ * dmax:	Specifies the histogram bound as [0,dmax), after rounding up to the cache grid.
  * nd:		Count of real data to form real histograms. This is used to
  * 			automatically decide number of bins and widths.
  * n1,
@@ -53,7 +78,7 @@ gsl_histogram* pij_nullhist_single(double dmax,size_t nd,size_t n1,size_t n2);
  * from real data count (nd).
  * For bin range settings, see histogram_unequalbins_fromnullcdf.
  * For null density histogram from pdf, see pij_nulldist_hist_pdf.
- * dmax:	Specifies the histogram bound as [0,dmax).
+ * dmax:	Specifies the histogram bound as [0,dmax), after rounding up to the cache grid.
  * nv:		Maximum number of values each genotype can type. Must be nv>=2.
  * 			This limits the possible values of kv in distribution, and
  * 			also output histogram count.
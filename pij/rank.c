@@ -26,10 +26,14 @@
 #include "../base/logger.h"
 #include "../base/macros.h"
 #include "../base/data_process.h"
+#include "../base/numa.h"
+#include "../base/mapfile.h"
 #include "../base/supernormalize.h"
 #include "../base/threading.h"
 #include "llrtopij.h"
 #include "llrtopv.h"
+#include "memplan.h"
+#include "stream.h"
 #include "rank.h"
 
 /* Calculates the log likelihood ratio correlated v.s. uncorrelated models.
@@ -59,27 +63,120 @@ static void pij_rank_llr_block(const MATRIXF* t,const MATRIXF* t2,MATRIXF* llr)
 	MATRIXFF(bound_below)(llr,0);
 }
 
+/* Converts bounded correlations into log likelihood ratios in place, as in pij_rank_llr_block.
+ * x:	(n) Correlations as input and log likelihood ratios as output
+ */
+static inline void pij_rank_llr_convert(FTYPE* restrict x,size_t n)
+{
+	size_t	i;
+	FTYPE	v;
+	
+	for(i=0;i<n;i++)
+	{
+		v=GSL_MIN(GSL_MAX(x[i],-1),1);
+		v=(FTYPE)log(1-v*v)*(FTYPE)-0.5;
+		x[i]=GSL_MAX(v,0);
+	}
+}
+
+/* Calculates log likelihood ratios of rows [n1,n2) of t against rows [n1,nt) of t2,
+ * when the top ng rows of t2 are t. Only columns from the diagonal are filled.
+ * Uses SYRK for the diagonal block and GEMM for the rest.
+ * t:	(ng,ns) Transcript data of A
+ * t2:	(nt,ns) Transcript data of B, whose top ng rows are t.
+ * llr:	(ng,nt) Log likelihood ratios for test.
+ */
+static void pij_rank_llr_block_sym(const MATRIXF* t,const MATRIXF* t2,MATRIXF* llr,size_t n1,size_t n2)
+{
+	size_t	i,nt=t2->size1;
+	FTYPE	scale=(FTYPE)1./(FTYPE)t->size2;
+	MATRIXFF(const_view) mvt=MATRIXFF(const_submatrix)(t,n1,0,n2-n1,t->size2);
+	MATRIXFF(view) mvllr=MATRIXFF(submatrix)(llr,n1,n1,n2-n1,n2-n1);
+	
+	BLASF(syrk)(CblasUpper,CblasNoTrans,scale,&mvt.matrix,0,&mvllr.matrix);
+	if(n2<nt)
+	{
+		MATRIXFF(const_view) mvt2=MATRIXFF(const_submatrix)(t2,n2,0,nt-n2,t2->size2);
+		mvllr=MATRIXFF(submatrix)(llr,n1,n2,n2-n1,nt-n2);
+		BLASF(gemm)(CblasNoTrans,CblasTrans,scale,&mvt.matrix,&mvt2.matrix,0,&mvllr.matrix);
+	}
+	for(i=n1;i<n2;i++)
+		pij_rank_llr_convert(MATRIXFF(ptr)(llr,i,i),nt-i);
+}
+
+/* Start row of thread x of nth, splitting rows [0,ng) of a triangular problem
+ * with nt-i elements in row i into equal amounts of work.
+ */
+static inline size_t pij_rank_llr_sym_start(size_t ng,size_t nt,size_t nth,size_t x)
+{
+	double	total,r;
+	
+	if(x>=nth)
+		return ng;
+	//Rows before r have r*nt-r*(r-1)/2 elements
+	total=(double)ng*((double)nt-((double)ng-1)/2);
+	r=(double)nt+0.5-sqrt(GSL_MAX(gsl_pow_2((double)nt+0.5)-2*total*(double)x/(double)nth,0));
+	return GSL_MIN((size_t)r,ng);
+}
+
+/* Whether the top rows of t2 are t, in which case the leading square block of
+ * log likelihood ratios is symmetric.
+ */
+static inline char pij_rank_llr_issym(const MATRIXF* t,const MATRIXF* t2)
+{
+	return (t->data==t2->data)&&(t->tda==t2->tda)&&(t->size2==t2->size2)&&(t->size1<=t2->size1);
+}
+
 /* Multithread calculation of log likelihood ratio
+ * When the top rows of t2 are t, such as t==t2, only the upper triangle of the
+ * symmetric block is computed and then mirrored to the lower triangle.
  * t:	(ng,ns) Full transcript data matrix of A
  * t2:	(nt,ns) Full transcript data matrix of B
  * llr:	(ng,nt). Log likelihood ratios for test.
  */
 static void pij_rank_llr(const MATRIXF* t,const MATRIXF* t2,MATRIXF* llr)
 {
+	struct threading_sched	sch;
+	
 	assert((t->size2==t2->size2)&&(llr->size1==t->size1)&&(llr->size2==t2->size1));
+	if(pij_rank_llr_issym(t,t2))
+	{
+		LOG(10,"Using symmetric log likelihood ratio calculation.")
+		#pragma omp parallel
+		{
+			size_t	nth=(size_t)omp_get_num_threads();
+			size_t	id=(size_t)omp_get_thread_num();
+			size_t	i,j,n1,n2;
+			
+			n1=pij_rank_llr_sym_start(t->size1,t2->size1,nth,id);
+			n2=pij_rank_llr_sym_start(t->size1,t2->size1,nth,id+1);
+			if(n2>n1)
+				pij_rank_llr_block_sym(t,t2,llr,n1,n2);
+			#pragma omp barrier
+			//Mirror to lower triangle
+			threading_get_startend(t->size1,&n1,&n2);
+			for(i=n1;i<n2;i++)
+				for(j=0;j<i;j++)
+					MATRIXFF(set)(llr,i,j,MATRIXFF(get)(llr,j,i));
+		}
+		return;
+	}
+	threading_sched_init(&sch,t->size1,0);
 	#pragma omp parallel
 	{
 		size_t	n1,n2;
+		double	t0=omp_get_wtime();
 		
-		threading_get_startend(t->size1,&n1,&n2);
-		if(n2>n1)
+		while(threading_sched_next(&sch,&n1,&n2))
 		{
 			MATRIXFF(const_view) mvt=MATRIXFF(const_submatrix)(t,n1,0,n2-n1,t->size2);
 			MATRIXFF(view)	mvllr;
 			mvllr=MATRIXFF(submatrix)(llr,n1,0,n2-n1,llr->size2);
 			pij_rank_llr_block(&mvt.matrix,t2,&mvllr.matrix);
 		}
+		threading_sched_done(&sch,t0);
 	}
+	threading_sched_log(&sch,"pij_rank_llr");
 }
 
 /* Converts log likelihood ratios into p-values for ranked correlation test
@@ -94,47 +191,46 @@ static inline void pij_rank_llrtopv(MATRIXF* d,size_t ns)
 
 int pij_rank_pv(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,size_t memlimit)
 {
-#define	CLEANUP		CLEANMATF(tnew)CLEANMATF(tnew2)
-	MATRIXF		*tnew,*tnew2;			//(nt,ns) Supernormalized transcript matrix
-	int			ret;
-	size_t		ng,nt,ns;
+#define	CLEANUP		CLEANMATF(tnew)CLEANMATF(tnew2)pool_end();
+	MATRIXF		*tnew,*tnew2;			//Supernormalized copies of t and t2, if needed
+	const MATRIXF	*tn,*tn2;			//(ng,ns) and (nt,ns) Supernormalized transcript matrices
+	size_t		ns;
+#ifndef NDEBUG
+	size_t		ng,nt;
 	
 	ng=t->size1;
 	nt=t2->size1;
+#endif
 	ns=t->size2;
 
 	tnew=tnew2=0;
+	tn=tn2=0;
 	
 	//Validation
 	assert((t2->size2==ns)&&(p->size1==ng)&&(p->size2==nt)&&memlimit);
+	pool_begin(memlimit);
 	if(ns<3)
 		ERRRET("Needs at least 3 samples to compute p-values.")
 	
 	{
-		size_t mem;
-		mem=(2*t->size1*t->size2+2*t2->size1*t2->size2+p->size1*p->size2)*FTYPEBITS/8;
-		if(memlimit<=mem)
-			ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
-		LOG(10,"Memory limit: %lu bytes.",memlimit)
+		struct pij_memplan	mp;
+		pij_memplan_init(&mp,"pij_rank_pv");
+		//Inputs, output, and supernormalized copies
+		pij_memplan_base(&mp,(t->size1*t->size2+t2->size1*t2->size2+p->size1*p->size2)*sizeof(FTYPE)
+			+supernormalize_input_mem2(t,t2),0);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		if(pij_memplan_fit(&mp,t->size1,memlimit))
+			ERRRET("pij_memplan_fit failed.")
 	}
 
-	tnew=MATRIXFF(alloc)(ng,ns);
-	tnew2=MATRIXFF(alloc)(nt,ns);
-	if(!(tnew&&tnew2))
-		ERRRET("Not enough memory.")
-
 	//Step 1: Supernormalization
 	LOG(9,"Supernormalizing...")
-	MATRIXFF(memcpy)(tnew,t);
-	ret=supernormalizea_byrow(tnew);
-	MATRIXFF(memcpy)(tnew2,t2);
-	ret=ret||supernormalizea_byrow(tnew2);
-	if(ret)
+	if(supernormalizea_byrow_input2(t,t2,&tn,&tn2,&tnew,&tnew2))
 		ERRRET("Supernormalization failed.")
 
 	//Step 2: Log likelihood ratios from nonpermuted data
 	LOG(9,"Calculating real log likelihood ratios...")
-	pij_rank_llr(tnew,tnew2,p);
+	pij_rank_llr(tn,tn2,p);
 	//Step 3: Convert log likelihood ratios to probabilities
 	LOG(9,"Converting likelihood ratios into p-values...")
 	pij_rank_llrtopv(p,ns);
@@ -168,55 +264,57 @@ static int pij_rank_llrtopij(MATRIXF* ans,size_t ns,char nodiag,long nodiagshift
 
 int pij_rank(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,char nodiag,size_t memlimit)
 {
-#define	CLEANUP		CLEANMATF(tnew)CLEANMATF(tnew2)
-	MATRIXF		*tnew,*tnew2;			//(nt,ns) Supernormalized transcript matrix
+#define	CLEANUP		CLEANMATF(tnew)CLEANMATF(tnew2)pool_end();
+	MATRIXF		*tnew,*tnew2;			//Supernormalized copies of t and t2, if needed
+	const MATRIXF	*tn,*tn2;			//(ng,ns) and (nt,ns) Supernormalized transcript matrices
 	VECTORFF(view)	vv;
 	int			ret;
-	size_t		ng,nt,ns;
+	size_t		ns;
+#ifndef NDEBUG
+	size_t		ng,nt;
 	
 	ng=t->size1;
 	nt=t2->size1;
+#endif
 	ns=t->size2;
 
 	tnew=tnew2=0;
+	tn=tn2=0;
 	
 	//Validation
 	assert((t2->size2==ns)&&(p->size1==ng)&&(p->size2==nt)&&memlimit);
+	//Out of core: process and release one block of rows at a time
+	if(MATRIXFF(mapfile_is)(p))
+		return pij_rank_stream(t,t2,p,0,0,nodiag,memlimit);
+	pool_begin(memlimit);
 	
 	if(ns<=2)
 		ERRRET("Needs at least 3 samples to compute probabilities.")
 	{
-		size_t mem;
-		mem=(2*t->size1*t->size2+2*t2->size1*t2->size2+p->size1*p->size2)*FTYPEBITS/8;
-		if(memlimit<=mem)
-			ERRRET("Memory limit lower than minimum memory needed. Try increasing your memory usage limit.")
-		LOG(10,"Memory limit: %lu bytes.",memlimit)
+		struct pij_memplan	mp;
+		size_t	fixed,perrow;
+		pij_memplan_init(&mp,"pij_rank");
+		//Inputs, output, and supernormalized copies
+		pij_memplan_base(&mp,(t->size1*t->size2+t2->size1*t2->size2+p->size1*p->size2)*sizeof(FTYPE)
+			+supernormalize_input_mem2(t,t2),0);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		pij_llrtopij_engine_mem(t2->size1,1,&fixed,&perrow);
+		pij_memplan_stage(&mp,"conversion to probabilities",fixed,perrow);
+		if(pij_memplan_fit(&mp,t->size1,memlimit))
+			ERRRET("pij_memplan_fit failed.")
 	}
 
-	tnew=MATRIXFF(alloc)(ng,ns);
-	tnew2=MATRIXFF(alloc)(nt,ns);
-	if(!(tnew&&tnew2))
-		ERRRET("Not enough memory.")
-
 	//Check for identical rows in input data
-	{
-		VECTORFF(view) vbuff1=MATRIXFF(column)(tnew,0);
-		VECTORFF(view) vbuff2=MATRIXFF(row)(tnew2,0);
-		MATRIXFF(cmprow)(t,t2,&vbuff1.vector,&vbuff2.vector,nodiag,1);
-	}
+	MATRIXFF(cmprow_auto)(t,t2,nodiag,1);
 
 	//Step 1: Supernormalization
 	LOG(9,"Supernormalizing...")
-	MATRIXFF(memcpy)(tnew,t);
-	ret=supernormalizea_byrow(tnew);
-	MATRIXFF(memcpy)(tnew2,t2);
-	ret=ret||supernormalizea_byrow(tnew2);
-	if(ret)
+	if(supernormalizea_byrow_input2(t,t2,&tn,&tn2,&tnew,&tnew2))
 		ERRRET("Supernormalization failed.")
 
 	//Step 2: Log likelihood ratios from nonpermuted data
 	LOG(9,"Calculating real log likelihood ratios...")
-	pij_rank_llr(tnew,tnew2,p);
+	pij_rank_llr(tn,tn2,p);
 	if(nodiag)
 	{
 		vv=MATRIXFF(diagonal)(p);
@@ -231,3 +329,112 @@ int pij_rank(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,char nodiag,size_t me
 	return ret;
 #undef	CLEANUP		
 }
+
+//Data of pij_rank_stream for the callbacks of pij_stream_run
+struct pij_rank_stream_data
+{
+	//(ng,ns) and (nt,ns) Supernormalized transcript matrices
+	const MATRIXF	*t,*t2;
+	char		nodiag;
+};
+
+//Step 2: Log likelihood ratios from nonpermuted data, with diagonal removed before maximum and conversion
+static int pij_rank_stream_llr(void* data,size_t start,MATRIXF* const* d)
+{
+	struct pij_rank_stream_data*	s=data;
+	MATRIXFF(const_view) mvt=MATRIXFF(const_submatrix)(s->t,start,0,d[0]->size1,s->t->size2);
+	VECTORFF(view)	vv;
+	
+	pij_rank_llr(&mvt.matrix,s->t2,d[0]);
+	if(s->nodiag&&(start<s->t2->size1))
+	{
+		vv=MATRIXFF(superdiagonal)(d[0],start);
+		VECTORFF(set_zero)(&vv.vector);
+	}
+	return 0;
+}
+
+//Step 3: Convert log likelihood ratios to probabilities
+static int pij_rank_stream_convert(void* data,size_t start,MATRIXF* const* d,const FTYPE* dmax)
+{
+	struct pij_rank_stream_data*	s=data;
+	
+	if(pij_llrtopij_convert_single_self_dmax(d[0],dmax[0],1,s->t->size2-2,s->nodiag,(long)start))
+	{
+		LOG(1,"Failed to convert log likelihood ratios to probabilities.")
+		return 1;
+	}
+	return 0;
+}
+
+int pij_rank_stream(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,pij_stream_func func,void* data,char nodiag,size_t memlimit)
+{
+#define	CLEANUP		CLEANMATF(tnew)CLEANMATF(tnew2)pool_end();
+	MATRIXF		*tnew,*tnew2;			//Supernormalized copies of t and t2, if needed
+	struct pij_rank_stream_data	sd={0,0,0};
+	struct pij_stream_method	m={"pij_rank_stream",1,1,0,0,pij_rank_stream_llr,0,pij_rank_stream_convert};
+	int			ret;
+	size_t		ng,nt,ns,nsplit;
+	
+	ng=t->size1;
+	nt=t2->size1;
+	ns=t->size2;
+
+	tnew=tnew2=0;
+	
+	//Validation
+	assert((t2->size2==ns)&&((!p)||((p->size1==ng)&&(p->size2==nt)))&&memlimit);
+	pool_begin(memlimit);
+	if(!(p||func))
+		ERRRET("Neither output matrix nor callback function is specified.")
+	if(ns<=2)
+		ERRRET("Needs at least 3 samples to compute probabilities.")
+	{
+		struct pij_memplan	mp;
+		size_t	fixed,perrow;
+		pij_memplan_init(&mp,"pij_rank_stream");
+		//Inputs, output, and supernormalized copies. Per primary target: LLR buffer if no output or output is mapped.
+		pij_memplan_base(&mp,(t->size1*t->size2+t2->size1*t2->size2)*sizeof(FTYPE)
+			+supernormalize_input_mem2(t,t2),pij_stream_nbuf(1,p)*nt*sizeof(FTYPE));
+		if(p)
+			pij_memplan_matrix(&mp,p);
+		pij_memplan_stage(&mp,"supernormalization",supernormalize_byrow_mem(ns),0);
+		pij_llrtopij_engine_mem(nt,1,&fixed,&perrow);
+		pij_memplan_stage(&mp,"conversion to probabilities",fixed,perrow);
+		if(pij_memplan_split(&mp,ng,memlimit,&nsplit))
+			ERRRET("pij_memplan_split failed.")
+	}
+
+	//Check for identical rows in input data
+	MATRIXFF(cmprow_auto)(t,t2,nodiag,1);
+
+	//Step 1: Supernormalization
+	LOG(9,"Supernormalizing...")
+	if(supernormalizea_byrow_input2(t,t2,&sd.t,&sd.t2,&tnew,&tnew2))
+		ERRRET("Supernormalization failed.")
+	sd.nodiag=nodiag;
+	m.data=&sd;
+	ret=pij_stream_run(&m,ng,nt,nsplit,p,func,data,nodiag);
+
+	//Cleanup
+	CLEANUP
+	return ret;
+#undef	CLEANUP		
+}
+
+int pij_rank_sparse(const MATRIXF* t,const MATRIXF* t2,struct pij_sparse* p,FTYPE threshold,size_t k,char nodiag,size_t memlimit)
+{
+	struct pij_sparse_filter	f={p,threshold,k};
+	
+	if(pij_sparse_init(p,t->size1,t2->size1,(k?GSL_MIN(k,t2->size1):1)*t->size1))
+	{
+		LOG(1,"Not enough memory.")
+		return 1;
+	}
+	if(pij_rank_stream(t,t2,0,pij_sparse_stream_func,&f,nodiag,memlimit))
+	{
+		pij_sparse_free(p);
+		return 1;
+	}
+	return 0;
+}
@@ -29,6 +29,7 @@
 #define _HEADER_LIB_PIJ_RANK_H_
 #include "../base/config.h"
 #include "../base/types.h"
+#include "sparse.h"
 #ifdef __cplusplus
 extern "C"
 {
@@ -48,7 +49,8 @@ int pij_rank_pv(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,size_t memlimit);
  * and null hypothesis.
  * t:		(ng,ns) Expression data for A
  * t2:		(nt,ns) Expression data for B
- * p:		(ng,nt) Output for probabilities A--B is true
+ * p:		(ng,nt) Output for probabilities A--B is true. If p is from MATRIXFF(mapfile),
+ * 			runs out of core with pij_rank_stream.
  * nodiag:	When the top ng rows of t2 is exactly t, diagonals of pij are meaningless.
  *			In this case, set nodiag to 1 to avoid inclusion of NANs. For nodiag=0, t and t2
  *			should not have any identical genes.
@@ -57,6 +59,30 @@ int pij_rank_pv(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,size_t memlimit);
  */
 int pij_rank(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,char nodiag,size_t memlimit);
 
+/* Streaming version of pij_rank that processes blocks of A separately.
+ * A first pass over blocks records the maximum LLR for the null histogram, and a second
+ * pass recomputes and converts LLRs of each block into probabilities, which are written
+ * to p and/or passed to func. Results are identical to pij_rank.
+ * Variables have the same definitions as pij_rank except:
+ * p:		(ng,nt) Output for probabilities A--B is true. Can be NULL if func is specified.
+ * func:	Callback function to receive each finished block of probabilities (see pij_stream_func).
+ * 			Can be NULL if p is specified. Called in the order of rows.
+ * data:	User data pointer passed to func.
+ * Return:	0 if succeed.
+ */
+int pij_rank_stream(const MATRIXF* t,const MATRIXF* t2,MATRIXF* p,pij_stream_func func,void* data,char nodiag,size_t memlimit);
+
+/* Sparse output version of pij_rank. Uses pij_rank_stream and keeps, for each A,
+ * only probabilities no smaller than threshold and at most the k largest of them.
+ * Variables have the same definitions as pij_rank except:
+ * p:		Output sparse matrix for probabilities A--B is true. Initialized by this function
+ * 			and must be freed with pij_sparse_free on success.
+ * threshold:	Minimum probability to keep.
+ * k:		Maximum number of Bs to keep for each A. 0 for unlimited.
+ * Return:	0 if succeed.
+ */
+int pij_rank_sparse(const MATRIXF* t,const MATRIXF* t2,struct pij_sparse* p,FTYPE threshold,size_t k,char nodiag,size_t memlimit);
+
 
 
 
@@ -0,0 +1,190 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "../base/config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../base/gsl/math.h"
+#include "../base/logger.h"
+#include "../base/macros.h"
+#include "../base/threading.h"
+#include "../base/data_struct_heap.h"
+#include "sparse.h"
+
+int pij_sparse_init(struct pij_sparse* s,size_t n1,size_t n2,size_t nmax)
+{
+	s->n1=n1;
+	s->n2=n2;
+	s->nrow=s->n=0;
+	s->nmax=nmax?nmax:1;
+	s->col=0;
+	s->val=0;
+	CALLOCSIZE(s->p,n1+1);
+	MALLOCSIZE(s->col,s->nmax);
+	MALLOCSIZE(s->val,s->nmax);
+	if(!(s->p&&s->col&&s->val))
+	{
+		pij_sparse_free(s);
+		return 1;
+	}
+	return 0;
+}
+
+void pij_sparse_free(struct pij_sparse* s)
+{
+	CLEANMEM(s->p)
+	CLEANMEM(s->col)
+	CLEANMEM(s->val)
+	s->nmax=s->n=s->nrow=0;
+}
+
+/* Grows capacity of sparse matrix to at least n elements.
+ * Return:	0 on success.
+ */
+static int pij_sparse_reserve(struct pij_sparse* s,size_t n)
+{
+	size_t	nnew;
+	size_t*	col;
+	FTYPE*	val;
+	
+	if(n<=s->nmax)
+		return 0;
+	nnew=GSL_MAX(n,2*s->nmax);
+	col=realloc(s->col,nnew*sizeof(*col));
+	if(!col)
+		return 1;
+	s->col=col;
+	val=realloc(s->val,nnew*sizeof(*val));
+	if(!val)
+		return 1;
+	s->val=val;
+	s->nmax=nnew;
+	return 0;
+}
+
+/* Whether element c1 of row d should be ranked below c2 in top-K selection.
+ * Larger values rank higher. Smaller column indices rank higher at ties.
+ */
+static inline int pij_sparse_below(const FTYPE* d,size_t c1,size_t c2)
+{
+	return (d[c1]<d[c2])||((d[c1]==d[c2])&&(c1>c2));
+}
+
+//Comparator of data_heapidx for pij_sparse_below, with param as row data
+static int pij_sparse_heap_before(size_t c1,size_t c2,const void* param)
+{
+	return pij_sparse_below((const FTYPE*)param,c1,c2);
+}
+
+static int pij_sparse_cmp(const void* a,const void* b)
+{
+	size_t	va=*(const size_t*)a,vb=*(const size_t*)b;
+	return (va>vb)-(va<vb);
+}
+
+/* Counts the number of elements to keep in one row.
+ * d:		(n2) Row data
+ */
+static inline size_t pij_sparse_count_row(const FTYPE* d,size_t n2,FTYPE threshold,size_t k)
+{
+	size_t	i,n;
+	
+	for(i=n=0;i<n2;i++)
+		n+=d[i]>=threshold;
+	return (k&&(n>k))?k:n;
+}
+
+/* Selects elements to keep in one row.
+ * d:		(n2) Row data
+ * k:		Maximum number of values to keep. 0 for unlimited.
+ * n:		Number of elements to keep, from pij_sparse_count_row
+ * col:		(n) Output column indices, ascending
+ * val:		(n) Output values
+ */
+static void pij_sparse_fill_row(const FTYPE* d,size_t n2,FTYPE threshold,size_t k,size_t n,size_t* col,FTYPE* val)
+{
+	size_t	i,j;
+	
+	for(i=j=0;(i<n2)&&(j<n);i++)
+		if(d[i]>=threshold)
+			col[j++]=i;
+	if(k&&(n==k)&&(i<n2))
+	{
+		//Top-K selection with heap of size n, whose top ranks lowest
+		struct data_heapidx	h;
+		data_heapidx_init(&h,col,n,pij_sparse_heap_before,d);
+		for(;i<n2;i++)
+			if((d[i]>=threshold)&&pij_sparse_below(d,data_heapidx_top(&h),i))
+				data_heapidx_replacetop(&h,i);
+		qsort(col,n,sizeof(*col),pij_sparse_cmp);
+	}
+	for(j=0;j<n;j++)
+		val[j]=d[col[j]];
+}
+
+int pij_sparse_add_rows(struct pij_sparse* s,const MATRIXF* d,FTYPE threshold,size_t k)
+{
+	size_t	i,nrow=d->size1;
+	size_t*	p;
+	
+	assert(d->size2==s->n2);
+	if(s->nrow+nrow>s->n1)
+	{
+		LOG(1,"Too many rows for sparse matrix.")
+		return 1;
+	}
+	p=s->p+s->nrow;
+	//Count
+	#pragma omp parallel
+	{
+		size_t	n1,n2,j;
+		threading_get_startend(nrow,&n1,&n2);
+		for(j=n1;j<n2;j++)
+			p[j+1]=pij_sparse_count_row(MATRIXFF(const_ptr)(d,j,0),d->size2,threshold,k);
+	}
+	for(i=0;i<nrow;i++)
+		p[i+1]+=p[i];
+	if(pij_sparse_reserve(s,p[nrow]))
+	{
+		LOG(1,"Not enough memory.")
+		return 1;
+	}
+	//Fill
+	#pragma omp parallel
+	{
+		size_t	n1,n2,j;
+		threading_get_startend(nrow,&n1,&n2);
+		for(j=n1;j<n2;j++)
+			pij_sparse_fill_row(MATRIXFF(const_ptr)(d,j,0),d->size2,threshold,k,p[j+1]-p[j],s->col+p[j],s->val+p[j]);
+	}
+	s->nrow+=nrow;
+	s->n=p[nrow];
+	return 0;
+}
+
+int pij_sparse_stream_func(const MATRIXF* d,size_t start,void* data)
+{
+	struct pij_sparse_filter*	f=data;
+	
+	if(start!=f->s->nrow)
+	{
+		LOG(1,"Rows must be appended to sparse matrix in order.")
+		return 1;
+	}
+	return pij_sparse_add_rows(f->s,d,f->threshold,f->k);
+}
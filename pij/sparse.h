@@ -0,0 +1,108 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file contains the sparse output format of pij functions.
+ * Rows of a dense (n1,n2) probability matrix are filtered by a threshold and/or
+ * top-K per row as soon as each block of rows is computed, and appended to a
+ * compressed sparse row (CSR) structure. The dense matrix is therefore never needed.
+ */
+
+#ifndef _HEADER_LIB_PIJ_SPARSE_H_
+#define _HEADER_LIB_PIJ_SPARSE_H_
+#include "../base/config.h"
+#include "../base/types.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Sparse matrix in compressed sparse row (CSR) format
+struct pij_sparse
+{
+	//Dimensions of the dense matrix represented
+	size_t	n1,n2;
+	//Number of rows filled so far
+	size_t	nrow;
+	//Number of stored elements
+	size_t	n;
+	//Capacity of col and val
+	size_t	nmax;
+	//(n1+1) Start of each row in col and val. Row i occupies [p[i],p[i+1]).
+	size_t*	p;
+	//(nmax) Column index of each stored element, ascending within each row
+	size_t*	col;
+	//(nmax) Value of each stored element
+	FTYPE*	val;
+};
+
+//Filter settings for pij_sparse_stream_func
+struct pij_sparse_filter
+{
+	//Output sparse matrix
+	struct pij_sparse*	s;
+	//Minimum value to keep
+	FTYPE	threshold;
+	//Maximum number of values to keep per row. 0 for unlimited.
+	size_t	k;
+};
+
+/* Callback function receiving one block of rows of a dense output matrix in streaming functions.
+ * d:		(n,n2) Rows start to start+n-1 of the output matrix. Only valid during the call.
+ * start:	Index of the first row of d in the full output matrix.
+ * data:	User data pointer passed to the streaming function.
+ * Return:	0 on success. Any other value aborts the streaming function.
+ */
+typedef int (*pij_stream_func)(const MATRIXF* d,size_t start,void* data);
+
+/* Initializes an empty sparse matrix.
+ * s:		Sparse matrix to initialize
+ * n1,
+ * n2:		Dimensions of the dense matrix represented
+ * nmax:	Initial capacity in number of elements. Grows automatically when needed.
+ * Return:	0 on success.
+ */
+int pij_sparse_init(struct pij_sparse* s,size_t n1,size_t n2,size_t nmax);
+
+// Frees memory of sparse matrix.
+void pij_sparse_free(struct pij_sparse* s);
+
+/* Appends rows of a dense matrix to a sparse matrix after filtering.
+ * Each row keeps elements no smaller than threshold. If k>0, only the k
+ * largest of them are kept, preferring smaller column indices at ties.
+ * Rows are processed in parallel.
+ * s:		Sparse matrix to append to. Rows are appended starting from s->nrow.
+ * d:		(n,s->n2) Rows to append
+ * threshold:	Minimum value to keep
+ * k:		Maximum number of values to keep per row. 0 for unlimited.
+ * Return:	0 on success.
+ */
+int pij_sparse_add_rows(struct pij_sparse* s,const MATRIXF* d,FTYPE threshold,size_t k);
+
+/* Streaming callback (see pij_stream_func) that appends each block to a sparse matrix
+ * with pij_sparse_add_rows.
+ * data:	struct pij_sparse_filter*, specifying output sparse matrix and filter settings.
+ */
+int pij_sparse_stream_func(const MATRIXF* d,size_t start,void* data);
+
+
+
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,101 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "../base/config.h"
+#include <assert.h>
+#include "../base/gsl/math.h"
+#include "../base/logger.h"
+#include "../base/macros.h"
+#include "../base/numa.h"
+#include "../base/mapfile.h"
+#include "llrtopij.h"
+#include "stream.h"
+
+size_t pij_stream_nbuf(size_t n,const MATRIXF* ans)
+{
+	//Unmapped output holds LLRs of d[0] in place
+	return (ans&&!MATRIXFF(mapfile_is)(ans))?n-1:n;
+}
+
+int pij_stream_run(const struct pij_stream_method* m,size_t ng,size_t nt,size_t nsplit,MATRIXF* ans,pij_stream_func func,void* data,char nodiag)
+{
+#define	CLEANUP			for(k=0;k<m->n;k++)CLEANMATF(buf[k])
+	MATRIXF*	buf[PIJ_STREAM_NLLR_MAX]={0,0,0,0};	//(nsplit,nt) Buffers of LLRs
+	MATRIXF*	d[PIJ_STREAM_NLLR_MAX];				//LLRs of current block
+	MATRIXFF(view)	mv[PIJ_STREAM_NLLR_MAX];
+	VECTORFF(view)	vv;
+	FTYPE		dmax[PIJ_STREAM_NLLR_MAX]={0,0,0,0};
+	int			ret;
+	size_t		i,k,ngnow,pass;
+	
+	assert(m&&m->llr&&m->convert&&(m->n<=PIJ_STREAM_NLLR_MAX)&&(m->nmax<=m->n)&&m->nmax&&nsplit);
+	assert((!ans)||((ans->size1==ng)&&(ans->size2==nt)));
+	//Mapped output is only written in pass 1, so file I/O is not doubled by pass 0
+	for(k=m->n-pij_stream_nbuf(m->n,ans);k<m->n;k++)
+		if(!(buf[k]=MATRIXFF(alloc_numa)(nsplit,nt)))
+			ERRRET("Not enough memory.")
+	ret=0;
+	
+	//Pass 0: maximum LLRs for null histograms. Pass 1: probabilities.
+	for(pass=0;pass<2;pass++)
+	{
+		if(pass)
+		{
+			if(m->prepare&&m->prepare(m->data,dmax))
+				ERRRET("Failed to prepare conversion to probabilities for %s.",m->name)
+			LOG(9,"Calculating and converting log likelihood ratios...")
+		}
+		else
+			LOG(9,"Calculating maximum of real log likelihood ratios...")
+		for(i=0;i<ng;i+=nsplit)
+		{
+			ngnow=GSL_MIN(ng-i,nsplit);
+			for(k=0;k<m->n;k++)
+			{
+				if(k||!ans||(buf[k]&&!pass))
+					mv[k]=MATRIXFF(submatrix)(buf[k],0,0,ngnow,nt);
+				else
+					mv[k]=MATRIXFF(submatrix)(ans,i,0,ngnow,nt);
+				d[k]=&mv[k].matrix;
+			}
+			if(m->llr(m->data,i,d))
+				ERRRET("Failed to calculate log likelihood ratios for %s.",m->name)
+			if(!pass)
+			{
+				for(k=0;k<m->nmax;k++)
+					if(pij_llrtopij_llrmatmax_block(d[k],dmax+k,nodiag,(long)i))
+						ERRRET("Negative or NAN found in LLR.")
+				continue;
+			}
+			if(m->convert(m->data,i,d,dmax))
+				ret=1;
+			if(nodiag&&m->zerodiag&&(i<nt))
+			{
+				vv=MATRIXFF(superdiagonal)(d[0],i);
+				VECTORFF(set_zero)(&vv.vector);
+			}
+			if(func&&func(d[0],i,data))
+				ERRRET("Callback function failed for rows from %lu.",i)
+			if(ans)
+				MATRIXFF(mapfile_done)(ans,i,ngnow);
+		}
+	}
+
+	CLEANUP
+	return ret;
+#undef	CLEANUP
+}
@@ -0,0 +1,95 @@
+/* Copyright 2016-2018, 2020 Lingfei Wang
+ * 
+ * This file is part of Findr.
+ * 
+ * Findr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Findr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Findr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file contains the shared driver of two-pass streaming pij inference.
+ * Pass 0 computes the LLRs of every block of primary targets only to find their
+ * maxima over the full matrix. Null histograms are then constructed up to these
+ * maxima, and pass 1 recomputes the LLRs of every block and converts them to
+ * probabilities, so only one block of LLRs is held in memory at any time.
+ * Methods provide the LLR calculation and conversion as callbacks.
+ */
+
+#ifndef _HEADER_LIB_PIJ_STREAM_H_
+#define _HEADER_LIB_PIJ_STREAM_H_
+#include "../base/config.h"
+#include "../base/types.h"
+#include "sparse.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Maximum number of LLR matrices per block
+#define	PIJ_STREAM_NLLR_MAX	4
+
+/* Method of streaming inference. In each callback, d[0] to d[n-1] are the (nb,nt)
+ * LLR matrices of a block of nb primary targets starting from row start.
+ * d[0] is also the output: convert must leave the final probabilities in it.
+ */
+struct pij_stream_method
+{
+	//Name for logging
+	const char*	name;
+	//Number of LLR matrices per block
+	size_t	n;
+	//Number of LLR matrices whose maxima are needed, which are d[0] to d[nmax-1]
+	size_t	nmax;
+	//Whether to zero the diagonal of output after conversion for nodiag
+	char	zerodiag;
+	//Method specific data passed to callbacks
+	void*	data;
+	/* Calculates LLRs of block.
+	 * Return:	0 on success.
+	 */
+	int	(*llr)(void* data,size_t start,MATRIXF* const* d);
+	/* Prepares conversion from maxima of LLRs, once between passes. Can be 0.
+	 * dmax:	(nmax) Maxima of d[0] to d[nmax-1] over all blocks
+	 * Return:	0 on success.
+	 */
+	int	(*prepare)(void* data,const FTYPE* dmax);
+	/* Converts LLRs of block to probabilities, and combines them into d[0].
+	 * dmax:	(nmax) Maxima of d[0] to d[nmax-1] over all blocks
+	 * Return:	0 on success, or nonzero if some LLRs failed conversion.
+	 * 			Failures are accumulated and do not stop other blocks.
+	 */
+	int	(*convert)(void* data,size_t start,MATRIXF* const* d,const FTYPE* dmax);
+};
+
+/* Number of (nsplit,nt) LLR buffers pij_stream_run allocates.
+ * n:		Number of LLR matrices per block of the method
+ * ans:		Output matrix passed to pij_stream_run, or 0.
+ */
+size_t pij_stream_nbuf(size_t n,const MATRIXF* ans);
+
+/* Runs two-pass streaming inference with method m, in blocks of nsplit primary targets.
+ * m:		Method
+ * ng:		Number of primary targets
+ * nt:		Number of secondary targets
+ * nsplit:	Number of primary targets per block
+ * ans:		(ng,nt) Output matrix, or 0 if only func receives the output.
+ * 			If from MATRIXFF(mapfile), rows are only written in pass 1 and released block by block.
+ * func:	Callback function to receive each finished block of output (see pij_stream_func), or 0.
+ * data:	User data pointer passed to func.
+ * nodiag:	Whether the diagonal elements are excluded in maxima and conversion.
+ * Return:	0 on success, or 1 on failure, including failed conversion of any block.
+ */
+int pij_stream_run(const struct pij_stream_method* m,size_t ng,size_t nt,size_t nsplit,MATRIXF* ans,pij_stream_func func,void* data,char nodiag);
+
+#ifdef __cplusplus
+}
+#endif
+#endif